@@ -23,6 +23,7 @@
 #include <sys/time.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <zlib.h>
 #include <b64/cdecode.h>
 #include "xml.h"
@@ -33,6 +34,9 @@
 #include <shlwapi.h>
 #define STRCASESTR StrStrIA
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #define STRCASESTR strcasestr
 #endif
 
@@ -68,9 +72,6 @@
 #define T48_FLAG		 0x40000000
 #define DEVICE_MASK		 (T56_FLAG | T48_FLAG | TL866II_FLAG)
 
-#define ALGO_CRC_OFFSET		 0x04
-#define ALGO_DATA_OFFSET	 0x08
-
 /* infoic.xml name and tag names */
 #define INFOIC_NAME		 "infoic.xml"
 #define LOGICIC_NAME		 "logicic.xml"
@@ -139,6 +140,8 @@ typedef struct state_machine_d {
 	uint32_t logic_count;
 	uint32_t logic_custom_count;
 	uint8_t load_vectors;
+	uint8_t with_vectors; /* Decode the vectors, otherwise just count */
+	struct state_machine_p *profile;
 } state_machine_d_t;
 
 /* State machine structure used by sax profile parser callback function
@@ -225,8 +228,6 @@ static const char t56_util_table[][16] = {
 #define UTIL_COUNT (sizeof((t56_util_table))/(sizeof(t56_util_table[0])))
 
 
-static int parse_profiles(state_machine_p_t *);
-
 /* return pin count from package_details */
 static uint32_t get_pin_count(uint32_t package_details)
 {
@@ -292,18 +293,17 @@ static int get_csv(const char *tag, size_t taglen, char *elem_name,
 	if (tagcmpn(tag, taglen, elem_name))
 		return EXIT_FAILURE;
 
-	/* Find start of the element data */
-	char *list = strchr(tag, '>') + 1;
-	char *endtag = strchr(tag, '<');
-	*endtag = '\0';
+	/* Find start of the element data. The input buffer is not
+	 * modified as it may be a read only mapping; strtoul stops at
+	 * the ',' separator or at the end tag anyway.
+	 */
+	const char *list = strchr(tag, '>') + 1;
+	const char *endtag = strchr(tag, '<');
 	char *endptr;
 
 	/* Parse each token */
 	int i = 0;
-	char *token = strchr(list, ',');
 	while (i < size && list < endtag) {
-		if (token)
-			*token = '\0';
 		errno = 0;
 		uint32_t value = strtoul(list, &endptr, 10);
 		if (errno || value > UINT16_MAX) {
@@ -311,27 +311,33 @@ static int get_csv(const char *tag, size_t taglen, char *elem_name,
 		}
 		out[i] = (uint16_t)value;
 		list = endptr + 1;
-		token = strchr(list, ',');
 		i++;
 	}
 
-	/* restore end tag */
-	*endtag = '<';
-
 	if (size != i)
 		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
 
+/* Match a device name against a -L search string or a prefix */
+static int match_name(const char *name, const char *filter, int prefix)
+{
+	if (!filter)
+		return 1;
+	if (prefix)
+		return !strncasecmp(name, filter, strlen(filter));
+	return STRCASESTR(name, filter) != NULL;
+}
+
 /* Print comma separated names  */
 static size_t print_chip_names(Memblock *memblock, const char *filter,
-			       int custom)
+			       int prefix, int custom)
 {
 	size_t count = 0;
 	char *list = strndup((char *)memblock->b, memblock->z);
 	char *token = strtok(list, ",");
 	while (token) {
-		if (!filter || STRCASESTR(token, filter))
+		if (match_name(token, filter, prefix))
 			fprintf(stdout, "%s%s\n", token,
 				custom == 1 ? "(custom)" : "");
 		token = strtok(NULL, ",");
@@ -356,6 +362,17 @@ static size_t get_chip_count(Memblock *memblock)
 	return count;
 }
 
+/* Count an entry matching the chip ID and print its names, or with
+ * db_data->quiet just count them */
+static size_t list_chip_id_names(Memblock *memblock, state_machine_d_t *sm)
+{
+	if (sm->db_data->records)
+		(*sm->db_data->records)++;
+	if (sm->db_data->quiet)
+		return get_chip_count(memblock);
+	return print_chip_names(memblock, NULL, 0, sm->custom);
+}
+
 /* Search the chip name in a comma separated names */
 static char *search_chip_name(Memblock *memblock, const char *name)
 {
@@ -389,7 +406,8 @@ static uint8_t get_id_bytes_count(uint32_t chip_id)
 
 /* Load a device from an xml 'ic' tag */
 static int load_mem_device(db_data_t *db_data, const char *xml_device,
-			   size_t size, device_t *device, uint8_t version)
+			   size_t size, device_t *device, uint8_t version,
+			   state_machine_p_t *profile)
 {
 	int err = 0;
 	uint32_t voltages, protocol_id, flags, opts, read_bufer_size,
@@ -450,23 +468,14 @@ static int load_mem_device(db_data_t *db_data, const char *xml_device,
 	if (!memblock.b)
 		return EXIT_FAILURE;
 
-	/* Check if there's a configuration name */
+	/* Check if there's a configuration name. The configuration itself
+	 * is loaded later, by the same pass that found the device.
+	 */
 	if (tagcmpn(memblock.b, memblock.z, "null")) {
-		/* Initialize parser state machine */
-		state_machine_p_t sm;
-		memset(&sm, 0, sizeof(sm));
-		memcpy(sm.name, memblock.b, memblock.z);
-		sm.db_data = db_data;
-
-		err = parse_profiles(&sm);
-		if (err)
+		if (memblock.z >= sizeof(profile->name))
 			return EXIT_FAILURE;
-		if (!sm.config) {
-			fprintf(stderr, "No %s configuration was found.\n",
-				sm.name);
-			return EXIT_FAILURE;
-		}
-		device->config = sm.config;
+		memcpy(profile->name, memblock.b, memblock.z);
+		profile->db_data = db_data;
 	}
 
 	/* Unpack flags */
@@ -529,9 +538,6 @@ static int load_mem_device(db_data_t *db_data, const char *xml_device,
 	/* PIC midrange/standard devices */
 	case PIC_INSTR_WORD_WIDTH_14:
 		device->compare_mask = 0x3fff;
-		if (CONFIG) {
-			CONFIG->rev_bits = 5;
-		}
 		break;
 
 	/* PIC 18F/18F_J devices */
@@ -543,18 +549,29 @@ static int load_mem_device(db_data_t *db_data, const char *xml_device,
 
 		/* This will tell us if PIC user id is 8bit or more */
 		device->flags.data_org = 0; /* User ID is 8 bit */
-		if (CONFIG) {
-			CONFIG->rev_bits =
-				device->chip_info ==
-						PIC_INSTR_WORD_WIDTH_16_PIC18F ?
-					4 :
-					5;
-		}
 		break;
 	}
 	return EXIT_SUCCESS;
 }
 
+/* Set the PIC configuration fields which depend on the chip_info.
+ * Called once the device configuration is attached.
+ */
+static void set_config_bits(device_t *device)
+{
+	if (!CONFIG)
+		return;
+	switch (device->chip_info) {
+	case PIC_INSTR_WORD_WIDTH_14:
+	case PIC_INSTR_WORD_WIDTH_16_PIC18J:
+		CONFIG->rev_bits = 5;
+		break;
+	case PIC_INSTR_WORD_WIDTH_16_PIC18F:
+		CONFIG->rev_bits = 4;
+		break;
+	}
+}
+
 /* Load a device from an xml 'ic' tag */
 static int load_logic_device(const char *xml_device, size_t size,
 			     device_t *device)
@@ -583,16 +600,18 @@ static int load_logic_device(const char *xml_device, size_t size,
 
 /* Load a device from an xml 'ic' tag */
 static int load_device(db_data_t *db_data, const char *xml_device, size_t size,
-		       device_t *device, uint8_t version)
+		       device_t *device, uint8_t version,
+		       state_machine_p_t *profile)
 {
 	if (get_attr_value(xml_device, size, "type", &device->chip_type))
 		return EXIT_FAILURE;
+	memset(profile->name, 0, sizeof(profile->name));
 	int ret;
 	if (device->chip_type == MP_LOGIC) {
 		ret = load_logic_device(xml_device, size, device);
 	} else {
 		ret = load_mem_device(db_data, xml_device, size, device,
-				      version);
+				      version, profile);
 	}
 	return ret;
 }
@@ -636,6 +655,53 @@ static int compare_device(const char *xml_device, size_t size,
 	return EXIT_SUCCESS;
 }
 
+/* Get the pin count and protocol ID of an 'ic' tag, 0 if not known */
+static int get_list_attributes(const char *xml_device, size_t size,
+			       int db_version, uint32_t *pin_count,
+			       uint32_t *protocol_id)
+{
+	uint32_t package_details;
+	int err;
+
+	/* Missing attributes leave the values untouched */
+	*pin_count = 0;
+	*protocol_id = 0;
+	if (db_version == LOGIC_DATABASE) {
+		err = get_attr_value(xml_device, size, "pins", pin_count);
+		return (err && err != ERREND) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	err = get_attr_value(xml_device, size, "protocol_id", protocol_id);
+	if (err && err != ERREND)
+		return EXIT_FAILURE;
+	err = get_attr_value(xml_device, size, "package_details",
+			     &package_details);
+	if (err && err != ERREND)
+		return EXIT_FAILURE;
+	if (!err)
+		*pin_count = get_pin_count(package_details);
+	return EXIT_SUCCESS;
+}
+
+/* Check the --pins and --protocol filters of a device listing.
+ * Devices with a malformed tag are not listed.
+ */
+static int match_list_filters(const char *xml_device, size_t size,
+			      state_machine_d_t *sm)
+{
+	uint32_t pin_count, protocol_id;
+	db_data_t *db_data = sm->db_data;
+
+	if (!db_data->filter_pins && !db_data->filter_protocol)
+		return 1;
+	if (get_list_attributes(xml_device, size, sm->db_version, &pin_count,
+				&protocol_id))
+		return 0;
+	return (!db_data->filter_pins || db_data->filter_pins == pin_count) &&
+	       (!db_data->filter_protocol ||
+		db_data->filter_protocol == protocol_id);
+}
+
 /* XML algorithm SAX parser handler. Each xml tag pair is dispatched here.
  * The persistent state machine data are kept in parser->userdata structure
  */
@@ -1156,19 +1222,22 @@ static int device_callback(int type, const char *tag, size_t taglen,
 						return EXIT_FAILURE;
 					if (sm->found) {
 						sm->found_count +=
-							print_chip_names(
-								&mb_name, NULL,
-								sm->custom);
+							list_chip_id_names(
+								&mb_name, sm);
 						fflush(stdout);
 						sm->found = 0;
 					}
 					return XML_OK;
 				}
 
-				/* Print all devices that match the name (-l and -L) */
-				print_chip_names(&mb_name,
-						 sm->db_data->device_name,
-						 sm->custom);
+				/* Print all devices that match the name and
+				 * the filters (-l, -L and --prefix) */
+				if (match_list_filters(tag, taglen, sm))
+					print_chip_names(
+						&mb_name,
+						sm->db_data->device_name,
+						sm->db_data->prefix,
+						sm->custom);
 				fflush(stdout);
 				return XML_OK;
 			}
@@ -1186,8 +1255,13 @@ static int device_callback(int type, const char *tag, size_t taglen,
 				if (sm->found && !strlen(sm->device->name)) {
 					char *end = memchr(mb_name.b, ',',
 							   mb_name.z);
-					strncpy(sm->device->name, mb_name.b,
-						end - mb_name.b);
+					size_t len = end ? end - mb_name.b :
+							   mb_name.z;
+					if (len >= sizeof(sm->device->name))
+						len = sizeof(sm->device->name) -
+						      1;
+					memcpy(sm->device->name, mb_name.b,
+					       len);
 					sm->found_count++;
 				}
 				return XML_OK;
@@ -1203,7 +1277,8 @@ static int device_callback(int type, const char *tag, size_t taglen,
 				free(name);
 				if (load_device(sm->db_data, tag, taglen,
 						sm->device,
-						sm->db_data->version))
+						sm->db_data->version,
+						sm->profile))
 					return EXIT_FAILURE;
 				sm->found_count++;
 
@@ -1240,7 +1315,11 @@ static int device_callback(int type, const char *tag, size_t taglen,
 			return XML_OK;
 		if (!tagcmpn(tag, taglen, IC_TAG))
 			sm->load_vectors = 0;
-		if (sm->load_vectors && !tagcmpn(tag, taglen, VECTOR_TAG)) {
+		if (sm->load_vectors && !sm->with_vectors &&
+		    !tagcmpn(tag, taglen, VECTOR_TAG)) {
+			sm->device->vector_count++;
+		} else if (sm->load_vectors &&
+			   !tagcmpn(tag, taglen, VECTOR_TAG)) {
 			size_t pin_count =
 				sm->device->package_details.pin_count;
 			size_t vector_count = sm->device->vector_count;
@@ -1374,197 +1453,1698 @@ static FILE *get_database_file(const char *name, const char *cli_name)
 	return NULL;
 }
 
-/* Parse xml pin maps */
-static int parse_maps(state_machine_m_t *sm)
-{
-	/* Open database xml file */
-	FILE *file = get_database_file(INFOIC_NAME, sm->db_data->infoic_path);
-	if (!file)
-		return EXIT_FAILURE;
+/*
+ * Compiled database cache.
+ *
+ * The first lookup in infoic.xml/logicic.xml compiles a binary index of the
+ * whole file. It holds the file offset of every 'ic', 'config' and 'map' tag,
+ * a sorted name table and a chip ID table. The index of algorithm.xml
+ * holds the 'algorithm' tags in the 'config' table. Later lookups map the index and
+ * binary search it, so only the referenced tags are parsed from the xml.
+ * Device listings and searches are answered from the index alone.
+ * The index is rebuilt whenever the xml size or modification time changes.
+ * If the index can't be used for any reason we fall back to the plain
+ * xml parsing.
+ */
 
-	/* Begin xml parse */
-	Parser parser = { .inputcbdata = file,
-			  .worker = map_callback,
-			  .userdata = sm };
+#define DB_CACHE_MAGIC	 "MPDBIDX"
+#define DB_CACHE_VERSION 2
+
+typedef struct db_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_count;
+	uint32_t name_count;
+	uint32_t chip_count;
+	uint32_t config_count;
+	uint32_t map_count;
+	uint32_t strings_size;
+	uint32_t reserved;
+	uint64_t xml_size;
+	uint64_t xml_mtime;
+	uint64_t xml_inode;
+} db_cache_header_t;
+
+/* One record for each 'ic' tag in file order. The names of the list are
+ * stored one after the other in the string pool. */
+typedef struct db_cache_record {
+	uint64_t offset; /* xml offset of the '<ic' tag */
+	uint32_t name;	 /* First name of the list */
+	uint32_t chip_id;
+	uint8_t version;
+	uint8_t custom;
+	uint16_t name_count;
+	uint16_t pin_count;
+	uint8_t protocol_id;
+	uint8_t reserved;
+} db_cache_record_t;
+
+/* Device names sorted case insensitive, then by record index */
+typedef struct db_cache_name {
+	uint32_t name;
+	uint32_t record;
+} db_cache_name_t;
+
+/* Chip IDs sorted by value, then by record index */
+typedef struct db_cache_chip {
+	uint32_t chip_id;
+	uint32_t record;
+} db_cache_chip_t;
+
+/* 'config' or 'algorithm' tags (by name) and 'map' tags (by index) in file
+ * order */
+typedef struct db_cache_entry {
+	uint64_t offset;
+	uint32_t key;
+	uint32_t reserved;
+} db_cache_entry_t;
+
+typedef struct db_cache {
+	const db_cache_header_t *header;
+	const db_cache_record_t *records;
+	const db_cache_name_t *names;
+	const db_cache_chip_t *chips;
+	const db_cache_entry_t *configs;
+	const db_cache_entry_t *maps;
+	const char *strings;
+	void *base;
+	size_t size;
+	int mapped;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+} db_cache_t;
 
-	int ret = parse(&parser);
-	done(&parser);
-	fclose(file);
-	if (ret) {
-		fprintf(stderr,
-			"An error occurred while parsing XML pin map.\n");
+/* State machine structure used by sax index compiler callback function
+ * for persistent data between calls.
+ */
+typedef struct state_machine_c {
+	int db_version;
+	int custom;
+	int has_profile;
+	int has_map;
+	int has_algo;
+	db_cache_record_t *records;
+	db_cache_name_t *names;
+	db_cache_entry_t *configs;
+	db_cache_entry_t *maps;
+	char *strings;
+	size_t record_count, record_size;
+	size_t name_count, name_size;
+	size_t config_count, config_size;
+	size_t map_count, map_size;
+	size_t strings_count, strings_size;
+} state_machine_c_t;
+
+/* Make room for one more element in a dynamic array */
+static int grow(void **array, size_t *size, size_t count, size_t elem_size)
+{
+	if (count < *size)
+		return EXIT_SUCCESS;
+	size_t new_size = *size ? *size * 2 : 1024;
+	void *p = realloc(*array, new_size * elem_size);
+	if (!p)
 		return EXIT_FAILURE;
-	}
+	*array = p;
+	*size = new_size;
 	return EXIT_SUCCESS;
 }
 
-/* Parse xml profiles */
-static int parse_profiles(state_machine_p_t *sm)
+/* Add a string to the index string pool and return its offset */
+static int add_string(state_machine_c_t *sm, const char *str, size_t len,
+		      uint32_t *offset)
 {
-	/* Open database xml file */
-	FILE *file = get_database_file(INFOIC_NAME, sm->db_data->infoic_path);
-	if (!file)
-		return EXIT_FAILURE;
-
-	/* Begin xml parse */
-	Parser parser = { .inputcbdata = file,
-			  .worker = profile_callback,
-			  .userdata = sm };
-
-	int ret = parse(&parser);
-	done(&parser);
-	fclose(file);
-	if (ret) {
-		fprintf(stderr,
-			"An error occurred while parsing XML profiles.\n");
-		return EXIT_FAILURE;
+	while (sm->strings_count + len + 1 > sm->strings_size) {
+		size_t new_size =
+			sm->strings_size ? sm->strings_size * 2 : 65536;
+		char *p = realloc(sm->strings, new_size);
+		if (!p)
+			return EXIT_FAILURE;
+		sm->strings = p;
+		sm->strings_size = new_size;
 	}
+	*offset = sm->strings_count;
+	memcpy(sm->strings + sm->strings_count, str, len);
+	sm->strings[sm->strings_count + len] = '\0';
+	sm->strings_count += len + 1;
 	return EXIT_SUCCESS;
 }
 
-/* Parse xml algorithms */
-static int parse_algorithms(state_machine_a_t *sm)
+/* Add a 'config' or 'map' entry */
+static int add_entry(db_cache_entry_t **entries, size_t *count, size_t *size,
+		     uint64_t offset, uint32_t key)
 {
-	/* Open database xml file */
-	FILE *file = get_database_file(ALGO_NAME, sm->db_data->algo_path);
-	if (!file)
+	if (grow((void **)entries, size, *count, sizeof(**entries)))
 		return EXIT_FAILURE;
-
-	/* Begin xml parse */
-	Parser parser = { .inputcbdata = file,
-			  .worker = algo_callback,
-			  .userdata = sm };
-
-	int ret = parse(&parser);
-	done(&parser);
-	fclose(file);
-	if (ret) {
-		fprintf(stderr,
-			"An error occurred while parsing XML algorithms.\n");
-		return EXIT_FAILURE;
-	}
+	(*entries)[*count].offset = offset;
+	(*entries)[*count].key = key;
+	(*entries)[*count].reserved = 0;
+	(*count)++;
 	return EXIT_SUCCESS;
 }
 
-/* Parse given xml file */
-static int parse_xml_file(void *sm, const char *name, const char *cli_name)
+/* XML index compiler SAX parser handler. Each xml tag pair is dispatched
+ * here. The persistent state machine data are kept in parser->userdata
+ * structure
+ */
+static int cache_callback(int type, const char *tag, size_t taglen,
+			  Parser *parser)
 {
-	/* Open database xml file */
-	FILE *file = get_database_file(name, cli_name);
-	if (!file)
-		return EXIT_FAILURE;
+	state_machine_c_t *sm = parser->userdata;
+	Memblock mb;
+	uint32_t value;
 
-	/* Begin xml parse */
-	Parser parser = { .inputcbdata = file,
-			  .worker = device_callback,
-			  .userdata = sm };
+	switch (type) {
+	case OPENTAG_:
+	case SELFCLOSE_:
+		if (!tagcmpn(tag, taglen, MANUF_TAG))
+			sm->custom = 0;
+		else if (!tagcmpn(tag, taglen, CUSTOM_TAG))
+			sm->custom = 1;
+		else if (!tagcmpn(tag, taglen, CFGS_TAG))
+			sm->has_profile = 1;
+		else if (!tagcmpn(tag, taglen, MAPS_TAG))
+			sm->has_map = 1;
+		else if (!tagcmpn(tag, taglen, ALGOS_TAG))
+			sm->has_algo = 1;
 
-	int ret = parse(&parser);
-	done(&parser);
-	fclose(file);
-	if (ret) {
-		fprintf(stderr,
-			"An error occurred while parsing XML database.\n");
-		return EXIT_FAILURE;
+		/* Get database version */
+		if (!tagcmpn(tag, taglen, DB_TAG)) {
+			mb = get_attribute(tag, taglen, TYPE_ATTR);
+			if (!tagcmpn(mb.b, mb.z, INFOIC2PLUS_ATTR_NAME))
+				sm->db_version = INFOIC2PLUS_DATABASE;
+			else if (!tagcmpn(mb.b, mb.z, INFOIC_ATTR_NAME))
+				sm->db_version = INFOIC_DATABASE;
+			else if (!tagcmpn(mb.b, mb.z, LOGIC_ATTR_NAME))
+				sm->db_version = LOGIC_DATABASE;
+			return XML_OK;
+		}
+
+		/* Profile or algorithm entry */
+		if ((sm->has_profile && !tagcmpn(tag, taglen, CFG_TAG)) ||
+		    (sm->has_algo && !tagcmpn(tag, taglen, ALGO_TAG))) {
+			mb = get_attribute(tag, taglen, NAME_ATTR);
+			if (!mb.b)
+				return EXIT_FAILURE;
+			if (add_string(sm, mb.b, mb.z, &value) ||
+			    add_entry(&sm->configs, &sm->config_count,
+				      &sm->config_size,
+				      get_offset(parser, tag) - 1, value))
+				return ERRMEM;
+			return XML_OK;
+		}
+
+		/* Pin map entry */
+		if (sm->has_map && !tagcmpn(tag, taglen, MAP_TAG)) {
+			if (get_attr_value(tag, taglen, "index", &value))
+				return EXIT_FAILURE;
+			if (add_entry(&sm->maps, &sm->map_count, &sm->map_size,
+				      get_offset(parser, tag) - 1, value))
+				return ERRMEM;
+			return XML_OK;
+		}
+
+		if (tagcmpn(tag, taglen, IC_TAG))
+			return XML_OK;
+
+		/* Device entry */
+		if (grow((void **)&sm->records, &sm->record_size,
+			 sm->record_count, sizeof(*sm->records)))
+			return ERRMEM;
+		db_cache_record_t *record = &sm->records[sm->record_count];
+		memset(record, 0, sizeof(*record));
+		record->offset = get_offset(parser, tag) - 1;
+		record->version = sm->db_version;
+		record->custom = sm->custom == 1;
+		int err = get_attr_value(tag, taglen, "chip_id", &value);
+		if (err && err != ERREND)
+			return EXIT_FAILURE;
+		record->chip_id = err ? 0 : value;
+		uint32_t pin_count, protocol_id;
+		if (get_list_attributes(tag, taglen, sm->db_version,
+					&pin_count, &protocol_id))
+			return EXIT_FAILURE;
+		record->pin_count = pin_count;
+		record->protocol_id = protocol_id;
+
+		/* Add each name from the comma separated list */
+		mb = get_attribute(tag, taglen, NAME_ATTR);
+		if (!mb.b)
+			return EXIT_FAILURE;
+		const char *name = mb.b;
+		const char *end = mb.b + mb.z;
+		int first = 1;
+		while (name < end) {
+			const char *token = memchr(name, ',', end - name);
+			if (!token)
+				token = end;
+			if (token > name) {
+				if (grow((void **)&sm->names, &sm->name_size,
+					 sm->name_count, sizeof(*sm->names)) ||
+				    add_string(sm, name, token - name, &value))
+					return ERRMEM;
+				sm->names[sm->name_count].name = value;
+				sm->names[sm->name_count].record =
+					sm->record_count;
+				sm->name_count++;
+				record->name_count++;
+				if (first)
+					record->name = value;
+				first = 0;
+			}
+			name = token + 1;
+		}
+		sm->record_count++;
+		break;
+
+	case FRAMECLOSE_:
+		if (!tagcmpn(tag, taglen, CFGS_TAG))
+			sm->has_profile = 0;
+		else if (!tagcmpn(tag, taglen, MAPS_TAG))
+			sm->has_map = 0;
+		else if (!tagcmpn(tag, taglen, ALGOS_TAG))
+			sm->has_algo = 0;
+		break;
 	}
-	return EXIT_SUCCESS;
+	return XML_OK;
 }
 
-/* Parse xml database */
-static int parse_xml(state_machine_d_t *sm)
+/* Sort helpers used only while compiling the index */
+typedef struct name_sort {
+	const char *name;
+	db_cache_name_t entry;
+} name_sort_t;
+
+static int compare_names(const void *a, const void *b)
 {
-	int version = sm->db_data->version;
-	sm->db_data->version = LOGIC_DATABASE;
-	int ret = parse_xml_file(sm, LOGICIC_NAME, sm->db_data->logicic_path);
+	const name_sort_t *n1 = a, *n2 = b;
+	int ret = strcasecmp(n1->name, n2->name);
 	if (ret)
 		return ret;
-	if (!sm->count_only && sm->device->chip_type == MP_LOGIC)
-		return ret;
-	sm->db_data->version = version;
-	return parse_xml_file(sm, INFOIC_NAME, sm->db_data->infoic_path);
+	return (n1->entry.record > n2->entry.record) -
+	       (n1->entry.record < n2->entry.record);
 }
 
-/* Translate programmer version to internal database version */
-static void translate_db(db_data_t *db_data)
+static int compare_chips(const void *a, const void *b)
 {
-	switch (db_data->version) {
-	case MP_TL866A:
-	case MP_TL866CS:
-		db_data->version = INFOIC_DATABASE;
-		break;
-	case MP_TL866IIPLUS:
-	case MP_T48:
-	case MP_T56:
-		db_data->version = INFOIC2PLUS_DATABASE;
-	}
+	const db_cache_chip_t *c1 = a, *c2 = b;
+	if (c1->chip_id != c2->chip_id)
+		return c1->chip_id > c2->chip_id ? 1 : -1;
+	return (c1->record > c2->record) - (c1->record < c2->record);
 }
 
-/* XML based device search */
-device_t *get_device_by_name(db_data_t *db_data)
+/* Set the section pointers of a loaded index and check its layout */
+static int set_cache_layout(db_cache_t *cache)
 {
-	if (!db_data->device_name)
-		return NULL;
-	device_t *device = device = calloc(1, sizeof(device_t));
-	if (!device) {
-		fprintf(stderr, "Out of memory\n");
-		return NULL;
-	}
-
-	/* Initialize state machine structure */
-	translate_db(db_data);
-	state_machine_d_t sm;
-	memset(&sm, 0, sizeof(sm));
-	sm.device = device;
-	sm.db_version = -1;
-	sm.custom = -1;
-	sm.db_data = db_data;
+	if (cache->size < sizeof(db_cache_header_t))
+		return EXIT_FAILURE;
+	const db_cache_header_t *header = cache->base;
+	if (memcmp(header->magic, DB_CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != DB_CACHE_VERSION)
+		return EXIT_FAILURE;
 
-	int ret = parse_xml(&sm);
+	uint64_t size = sizeof(*header) +
+			(uint64_t)header->record_count *
+				sizeof(db_cache_record_t) +
+			(uint64_t)header->name_count * sizeof(db_cache_name_t) +
+			(uint64_t)header->chip_count * sizeof(db_cache_chip_t) +
+			((uint64_t)header->config_count + header->map_count) *
+				sizeof(db_cache_entry_t) +
+			header->strings_size;
+	if (size != cache->size || !header->strings_size)
+		return EXIT_FAILURE;
 
-	if (ret || !sm.found_count) {
-		free(device);
-		device = NULL;
-	}
-	return device;
+	const uint8_t *p = (const uint8_t *)cache->base + sizeof(*header);
+	cache->header = header;
+	cache->records = (const db_cache_record_t *)p;
+	p += header->record_count * sizeof(db_cache_record_t);
+	cache->names = (const db_cache_name_t *)p;
+	p += header->name_count * sizeof(db_cache_name_t);
+	cache->chips = (const db_cache_chip_t *)p;
+	p += header->chip_count * sizeof(db_cache_chip_t);
+	cache->configs = (const db_cache_entry_t *)p;
+	p += header->config_count * sizeof(db_cache_entry_t);
+	cache->maps = (const db_cache_entry_t *)p;
+	p += header->map_count * sizeof(db_cache_entry_t);
+	cache->strings = (const char *)p;
+	if (cache->strings[header->strings_size - 1] != '\0')
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
 }
 
-/* Get first device name found in the database from a device ID */
-const char *get_device_from_id(db_data_t *db_data)
+/* Release an index */
+static void close_db_cache(db_cache_t *cache)
 {
-	device_t device;
-	device.chip_id = db_data->chip_id;
-	device.protocol_id = db_data->protocol;
-	device.package_details.pin_count = 0;
-	memset(device.name, 0, sizeof(device.name));
-
-	/* Initialize state machine structure  */
-	translate_db(db_data);
-	state_machine_d_t sm;
-	memset(&sm, 0, sizeof(sm));
-	sm.device = &device;
-	sm.db_version = -1;
-	sm.custom = -1;
-	sm.match_id = 1;
-	sm.db_data = db_data;
+	if (!cache->base)
+		return;
+	if (cache->mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(cache->base);
+		CloseHandle(cache->mapping);
+#else
+		munmap(cache->base, cache->size);
+#endif
+	} else
+		free(cache->base);
+	memset(cache, 0, sizeof(*cache));
+}
 
-	if (parse_xml(&sm))
-		return NULL;
-	return sm.found_count ? strdup(device.name) : NULL;
+/* Map an index file in memory */
+static int map_db_cache(db_cache_t *cache, const char *path)
+{
+	memset(cache, 0, sizeof(*cache));
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+				  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return EXIT_FAILURE;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+		CloseHandle(file);
+		return EXIT_FAILURE;
+	}
+	cache->mapping =
+		CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!cache->mapping)
+		return EXIT_FAILURE;
+	cache->base = MapViewOfFile(cache->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!cache->base) {
+		CloseHandle(cache->mapping);
+		return EXIT_FAILURE;
+	}
+	cache->size = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return EXIT_FAILURE;
+	struct stat st;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	cache->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (cache->base == MAP_FAILED) {
+		cache->base = NULL;
+		return EXIT_FAILURE;
+	}
+	cache->size = st.st_size;
+#endif
+	cache->mapped = 1;
+	if (set_cache_layout(cache)) {
+		close_db_cache(cache);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
-/* List all devices from XML
- * If name == NULL list all devices
+/* Build an index file path. 'user' selects the per user cache directory
+ * instead of the database directory.
  */
-int list_devices(db_data_t *db_data)
+static int get_cache_path(const char *name, char *path, size_t size,
+			  int user)
 {
-	device_t device;
-	device.chip_id = db_data->chip_id;
+	int count;
+#ifdef _WIN32
+	char appdata[MAX_PATH];
+	if (!SHGetSpecialFolderPathA(NULL, appdata,
+				     user ? CSIDL_LOCAL_APPDATA :
+					    CSIDL_COMMON_APPDATA,
+				     user))
+		return EXIT_FAILURE;
+	count = snprintf(path, size, "%s\\minipro", appdata);
+	if (count < 0 || count >= size)
+		return EXIT_FAILURE;
+	if (user)
+		CreateDirectoryA(path, NULL);
+	count = snprintf(path, size, "%s\\minipro\\%s", appdata, name);
+#else
+	char *env_path = getenv("MINIPRO_HOME");
+	if (!user) {
+		count = snprintf(path, size, "%s/%s",
+				 env_path ? env_path : SHARE_INSTDIR, name);
+	} else {
+		char *cache_home = getenv("XDG_CACHE_HOME");
+		char *home = getenv("HOME");
+		if (env_path || (!cache_home && !home))
+			return EXIT_FAILURE;
+		if (cache_home)
+			count = snprintf(path, size, "%s/minipro", cache_home);
+		else
+			count = snprintf(path, size, "%s/.cache", home);
+		if (count < 0 || count >= size)
+			return EXIT_FAILURE;
+		if (!cache_home) {
+			mkdir(path, 0755);
+			count = snprintf(path, size, "%s/.cache/minipro", home);
+			if (count < 0 || count >= size)
+				return EXIT_FAILURE;
+		}
+		mkdir(path, 0755);
+		size_t len = strlen(path);
+		count = snprintf(path + len, size - len, "/%s", name);
+		count += len;
+	}
+#endif
+	if (count < 0 || count >= size)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+/* Build the cache file name of an xml database file. A file given on the
+ * command line gets a name derived from its full path, so its cache never
+ * replaces the one of the installed file and both stay valid.
+ */
+static int get_db_cache_name(const char *name, const char *cli_name,
+			     const char *suffix, char *cache_name, size_t size)
+{
+	int count;
+	if (!cli_name) {
+		count = snprintf(cache_name, size, "%s.%s", name, suffix);
+		return (count < 0 || count >= size) ? EXIT_FAILURE :
+						      EXIT_SUCCESS;
+	}
+
+	char full[PATH_MAX];
+#ifdef _WIN32
+	if (!_fullpath(full, cli_name, sizeof(full)))
+		return EXIT_FAILURE;
+#else
+	if (!realpath(cli_name, full))
+		return EXIT_FAILURE;
+#endif
+	/* FNV-1a hash of the path */
+	uint32_t hash = 0x811C9DC5;
+	for (const char *p = full; *p; p++)
+		hash = (hash ^ (uint8_t)*p) * 0x01000193;
+	count = snprintf(cache_name, size, "%s.%08X.%s", name, hash, suffix);
+	return (count < 0 || count >= size) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Build the path of a file in the per user cache directory */
+int get_cache_file(const char *name, char *path, size_t size)
+{
+	return get_cache_path(name, path, size, 1);
+}
+
+/* Write a compiled index file. The file is written under a temporary name
+ * first so a concurrent reader never sees a partial index.
+ */
+static int write_db_cache(const char *path, const void *data, size_t size)
+{
+	char temp[PATH_MAX + 16];
+	snprintf(temp, sizeof(temp), "%s.%u", path, (unsigned int)getpid());
+	FILE *file = fopen(temp, "wb");
+	if (!file)
+		return EXIT_FAILURE;
+	size_t ret = fwrite(data, 1, size, file);
+	if (fclose(file) || ret != size) {
+		remove(temp);
+		return EXIT_FAILURE;
+	}
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(temp, path)) {
+		remove(temp);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Compile the index of an xml database file */
+static int compile_db_cache(db_cache_t *cache, FILE *file, struct stat *st)
+{
+	state_machine_c_t sm;
+	memset(&sm, 0, sizeof(sm));
+	sm.db_version = -1;
+	sm.custom = -1;
+
+	Parser parser = { .inputcbdata = file,
+			  .worker = cache_callback,
+			  .userdata = &sm };
+	map_input(&parser, file); /* Falls back to reading the file */
+	int ret = parse(&parser);
+	done(&parser);
+
+	uint8_t *base = NULL;
+	name_sort_t *sorted = NULL;
+	db_cache_chip_t *chips = NULL;
+	size_t chip_count = 0;
+	if (ret || !sm.strings_count)
+		goto out;
+
+	/* Sort the name table */
+	ret = EXIT_FAILURE;
+	sorted = malloc(sm.name_count * sizeof(*sorted) + 1);
+	chips = malloc(sm.record_count * sizeof(*chips) + 1);
+	if (!sorted || !chips)
+		goto out;
+	for (size_t i = 0; i < sm.name_count; i++) {
+		sorted[i].name = sm.strings + sm.names[i].name;
+		sorted[i].entry = sm.names[i];
+	}
+	qsort(sorted, sm.name_count, sizeof(*sorted), compare_names);
+
+	/* Sort the chip ID table */
+	for (size_t i = 0; i < sm.record_count; i++) {
+		if (!sm.records[i].chip_id)
+			continue;
+		chips[chip_count].chip_id = sm.records[i].chip_id;
+		chips[chip_count].record = i;
+		chip_count++;
+	}
+	qsort(chips, chip_count, sizeof(*chips), compare_chips);
+
+	/* Now assemble the index image */
+	db_cache_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DB_CACHE_MAGIC, sizeof(header.magic));
+	header.version = DB_CACHE_VERSION;
+	header.record_count = sm.record_count;
+	header.name_count = sm.name_count;
+	header.chip_count = chip_count;
+	header.config_count = sm.config_count;
+	header.map_count = sm.map_count;
+	header.strings_size = sm.strings_count;
+	header.xml_size = st->st_size;
+	header.xml_mtime = st->st_mtime;
+	header.xml_inode = st->st_ino;
+
+	size_t size = sizeof(header) +
+		      sm.record_count * sizeof(db_cache_record_t) +
+		      sm.name_count * sizeof(db_cache_name_t) +
+		      chip_count * sizeof(db_cache_chip_t) +
+		      (sm.config_count + sm.map_count) *
+			      sizeof(db_cache_entry_t) +
+		      sm.strings_count;
+	base = malloc(size);
+	if (!base)
+		goto out;
+	uint8_t *p = base;
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	memcpy(p, sm.records, sm.record_count * sizeof(db_cache_record_t));
+	p += sm.record_count * sizeof(db_cache_record_t);
+	for (size_t i = 0; i < sm.name_count; i++) {
+		memcpy(p, &sorted[i].entry, sizeof(db_cache_name_t));
+		p += sizeof(db_cache_name_t);
+	}
+	memcpy(p, chips, chip_count * sizeof(db_cache_chip_t));
+	p += chip_count * sizeof(db_cache_chip_t);
+	memcpy(p, sm.configs, sm.config_count * sizeof(db_cache_entry_t));
+	p += sm.config_count * sizeof(db_cache_entry_t);
+	memcpy(p, sm.maps, sm.map_count * sizeof(db_cache_entry_t));
+	p += sm.map_count * sizeof(db_cache_entry_t);
+	memcpy(p, sm.strings, sm.strings_count);
+
+	memset(cache, 0, sizeof(*cache));
+	cache->base = base;
+	cache->size = size;
+	ret = set_cache_layout(cache);
+	if (ret) {
+		memset(cache, 0, sizeof(*cache));
+		free(base);
+	}
+
+out:
+	free(sorted);
+	free(chips);
+	free(sm.records);
+	free(sm.names);
+	free(sm.configs);
+	free(sm.maps);
+	free(sm.strings);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Check if an index was compiled from this xml file */
+static int check_db_cache(db_cache_t *cache, struct stat *st)
+{
+	return (cache->header->xml_size != (uint64_t)st->st_size ||
+		cache->header->xml_mtime != (uint64_t)st->st_mtime ||
+		cache->header->xml_inode != (uint64_t)st->st_ino) ?
+		       EXIT_FAILURE :
+		       EXIT_SUCCESS;
+}
+
+/* Open and validate the index of an xml database file, compiling it
+ * first if needed.
+ */
+static int open_db_cache(db_cache_t *cache, const char *name,
+			 const char *cli_name)
+{
+	char path[2][PATH_MAX];
+	char cache_name[64];
+	struct stat st;
+	int i;
+
+	FILE *file = get_database_file(name, cli_name);
+	if (!file)
+		return EXIT_FAILURE;
+	if (fstat(fileno(file), &st)) {
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	/* Search the index in the database and user cache directories. The
+	 * index of a file given on the command line is only kept in the user
+	 * cache. */
+	if (get_db_cache_name(name, cli_name, "idx", cache_name,
+			      sizeof(cache_name))) {
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+	path[0][0] = '\0';
+	for (i = cli_name ? 1 : 0; i < 2; i++) {
+		if (get_cache_path(cache_name, path[i], sizeof(path[i]), i)) {
+			path[i][0] = '\0';
+			continue;
+		}
+		if (map_db_cache(cache, path[i]))
+			continue;
+		if (!check_db_cache(cache, &st)) {
+			fclose(file);
+			return EXIT_SUCCESS;
+		}
+		close_db_cache(cache);
+	}
+
+	/* Not found or out of date, compile a new one */
+	int ret = compile_db_cache(cache, file, &st);
+	fclose(file);
+	if (ret)
+		return EXIT_FAILURE;
+	for (i = 0; i < 2; i++) {
+		if (path[i][0] && !write_db_cache(path[i], cache->base,
+						  cache->size))
+			break;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Open an xml database file positioned at the given offset */
+static FILE *get_database_file_at(const char *name, const char *cli_name,
+				  uint64_t offset)
+{
+	FILE *file = get_database_file(name, cli_name);
+	if (!file)
+		return NULL;
+	if (fseek(file, (long)offset, SEEK_SET)) {
+		fclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+/* Parse an xml section starting at the given offset. The worker returns
+ * ERREND when it is done.
+ */
+static int parse_xml_at(const char *name, const char *cli_name,
+			uint64_t offset, int (*worker)(), void *sm)
+{
+	FILE *file = get_database_file_at(name, cli_name, offset);
+	if (!file)
+		return EXIT_FAILURE;
+
+	Parser parser = { .inputcbdata = file,
+			  .worker = worker,
+			  .userdata = sm,
+			  .mm.o = offset };
+	map_input(&parser, file); /* Falls back to reading the file */
+	int ret = parse(&parser);
+	done(&parser);
+	fclose(file);
+	if (ret && ret != ERREND) {
+		fprintf(stderr,
+			"An error occurred while parsing XML database.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Stop parsing once the device tag is loaded */
+static int cached_device_callback(int type, const char *tag, size_t taglen,
+				  Parser *parser)
+{
+	state_machine_d_t *sm = parser->userdata;
+	int ret = device_callback(type, tag, taglen, parser);
+	if (ret != XML_OK)
+		return ret;
+	return (sm->found_count && !sm->load_vectors) ? ERREND : XML_OK;
+}
+
+/* Stop parsing once the configuration is loaded */
+static int cached_profile_callback(int type, const char *tag, size_t taglen,
+				   Parser *parser)
+{
+	state_machine_p_t *sm = parser->userdata;
+	int ret = profile_callback(type, tag, taglen, parser);
+	if (ret != XML_OK)
+		return ret;
+	return sm->found ? ERREND : XML_OK;
+}
+
+/* Stop parsing once the pin map is loaded */
+static int cached_map_callback(int type, const char *tag, size_t taglen,
+			       Parser *parser)
+{
+	state_machine_m_t *sm = parser->userdata;
+	int ret = map_callback(type, tag, taglen, parser);
+	if (ret != XML_OK)
+		return ret;
+	return sm->found == 3 ? ERREND : XML_OK;
+}
+
+/* Binary search the first name table entry not less than 'name' */
+static size_t cache_lower_bound(db_cache_t *cache, const char *name)
+{
+	size_t first = 0, last = cache->header->name_count;
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (strcasecmp(cache->strings + cache->names[mid].name, name) < 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return first;
+}
+
+/* Find a device by name in an index. Like the xml search the first match
+ * is used unless it is overridden by a custom entry.
+ * Returns the record index or -1 if not found.
+ */
+static long cache_find_name(db_cache_t *cache, const char *name,
+			    uint8_t version)
+{
+	long found = -1;
+	size_t i = cache_lower_bound(cache, name);
+	for (; i < cache->header->name_count; i++) {
+		const db_cache_name_t *entry = &cache->names[i];
+		if (strcasecmp(cache->strings + entry->name, name))
+			break;
+		const db_cache_record_t *record =
+			&cache->records[entry->record];
+		if (record->version != version)
+			continue;
+		if (found < 0 || record->custom)
+			found = entry->record;
+	}
+	return found;
+}
+
+/* Load a device from an indexed 'ic' tag */
+static int cache_load_device(state_machine_d_t *sm, db_cache_t *cache,
+			     long index, const char *name,
+			     const char *cli_name)
+{
+	const db_cache_record_t *record = &cache->records[index];
+	sm->db_version = record->version;
+	sm->custom = record->custom;
+	sm->db_data->version = record->version;
+	return parse_xml_at(name, cli_name, record->offset,
+			    cached_device_callback, sm);
+}
+
+/* Device search using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_get_device(state_machine_d_t *sm)
+{
+	db_data_t *db_data = sm->db_data;
+	uint8_t version = db_data->version;
+	db_cache_t logic, infoic;
+	long index;
+
+	if (open_db_cache(&logic, LOGICIC_NAME, db_data->logicic_path))
+		return EXIT_FAILURE;
+	if (open_db_cache(&infoic, INFOIC_NAME, db_data->infoic_path)) {
+		close_db_cache(&logic);
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_SUCCESS;
+	index = cache_find_name(&logic, db_data->device_name, LOGIC_DATABASE);
+	if (index >= 0) {
+		ret = cache_load_device(sm, &logic, index, LOGICIC_NAME,
+					db_data->logicic_path);
+	} else {
+		index = cache_find_name(&infoic, db_data->device_name,
+					version);
+		if (index >= 0)
+			ret = cache_load_device(sm, &infoic, index,
+						INFOIC_NAME,
+						db_data->infoic_path);
+	}
+	db_data->version = version;
+	close_db_cache(&logic);
+	close_db_cache(&infoic);
+	if (ret)
+		sm->found_count = 0;
+	return EXIT_SUCCESS;
+}
+
+/* Chip ID search using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_get_device_from_id(db_data_t *db_data, char **name)
+{
+	db_cache_t cache;
+	if (open_db_cache(&cache, INFOIC_NAME, db_data->infoic_path))
+		return EXIT_FAILURE;
+
+	/* Binary search the first entry with this chip ID */
+	size_t first = 0, last = cache.header->chip_count;
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (cache.chips[mid].chip_id < db_data->chip_id)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	/* The entries are sorted in file order, take the first one
+	 * from the desired database */
+	*name = NULL;
+	for (; first < cache.header->chip_count; first++) {
+		const db_cache_chip_t *chip = &cache.chips[first];
+		if (chip->chip_id != db_data->chip_id)
+			break;
+		const db_cache_record_t *record = &cache.records[chip->record];
+		if (record->version == db_data->version &&
+		    (!db_data->pin_count ||
+		     record->pin_count == db_data->pin_count)) {
+			*name = strdup(cache.strings + record->name);
+			break;
+		}
+	}
+	close_db_cache(&cache);
+	return EXIT_SUCCESS;
+}
+
+/* Check the listing filters against an index record */
+static int cache_match_record(const db_cache_record_t *record,
+			      db_data_t *db_data, uint8_t version)
+{
+	return record->version == version &&
+	       (!db_data->filter_pins ||
+		db_data->filter_pins == record->pin_count) &&
+	       (!db_data->filter_protocol ||
+		db_data->filter_protocol == record->protocol_id);
+}
+
+/* Print the names of a record which match the search string */
+static size_t cache_print_record(db_cache_t *cache,
+				 const db_cache_record_t *record,
+				 const char *filter, int prefix)
+{
+	const char *name = cache->strings + record->name;
+	size_t i, count = 0;
+
+	for (i = 0; i < record->name_count; i++) {
+		if (match_name(name, filter, prefix)) {
+			fprintf(stdout, "%s%s\n", name,
+				record->custom ? "(custom)" : "");
+			count++;
+		}
+		name += strlen(name) + 1;
+	}
+	return count;
+}
+
+/* List the devices of one index, in file order or, for a prefix search,
+ * in name order straight from the sorted name table */
+static size_t cache_list(db_cache_t *cache, db_data_t *db_data,
+			 uint8_t version)
+{
+	const char *filter = db_data->device_name;
+	size_t i, count = 0;
+
+	if (!filter || !db_data->prefix) {
+		for (i = 0; i < cache->header->record_count; i++) {
+			if (cache_match_record(&cache->records[i], db_data,
+					       version))
+				count += cache_print_record(
+					cache, &cache->records[i], filter, 0);
+		}
+		return count;
+	}
+
+	size_t len = strlen(filter);
+	for (i = cache_lower_bound(cache, filter);
+	     i < cache->header->name_count; i++) {
+		const char *name = cache->strings + cache->names[i].name;
+		if (strncasecmp(name, filter, len))
+			break;
+		const db_cache_record_t *record =
+			&cache->records[cache->names[i].record];
+		if (!cache_match_record(record, db_data, version))
+			continue;
+		fprintf(stdout, "%s%s\n", name,
+			record->custom ? "(custom)" : "");
+		count++;
+	}
+	return count;
+}
+
+/* List the devices with the autodetected chip ID and package */
+static size_t cache_list_chip_id(db_cache_t *cache, db_data_t *db_data)
+{
+	size_t first = 0, last = cache->header->chip_count, count = 0;
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (cache->chips[mid].chip_id < db_data->chip_id)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	for (; first < cache->header->chip_count; first++) {
+		const db_cache_chip_t *chip = &cache->chips[first];
+		if (chip->chip_id != db_data->chip_id)
+			break;
+		const db_cache_record_t *record = &cache->records[chip->record];
+		if (!cache_match_record(record, db_data, db_data->version) ||
+		    (db_data->pin_count &&
+		     db_data->pin_count != record->pin_count))
+			continue;
+		if (db_data->records)
+			(*db_data->records)++;
+		count += db_data->quiet ?
+				 record->name_count :
+				 cache_print_record(cache, record, NULL, 0);
+	}
+	return count;
+}
+
+/* Device listing using the compiled index, no xml is parsed at all.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_list_devices(db_data_t *db_data, uint32_t *count)
+{
+	db_cache_t logic, infoic;
+
+	if (open_db_cache(&infoic, INFOIC_NAME, db_data->infoic_path))
+		return EXIT_FAILURE;
+	/* SPI autodetect, like the xml search only infoic.xml has chip IDs */
+	if (db_data->chip_id || db_data->pin_count) {
+		*count = cache_list_chip_id(&infoic, db_data);
+		close_db_cache(&infoic);
+		return EXIT_SUCCESS;
+	}
+
+	if (open_db_cache(&logic, LOGICIC_NAME, db_data->logicic_path)) {
+		close_db_cache(&infoic);
+		return EXIT_FAILURE;
+	}
+	*count = cache_list(&logic, db_data, LOGIC_DATABASE);
+	*count += cache_list(&infoic, db_data, db_data->version);
+	close_db_cache(&logic);
+	close_db_cache(&infoic);
+	return EXIT_SUCCESS;
+}
+
+/* Profile search using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_get_profile(state_machine_p_t *sm, int *ret)
+{
+	db_cache_t cache;
+	if (open_db_cache(&cache, INFOIC_NAME, sm->db_data->infoic_path))
+		return EXIT_FAILURE;
+
+	/* Like the xml search, the first entry that starts with
+	 * the needed name is used */
+	*ret = EXIT_SUCCESS;
+	size_t len = strlen(sm->name);
+	for (size_t i = 0; i < cache.header->config_count; i++) {
+		if (strncasecmp(cache.strings + cache.configs[i].key, sm->name,
+				len))
+			continue;
+		sm->has_profile = 1;
+		*ret = parse_xml_at(INFOIC_NAME, sm->db_data->infoic_path,
+				    cache.configs[i].offset,
+				    cached_profile_callback, sm);
+		break;
+	}
+	close_db_cache(&cache);
+	return EXIT_SUCCESS;
+}
+
+/* Pin map search using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_get_map(state_machine_m_t *sm, int *ret)
+{
+	db_cache_t cache;
+	if (open_db_cache(&cache, INFOIC_NAME, sm->db_data->infoic_path))
+		return EXIT_FAILURE;
+
+	*ret = EXIT_SUCCESS;
+	for (size_t i = 0; i < cache.header->map_count; i++) {
+		if (cache.maps[i].key != sm->db_data->index)
+			continue;
+		sm->has_map = 1;
+		*ret = parse_xml_at(INFOIC_NAME, sm->db_data->infoic_path,
+				    cache.maps[i].offset, cached_map_callback,
+				    sm);
+		break;
+	}
+	close_db_cache(&cache);
+	return EXIT_SUCCESS;
+}
+
+/* Stop parsing once the algorithm is found */
+static int cached_algo_callback(int type, const char *tag, size_t taglen,
+				Parser *parser)
+{
+	state_machine_a_t *sm = parser->userdata;
+	int ret = algo_callback(type, tag, taglen, parser);
+	if (ret != XML_OK)
+		return ret;
+	return sm->found ? ERREND : XML_OK;
+}
+
+/* Algorithm search using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int cache_get_algorithm(state_machine_a_t *sm, int *ret)
+{
+	db_cache_t cache;
+	if (open_db_cache(&cache, ALGO_NAME, sm->db_data->algo_path))
+		return EXIT_FAILURE;
+
+	*ret = EXIT_SUCCESS;
+	for (size_t i = 0; i < cache.header->config_count; i++) {
+		if (strcasecmp(cache.strings + cache.configs[i].key,
+			       sm->db_data->device_name))
+			continue;
+		sm->has_algo = 1;
+		*ret = parse_xml_at(ALGO_NAME, sm->db_data->algo_path,
+				    cache.configs[i].offset,
+				    cached_algo_callback, sm);
+		break;
+	}
+	close_db_cache(&cache);
+	return EXIT_SUCCESS;
+}
+
+/* Parse xml algorithms */
+static int parse_algorithms(state_machine_a_t *sm)
+{
+	int ret;
+	if (!cache_get_algorithm(sm, &ret))
+		return ret;
+
+	/* Open database xml file */
+	FILE *file = get_database_file(ALGO_NAME, sm->db_data->algo_path);
+	if (!file)
+		return EXIT_FAILURE;
+
+	/* Begin xml parse */
+	Parser parser = { .inputcbdata = file,
+			  .worker = algo_callback,
+			  .userdata = sm };
+	map_input(&parser, file); /* Falls back to reading the file */
+
+	ret = parse(&parser);
+	done(&parser);
+	fclose(file);
+	if (ret) {
+		fprintf(stderr,
+			"An error occurred while parsing XML algorithms.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Parse given xml file */
+static int parse_xml_file(void *sm, const char *name, const char *cli_name)
+{
+	return parse_xml_at(name, cli_name, 0, device_callback, sm);
+}
+
+/* Parse xml database */
+static int parse_xml(state_machine_d_t *sm)
+{
+	int version = sm->db_data->version;
+	sm->db_data->version = LOGIC_DATABASE;
+	int ret = parse_xml_file(sm, LOGICIC_NAME, sm->db_data->logicic_path);
+	if (ret)
+		return ret;
+	if (!sm->count_only && sm->device->chip_type == MP_LOGIC)
+		return ret;
+	sm->db_data->version = version;
+	return parse_xml_file(sm, INFOIC_NAME, sm->db_data->infoic_path);
+}
+
+/* Translate programmer version to internal database version */
+static void translate_db(db_data_t *db_data)
+{
+	switch (db_data->version) {
+	case MP_TL866A:
+	case MP_TL866CS:
+		db_data->version = INFOIC_DATABASE;
+		break;
+	case MP_TL866IIPLUS:
+	case MP_T48:
+	case MP_T56:
+		db_data->version = INFOIC2PLUS_DATABASE;
+	}
+}
+
+/*
+ * Chip ID lookup memo.
+ * A server runs many jobs on the same few chip types and looks up the
+ * same chip IDs again and again. The results, including the misses, are
+ * kept per database version, protocol, chip ID (which also tells the ID
+ * byte count) and pin count for as long as infoic.xml keeps its size,
+ * modification time and inode. minipro itself searches from one thread,
+ * but libminipro users may call query_database() from several, so the
+ * memo is only used with chip_id_memo_lock held. A result is only added
+ * to the memo generation it was looked up in.
+ */
+#define CHIP_ID_MEMO_SIZE 16
+
+typedef struct chip_id_memo {
+	uint32_t chip_id;
+	uint32_t protocol;
+	uint32_t pin_count;
+	uint8_t version;
+	char *name; /* NULL if not found */
+} chip_id_memo_t;
+
+static chip_id_memo_t chip_id_memo[CHIP_ID_MEMO_SIZE];
+static size_t chip_id_memo_count, chip_id_memo_next;
+static struct stat chip_id_memo_st;
+static char *chip_id_memo_path;
+static unsigned int chip_id_memo_generation;
+static pthread_mutex_t chip_id_memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_chip_id_memo(void)
+{
+	for (size_t i = 0; i < chip_id_memo_count; i++)
+		free(chip_id_memo[i].name);
+	chip_id_memo_count = 0;
+	chip_id_memo_next = 0;
+	free(chip_id_memo_path);
+	chip_id_memo_path = NULL;
+	chip_id_memo_generation++;
+}
+
+/* Drop the memo if another or a changed infoic.xml is used */
+static int check_chip_id_memo(const char *cli_name)
+{
+	struct stat st;
+	int ret;
+
+	/* An overridden file is announced when opened, just stat it */
+	if (cli_name) {
+		ret = stat(cli_name, &st);
+	} else {
+		FILE *file = get_database_file(INFOIC_NAME, NULL);
+		if (!file)
+			return EXIT_FAILURE;
+		ret = fstat(fileno(file), &st);
+		fclose(file);
+	}
+	if (ret)
+		return EXIT_FAILURE;
+
+	if (chip_id_memo_count &&
+	    (st.st_size != chip_id_memo_st.st_size ||
+	     st.st_mtime != chip_id_memo_st.st_mtime ||
+	     st.st_ino != chip_id_memo_st.st_ino ||
+	     (cli_name ? !chip_id_memo_path ||
+				 strcmp(cli_name, chip_id_memo_path) :
+			 chip_id_memo_path != NULL)))
+		free_chip_id_memo();
+	if (!chip_id_memo_count) {
+		chip_id_memo_st = st;
+		if (cli_name) {
+			chip_id_memo_path = strdup(cli_name);
+			if (!chip_id_memo_path)
+				return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static chip_id_memo_t *find_chip_id_memo(db_query_t *query, uint8_t version)
+{
+	for (size_t i = 0; i < chip_id_memo_count; i++) {
+		chip_id_memo_t *memo = &chip_id_memo[i];
+		if (memo->chip_id == query->chip_id &&
+		    memo->protocol == query->protocol &&
+		    memo->pin_count == query->pin_count &&
+		    memo->version == version)
+			return memo;
+	}
+	return NULL;
+}
+
+/* Remember a chip ID search result, replacing the oldest entry if full */
+static void add_chip_id_memo(db_query_t *query, uint8_t version,
+			     unsigned int generation)
+{
+	char *name = NULL;
+	if (query->chip_name) {
+		name = strdup(query->chip_name);
+		if (!name)
+			return;
+	}
+
+	pthread_mutex_lock(&chip_id_memo_lock);
+	if (generation != chip_id_memo_generation) {
+		pthread_mutex_unlock(&chip_id_memo_lock);
+		free(name);
+		return;
+	}
+	chip_id_memo_t *memo = &chip_id_memo[chip_id_memo_next];
+	if (chip_id_memo_count < CHIP_ID_MEMO_SIZE)
+		chip_id_memo_count++;
+	else
+		free(memo->name);
+	chip_id_memo_next = (chip_id_memo_next + 1) % CHIP_ID_MEMO_SIZE;
+	memo->chip_id = query->chip_id;
+	memo->protocol = query->protocol;
+	memo->pin_count = query->pin_count;
+	memo->version = version;
+	memo->name = name;
+	pthread_mutex_unlock(&chip_id_memo_lock);
+}
+
+/* Per query state of a batched database search */
+typedef struct query_state {
+	db_query_t *query;
+	db_data_t db_data;
+	device_t *device;
+	state_machine_d_t d;
+	state_machine_p_t p;
+	state_machine_m_t m;
+	int located;
+	int done;
+	int memoized; /* A chip ID search answered from the memo */
+	int memo_valid; /* The memo matches the infoic.xml searched */
+	unsigned int memo_generation;
+} query_state_t;
+
+/* State machine structure used by the batched sax parser callback
+ * function for persistent data between calls.
+ */
+typedef struct state_machine_q {
+	query_state_t *state;
+	size_t count;
+	size_t pending;
+	int logic_pass;
+} state_machine_q_t;
+
+/* Initialize the search state of a query */
+static int query_init(query_state_t *state, db_query_t *query,
+		      db_data_t *db_data)
+{
+	state->query = query;
+	state->db_data = *db_data;
+	state->db_data.device_name = NULL;
+	state->db_data.index = 0;
+	state->d.db_version = -1;
+	state->d.custom = -1;
+	state->d.db_data = &state->db_data;
+	state->d.profile = &state->p;
+	state->p.db_data = &state->db_data;
+	state->m.db_data = &state->db_data;
+
+	if (query->type == DB_QUERY_CHIP_ID) {
+		int found = 0;
+		pthread_mutex_lock(&chip_id_memo_lock);
+		if (!check_chip_id_memo(db_data->infoic_path)) {
+			chip_id_memo_t *memo = find_chip_id_memo(
+				query, state->db_data.version);
+			state->memo_valid = 1;
+			state->memo_generation = chip_id_memo_generation;
+			if (memo) {
+				found = 1;
+				if (memo->name)
+					query->chip_name = strdup(memo->name);
+				if (memo->name && !query->chip_name)
+					found = -1;
+			}
+		}
+		pthread_mutex_unlock(&chip_id_memo_lock);
+		if (found < 0) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
+		if (found) {
+			state->memoized = 1;
+			state->done = 1;
+			return EXIT_SUCCESS;
+		}
+	}
+
+	switch (query->type) {
+	case DB_QUERY_DEVICE:
+	case DB_QUERY_CHIP_ID:
+		state->device = calloc(1, sizeof(device_t));
+		if (!state->device) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
+		state->d.device = state->device;
+		if (query->type == DB_QUERY_DEVICE) {
+			state->db_data.device_name = query->name;
+			state->d.with_vectors = query->with_vectors;
+			state->done = !query->name;
+			break;
+		}
+		state->device->chip_id = query->chip_id;
+		state->device->protocol_id = query->protocol;
+		state->device->package_details.pin_count = query->pin_count;
+		state->db_data.chip_id = query->chip_id;
+		state->db_data.pin_count = query->pin_count;
+		state->d.match_id = 1;
+		break;
+	case DB_QUERY_PROFILE:
+		state->located = 1;
+		state->done = !query->name ||
+			      strlen(query->name) >= sizeof(state->p.name);
+		if (!state->done)
+			strcpy(state->p.name, query->name);
+		break;
+	case DB_QUERY_MAP:
+		state->located = 1;
+		state->db_data.index = query->index;
+		state->done = !query->index;
+		break;
+	default:
+		state->done = 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Resolve a query using the compiled index.
+ * Returns EXIT_FAILURE only if the index can't be used.
+ */
+static int query_cache(query_state_t *state, int *ret)
+{
+	*ret = EXIT_SUCCESS;
+	switch (state->query->type) {
+	case DB_QUERY_CHIP_ID:
+		return cache_get_device_from_id(&state->db_data,
+						&state->query->chip_name);
+	case DB_QUERY_PROFILE:
+		return cache_get_profile(&state->p, ret);
+	case DB_QUERY_MAP:
+		return cache_get_map(&state->m, ret);
+	}
+
+	/* Device and its dependent configuration/pin map */
+	if (cache_get_device(&state->d))
+		return EXIT_FAILURE;
+	if (!state->d.found_count)
+		return EXIT_SUCCESS;
+	if (state->p.name[0] && cache_get_profile(&state->p, ret))
+		*ret = EXIT_FAILURE;
+	if (!*ret && state->query->with_map && state->device->pin_map) {
+		state->db_data.index = state->device->pin_map;
+		if (cache_get_map(&state->m, ret))
+			*ret = EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Dispatch one xml tag to a pending query */
+static int query_step(query_state_t *state, int type, const char *tag,
+		      size_t taglen, Parser *parser)
+{
+	int ret;
+	if (!state->located) {
+		parser->userdata = &state->d;
+		ret = device_callback(type, tag, taglen, parser);
+		if (ret != XML_OK)
+			return ret;
+
+		/* A chip ID search stops at the first match. A device search
+		 * ends with the desired database, as custom entries there can
+		 * still override the first match.
+		 */
+		if (state->d.match_id && state->d.found_count)
+			state->located = 1;
+		if (type == FRAMECLOSE_ && !tagcmpn(tag, taglen, DB_TAG) &&
+		    state->d.db_version == state->db_data.version)
+			state->located = 1;
+		if (type == OPENTAG_ && !tagcmpn(tag, taglen, CFGS_TAG))
+			state->located = 1;
+		if (!state->located)
+			return XML_OK;
+		if (!state->d.found_count || state->d.match_id) {
+			state->done = 1;
+			return XML_OK;
+		}
+		if (state->query->with_map)
+			state->db_data.index = state->device->pin_map;
+	}
+
+	/* Configuration and pin map, either queried directly or needed
+	 * by the device found above
+	 */
+	if (state->p.name[0] && !state->p.found && !state->p.skip) {
+		parser->userdata = &state->p;
+		ret = profile_callback(type, tag, taglen, parser);
+		if (ret != XML_OK)
+			return ret;
+	}
+	if (state->db_data.index && state->m.found != 3) {
+		parser->userdata = &state->m;
+		ret = map_callback(type, tag, taglen, parser);
+		if (ret != XML_OK)
+			return ret;
+	}
+	state->done =
+		(!state->p.name[0] || state->p.found || state->p.skip) &&
+		(!state->db_data.index || state->m.found == 3);
+	return XML_OK;
+}
+
+/* XML batched query SAX parser handler. Each xml tag pair is dispatched
+ * to all pending queries, and parsing stops once all of them are done.
+ */
+static int query_callback(int type, const char *tag, size_t taglen,
+			  Parser *parser)
+{
+	state_machine_q_t *sm = parser->userdata;
+	int ret = XML_OK;
+
+	for (size_t i = 0; i < sm->count && ret == XML_OK; i++) {
+		query_state_t *state = &sm->state[i];
+		if (state->done)
+			continue;
+
+		/* Only device searches use the logic database */
+		if (sm->logic_pass) {
+			if (state->query->type != DB_QUERY_DEVICE)
+				continue;
+			parser->userdata = &state->d;
+			ret = device_callback(type, tag, taglen, parser);
+			continue;
+		}
+
+		ret = query_step(state, type, tag, taglen, parser);
+		if (state->done)
+			sm->pending--;
+	}
+	parser->userdata = sm;
+	if (ret != XML_OK)
+		return ret;
+	return sm->pending ? XML_OK : ERREND;
+}
+
+/* Move the results of a query to the caller */
+static void query_finish(query_state_t *state)
+{
+	db_query_t *query = state->query;
+	device_t *device = state->device;
+
+	switch (query->type) {
+	case DB_QUERY_DEVICE:
+		if (!state->d.found_count)
+			break;
+		if (state->p.name[0]) {
+			if (!state->p.config) {
+				fprintf(stderr,
+					"No %s configuration was found.\n",
+					state->p.name);
+				break;
+			}
+			device->config = state->p.config;
+			state->p.config = NULL;
+			set_config_bits(device);
+		}
+		query->device = device;
+		state->device = NULL;
+		query->map = state->m.map;
+		state->m.map = NULL;
+		break;
+	case DB_QUERY_CHIP_ID:
+		if (state->memoized)
+			break;
+		if (!query->chip_name && state->d.found_count)
+			query->chip_name = strdup(device->name);
+		if (state->memo_valid)
+			add_chip_id_memo(query, state->db_data.version,
+					 state->memo_generation);
+		break;
+	case DB_QUERY_PROFILE:
+		query->config = state->p.config;
+		state->p.config = NULL;
+		break;
+	case DB_QUERY_MAP:
+		query->map = state->m.map;
+		state->m.map = NULL;
+		break;
+	}
+}
+
+/* Free whatever was not handed over to the caller */
+static void query_free(query_state_t *state)
+{
+	if (state->p.config) {
+		if (state->p.type == PLD_CHIP)
+			free(((gal_config_t *)state->p.config)->acw_bits);
+		free(state->p.config);
+	}
+	free(state->m.map);
+	if (state->device) {
+		free(state->device->vectors);
+		free(state->device);
+	}
+}
+
+/* Resolve a batch of database queries.
+ * The compiled index is used when available, otherwise all queries are
+ * resolved in a single pass over each xml file, which stops as soon as
+ * every query is satisfied. Queries not found have NULL results.
+ */
+int query_database(db_data_t *db_data, db_query_t *query, size_t count)
+{
+	state_machine_q_t sm;
+	memset(&sm, 0, sizeof(sm));
+	for (size_t i = 0; i < count; i++) {
+		query[i].device = NULL;
+		query[i].chip_name = NULL;
+		query[i].config = NULL;
+		query[i].map = NULL;
+	}
+
+	sm.state = calloc(count, sizeof(query_state_t));
+	if (!sm.state) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	sm.count = count;
+
+	/* Try the compiled index first, the rest goes to the xml pass */
+	translate_db(db_data);
+	int ret = EXIT_SUCCESS, err;
+	for (size_t i = 0; i < count && !ret; i++) {
+		query_state_t *state = &sm.state[i];
+		ret = query_init(state, &query[i], db_data);
+		if (ret || state->done)
+			continue;
+		if (!query_cache(state, &err)) {
+			state->done = 1;
+			ret = err;
+			continue;
+		}
+		sm.pending++;
+		if (query[i].type == DB_QUERY_DEVICE)
+			sm.logic_pass = 1;
+	}
+
+	/* Logic devices are searched first */
+	if (!ret && sm.logic_pass) {
+		for (size_t i = 0; i < count; i++)
+			sm.state[i].db_data.version = LOGIC_DATABASE;
+		ret = parse_xml_at(LOGICIC_NAME, db_data->logicic_path, 0,
+				   query_callback, &sm);
+		sm.logic_pass = 0;
+		for (size_t i = 0; i < count; i++) {
+			query_state_t *state = &sm.state[i];
+			state->db_data.version = db_data->version;
+			if (state->done || state->query->type != DB_QUERY_DEVICE ||
+			    !state->d.found_count)
+				continue;
+			state->located = 1;
+			state->done = 1;
+			sm.pending--;
+		}
+	}
+
+	if (!ret && sm.pending)
+		ret = parse_xml_at(INFOIC_NAME, db_data->infoic_path, 0,
+				   query_callback, &sm);
+
+	for (size_t i = 0; i < count; i++) {
+		if (!ret)
+			query_finish(&sm.state[i]);
+		query_free(&sm.state[i]);
+	}
+	free(sm.state);
+	if (ret) {
+		for (size_t i = 0; i < count; i++) {
+			free(query[i].chip_name);
+			query[i].chip_name = NULL;
+		}
+	}
+	return ret;
+}
+
+/* XML based device search */
+device_t *get_device_by_name(db_data_t *db_data)
+{
+	db_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_DEVICE;
+	query.name = db_data->device_name;
+	if (query_database(db_data, &query, 1))
+		return NULL;
+	return query.device;
+}
+
+/* Get first device name found in the database from a device ID */
+const char *get_device_from_id(db_data_t *db_data)
+{
+	db_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_CHIP_ID;
+	query.chip_id = db_data->chip_id;
+	query.protocol = db_data->protocol;
+	if (query_database(db_data, &query, 1))
+		return NULL;
+	return query.chip_name;
+}
+
+/* List all devices from XML
+ * If name == NULL list all devices
+ */
+int list_devices(db_data_t *db_data)
+{
+	device_t device;
+	device.chip_id = db_data->chip_id;
 	device.package_details.pin_count = db_data->pin_count;
 	memset(device.name, 0, sizeof(device.name));
 	int flag = (db_data->chip_id || db_data->pin_count) ? 1 : 0;
 
-	/* Initialize state machine structure */
 	translate_db(db_data);
+	uint32_t count;
+	if (!cache_list_devices(db_data, &count)) {
+		if (db_data->count)
+			*(db_data->count) = count;
+		return EXIT_SUCCESS;
+	}
+
+	/* Initialize state machine structure */
 	state_machine_d_t sm;
 	memset(&sm, 0, sizeof(sm));
 	sm.device = &device;
@@ -1617,82 +3197,174 @@ pin_map_t *get_pin_map(db_data_t *db_data)
 		return NULL;
 	}
 
-	/* Set the Infoic2Plus database for pin map search */
-	db_data->version = INFOIC2PLUS_DATABASE;
-	state_machine_m_t sm;
-	memset(&sm, 0, sizeof(sm));
-	sm.db_data = db_data;
-	if (parse_maps(&sm))
+	db_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_MAP;
+	query.index = db_data->index;
+	if (query_database(db_data, &query, 1))
 		return NULL;
-	if (!sm.map) {
+	if (!query.map) {
 		fprintf(stderr, "No pin map %u was found.\n", db_data->index);
 		return NULL;
 	}
-	return sm.map;
+	return query.map;
 }
 
-/* Return an algorithm_t structure */
-int get_algorithm(device_t *device, const char *algo_path, uint8_t icsp,
-		  uint8_t vopt, size_t offset)
-{
-	algorithm_t *algorithm = &device->algorithm;
-	uint8_t algo_number = (uint8_t)(device->variant >> 8);
-	uint8_t error = 0;
-	const char *entry;
+/*
+ * Decoded algorithm cache.
+ *
+ * Decoding an algorithm means a base64 decoding and a gunzip of the
+ * bitstream. The decoded and CRC checked bitstream is saved in the
+ * database or user cache directory as 'algorithm.xml.<name>.bin' and used
+ * as long as algorithm.xml keeps the same size, modification time and
+ * inode, like the compiled index. The algorithms of a file given with
+ * --algorithms are cached per user as 'algorithm.xml.<hash>.<name>.bin'.
+ */
 
-	/* Check if the arguments are in valid range */
-	if (device->protocol_id != IC2_ALG_NONE) {
-		int isProtocolValid = device->protocol_id > ALGO_COUNT;
-		entry = t56_algo_table[device->protocol_id - 1];
-		if (isProtocolValid || (entry == NULL))
-			error = 1;
-	} else {
-		if (algo_number > UTIL_COUNT)
-			error = 1;
-	}
+#define ALGO_CACHE_MAGIC   "MPALGOS"
+#define ALGO_CACHE_VERSION 1
+
+typedef struct algo_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t size; /* uncompressed bitstream size */
+	uint64_t xml_size;
+	uint64_t xml_mtime;
+	uint64_t xml_inode;
+} algo_cache_header_t;
+
+/* Check the algorithm CRC */
+static int check_algorithm(algorithm_t *algorithm, size_t offset,
+			   uint32_t usize)
+{
+	uint32_t file_crc =
+		load_int(algorithm->bitstream + offset + ALGO_CRC_OFFSET, 4,
+			 MP_LITTLE_ENDIAN);
+	uint32_t data_crc =
+		crc_32(algorithm->bitstream + offset + ALGO_DATA_OFFSET,
+		       usize - ALGO_DATA_OFFSET, 0xFFFFFFFF);
+	return file_crc != data_crc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-	if (error) {
-		fprintf(stderr, "Invalid algorithm number found.\n");
+/* Get the status of an xml database file */
+static int stat_database(const char *name, const char *cli_name,
+			 struct stat *st)
+{
+	FILE *file = get_database_file(name, cli_name);
+	if (!file)
 		return EXIT_FAILURE;
-	}
-
-	/* If not a logic chip grab the prefix name using the protocol_id-1 */
-	if (device->protocol_id != IC2_ALG_NONE) {
+	int ret = fstat(fileno(file), st);
+	fclose(file);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-		char algo_str[8];
-		snprintf(algo_str, sizeof(algo_str), "%02X", algo_number);
-		char *name = stpcpy(algorithm->name, entry);
+/* Build the cache file name of an algorithm */
+static int get_algo_cache_name(const char *algo_name, const char *algo_path,
+			       char *name, size_t size)
+{
+	char suffix[NAME_LEN + 8];
 
-		switch (device->protocol_id) {
-		/* Choose icsp algorithm for Atmel ATmega, ATtiny and AT90 */
-		case IC2_ALG_ATMGA:
-				strcat(name, icsp ? "11S" : algo_str);
-			break;
+	/* The algorithm name becomes part of a file name */
+	for (const char *p = algo_name; *p; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_' && *p != '-')
+			return EXIT_FAILURE;
+	}
+	snprintf(suffix, sizeof(suffix), "%s.bin", algo_name);
+	return get_db_cache_name(ALGO_NAME, algo_path, suffix, name, size);
+}
 
-		/* Choose ICSP option for AT89C*/
-		case IC2_ALG_AT89C:
-			strcat(name, icsp ? "2S" : algo_str);
-			break;
+/* Load a decoded algorithm from the cache */
+static int load_algo_cache(algorithm_t *algorithm, const char *algo_path,
+			   size_t offset, struct stat *st, uint32_t *usize)
+{
+	char name[NAME_LEN + 32], path[PATH_MAX];
+	algo_cache_header_t header;
 
-		/* Choose 1.8V/3.3V for EMMC */
-		case IC2_ALG_EMMC:
-				strcat(name, V_1V8 ? "_18" : "_33");
-			break;
+	if (get_algo_cache_name(algorithm->name, algo_path, name,
+				sizeof(name)))
+		return EXIT_FAILURE;
+	/* A file given with --algorithms is only cached per user */
+	for (int i = algo_path ? 1 : 0; i < 2; i++) {
+		if (get_cache_path(name, path, sizeof(path), i))
+			continue;
+		FILE *file = fopen(path, "rb");
+		if (!file)
+			continue;
+		if (fread(&header, sizeof(header), 1, file) != 1 ||
+		    memcmp(header.magic, ALGO_CACHE_MAGIC,
+			   sizeof(header.magic)) ||
+		    header.version != ALGO_CACHE_VERSION ||
+		    header.size <= ALGO_DATA_OFFSET ||
+		    header.xml_size != (uint64_t)st->st_size ||
+		    header.xml_mtime != (uint64_t)st->st_mtime ||
+		    header.xml_inode != (uint64_t)st->st_ino) {
+			fclose(file);
+			continue;
+		}
 
-			/* Default case. Handle reversed package devices */
-		default:
-			strcat(name, algo_str);
-			if (device->flags.reversed_package)
-				strcat(algorithm->name, "R");
+		/* Same layout as a freshly decoded algorithm */
+		algorithm->length =
+			header.size + (0x200 - (header.size % 0x200));
+		algorithm->bitstream = calloc(1, algorithm->length + offset);
+		if (!algorithm->bitstream) {
+			fclose(file);
+			return EXIT_FAILURE;
 		}
-		/* For Logic chips/utils copy only the algorithm name */
-	} else {
-		strncpy(algorithm->name, t56_util_table[algo_number], NAME_LEN);
+		size_t ret = fread(algorithm->bitstream + offset, 1,
+				   header.size, file);
+		fclose(file);
+		/* A damaged cache file is simply decoded again */
+		if (ret == header.size &&
+		    !check_algorithm(algorithm, offset, header.size)) {
+			*usize = header.size;
+			return EXIT_SUCCESS;
+		}
+		free(algorithm->bitstream);
+		algorithm->bitstream = NULL;
+	}
+	return EXIT_FAILURE;
+}
+
+/* Save a decoded algorithm in the cache */
+static void save_algo_cache(algorithm_t *algorithm, const char *algo_path,
+			    size_t offset, struct stat *st, uint32_t usize)
+{
+	char name[NAME_LEN + 32], path[PATH_MAX];
+	algo_cache_header_t *header;
+
+	if (get_algo_cache_name(algorithm->name, algo_path, name,
+				sizeof(name)))
+		return;
+	uint8_t *data = malloc(sizeof(*header) + usize);
+	if (!data)
+		return;
+	header = (algo_cache_header_t *)data;
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, ALGO_CACHE_MAGIC, sizeof(header->magic));
+	header->version = ALGO_CACHE_VERSION;
+	header->size = usize;
+	header->xml_size = st->st_size;
+	header->xml_mtime = st->st_mtime;
+	header->xml_inode = st->st_ino;
+	memcpy(data + sizeof(*header), algorithm->bitstream + offset, usize);
+
+	for (int i = algo_path ? 1 : 0; i < 2; i++) {
+		if (!get_cache_path(name, path, sizeof(path), i) &&
+		    !write_db_cache(path, data, sizeof(*header) + usize))
+			break;
 	}
+	free(data);
+}
 
+/* Search an algorithm in algorithm.xml and decode it. The uncompressed
+ * size is returned in 'usize'.
+ */
+static int decode_algorithm(algorithm_t *algorithm, const char *algo_path,
+			    size_t offset, uint32_t *usize)
+{
+	const char *algo_name = algorithm->name;
 	/* Set the database for algorithm search */
 	db_data_t db_data;
-	const char *algo_name = algorithm->name;
 	db_data.version = ALGORITHM_DATABASE;
 	db_data.algo_path = algo_path;
 	db_data.device_name = algo_name;
@@ -1723,20 +3395,21 @@ int get_algorithm(device_t *device, const char *algo_path, uint8_t icsp,
 	out_size = base64_decode_block(sm.base64_data, out_size, gzip, &ds);
 	free(sm.base64_data);
 	if (!out_size) {
+		free(gzip);
 		fprintf(stderr, "Algorithm %s base64 decoding error!\n",
 			algo_name);
 		return EXIT_FAILURE;
 	}
 
 	/* Get the gzip uncompressed size and add the offset length */
-	uint32_t usize =
-		load_int((uint8_t *)(gzip + out_size - 4), 4, MP_LITTLE_ENDIAN);
+	*usize = load_int((uint8_t *)(gzip + out_size - 4), 4, MP_LITTLE_ENDIAN);
 
 	/* Round up to the nearest 512 byte multiple  */
-	algorithm->length = usize + (0x200 - (usize % 0x200));
+	algorithm->length = *usize + (0x200 - (*usize % 0x200));
 
 	algorithm->bitstream = calloc(1, algorithm->length + offset);
 	if (!algorithm->bitstream) {
+		free(gzip);
 		fprintf(stderr, "Out of memory!\n");
 		return EXIT_FAILURE;
 	}
@@ -1750,6 +3423,7 @@ int get_algorithm(device_t *device, const char *algo_path, uint8_t icsp,
 	int inf_init_err = inflateInit2(&stream, MAX_WBITS + 16);
 	int inf_err = inflate(&stream, Z_FINISH);
 	int inf_end_err = inflateEnd(&stream);
+	free(gzip);
 	if (inf_init_err != Z_OK ||
 	    (inf_err != Z_OK && inf_err != Z_STREAM_END) ||
 	    inf_end_err != Z_OK) {
@@ -1760,24 +3434,90 @@ int get_algorithm(device_t *device, const char *algo_path, uint8_t icsp,
 	}
 
 	/* Check if gzip inflate was ok */
-	if (stream.total_out != usize) {
+	if (stream.total_out != *usize) {
 		free(algorithm->bitstream);
 		return EXIT_FAILURE;
 	}
 
-	/* Check for algorithm integrity */
-	uint32_t file_crc =
-		load_int(algorithm->bitstream + offset + ALGO_CRC_OFFSET, 4,
-			 MP_LITTLE_ENDIAN);
-	uint32_t data_crc =
-		crc_32(algorithm->bitstream + offset + ALGO_DATA_OFFSET,
-		       usize - ALGO_DATA_OFFSET, 0xFFFFFFFF);
+	return EXIT_SUCCESS;
+}
+
+/* Return an algorithm_t structure */
+int get_algorithm(device_t *device, const char *algo_path, uint8_t icsp,
+		  uint8_t vopt, size_t offset)
+{
+	algorithm_t *algorithm = &device->algorithm;
+	uint8_t algo_number = (uint8_t)(device->variant >> 8);
+	uint8_t error = 0;
+	const char *entry;
+
+	/* Check if the arguments are in valid range */
+	if (device->protocol_id != IC2_ALG_NONE) {
+		int isProtocolValid = device->protocol_id > ALGO_COUNT;
+		entry = t56_algo_table[device->protocol_id - 1];
+		if (isProtocolValid || (entry == NULL))
+			error = 1;
+	} else {
+		if (algo_number > UTIL_COUNT)
+			error = 1;
+	}
+
+	if (error) {
+		fprintf(stderr, "Invalid algorithm number found.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* If not a logic chip grab the prefix name using the protocol_id-1 */
+	if (device->protocol_id != IC2_ALG_NONE) {
+
+		char algo_str[8];
+		snprintf(algo_str, sizeof(algo_str), "%02X", algo_number);
+		char *name = stpcpy(algorithm->name, entry);
+
+		switch (device->protocol_id) {
+		/* Choose icsp algorithm for Atmel ATmega, ATtiny and AT90 */
+		case IC2_ALG_ATMGA:
+				strcat(name, icsp ? "11S" : algo_str);
+			break;
+
+		/* Choose ICSP option for AT89C*/
+		case IC2_ALG_AT89C:
+			strcat(name, icsp ? "2S" : algo_str);
+			break;
+
+		/* Choose 1.8V/3.3V for EMMC */
+		case IC2_ALG_EMMC:
+				strcat(name, V_1V8 ? "_18" : "_33");
+			break;
+
+			/* Default case. Handle reversed package devices */
+		default:
+			strcat(name, algo_str);
+			if (device->flags.reversed_package)
+				strcat(algorithm->name, "R");
+		}
+		/* For Logic chips/utils copy only the algorithm name */
+	} else {
+		strncpy(algorithm->name, t56_util_table[algo_number], NAME_LEN);
+	}
 
-	if (file_crc != data_crc) {
+	const char *algo_name = algorithm->name;
+	uint32_t usize;
+	struct stat st;
+	int cached = !stat_database(ALGO_NAME, algo_path, &st) &&
+		     !load_algo_cache(algorithm, algo_path, offset, &st, &usize);
+	if (!cached &&
+	    decode_algorithm(algorithm, algo_path, offset, &usize))
+		return EXIT_FAILURE;
+
+	/* Check for algorithm integrity */
+	if (!cached && check_algorithm(algorithm, offset, usize)) {
 		fprintf(stderr, "Corrupted %s algorithm. Bad CRC.\n",
 			algo_name);
 		free(algorithm->bitstream);
 		return EXIT_FAILURE;
 	}
+	if (!cached)
+		save_algo_cache(algorithm, algo_path, offset, &st, usize);
 	return EXIT_SUCCESS;
 }
@@ -97,6 +97,10 @@
 #define UTIL_ALG_VGA800x600		0x0F
 #define UTIL_ALG_VGA_HDMI		0x10
 
+/* Decoded algorithm header */
+#define ALGO_CRC_OFFSET			0x04
+#define ALGO_DATA_OFFSET		0x08
+
 typedef struct fuse {
 	uint16_t mask;
 	uint16_t def;
@@ -147,10 +151,42 @@ typedef struct db_data {
 	uint32_t pin_count;
 	uint32_t index;
 	uint32_t *count;
+
+	/* list_devices() filters */
+	uint8_t prefix;			/* Match device_name as a name prefix */
+	uint32_t filter_pins;		/* Pin count, 0 for any */
+	uint32_t filter_protocol;	/* Protocol ID, 0 for any */
+	uint8_t quiet;			/* Only count, print no names */
+	uint32_t *records;		/* Chip ID matches, entries not names */
 } db_data_t;
 
+/* Batched database queries, see query_database() */
+#define DB_QUERY_DEVICE		0x00	/* Device by name */
+#define DB_QUERY_CHIP_ID	0x01	/* First device name from a chip ID */
+#define DB_QUERY_PROFILE	0x02	/* Fuse configuration by name */
+#define DB_QUERY_MAP		0x03	/* Pin map by index */
+
+typedef struct db_query {
+	uint8_t type;
+	uint8_t with_map;	/* DB_QUERY_DEVICE: also load its pin map */
+	uint8_t with_vectors;	/* DB_QUERY_DEVICE: decode the logic vectors */
+	const char *name;	/* Device or configuration name */
+	uint32_t chip_id;	/* DB_QUERY_CHIP_ID */
+	uint32_t protocol;	/* DB_QUERY_CHIP_ID */
+	uint32_t pin_count;	/* DB_QUERY_CHIP_ID, 0 for any package */
+	uint32_t index;		/* DB_QUERY_MAP */
+
+	/* Results, NULL if not found */
+	device_t *device;
+	char *chip_name;
+	void *config;
+	pin_map_t *map;
+} db_query_t;
+
+int query_database(db_data_t *, db_query_t *, size_t);
 pin_map_t *get_pin_map(db_data_t *);
 int get_algorithm(device_t *, const char *, uint8_t, uint8_t, size_t);
+int get_cache_file(const char *, char *, size_t);
 int print_chip_count(db_data_t *);
 int list_devices(db_data_t *);
 device_t *get_device_by_name(db_data_t *);
@@ -0,0 +1,36 @@
+/*
+ * hexenc.h - Hex digit encoding of the Intel hex and S-Record writers.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+
+#ifndef HEXENC_H_
+#define HEXENC_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Two hex digits for every byte value */
+extern const char hexenc_table[512];
+
+/* Append the two hex digits of 'byte' and add it to the checksum */
+static inline char *put_byte(char *out, uint8_t byte, uint8_t *checksum)
+{
+	*checksum += byte;
+	memcpy(out, &hexenc_table[byte * 2], 2);
+	return out + 2;
+}
+
+#endif
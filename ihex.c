@@ -20,10 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "hexenc.h"
 #include "ihex.h"
 
 #define MIN_RECORD_SIZE 11
-#define ROW_SIZE	16
+#define MAX_LINE_SIZE	523
+#define ROW_SIZE	IHEX_ROW_SIZE
 
 typedef enum {
 	IHEX_DATA = 0,
@@ -75,7 +77,8 @@ static record_t parse_record(uint8_t *record)
 	}
 
 	/* Check for valid characters */
-	for (i = 1; record[i] != '\r' && record[i] != '\n'; i++) {
+	for (i = 1; record[i] && record[i] != '\r' && record[i] != '\n';
+	     i++) {
 		if (hex(record[i]) > 0x0F) {
 			rec.result = BAD_FORMAT;
 			return rec;
@@ -120,165 +123,287 @@ static record_t parse_record(uint8_t *record)
 }
 
 /* Write a record */
-static int write_record(FILE *file, record_t *record)
+void ihex_reader_init(ihex_reader_t *reader, uint8_t *data, size_t size)
 {
-	uint8_t checksum = record->count + (uint8_t)record->address +
-			   (uint8_t)(record->address >> 8) + record->type;
-	uint8_t *pData = record->data;
-	fprintf(file, ":%02X%04X%02X", record->count, record->address,
-		record->type);
-	while (record->count--) {
-		fprintf(file, "%02X", *pData);
-		checksum += *pData;
-		pData++;
-	}
-	checksum = ~checksum + 1;
-	fprintf(file, "%02X\r\n", checksum);
-	return EXIT_SUCCESS;
+	memset(reader, 0, sizeof(*reader));
+	reader->data = data;
+	reader->chip_size = size;
+	reader->log = stderr;
 }
 
-/* Read an Intel hex file */
-int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size)
+/* Parse one line of an Intel hex file, the line ends with a new line or
+ * NUL character. Returns NOT_IHEX if the first record isn't valid.
+ */
+int ihex_read_line(ihex_reader_t *reader, const uint8_t *line)
 {
-	uint32_t line = 0, uba = 0;
 	record_t rec;
-	uint8_t eof = 0;
+	uint32_t uba = reader->uba;
 
-	size_t chip_size = *size;
-	while (buffer) {
-		/* Skip empty lines */
-		line++;
-		if (*buffer == '\r' || *buffer == '\n') {
-			buffer++;
-			continue;
-		}
+	reader->line++;
+	if (!reader->records) {
+		/* The first record must start the line */
+		if (!*line || *line == '\r' || *line == '\n')
+			return EXIT_SUCCESS;
+		if (*line != ':')
+			return NOT_IHEX;
+	} else {
+		/* Skip anything before the start code */
+		while (*line && *line != '\n' && *line != ':')
+			line++;
+		if (*line != ':')
+			return EXIT_SUCCESS;
+	}
 
-		rec = parse_record(buffer);
-		switch (rec.result) {
-		case BAD_FORMAT:
+	rec = parse_record((uint8_t *)line);
+	switch (rec.result) {
+	case BAD_FORMAT:
+		if (!reader->records)
 			return NOT_IHEX;
-		case BAD_RECORD:
-			fprintf(stderr, "Error on line %u: bad record type.\n",
-				line);
-			return EXIT_FAILURE;
-		case BAD_COUNT:
-			fprintf(stderr, "Error on line %u: bad count.\n", line);
-			return EXIT_FAILURE;
-		case BAD_CKECKSUM:
-			fprintf(stderr, "Error on line %u: bad checksum.\n",
-				line);
+		fprintf(reader->log, "Error on line %u: bad record.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_RECORD:
+		fprintf(reader->log, "Error on line %u: bad record type.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_COUNT:
+		fprintf(reader->log, "Error on line %u: bad count.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_CKECKSUM:
+		fprintf(reader->log, "Error on line %u: bad checksum.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	default:
+		break;
+	}
+
+	reader->records++;
+	if (rec.type != IHEX_EOF && reader->eof) {
+		fprintf(reader->log,
+			"Error on line %u: wrong record after end of file .\n",
+			reader->line);
+	}
+	switch (rec.type) {
+	case IHEX_DATA:
+		/* Records beyond the chip size are ignored */
+		if (reader->chip_size >= uba + rec.address + rec.count)
+			/* copy record data */
+			memcpy(&(reader->data[uba + rec.address]), rec.data,
+			       rec.count);
+		break;
+	case IHEX_EOF:
+		if (reader->eof) {
+			fprintf(reader->log,
+				"Error on line %u: wrong end of file record.\n",
+				reader->line);
 			return EXIT_FAILURE;
-		default:
-			if (rec.type != IHEX_EOF && eof) {
-				fprintf(stderr,
-					"Error on line %u: wrong record after end of file .\n",
-					line);
-			}
-			switch (rec.type) {
-			case IHEX_DATA:
-				/* If file data size is bigger than chip size
-				 * update the new size */
-				if (chip_size >= uba + rec.address + rec.count)
-					/* copy record data */
-					memcpy(&(data[uba + rec.address]),
-					       rec.data, rec.count);
-				/* else
-				 * *size = (uba + rec.address + rec.count);
-				 */
-				break;
-			case IHEX_EOF:
-				if (eof) {
-					fprintf(stderr,
-						"Error on line %u: wrong end of file record.\n",
-						line);
-					return EXIT_FAILURE;
-				}
-				eof = 1;
-				break;
-				/* Calculate the upper block address from a segment address */
-			case IHEX_ESA:
-				uba = ((rec.data[0] << 12) |
-				       (rec.data[1] << 4));
-				break;
-				/* Calculate the upper block address from an extended linear address */
-			case IHEX_ELA:
-				uba = ((rec.data[0] << 24) | rec.data[1] << 16);
-				break;
-				/* Load a segmented address */
-			case IHEX_SSA:
-				uba = ((rec.data[0] << 12) |
-				       (rec.data[1] << 4)) +
-				      ((rec.data[2] << 8) | rec.data[3]);
-				break;
-				/* Load a linear address */
-			case IHEX_SLA:
-				uba = ((rec.data[0] << 24) |
-				       (rec.data[1] << 16) |
-				       (rec.data[2] << 8) | rec.data[3]);
-				break;
-			default:
-				fprintf(stderr,
-					"Error on line %u: unknown record type.\n",
-					line);
-				return EXIT_FAILURE;
-			}
 		}
-		buffer = (uint8_t *)strchr((char *)++buffer, ':');
+		reader->eof = 1;
+		break;
+		/* Calculate the upper block address from a segment address */
+	case IHEX_ESA:
+		uba = ((rec.data[0] << 12) | (rec.data[1] << 4));
+		break;
+		/* Calculate the upper block address from an extended linear address */
+	case IHEX_ELA:
+		uba = ((rec.data[0] << 24) | rec.data[1] << 16);
+		break;
+		/* Load a segmented address */
+	case IHEX_SSA:
+		uba = ((rec.data[0] << 12) | (rec.data[1] << 4)) +
+		      ((rec.data[2] << 8) | rec.data[3]);
+		break;
+		/* Load a linear address */
+	case IHEX_SLA:
+		uba = ((rec.data[0] << 24) | (rec.data[1] << 16) |
+		       (rec.data[2] << 8) | rec.data[3]);
+		break;
+	default:
+		fprintf(reader->log,
+			"Error on line %u: unknown record type.\n",
+			reader->line);
+		return EXIT_FAILURE;
 	}
-	if (!eof) {
-		fprintf(stderr, "Error: no end of file record found.\n");
+	reader->uba = uba;
+	return EXIT_SUCCESS;
+}
+
+/* Check the end of the file */
+int ihex_reader_end(ihex_reader_t *reader)
+{
+	if (!reader->records)
+		return NOT_IHEX;
+	if (!reader->eof) {
+		fprintf(reader->log, "Error: no end of file record found.\n");
 		return EXIT_FAILURE;
 	}
 	return INTEL_HEX_FORMAT;
 }
 
-/* Write an Intel hex file */
-int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
-		   int write_eof)
+/* Read an Intel hex file from a NUL terminated buffer */
+int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size)
 {
-	record_t rec;
-	uint16_t uba = 0;
-	size_t len;
+	ihex_reader_t reader;
+	ihex_reader_init(&reader, data, *size);
+	while (buffer && *buffer) {
+		int ret = ihex_read_line(&reader, buffer);
+		if (ret)
+			return ret;
+		buffer = (uint8_t *)strchr((char *)buffer, '\n');
+		if (buffer)
+			buffer++;
+	}
+	return ihex_reader_end(&reader);
+}
+
+static void flush_output(ihex_writer_t *writer)
+{
+	if (writer->out_len &&
+	    fwrite(writer->out, 1, writer->out_len, writer->file) !=
+		    writer->out_len)
+		writer->error = 1;
+	writer->out_len = 0;
+}
+
+/* Encode a record into the output buffer */
+static void write_record(ihex_writer_t *writer, record_t *record)
+{
+	if (writer->out_len + MAX_LINE_SIZE > IHEX_OUT_SIZE)
+		flush_output(writer);
+
+	char *out = writer->out + writer->out_len;
+	uint8_t checksum = 0;
+	size_t i;
+	*out++ = ':';
+	out = put_byte(out, record->count, &checksum);
+	out = put_byte(out, record->address >> 8, &checksum);
+	out = put_byte(out, (uint8_t)record->address, &checksum);
+	out = put_byte(out, record->type, &checksum);
+	for (i = 0; i < record->count; i++)
+		out = put_byte(out, record->data[i], &checksum);
+	out = put_byte(out, ~checksum + 1, &checksum);
+	*out++ = '\r';
+	*out++ = '\n';
+	writer->out_len = out - writer->out;
+}
+
+/* Start an Intel hex file of 'size' bytes. With 'blank' set to a byte value
+ * rows holding only that value are left out, -1 writes every row.
+ */
+void ihex_writer_init(ihex_writer_t *writer, FILE *file, uint16_t address,
+		      size_t size, int blank)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->file = file;
+	writer->address = address;
+	writer->blank = blank;
 
 	/* if size > 64K insert an extended linear address record */
-	memset(rec.data, 0x00, sizeof(rec.data));
 	if (size > 65536) {
+		record_t rec;
+		memset(rec.data, 0x00, sizeof(rec.data));
+		rec.type = IHEX_ELA;
+		rec.count = 0x02;
+		rec.address = 0x00;
+		write_record(writer, &rec);
+	}
+}
+
+/* Check if the row buffer only holds the skipped blank value */
+static int row_is_blank(ihex_writer_t *writer)
+{
+	size_t i;
+	if (writer->blank < 0)
+		return 0;
+	for (i = 0; i < writer->len; i++)
+		if (writer->row[i] != writer->blank)
+			return 0;
+	return 1;
+}
+
+/* Write one data record from the row buffer */
+static void write_row(ihex_writer_t *writer)
+{
+	record_t rec;
+
+	/* Insert an extended linear address record when the upper address
+	 * changes, either by crossing 64K or by skipping blank rows.
+	 */
+	uint16_t uba = writer->address >> 16;
+	if (uba != writer->uba) {
 		rec.type = IHEX_ELA;
 		rec.count = 0x02;
 		rec.address = 0x00;
-		write_record(file, &rec);
+		rec.data[0] = uba >> 8;
+		rec.data[1] = (uint8_t)uba;
+		write_record(writer, &rec);
+		writer->uba = uba;
 	}
 
+	rec.type = IHEX_DATA;
+	rec.count = writer->len;
+	rec.address = (uint16_t)writer->address;
+	memcpy(rec.data, writer->row, writer->len);
+	write_record(writer, &rec);
+}
+
+/* Append 'size' bytes, full rows are written as soon as they are complete */
+int ihex_write_data(ihex_writer_t *writer, const uint8_t *data, size_t size)
+{
 	while (size) {
-		/* Write data */
-		len = (size > ROW_SIZE ? ROW_SIZE : size);
-		rec.type = IHEX_DATA;
-		rec.count = len;
-		rec.address = address;
-		memcpy(rec.data, data, len);
-		write_record(file, &rec);
-		data += ROW_SIZE;
+		size_t len = ROW_SIZE - writer->len;
+		if (len > size)
+			len = size;
+		memcpy(writer->row + writer->len, data, len);
+		writer->len += len;
+		data += len;
 		size -= len;
-		address += ROW_SIZE;
-
-		/* Insert an extended linear address record */
-		if (!address && size) {
-			uba++;
-			rec.type = IHEX_ELA;
-			rec.count = 0x02;
-			rec.address = 0x00;
-			rec.data[0] = (uint8_t)uba << 8;
-			rec.data[1] = (uint8_t)uba;
-			write_record(file, &rec);
-		}
+		if (writer->len < ROW_SIZE)
+			continue;
+		writer->skipped = row_is_blank(writer);
+		if (!writer->skipped)
+			write_row(writer);
+		writer->address += ROW_SIZE;
+		writer->len = 0;
 	}
+	return writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-	/* Insert EOF record if requested */
+/* Flush the last row and insert the EOF record if requested. The last row
+ * is always written, even if blank, so the file keeps the image size.
+ */
+int ihex_writer_end(ihex_writer_t *writer, int write_eof)
+{
+	if (!writer->len && writer->skipped) {
+		writer->address -= ROW_SIZE;
+		writer->len = ROW_SIZE;
+		memset(writer->row, writer->blank, ROW_SIZE);
+	}
+	if (writer->len)
+		write_row(writer);
 	if (write_eof) {
+		record_t rec;
 		rec.type = IHEX_EOF;
 		rec.count = 0x00;
 		rec.address = 0x00;
-		write_record(file, &rec);
+		write_record(writer, &rec);
 	}
-	return EXIT_SUCCESS;
+	flush_output(writer);
+	return writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Write an Intel hex file */
+int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
+		   int write_eof)
+{
+	ihex_writer_t *writer = malloc(sizeof(*writer));
+	if (!writer)
+		return EXIT_FAILURE;
+	ihex_writer_init(writer, file, address, size, -1);
+	int ret = ihex_write_data(writer, data, size);
+	if (ihex_writer_end(writer, write_eof))
+		ret = EXIT_FAILURE;
+	free(writer);
+	return ret;
 }
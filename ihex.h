@@ -20,11 +20,46 @@
 #define IHEX_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define INTEL_HEX_FORMAT 0
 #define NOT_IHEX	 -1
+#define IHEX_ROW_SIZE	 16
+#define IHEX_OUT_SIZE	 16384
 
+/* Line by line Intel hex reader */
+typedef struct ihex_reader {
+	uint8_t *data;
+	size_t chip_size;
+	FILE *log; /* Errors and notes, stderr by default */
+	uint32_t line;
+	uint32_t records;
+	uint32_t uba;
+	uint8_t eof;
+} ihex_reader_t;
+
+/* Intel hex writer fed with consecutive blocks of data */
+typedef struct ihex_writer {
+	FILE *file;
+	uint32_t address;
+	uint16_t uba;
+	int blank;
+	uint8_t skipped;
+	uint8_t error;
+	uint8_t row[IHEX_ROW_SIZE];
+	size_t len;
+	size_t out_len;
+	char out[IHEX_OUT_SIZE];
+} ihex_writer_t;
+
+void ihex_reader_init(ihex_reader_t *reader, uint8_t *data, size_t size);
+int ihex_read_line(ihex_reader_t *reader, const uint8_t *line);
+int ihex_reader_end(ihex_reader_t *reader);
 int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size);
+void ihex_writer_init(ihex_writer_t *writer, FILE *file, uint16_t address,
+		      size_t size, int blank);
+int ihex_write_data(ihex_writer_t *writer, const uint8_t *data, size_t size);
+int ihex_writer_end(ihex_writer_t *writer, int write_eof);
 int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
 		   int write_eof);
 
@@ -52,6 +52,66 @@ static int parse_uint32(const char *buffer, uint32_t *value, char **pEnd,
 		return BAD_FORMAT;
 	return errno;
 }
+/* Load 'count' (1-8) fuses starting at 'fuse' as the low bits of a byte */
+static uint8_t load_fuses(const uint8_t *fuses, size_t fuse, size_t count)
+{
+	size_t i = fuse / 8, shift = fuse & 0x07;
+	unsigned int bits = fuses[i] >> shift;
+	if (shift + count > 8)
+		bits |= fuses[i + 1] << (8 - shift);
+	return bits & ((1U << count) - 1);
+}
+
+/* Store the low 'count' (1-8) bits of 'bits' starting at fuse 'fuse' */
+static void store_fuses(uint8_t *fuses, size_t fuse, uint8_t bits,
+			size_t count)
+{
+	size_t i = fuse / 8, shift = fuse & 0x07;
+	unsigned int mask = ((1U << count) - 1) << shift;
+	unsigned int value = ((unsigned int)bits << shift) & mask;
+	fuses[i] = (fuses[i] & ~mask) | value;
+	if (shift + count > 8)
+		fuses[i + 1] = (fuses[i + 1] & ~(mask >> 8)) | (value >> 8);
+}
+
+/* Device rows are MSB first, the fuse map is LSB first */
+static uint8_t reverse_bits(uint8_t bits)
+{
+	bits = (bits & 0xF0) >> 4 | (bits & 0x0F) << 4;
+	bits = (bits & 0xCC) >> 2 | (bits & 0x33) << 2;
+	bits = (bits & 0xAA) >> 1 | (bits & 0x55) << 1;
+	return bits;
+}
+
+/* Transpose an 8x8 bit matrix, bit 'b' of byte 'a' becomes bit 'a' of
+ * byte 'b'. From Hacker's Delight, section 7-3.
+ */
+static uint64_t transpose8(uint64_t x)
+{
+	uint64_t t;
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+	return x;
+}
+
+/* Parse eight '0'/'1' characters at once */
+static int parse_fuse_octet(const char *p, uint8_t *bits)
+{
+	uint8_t value = 0;
+	int i;
+	for (i = 0; i < 8; i++) {
+		if ((p[i] & ~0x01) != '0')
+			return 0;
+		value |= (p[i] & 0x01) << i;
+	}
+	*bits = value;
+	return 1;
+}
+
 /*
  This function will parse the numeric value of the given command.
  If found, will return the parsed value and a pointer after the last character
@@ -76,8 +136,7 @@ static int parse_token(const char *buffer, const char *token_name,
  Supported commands: QP, QF, F, G, L, C
  It was adapted for most horrible formated jedec files i have found.
  */
-static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
-			uint16_t *checksum)
+static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec)
 {
 	/* some state machine helpers */
 	uint8_t is_QP_set = 0;
@@ -251,17 +310,10 @@ static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
 				 * If no 'F' default fuse value
 			         * is set then the default will be 0.
 				 */
-				jedec->fuses = malloc(jedec->QF);
-				if (!jedec->fuses) {
+				if (jedec_alloc_fuses(jedec,
+						      is_F_set ? jedec->F : 0))
 					return MEMORY_ERROR;
-				}
-				memset(jedec->fuses,
-				       is_F_set ?
-					       (jedec->F == 0 ? 0x00 : 0x01) :
-					       0,
-				       (jedec->QF));
 				is_initialized = 1;
-				*checksum = 0;
 			}
 
 			/* Some jed files have fuses divided on several lines.
@@ -274,18 +326,27 @@ static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
 			 * 120 bits row.
 			 */
 			while (*p_next != DELIMITER) {
-				if (!iscntrl((int)*p_next) && *p_next != ' ' &&
-				    *p_next != '0' && *p_next != '1')
+				uint8_t bits;
+				if (parsed_value + 8 <= jedec->QF &&
+				    parse_fuse_octet(p_next, &bits)) {
+					store_fuses(jedec->fuses, parsed_value,
+						    bits, 8);
+					parsed_value += 8;
+					p_next += 8;
+					continue;
+				}
+
+				if (!*p_next || *p_next == ETX ||
+				    (!iscntrl((int)*p_next) && *p_next != ' ' &&
+				     *p_next != '0' && *p_next != '1'))
 					return BAD_FORMAT;
 
 				if (*p_next == '0' || *p_next == '1') {
-					jedec->fuses[parsed_value] = 0;
-					if (*p_next == '1') {
-						jedec->fuses[parsed_value] = 1;
-						(*checksum) +=
-							(0x01 << (parsed_value &
-								  0x07));
-					}
+					/* Fuses beyond QF */
+					if (parsed_value >= jedec->QF)
+						return BAD_FORMAT;
+					jedec_set_fuse(jedec, parsed_value,
+						       *p_next == '1');
 					parsed_value++;
 				}
 				p_next++;
@@ -304,7 +365,7 @@ static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
 /* JEDEC file parser */
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 {
-	uint16_t checksum = 0;
+	jedec->fuses = NULL;
 
 	/* Check for size limits */
 	if (size < JED_MIN_SIZE) {
@@ -313,7 +374,7 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 		return EXIT_FAILURE;
 	}
 
-	switch (parse_tokens(buffer, size, jedec, &checksum)) {
+	switch (parse_tokens(buffer, size, jedec)) {
 	case BAD_FORMAT:
 		fprintf(stderr, "JED file format error!\n");
 		free(buffer);
@@ -326,7 +387,8 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 		break;
 	}
 
-	jedec->fuse_checksum = checksum;
+	if (jedec->fuses)
+		jedec->fuse_checksum = jedec_fuse_checksum(jedec);
 	return EXIT_SUCCESS;
 }
 
@@ -355,16 +417,18 @@ int write_jedec_file(FILE *file, jedec_t *jedec)
 		jedec->F, jedec->G);
 
 	/* Print fuses */
-	for (i = 0; i < jedec->QF; i++) {
-		if ((i % ROW_SIZE) == 0)
-			p_buff += sprintf(p_buff, "%s*L%05u ",
-					  i ? (i % ROW_SIZE ? "" : "\r\n") : "",
-					  (uint32_t)i);
-		p_buff +=
-			sprintf(p_buff, "%c", jedec->fuses[i] == 1 ? '1' : '0');
-		fuse_checksum += jedec->fuses[i] == 1 ? (0x01 << (i & 0x07)) :
-							0;
+	for (i = 0; i < jedec->QF; i += ROW_SIZE) {
+		p_buff += sprintf(p_buff, "%s*L%05u ", i ? "\r\n" : "",
+				  (uint32_t)i);
+		size_t j, k, count;
+		for (j = i; j < jedec->QF && j < i + ROW_SIZE; j += 8) {
+			count = jedec->QF - j < 8 ? jedec->QF - j : 8;
+			uint8_t bits = load_fuses(jedec->fuses, j, count);
+			for (k = 0; k < count; k++)
+				*p_buff++ = '0' + ((bits >> k) & 0x01);
+		}
 	}
+	fuse_checksum = jedec_fuse_checksum(jedec);
 
 	/* Print fuses checksum and ETX character */
 	p_buff += sprintf(p_buff, "\r\n*C%04X\r\n%c", fuse_checksum, ETX);
@@ -379,3 +443,122 @@ int write_jedec_file(FILE *file, jedec_t *jedec)
 	free(buffer);
 	return EXIT_SUCCESS;
 }
+
+/* Allocate the fuse map of QF fuses, all set to 'value' (0-1) */
+int jedec_alloc_fuses(jedec_t *jedec, uint8_t value)
+{
+	size_t size = JEDEC_FUSE_BYTES(jedec->QF);
+	jedec->fuses = malloc(size ? size : 1);
+	if (!jedec->fuses)
+		return EXIT_FAILURE;
+	memset(jedec->fuses, value ? 0xff : 0x00, size);
+	/* Keep the bits past the last fuse clear */
+	if (jedec->QF & 0x07)
+		jedec->fuses[size - 1] &= (1U << (jedec->QF & 0x07)) - 1;
+	return EXIT_SUCCESS;
+}
+
+/* The fuse checksum is the 16-bit sum of the fuses packed LSB first in bytes */
+uint16_t jedec_fuse_checksum(const jedec_t *jedec)
+{
+	uint16_t checksum = 0;
+	size_t i, size = jedec->QF / 8;
+	for (i = 0; i < size; i++)
+		checksum += jedec->fuses[i];
+	if (jedec->QF & 0x07)
+		checksum += load_fuses(jedec->fuses, size * 8, jedec->QF & 0x07);
+	return checksum;
+}
+
+/* Compare two fuse maps, returns EXIT_FAILURE and the first mismatching
+ * fuse with both values on mismatch.
+ */
+int jedec_compare_fuses(const jedec_t *jedec1, const jedec_t *jedec2,
+			uint32_t *address, uint8_t *c1, uint8_t *c2)
+{
+	size_t size = jedec1->QF < jedec2->QF ? jedec1->QF : jedec2->QF;
+	size_t i = 0;
+
+	/* Whole bytes first, then the exact fuse */
+	if (!memcmp(jedec1->fuses, jedec2->fuses, size / 8))
+		i = size / 8 * 8;
+	else
+		while (jedec1->fuses[i / 8] == jedec2->fuses[i / 8])
+			i += 8;
+	for (; i < size; i++) {
+		if (jedec_get_fuse(jedec1, i) != jedec_get_fuse(jedec2, i)) {
+			if (address)
+				*address = i;
+			if (c1)
+				*c1 = jedec_get_fuse(jedec1, i);
+			if (c2)
+				*c2 = jedec_get_fuse(jedec2, i);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Copy 'count' consecutive fuses to an MSB first device buffer */
+void jedec_get_bits(const jedec_t *jedec, size_t fuse, uint8_t *buffer,
+		    size_t count)
+{
+	size_t i;
+	for (i = 0; i < count; i += 8)
+		buffer[i / 8] = reverse_bits(load_fuses(
+			jedec->fuses, fuse + i, count - i < 8 ? count - i : 8));
+}
+
+/* Copy 'count' bits of an MSB first device buffer to consecutive fuses */
+void jedec_put_bits(jedec_t *jedec, size_t fuse, const uint8_t *buffer,
+		    size_t count)
+{
+	size_t i;
+	for (i = 0; i < count; i += 8)
+		store_fuses(jedec->fuses, fuse + i, reverse_bits(buffer[i / 8]),
+			    count - i < 8 ? count - i : 8);
+}
+
+/*
+ * GAL/ATF devices are programmed by rows while the fuse map is ordered by
+ * columns: bit 'col' of device row 'row' is fuse col * fuses_size + row.
+ * 'count' (1-8) rows starting at 'first_row' are converted at once, eight
+ * columns at a time through an 8x8 bit transpose.
+ */
+void jedec_rows_to_fuses(jedec_t *jedec,
+			 uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES],
+			 size_t first_row, size_t count, size_t fuses_size,
+			 size_t row_width)
+{
+	size_t i, j, col;
+	for (i = 0; i * 8 < row_width; i++) {
+		uint64_t x = 0;
+		for (j = 0; j < count; j++)
+			x |= (uint64_t)rows[j][i] << (8 * j);
+		/* Byte 7 - j now holds column i * 8 + j, row 0 in bit 0 */
+		x = transpose8(x);
+		for (j = 0; j < 8 && (col = i * 8 + j) < row_width; j++)
+			store_fuses(jedec->fuses, col * fuses_size + first_row,
+				    x >> (8 * (7 - j)), count);
+	}
+}
+
+void jedec_fuses_to_rows(const jedec_t *jedec,
+			 uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES],
+			 size_t first_row, size_t count, size_t fuses_size,
+			 size_t row_width)
+{
+	size_t i, j, col;
+	memset(rows, 0, JEDEC_ROW_GROUP * JEDEC_ROW_BYTES);
+	for (i = 0; i * 8 < row_width; i++) {
+		uint64_t x = 0;
+		for (j = 0; j < 8 && (col = i * 8 + j) < row_width; j++)
+			x |= (uint64_t)load_fuses(jedec->fuses,
+						  col * fuses_size + first_row,
+						  count)
+			     << (8 * (7 - j));
+		x = transpose8(x);
+		for (j = 0; j < count; j++)
+			rows[j][i] = x >> (8 * j);
+	}
+}
@@ -20,6 +20,7 @@
 #define JEDEC_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct jedec_s {
 	const char *device_name;     /* Device name */
@@ -31,10 +32,45 @@ typedef struct jedec_s {
 	uint16_t fuse_checksum;	     /* calculated fuses checksum */
 	uint16_t calc_file_checksum; /* calculated file checksum */
 	uint16_t decl_file_checksum; /* declared file checksum */
-	uint8_t *fuses;		     /* Fuses array */
+	uint8_t *fuses;		     /* Bit-packed fuses, LSB first */
 } jedec_t;
 
+/* Device rows passed to the row transpose routines */
+#define JEDEC_ROW_BYTES	  32
+#define JEDEC_ROW_GROUP	  8
+#define JEDEC_FUSE_BYTES(n) (((size_t)(n) + 7) / 8)
+
+/* Fuse n is bit (n & 7) of fuses[n / 8] */
+static inline int jedec_get_fuse(const jedec_t *jedec, size_t fuse)
+{
+	return (jedec->fuses[fuse / 8] >> (fuse & 0x07)) & 0x01;
+}
+
+static inline void jedec_set_fuse(jedec_t *jedec, size_t fuse, int value)
+{
+	if (value)
+		jedec->fuses[fuse / 8] |= 0x01 << (fuse & 0x07);
+	else
+		jedec->fuses[fuse / 8] &= ~(0x01 << (fuse & 0x07));
+}
+
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec);
 int write_jedec_file(FILE *file, jedec_t *jedec);
+int jedec_alloc_fuses(jedec_t *jedec, uint8_t value);
+uint16_t jedec_fuse_checksum(const jedec_t *jedec);
+int jedec_compare_fuses(const jedec_t *jedec1, const jedec_t *jedec2,
+			uint32_t *address, uint8_t *c1, uint8_t *c2);
+void jedec_get_bits(const jedec_t *jedec, size_t fuse, uint8_t *buffer,
+		    size_t count);
+void jedec_put_bits(jedec_t *jedec, size_t fuse, const uint8_t *buffer,
+		    size_t count);
+void jedec_rows_to_fuses(jedec_t *jedec,
+			 uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES],
+			 size_t first_row, size_t count, size_t fuses_size,
+			 size_t row_width);
+void jedec_fuses_to_rows(const jedec_t *jedec,
+			 uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES],
+			 size_t first_row, size_t count, size_t fuses_size,
+			 size_t row_width);
 
 #endif /* JEDEC_H_ */
@@ -20,6 +20,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <libgen.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -28,6 +29,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "database.h"
@@ -35,6 +37,8 @@
 #include "ihex.h"
 #include "srec.h"
 #include "minipro.h"
+#include "stats.h"
+#include "usb.h"
 #include "version.h"
 
 #ifdef _WIN32
@@ -42,14 +46,22 @@
 #include <fcntl.h>
 #define STRCASESTR StrStrIA
 #else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #define STRCASESTR strcasestr
 #endif
 
 #define VPP_VOLTAGE	 0
 #define VCC_VOLTAGE	 1
 
-#define READ_BUFFER_SIZE 65536
-#define MIN(a, b)	 (((a) < (b)) ? (a) : (b))
+#define READ_BUFFER_SIZE   65536
+#define MIN(a, b)	   (((a) < (b)) ? (a) : (b))
+#define VECTOR_QUEUE_MAX   16
+#define READ_RING_SLOTS	   4
+#define REPLAY_LATENCY_MAX 1000000 /* us */
 
 static const char *user_id[] = {
 	"user_id0", "user_id1", "user_id2", "user_id3",
@@ -108,6 +120,31 @@ static struct option long_options[] = {
 	{ "logicic", required_argument, NULL, 4 },
 	{ "logicic_out", required_argument, NULL, 5 },
 	{ "algorithms", required_argument, NULL, 6 },
+	{ "ovc_interval", required_argument, NULL, 7 },
+	{ "mismatch_report", no_argument, NULL, 8 },
+	{ "abort_on_mismatch", no_argument, NULL, 9 },
+	{ "incremental", no_argument, NULL, 10 },
+	{ "reuse_bitstream", no_argument, NULL, 11 },
+	{ "unit", required_argument, NULL, 12 },
+	{ "gang", required_argument, NULL, 13 },
+	{ "server", required_argument, NULL, 14 },
+	{ "connect", required_argument, NULL, 15 },
+	{ "vector_queue", required_argument, NULL, 16 },
+	{ "skip_blank", no_argument, NULL, 17 },
+	{ "row_queue", required_argument, NULL, 18 },
+	{ "verify_rows", no_argument, NULL, 19 },
+	{ "stats", required_argument, NULL, 20 },
+	{ "trace", required_argument, NULL, 21 },
+	{ "record", required_argument, NULL, 22 },
+	{ "replay", required_argument, NULL, 23 },
+	{ "replay_latency", required_argument, NULL, 24 },
+	{ "crc32", required_argument, NULL, 25 },
+	{ "batch_config", no_argument, NULL, 26 },
+	{ "prefix", required_argument, NULL, 27 },
+	{ "pins", required_argument, NULL, 28 },
+	{ "protocol", required_argument, NULL, 29 },
+	{ "async_load", no_argument, NULL, 30 },
+	{ "adaptive", no_argument, NULL, 31 },
 	{ "list", no_argument, NULL, 'l' },
 	{ "search", required_argument, NULL, 'L' },
 	{ "get_info", required_argument, NULL, 'd' },
@@ -171,7 +208,7 @@ void print_version_and_exit(cmdopts_t *cmdopts)
 }
 
 /* Add usage information to the manpage in man/minipro.1, not here. */
-void print_help_and_exit(char *progname)
+void print_help(char *progname)
 {
 	char *myname;
 	char usage[] =
@@ -180,6 +217,11 @@ void print_help_and_exit(char *progname)
 	myname = basename(progname);
 	fprintf(stderr, signon, VERSION);
 	fprintf(stderr, usage, myname, myname);
+}
+
+void print_help_and_exit(char *progname)
+{
+	print_help(progname);
 	exit(EXIT_FAILURE);
 }
 
@@ -266,6 +308,9 @@ void print_devices_and_exit(cmdopts_t *cmdopts)
 	db_data.logicic_path = cmdopts->logicic_path;
 	db_data.infoic_path = cmdopts->infoic_path;
 	db_data.version = cmdopts->version;
+	db_data.prefix = cmdopts->list_prefix;
+	db_data.filter_pins = cmdopts->list_pins;
+	db_data.filter_protocol = cmdopts->list_protocol;
 	if (get_programmer_version(&db_data.version))
 		exit(EXIT_FAILURE);
 
@@ -386,21 +431,103 @@ int set_voltage(minipro_handle_t *handle, char *value, uint8_t *target,
 	return EXIT_FAILURE;
 }
 
+/* Find the SPI 25xx device in the socket by its chip ID (-a with an
+ * action). The same ID is often shared by several entries (other
+ * voltages, OTP variants), so only a unique match is used, otherwise
+ * the candidates are listed. Returns the device name, to be freed, or
+ * NULL.
+ */
+static char *autodetect_device(minipro_handle_t *handle)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	uint32_t chip_id, records = 0;
+
+	if (handle->status == MP_STATUS_BOOTLOADER) {
+		fprintf(stderr, "in bootloader mode!\n");
+		return NULL;
+	}
+	handle->device = NULL;
+	if (minipro_spi_autodetect(handle, cmdopts->auto_detect >> 4,
+				   &chip_id))
+		return NULL;
+
+	db_data_t db_data;
+	memset(&db_data, 0, sizeof(db_data));
+	db_data.logicic_path = cmdopts->logicic_path;
+	db_data.infoic_path = cmdopts->infoic_path;
+	db_data.version = handle->version;
+
+	db_data_t list = db_data;
+	list.chip_id = chip_id;
+	list.pin_count = cmdopts->auto_detect;
+	list.records = &records;
+	list.quiet = 1;
+	if (list_devices(&list))
+		return NULL;
+	if (records > 1) {
+		fprintf(stderr, "Chip ID 0x%04X matches %u different devices:\n",
+			chip_id, records);
+		list = db_data;
+		list.chip_id = chip_id;
+		list.pin_count = cmdopts->auto_detect;
+		list_devices(&list);
+		fprintf(stderr, "Select one of them with -p.\n");
+		return NULL;
+	}
+
+	db_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_CHIP_ID;
+	query.chip_id = chip_id;
+	query.pin_count = cmdopts->auto_detect;
+	if (query_database(&db_data, &query, 1))
+		return NULL;
+	if (!query.chip_name) {
+		fprintf(stderr, "No device found (ID:0x%04X)\n", chip_id);
+		return NULL;
+	}
+	fprintf(stderr, "Autodetected %s (ID:0x%04X)\n", query.chip_name,
+		chip_id);
+	return query.chip_name;
+}
+
 int get_device(minipro_handle_t *handle)
 {
+	char *detected = NULL;
+	if (!handle->cmdopts->device_name && handle->cmdopts->auto_detect) {
+		detected = autodetect_device(handle);
+		if (!detected)
+			return EXIT_FAILURE;
+	}
+
 	db_data_t db_data;
 	memset(&db_data, 0, sizeof(db_data));
-	db_data.device_name = handle->cmdopts->device_name;
+	db_data.device_name = detected ? detected :
+					 handle->cmdopts->device_name;
 	db_data.logicic_path = handle->cmdopts->logicic_path;
 	db_data.infoic_path = handle->cmdopts->infoic_path;
 	db_data.version = handle->version;
-	handle->device = get_device_by_name(&db_data);
-	if (!handle->device) {
-		fprintf(stderr, "Device %s not found!\n",
-			handle->cmdopts->device_name);
-		return EXIT_FAILURE;
-	}
-	return EXIT_SUCCESS;
+
+	/* Load the pin map needed by the pin test in the same search */
+	db_query_t query;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_DEVICE;
+	query.name = db_data.device_name;
+	query.with_map = handle->cmdopts->pincheck &&
+			 !handle->cmdopts->icsp &&
+			 handle->version == MP_TL866IIPLUS;
+	/* Only the logic test needs the vectors, the rest just counts them */
+	query.with_vectors = handle->cmdopts->action == LOGIC_IC_TEST;
+	uint64_t start = stats_start();
+	if (query_database(&db_data, &query, 1))
+		query.device = NULL;
+	stats_record(STATS_PHASE, "database", 0, start);
+	handle->device = query.device;
+	handle->pin_map = query.map;
+	if (!handle->device)
+		fprintf(stderr, "Device %s not found!\n", db_data.device_name);
+	free(detected);
+	return handle->device ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 void print_device_info_and_exit(cmdopts_t *cmdopts)
@@ -480,6 +607,17 @@ void print_device_info_and_exit(cmdopts_t *cmdopts)
 		}
 		fprintf(stderr, "\n");
 
+		/* NAND geometry */
+		if (device->chip_type == MP_NAND && device->page_size &&
+		    device->pages_per_block) {
+			fprintf(stderr,
+				"NAND geometry: %u Bytes page, %u pages per block, %u blocks\n",
+				device->page_size, device->pages_per_block,
+				device->code_memory_size /
+					(device->page_size *
+					 device->pages_per_block));
+		}
+
 		/* Package info */
 		fprintf(stderr, "Package: ");
 		if (device->package_details.adapter) {
@@ -755,10 +893,14 @@ void spi_autodetect_and_exit(uint8_t package_type, cmdopts_t *cmdopts)
 void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 {
 	int8_t c;
+	char *endptr;
+	unsigned long v;
 	uint8_t package_type = 0;
 	void (*p_func)(cmdopts_t *) = NULL;
 
 	memset(cmdopts, 0, sizeof(cmdopts_t));
+	optind = 1;
+	opterr = 1;
 	long_options[4].flag = &cmdopts->filter_fuses;
 	long_options[5].flag = &cmdopts->filter_uid;
 	long_options[6].flag = &cmdopts->filter_locks;
@@ -781,6 +923,136 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 		case 6:
 			cmdopts->algo_path = optarg; /* Custom algorithm.xml */
 			break;
+		case 7:
+			errno = 0;
+			cmdopts->ovc_interval = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr || errno ||
+			    !cmdopts->ovc_interval) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
+		case 8:
+			cmdopts->mismatch_report = 1;
+			break;
+		case 9:
+			cmdopts->abort_on_mismatch = 1;
+			break;
+		case 10:
+			cmdopts->incremental = 1;
+			break;
+		case 11:
+			cmdopts->reuse_bitstream = 1;
+			break;
+		case 12:
+			minipro_select_unit(optarg);
+			break;
+		case 13:
+			cmdopts->gang = optarg;
+			break;
+		case 14:
+			cmdopts->server = optarg;
+			break;
+		case 15:
+			cmdopts->connect = optarg;
+			break;
+		case 16:
+			errno = 0;
+			v = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr || errno || !v ||
+			    v > VECTOR_QUEUE_MAX) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->vector_queue = v;
+			break;
+		case 17:
+			cmdopts->skip_blank = 1;
+			break;
+		case 18:
+			errno = 0;
+			v = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr || errno || !v ||
+			    v > JEDEC_ROW_GROUP) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->row_queue = v;
+			break;
+		case 19:
+			cmdopts->verify_rows = 1;
+			break;
+		case 20:
+			cmdopts->stats = optarg;
+			break;
+		case 21:
+			cmdopts->trace = optarg;
+			break;
+		case 22:
+			cmdopts->record = optarg;
+			break;
+		case 23:
+			cmdopts->replay = optarg;
+			break;
+		case 24:
+			if (!strcasecmp(optarg, "recorded")) {
+				cmdopts->replay_latency = USB_LATENCY_RECORDED;
+				break;
+			}
+			errno = 0;
+			v = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr || errno ||
+			    v > REPLAY_LATENCY_MAX) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->replay_latency = v;
+			break;
+		case 25:
+			errno = 0;
+			v = strtoul(optarg, &endptr, 16);
+			if ((endptr == optarg) || *endptr || errno ||
+			    v > 0xFFFFFFFF) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->crc32 = v;
+			cmdopts->crc32_check = 1;
+			break;
+		case 26:
+			cmdopts->batch_config = 1;
+			break;
+		case 27:
+			cmdopts->device_name = optarg;
+			cmdopts->list_prefix = 1;
+			p_func = print_devices_and_exit;
+			break;
+		case 28:
+			errno = 0;
+			v = strtoul(optarg, &endptr, 10);
+			if ((endptr == optarg) || *endptr || errno || !v ||
+			    v > UINT16_MAX) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->list_pins = v;
+			break;
+		case 29:
+			errno = 0;
+			v = strtoul(optarg, &endptr, 0);
+			if ((endptr == optarg) || *endptr || errno || !v ||
+			    v > UINT8_MAX) {
+				fprintf(stderr, "Invalid argument.\n");
+				print_help_and_exit(argv[0]);
+			}
+			cmdopts->list_protocol = v;
+			break;
+		case 30:
+			cmdopts->async_load = 1;
+			break;
+		case 31:
+			cmdopts->adaptive = 1;
+			break;
 		case 'q':
 			if (!strcasecmp(optarg, "tl866a"))
 				cmdopts->version = MP_TL866A;
@@ -990,7 +1262,11 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 	}
 	if (p_func)
 		p_func(cmdopts);
-	if (package_type)
+	/* With an action the detected device is used for the job */
+	if (package_type && !cmdopts->device_name &&
+	    cmdopts->action != NO_ACTION && cmdopts->action != LOGIC_IC_TEST)
+		cmdopts->auto_detect = package_type;
+	else if (package_type)
 		spi_autodetect_and_exit(package_type, cmdopts);
 }
 
@@ -1047,224 +1323,70 @@ void update_status(char *status_msg, char *fmt, ...)
 	va_end(args);
 }
 
-int compare_memory(uint8_t compare_mask, uint8_t *s1, uint8_t *s2, size_t size1,
-		   size_t size2, uint32_t *address, uint8_t *c1, uint8_t *c2)
+/* Read the UES, ACW and power-down fuses of a PLD device */
+static int read_jedec_control(minipro_handle_t *handle, jedec_t *jedec)
 {
 	size_t i;
-	uint8_t v1, v2;
-	size_t size = (size1 > size2) ? size2 : size1;
-	for (i = 0; i < size; i++) {
-		v1 = (i < size1) ?
-			     s1[i] :
-			     compare_mask; /* use mask value when buffer too short */
-		v2 = (i < size2) ? s2[i] : compare_mask;
-		v1 &= compare_mask;
-		v2 &= compare_mask;
-		if (v1 != v2) {
-			if (address)
-				*address = i;
-			if (c1)
-				*c1 = v1;
-			if (c2)
-				*c2 = v2;
-			return EXIT_FAILURE;
-		}
-	}
-	return EXIT_SUCCESS;
-}
+	uint8_t buffer[JEDEC_ROW_BYTES];
+	gal_config_t *config = (gal_config_t *)handle->device->config;
 
-/* returned value will be a byte offset
- * sizes are in bytes
- * replacement_value needs to be in native byte order
- * sizes can be odd */
-int compare_word_memory(uint16_t replacement_value, uint16_t compare_mask,
-			uint8_t little_endian, uint8_t *s1, uint8_t *s2,
-			size_t size1, size_t size2, uint32_t *address,
-			uint16_t *c1, uint16_t *c2)
-{
-	size_t i;
-	uint16_t v1, v2;
-	size_t size = (size1 > size2) ? size2 : size1;
-	if (compare_mask == 0)
-		compare_mask = 0xffff;
-	uint8_t rvl = (replacement_value & compare_mask) & 0xff;
-	uint8_t rvh = ((replacement_value & compare_mask) >> 8) & 0xff;
-
-	for (i = 0; i < size; i += 2) {
-		if (little_endian) {
-			v1 = (i < size1) ? s1[i] : rvl;
-			v1 |= (((i + 1) < size1) ? s1[i + 1] : rvh) << 8;
-			v2 = (i < size2) ? s2[i] : rvl;
-			v2 |= (((i + 1) < size2) ? s2[i + 1] : rvh) << 8;
-		} else {
-			v1 = ((i < size1) ? s1[i] : rvh) << 8;
-			v1 |= ((i + 1) < size1) ? (s1[i + 1]) : rvl;
-			v2 = ((i < size2) ? s2[i] : rvh) << 8;
-			v2 |= ((i + 1) < size2) ? (s2[i + 1]) : rvl;
-		}
-		if ((v1 & compare_mask) != (v2 & compare_mask)) {
-			if (address)
-				*address = i;
-			if (c1)
-				*c1 = v1;
-			if (c2)
-				*c2 = v2;
+	/* Read user electronic signature (UES)
+	 * UES data can be missing in jedec, e.g. for db entry "ATF22V10C" */
+	if ((config->ues_address != 0) && (config->ues_size != 0) &&
+	    ((config->ues_address + config->ues_size) <= jedec->QF) &&
+	    !(handle->device->voltages.vdd & ATF_IN_PAL_COMPAT_MODE)) {
+		if (minipro_read_jedec_row(handle, buffer, config->fuses_size,
+					   0, config->ues_size))
 			return EXIT_FAILURE;
-		}
+		jedec_put_bits(jedec, config->ues_address, buffer,
+			       config->ues_size);
 	}
-	return EXIT_SUCCESS;
-}
 
-/* RAM-centric IO operations */
-int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
-		  size_t size)
-{
-	char status_msg[64], *name;
-	switch (type) {
-	case MP_DATA:
-		name = "Data";
-		break;
-	case MP_USER:
-		name = "User";
-		break;
-	default:
-		name = "Code";
+	/* Read architecture control word (ACW) */
+	if (minipro_read_jedec_row(handle, buffer, config->acw_address,
+				   config->acw_address, config->acw_size))
+		return EXIT_FAILURE;
+	for (i = 0; i < config->acw_size; i++) {
+		if (buffer[i / 8] & (0x80 >> (i & 0x07)))
+			jedec_set_fuse(jedec, config->acw_bits[i], 1);
 	}
-	snprintf(status_msg, sizeof(status_msg), "Reading %s...  ", name);
-
-	size_t buffer_size = size < handle->device->read_buffer_size ?
-				     size :
-				     handle->device->read_buffer_size;
-	size_t blocks_count = size / buffer_size;
-	if (size % buffer_size)
-		blocks_count++;
 
-	struct timeval begin, end;
-	gettimeofday(&begin, NULL);
-	/* Some controllers have data memory (eeprom) mapped to a
-	 * different address than 0 in programming mode. For ex. AT89S8252 */
-	uint32_t offset = (handle->device->flags.has_data_offset) ?
-				  handle->device->page_size :
-				  0;
-	uint32_t address;
-	size_t i;
-	for (i = 0; i < blocks_count; i++) {
-		update_status(status_msg, "%2d%%", i * 100 / blocks_count);
-		/* Translating address to protocol-specific */
-		address = i * buffer_size + offset;
-		if (handle->device->flags.has_word && type == MP_CODE)
-			address = address >> 1;
-
-		if (minipro_read_block(handle, type, address,
-				       buf + i * buffer_size, buffer_size))
-			return EXIT_FAILURE;
-
-		uint8_t ovc;
-		if (minipro_get_ovc_status(handle, NULL, &ovc))
-			return EXIT_FAILURE;
-		if (ovc) {
-			fprintf(stderr, "\nOvercurrent protection!\007\n");
+	/* Read Power-Down bit */
+	if ((config->powerdown_row != 0) &&
+	    (handle->device->flags.has_power_down)) {
+		if (minipro_read_jedec_row(handle, buffer,
+					   config->powerdown_row, 0, 1))
 			return EXIT_FAILURE;
-		}
+		jedec_set_fuse(jedec, jedec->QF - 1, (buffer[0] >> 7) & 0x01);
 	}
-	gettimeofday(&end, NULL);
-	snprintf(status_msg, sizeof(status_msg), "Reading %s...  %.2fSec  OK",
-		 name,
-		 (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-			 (double)(end.tv_sec - begin.tv_sec));
-	update_status(status_msg, "\n");
 	return EXIT_SUCCESS;
 }
 
-int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
-		   size_t size)
+/* Read a group of up to JEDEC_ROW_GROUP fuse rows into the fuse map */
+static int read_jedec_group(minipro_handle_t *handle, jedec_t *jedec,
+			    size_t row)
 {
-	char status_msg[64], *name;
-	switch (type) {
-	case MP_DATA:
-		name = "Data";
-		break;
-	case MP_USER:
-		name = "User";
-		break;
-	default:
-		name = "Code";
-	}
-	snprintf(status_msg, sizeof(status_msg), "Writing  %s...  ", name);
-
-	size_t buffer_size = handle->device->write_buffer_size;
-	size_t blocks_count = size / buffer_size;
-	if (size % buffer_size)
-		blocks_count++;
-
-	struct timeval begin, end;
-	gettimeofday(&begin, NULL);
-	minipro_status_t status;
-	size_t i;
-	/* Some controllers have data memory (eeprom) mapped to a
-	 * different address than 0 in programming mode. For ex. AT89S8252 */
-	uint32_t offset = (handle->device->flags.has_data_offset) ?
-				  handle->device->page_size :
-				  0;
-	uint32_t address;
-	for (i = 0; i < blocks_count; i++) {
-		update_status(status_msg, "%2d%%", i * 100 / blocks_count);
-		/* Translating address to protocol-specific */
-		address = i * buffer_size + offset;
-		if (handle->device->flags.has_word && type == MP_CODE)
-			address = address >> 1;
-
-		/* Last block */
-		if ((i + 1) * buffer_size > size)
-			buffer_size = size % buffer_size;
-		if (minipro_write_block(handle, type, address,
-					buffer + i * buffer_size, buffer_size))
-			return EXIT_FAILURE;
+	uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES];
+	gal_config_t *config = (gal_config_t *)handle->device->config;
+	size_t count = MIN(JEDEC_ROW_GROUP, config->fuses_size - row);
 
-		uint8_t ovc = 0;
-		if (minipro_get_ovc_status(handle, &status, &ovc))
-			return EXIT_FAILURE;
-		if (ovc) {
-			fprintf(stderr, "\nOvercurrent protection!\007\n");
-			return EXIT_FAILURE;
-		}
-		if (status.error && !handle->cmdopts->no_verify) {
-			if (minipro_end_transaction(handle))
-				return EXIT_FAILURE;
-			fprintf(stderr,
-				"\nVerification failed at address 0x%04X: File=0x%02X, "
-				"Device=0x%02X\n",
-				status.address,
-				status.c2 &
-					(handle->device->flags.word_size == 1 ?
-						 0xFF :
-						 0xFFFF),
-				status.c1 &
-					(handle->device->flags.word_size == 1 ?
-						 0xFF :
-						 0xFFFF));
-			return EXIT_FAILURE;
-		}
-	}
-	gettimeofday(&end, NULL);
-	snprintf(status_msg, sizeof(status_msg), "Writing %s...  %.2fSec  OK",
-		 name,
-		 (double)(end.tv_usec - begin.tv_usec) / 1000000 +
-			 (double)(end.tv_sec - begin.tv_sec));
-	update_status(status_msg, "\n");
+	if (minipro_read_jedec_rows(handle, rows[0], JEDEC_ROW_BYTES, row, 0,
+				    config->row_width, count))
+		return EXIT_FAILURE;
+	jedec_rows_to_fuses(jedec, rows, row, count, config->fuses_size,
+			    config->row_width);
 	return EXIT_SUCCESS;
 }
 
 /* Read PLD device */
 int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 {
-	size_t i, j;
+	size_t i;
 	struct timeval begin, end;
 	gettimeofday(&begin, NULL);
 
 	char status_msg[64];
 	snprintf(status_msg, sizeof(status_msg), "Reading device... ");
-	uint8_t buffer[32];
 	gal_config_t *config = (gal_config_t *)handle->device->config;
 
 	uint8_t ovc = 0;
@@ -1276,51 +1398,16 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	}
 
 	/* Read fuses */
-	memset(jedec->fuses, 0, jedec->QF);
-	for (i = 0; i < config->fuses_size; i++) {
-		if (minipro_read_jedec_row(handle, buffer, i, 0,
-					   config->row_width))
-			return EXIT_FAILURE;
-		/* Unpacking the row */
-		for (j = 0; j < config->row_width; j++) {
-			if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-				jedec->fuses[config->fuses_size * j + i] = 1;
-		}
+	memset(jedec->fuses, 0, JEDEC_FUSE_BYTES(jedec->QF));
+	for (i = 0; i < config->fuses_size; i += JEDEC_ROW_GROUP) {
 		update_status(status_msg, "%2d%%",
 			      i * 100 / config->fuses_size);
-	}
-
-	/* Read user electronic signature (UES)
-	 * UES data can be missing in jedec, e.g. for db entry "ATF22V10C" */
-	if ((config->ues_address != 0) && (config->ues_size != 0) &&
-	    ((config->ues_address + config->ues_size) <= jedec->QF) &&
-	    !(handle->device->voltages.vdd & ATF_IN_PAL_COMPAT_MODE)) {
-		if (minipro_read_jedec_row(handle, buffer, i, 0,
-					   config->ues_size))
+		if (read_jedec_group(handle, jedec, i))
 			return EXIT_FAILURE;
-		for (j = 0; j < config->ues_size; j++) {
-			if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-				jedec->fuses[config->ues_address + j] = 1;
-		}
 	}
 
-	/* Read architecture control word (ACW) */
-	if (minipro_read_jedec_row(handle, buffer, config->acw_address,
-				   config->acw_address, config->acw_size))
+	if (read_jedec_control(handle, jedec))
 		return EXIT_FAILURE;
-	for (i = 0; i < config->acw_size; i++) {
-		if (buffer[i / 8] & (0x80 >> (i & 0x07)))
-			jedec->fuses[config->acw_bits[i]] = 1;
-	}
-
-	/* Read Power-Down bit */
-	if ((config->powerdown_row != 0) &&
-	    (handle->device->flags.has_power_down)) {
-		if (minipro_read_jedec_row(handle, buffer,
-					   config->powerdown_row, 0, 1))
-			return EXIT_FAILURE;
-		jedec->fuses[jedec->QF - 1] = (buffer[0] >> 7) & 0x01;
-	}
 
 	gettimeofday(&end, NULL);
 	snprintf(status_msg, sizeof(status_msg),
@@ -1331,8 +1418,11 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	return EXIT_SUCCESS;
 }
 
-/* Write PLD device */
-int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
+/* Write PLD device. If 'rjedec' is not NULL every group of rows is read
+ * back into it right after it is written, followed by the UES, ACW and
+ * power-down fuses, so no second pass is needed to verify the device.
+ */
+int write_jedec(minipro_handle_t *handle, jedec_t *jedec, jedec_t *rjedec)
 {
 	size_t i, j;
 	struct timeval begin, end;
@@ -1340,7 +1430,8 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 
 	char status_msg[64];
 	snprintf(status_msg, sizeof(status_msg), "Writing jedec file... ");
-	uint8_t buffer[32];
+	uint8_t buffer[JEDEC_ROW_BYTES];
+	uint8_t rows[JEDEC_ROW_GROUP][JEDEC_ROW_BYTES];
 	gal_config_t *config = (gal_config_t *)handle->device->config;
 
 	uint8_t ovc = 0;
@@ -1353,17 +1444,22 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 
 	/* Write fuses */
 	for (i = 0; i < config->fuses_size; i++) {
-		memset(buffer, 0, sizeof(buffer));
-		/* Building a row */
-		for (j = 0; j < config->row_width; j++) {
-			if (jedec->fuses[config->fuses_size * j + i] == 1)
-				buffer[j / 8] |= (0x80 >> (j & 0x07));
-		}
+		/* Building a group of rows */
+		j = i % JEDEC_ROW_GROUP;
+		if (!j)
+			jedec_fuses_to_rows(
+				jedec, rows, i,
+				MIN(JEDEC_ROW_GROUP, config->fuses_size - i),
+				config->fuses_size, config->row_width);
 		update_status(status_msg, "%2d%%",
 			      i * 100 / config->fuses_size);
-		if (minipro_write_jedec_row(handle, buffer, i, 0,
+		if (minipro_write_jedec_row(handle, rows[j], i, 0,
 					    config->row_width))
 			return EXIT_FAILURE;
+		if (rjedec && (j == JEDEC_ROW_GROUP - 1 ||
+			       i + 1 == config->fuses_size) &&
+		    read_jedec_group(handle, rjedec, i - j))
+			return EXIT_FAILURE;
 	}
 
 	/* Write user electronic signature (UES) */
@@ -1372,10 +1468,8 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	if ((config->ues_address != 0) && (config->ues_size != 0) &&
 	    ((config->ues_address + config->ues_size) <= jedec->QF) &&
 	    !(handle->device->voltages.vdd & ATF_IN_PAL_COMPAT_MODE)) {
-		for (j = 0; j < config->ues_size; j++) {
-			if (jedec->fuses[config->ues_address + j] == 1)
-				buffer[j / 8] |= (0x80 >> (j & 0x07));
-		}
+		jedec_get_bits(jedec, config->ues_address, buffer,
+			       config->ues_size);
 	}
 	/* UES field is always written, even when not contained in JEDEC */
 	if (minipro_write_jedec_row(handle, buffer, i, 0, config->ues_size))
@@ -1384,7 +1478,7 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	/* Write architecture control word (ACW) */
 	memset(buffer, 0, sizeof(buffer));
 	for (i = 0; i < config->acw_size; i++) {
-		if (jedec->fuses[config->acw_bits[i]] == 1)
+		if (jedec_get_fuse(jedec, config->acw_bits[i]))
 			buffer[i / 8] |= (0x80 >> (i & 0x07));
 	}
 	if (minipro_write_jedec_row(handle, buffer, config->acw_address,
@@ -1395,7 +1489,7 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	if (config->powerdown_row != 0) {
 		/* only '0' bits shall be written */
 		if (((handle->device->flags.has_power_down) &&
-		     (jedec->fuses[jedec->QF - 1] == 0)) ||
+		     !jedec_get_fuse(jedec, jedec->QF - 1)) ||
 		     (handle->device->flags.is_powerdown_disabled)) {
 			memset(buffer, 0, sizeof(buffer));
 			if (minipro_write_jedec_row(handle, buffer,
@@ -1405,6 +1499,9 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 		}
 	}
 
+	if (rjedec && read_jedec_control(handle, rjedec))
+		return EXIT_FAILURE;
+
 	gettimeofday(&end, NULL);
 	snprintf(status_msg, sizeof(status_msg),
 		 "Writing jedec file...  %.2fSec  OK",
@@ -1433,132 +1530,227 @@ int erase_device(minipro_handle_t *handle)
 	return EXIT_SUCCESS;
 }
 
-/* Opens a physical file or a pipe if the pipe character is specified */
-int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size)
+/* A line filling the whole buffer means a binary file, unless records
+ * were decoded already. Part of the file is consumed by then, so it
+ * can't be loaded as a binary file any more.
+ */
+static int line_too_long(uint8_t format, void *reader)
+{
+	if (format == IHEX) {
+		ihex_reader_t *ihex = reader;
+		if (!ihex->records)
+			return NOT_IHEX;
+		fprintf(ihex->log, "Error on line %u: line too long.\n",
+			ihex->line + 1);
+	} else {
+		srec_reader_t *srec = reader;
+		if (!srec->records)
+			return NOT_SREC;
+		fprintf(srec->log, "Error on line %u: line too long.\n",
+			srec->line + 1);
+	}
+	return EXIT_FAILURE;
+}
+
+/* Feed a text file to the Intel hex or S-Record reader one line at a time.
+ * 'buffer' holds the first 'len' bytes of the file and has room for
+ * READ_BUFFER_SIZE + 1 bytes. Returns NOT_IHEX/NOT_SREC if the first record
+ * isn't valid, the buffer is then left unchanged. A line longer than the
+ * buffer after valid records is an error.
+ */
+static int read_text_file(FILE *file, uint8_t *buffer, size_t len,
+			  uint8_t format, void *reader)
+{
+	size_t start = 0, n;
+	int ret, eof = 0;
+
+	for (;;) {
+		uint8_t *line = buffer + start;
+		uint8_t *nl = memchr(line, '\n', len - start);
+		if (!nl && !eof) {
+			/* Move the partial line to the front and read more */
+			if (!start && len == READ_BUFFER_SIZE)
+				return line_too_long(format, reader);
+			memmove(buffer, line, len - start);
+			len -= start;
+			start = 0;
+			n = fread(buffer + len, 1, READ_BUFFER_SIZE - len, file);
+			eof = !n;
+			len += n;
+			continue;
+		}
+		if (!nl && start == len)
+			break;
+
+		/* The last line may have no new line */
+		buffer[len] = '\0';
+		if (format == IHEX)
+			ret = ihex_read_line(reader, line);
+		else
+			ret = srec_read_line(reader, line);
+		if (ret)
+			return ret;
+		if (!nl)
+			break;
+		start = nl - buffer + 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Opens a physical file or a pipe if the pipe character is specified.
+ * '*st_size' is the size of a physical file and 0 for a pipe.
+ */
+static FILE *open_input_file(minipro_handle_t *handle, size_t *st_size)
 {
 	FILE *file;
 	struct stat st;
 
 	/* Check if we are dealing with a pipe. */
 	if (handle->cmdopts->is_pipe) {
-		file = stdin;
-		st.st_size = 0;
-	} else {
-		file = fopen(handle->cmdopts->filename, "rb");
-		int ret = stat(handle->cmdopts->filename, &st);
-		if (!file || ret) {
-			fprintf(stderr, "Could not open file %s for reading.\n",
-				handle->cmdopts->filename);
-			perror("");
-			if (file)
-				fclose(file);
+		*st_size = 0;
+		return stdin;
+	}
+	file = fopen(handle->cmdopts->filename, "rb");
+	int ret = stat(handle->cmdopts->filename, &st);
+	if (!file || ret) {
+		fprintf(stderr, "Could not open file %s for reading.\n",
+			handle->cmdopts->filename);
+		perror("");
+		if (file)
+			fclose(file);
+		return NULL;
+	}
+	*st_size = st.st_size;
+	return file;
+}
+
+/* Reads an opened input file and closes it. Intel hex and S-Record files
+ * are decoded and binary files are read straight into 'data', which
+ * holds '*file_size' bytes. The file is read READ_BUFFER_SIZE bytes at
+ * a time, so it is never held in memory. The messages go to 'log'.
+ */
+static int load_file(minipro_handle_t *handle, FILE *file, size_t st_size,
+		     uint8_t *data, size_t *file_size, FILE *log)
+{
+	/* If we are dealing with a jed file just return the data. */
+	if (handle->device->chip_type == MP_PLD) {
+		size_t br = fread(data, 1, READ_BUFFER_SIZE, file);
+		int more = br == READ_BUFFER_SIZE && fgetc(file) != EOF;
+		fclose(file);
+		if (!br) {
+			fprintf(log, "No data to read.\n");
+			return EXIT_FAILURE;
+		}
+		if (more) {
+			fprintf(log, "JED file too big.\n");
 			return EXIT_FAILURE;
 		}
+		*file_size = br;
+		return EXIT_SUCCESS;
 	}
 
-	/* Allocate a zero initialized buffer.
-	 * If the file size is unknown (pipe) a default size will be used. */
-	uint8_t *buffer = calloc(1, st.st_size ? st.st_size : READ_BUFFER_SIZE);
+	uint8_t *buffer = malloc(READ_BUFFER_SIZE + 1);
 	if (!buffer) {
 		fclose(file);
-		fprintf(stderr, "Out of memory!\n");
+		fprintf(log, "Out of memory!\n");
 		return EXIT_FAILURE;
 	}
-
-	/* Try to read the whole file.
-	 * If we are reading from stdin, data will be read in small
-	 * chunks of 64K each until EOF. */
-	size_t br = 0;
-	size_t sz = READ_BUFFER_SIZE;
-	if (!st.st_size) {
-		size_t ch;
-		uint8_t *tmp;
-		while (br < UINT32_MAX) {
-			ch = fread(buffer + br, 1, READ_BUFFER_SIZE, file);
-			br += ch;
-			if (ch != READ_BUFFER_SIZE)
-				break;
-			sz += READ_BUFFER_SIZE;
-			tmp = realloc(buffer, sz);
-			if (!tmp) {
-				free(buffer);
-				fclose(file);
-				fprintf(stderr, "Out of memory!\n");
-				return EXIT_FAILURE;
-			}
-			buffer = tmp;
-		}
-	} else
-		br = fread(buffer, 1, st.st_size, file);
-
-	fclose(file);
+	size_t br = fread(buffer, 1, READ_BUFFER_SIZE, file);
 	if (!br) {
-		fprintf(stderr, "No data to read.\n");
+		fprintf(log, "No data to read.\n");
 		free(buffer);
+		fclose(file);
 		return EXIT_FAILURE;
 	}
-
-	/* If we are dealing with a jed file just return the data. */
-	if (handle->device->chip_type == MP_PLD) {
-		memcpy(data, buffer, br);
-		free(buffer);
-		*file_size = br;
-		return EXIT_SUCCESS;
-	}
-
 	size_t chip_size = *file_size;
-	*file_size = br;
 
-	/* Probe for an Intel hex file */
-	size_t hex_size = chip_size;
-	int ret = read_hex_file(buffer, data, &hex_size);
-	switch (ret) {
-	case NOT_IHEX:
-		break;
-	case EXIT_FAILURE:
-		free(buffer);
-		return EXIT_FAILURE;
-		break;
-	case INTEL_HEX_FORMAT:
-		*file_size = hex_size;
-		fprintf(stderr, "Found Intel hex file.\n");
-		free(buffer);
-		return EXIT_SUCCESS;
+	/* The format is known from the first record */
+	size_t i = 0;
+	while (i < br && (buffer[i] == '\r' || buffer[i] == '\n'))
+		i++;
+	int ret = NOT_IHEX;
+	if (i < br && buffer[i] == ':' && handle->cmdopts->format != SREC) {
+		ihex_reader_t reader;
+		ihex_reader_init(&reader, data, chip_size);
+		reader.log = log;
+		ret = read_text_file(file, buffer, br, IHEX, &reader);
+		if (!ret)
+			ret = ihex_reader_end(&reader);
+		if (ret == INTEL_HEX_FORMAT)
+			fprintf(log, "Found Intel hex file.\n");
+	} else if (i < br && buffer[i] == 'S' &&
+		   handle->cmdopts->format != IHEX) {
+		srec_reader_t reader;
+		srec_reader_init(&reader, data, chip_size);
+		reader.log = log;
+		ret = read_text_file(file, buffer, br, SREC, &reader);
+		if (!ret)
+			ret = srec_reader_end(&reader, file_size);
+		if (ret == SREC_FORMAT)
+			fprintf(log, "Found Motorola S-Record file.\n");
 	}
-
-	/* Probe for a Motorola srec file */
-	hex_size = chip_size;
-	ret = read_srec_file(buffer, data, &hex_size);
 	switch (ret) {
-	case NOT_SREC:
+	case NOT_IHEX: /* Same as NOT_SREC */
 		break;
 	case EXIT_FAILURE:
 		free(buffer);
+		fclose(file);
 		return EXIT_FAILURE;
-		break;
-	case SREC_FORMAT:
-		*file_size = hex_size;
-		fprintf(stderr, "Found Motorola S-Record file.\n");
+	default: /* INTEL_HEX_FORMAT or SREC_FORMAT */
 		free(buffer);
+		fclose(file);
 		return EXIT_SUCCESS;
 	}
 
 	if (handle->cmdopts->format == IHEX) {
-		fprintf(stderr, "This is not an Intel hex file.\n");
+		fprintf(log, "This is not an Intel hex file.\n");
 		free(buffer);
+		fclose(file);
 		return EXIT_FAILURE;
 	}
 	if (handle->cmdopts->format == SREC) {
-		fprintf(stderr, "This is not an S-Record file.\n");
+		fprintf(log, "This is not an S-Record file.\n");
 		free(buffer);
+		fclose(file);
 		return EXIT_FAILURE;
 	}
-	/* This must be a binary file */
-	memcpy(data, buffer, *file_size > chip_size ? chip_size : *file_size);
+
+	/* This must be a binary file, read the rest straight into 'data' and
+	 * count what doesn't fit */
+	memcpy(data, buffer, MIN(br, chip_size));
+	size_t n;
+	while (br < chip_size &&
+	       (n = fread(data + br, 1, chip_size - br, file)))
+		br += n;
+	if (st_size)
+		br = st_size;
+	else
+		while ((n = fread(buffer, 1, READ_BUFFER_SIZE, file)))
+			br += n;
+	*file_size = br;
 	free(buffer);
+	fclose(file);
 	return EXIT_SUCCESS;
 }
 
+static int read_file(minipro_handle_t *handle, FILE *file, size_t st_size,
+		     uint8_t *data, size_t *file_size, FILE *log)
+{
+	uint64_t start = stats_start();
+	int ret = load_file(handle, file, st_size, data, file_size, log);
+	stats_record(STATS_PHASE, "file_read", *file_size, start);
+	return ret;
+}
+
+int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size)
+{
+	size_t st_size;
+	FILE *file = open_input_file(handle, &st_size);
+	if (!file)
+		return EXIT_FAILURE;
+	return read_file(handle, file, st_size, data, file_size, stderr);
+}
+
 /* Open a JED file */
 int open_jed_file(minipro_handle_t *handle, jedec_t *jedec)
 {
@@ -1619,67 +1811,289 @@ FILE *get_file(minipro_handle_t *handle)
 	return file;
 }
 
-/* Wrappers for operating with files */
-int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
+/* The input of a write: the decoded file and, for an incremental write
+ * to an erased chip, the blank block map. With --async_load the file is
+ * opened up front and decoded by a worker thread while the programmer
+ * sets up the transaction and erases the chip. The worker's messages are
+ * kept in 'log' until the data is needed, so they don't break into the
+ * progress of the erase.
+ */
+typedef struct write_prep {
+	minipro_handle_t *handle;
+	uint8_t type;
+	size_t size;
+	size_t file_size;
+	uint8_t *file_data;
+	uint8_t *skip;
+	FILE *file;
+	size_t st_size;
+	FILE *log;
+	int skipped;
+	int erased;
+	int ret;
+	int started;
+	pthread_t thread;
+} write_prep_t;
+
+/* Load the file and size the write, the buffers are freed on failure */
+static int prepare_write(write_prep_t *prep)
 {
+	minipro_handle_t *handle = prep->handle;
+	size_t size = prep->size;
+	FILE *file = prep->file;
+
+	/* The file is already open when it is loaded by the worker */
+	if (!file) {
+		file = open_input_file(handle, &prep->st_size);
+		if (!file)
+			return EXIT_FAILURE;
+	}
+	prep->file = NULL;
+
 	/* Allocate the buffer and clear it with default value */
-	uint8_t *file_data = malloc(size);
-	if (!file_data) {
-		fprintf(stderr, "Out of memory!\n");
+	prep->file_data = malloc(size);
+	if (!prep->file_data) {
+		fprintf(prep->log, "Out of memory!\n");
+		fclose(file);
 		return EXIT_FAILURE;
 	}
 
-	memset(file_data, handle->device->blank_value, size);
-	size_t file_size = size;
-	if (open_file(handle, file_data, &file_size))
+	memset(prep->file_data, handle->device->blank_value, size);
+	prep->file_size = size;
+	if (read_file(handle, file, prep->st_size, prep->file_data,
+		      &prep->file_size, prep->log)) {
+		free(prep->file_data);
+		prep->file_data = NULL;
 		return EXIT_FAILURE;
-	if (file_size != size) {
+	}
+	if (prep->file_size != size) {
 		if (!handle->cmdopts->size_error) {
-			fprintf(stderr,
+			fprintf(prep->log,
 				"Incorrect file size: %zu (needed %zu, use -s/S to ignore)\n",
-				file_size, size);
-			free(file_data);
+				prep->file_size, size);
+			free(prep->file_data);
+			prep->file_data = NULL;
 			return EXIT_FAILURE;
 		} else if (handle->cmdopts->size_nowarn == 0)
-			fprintf(stderr,
+			fprintf(prep->log,
 				"Warning: Incorrect file size: %zu (needed %zu)\n",
-				file_size, size);
+				prep->file_size, size);
 
 		/* The size of our array must be a multiple of
-		 * handle->device->read_buffer_size, otherwise read_page_ram
+		 * handle->device->read_buffer_size, otherwise minipro_read_memory
 		 * will try to access an out of bounds index. */
 		const uint16_t buffer_size = handle->device->read_buffer_size;
-		size = MIN(file_size, size);
+		size = MIN(prep->file_size, size);
 		const uint16_t size_mod = size % buffer_size;
 		if (size_mod)
 			size += buffer_size - size_mod;
+		prep->size = size;
+	}
+
+	/* Blank blocks of an erased chip are found without the chip */
+	if (handle->cmdopts->incremental && prep->erased) {
+		size_t blocks_count = (size + handle->device->write_buffer_size -
+				       1) / handle->device->write_buffer_size;
+		prep->skip = malloc(blocks_count);
+		if (!prep->skip) {
+			fprintf(prep->log, "Out of memory!\n");
+			free(prep->file_data);
+			prep->file_data = NULL;
+			return EXIT_FAILURE;
+		}
+		prep->skipped = minipro_get_skip_blocks(handle, prep->file_data,
+							prep->type, size, 1,
+							prep->skip);
+		if (prep->skipped < 0) {
+			free(prep->skip);
+			free(prep->file_data);
+			prep->skip = NULL;
+			prep->file_data = NULL;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static void *write_prep_worker(void *arg)
+{
+	write_prep_t *prep = arg;
+	prep->ret = prepare_write(prep);
+	return NULL;
+}
+
+static void init_write_prep(write_prep_t *prep, minipro_handle_t *handle,
+			    uint8_t type, size_t size)
+{
+	memset(prep, 0, sizeof(*prep));
+	prep->handle = handle;
+	prep->type = type;
+	prep->size = size;
+	prep->log = stderr;
+	prep->erased = !handle->cmdopts->no_erase &&
+		       handle->device->flags.can_erase;
+}
+
+/* Start loading the file of a code, data or user page write on a worker
+ * thread if --async_load is given */
+static int start_write_prep(minipro_handle_t *handle, write_prep_t *prep)
+{
+	uint8_t type;
+	size_t size;
+
+	memset(prep, 0, sizeof(*prep));
+	if (!handle->cmdopts->async_load)
+		return EXIT_SUCCESS;
+	switch (handle->cmdopts->page) {
+	case UNSPECIFIED:
+	case CODE:
+		type = MP_CODE;
+		size = handle->device->code_memory_size;
+		break;
+	case DATA:
+		type = MP_DATA;
+		size = handle->device->data_memory_size;
+		break;
+	case USER:
+		type = MP_USER;
+		size = handle->device->data_memory2_size;
+		break;
+	default:
+		return EXIT_SUCCESS;
+	}
+	if (!size)
+		return EXIT_SUCCESS;
+
+	/* A missing file is reported before anything is erased */
+	init_write_prep(prep, handle, type, size);
+	prep->file = open_input_file(handle, &prep->st_size);
+	if (!prep->file)
+		return EXIT_FAILURE;
+
+	/* Without a place for the messages the file is loaded later */
+	prep->log = tmpfile();
+	if (!prep->log) {
+		prep->log = stderr;
+		return EXIT_SUCCESS;
+	}
+	if (pthread_create(&prep->thread, NULL, write_prep_worker, prep)) {
+		fprintf(stderr, "Could not start the file loader thread.\n");
+		fclose(prep->file);
+		fclose(prep->log);
+		prep->file = NULL;
+		prep->log = stderr;
+		return EXIT_FAILURE;
+	}
+	prep->started = 1;
+	return EXIT_SUCCESS;
+}
+
+/* Wait for the worker and print its messages, returns the result of the
+ * preparation */
+static int finish_write_prep(write_prep_t *prep)
+{
+	char buffer[256];
+	size_t n;
+
+	if (prep->started) {
+		pthread_join(prep->thread, NULL);
+		prep->started = 0;
+		rewind(prep->log);
+		while ((n = fread(buffer, 1, sizeof(buffer), prep->log)))
+			fwrite(buffer, 1, n, stderr);
+		fclose(prep->log);
+		prep->log = stderr;
+	}
+	return prep->ret;
+}
+
+static void free_write_prep(write_prep_t *prep)
+{
+	finish_write_prep(prep);
+	if (prep->file)
+		fclose(prep->file);
+	prep->file = NULL;
+	free(prep->skip);
+	free(prep->file_data);
+	prep->skip = NULL;
+	prep->file_data = NULL;
+}
+
+/* Wrappers for operating with files */
+int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size,
+		    write_prep_t *prep)
+{
+	write_prep_t sync;
+
+	/* Without a worker the file is loaded before the erase */
+	if (!prep->started) {
+		init_write_prep(&sync, handle, type, size);
+		sync.file = prep->file;
+		sync.st_size = prep->st_size;
+		prep->file = NULL;
+		if (prepare_write(&sync))
+			return EXIT_FAILURE;
+		prep = &sync;
 	}
 
 	/* Perform an erase first */
 	if (erase_device(handle)) {
-		free(file_data);
+		free_write_prep(prep);
 		return EXIT_FAILURE;
 	}
 	/* We must reset the transaction after the erase */
 	if (minipro_end_transaction(handle)) {
-		free(file_data);
+		free_write_prep(prep);
 		return EXIT_FAILURE;
 	}
 	if (minipro_begin_transaction(handle)) {
-		free(file_data);
+		free_write_prep(prep);
 		return EXIT_FAILURE;
 	}
 
 	if (handle->cmdopts->protect_off &&
 	    handle->device->flags.off_protect_before) {
 		if (minipro_protect_off(handle)) {
-			free(file_data);
+			free_write_prep(prep);
 			return EXIT_FAILURE;
 		}
 		fprintf(stderr, "Protect off...OK\n");
 	}
 
-	if (write_page_ram(handle, file_data, type, size)) {
+	/* Now the data is needed */
+	if (finish_write_prep(prep))
+		return EXIT_FAILURE;
+	uint8_t *file_data = prep->file_data;
+	size_t file_size = prep->file_size;
+	size = prep->size;
+
+	if (handle->cmdopts->incremental) {
+		size_t blocks_count = (size + handle->device->write_buffer_size -
+				       1) / handle->device->write_buffer_size;
+		if (!prep->erased) {
+			prep->skip = malloc(blocks_count);
+			if (!prep->skip) {
+				fprintf(stderr, "Out of memory!\n");
+				free_write_prep(prep);
+				return EXIT_FAILURE;
+			}
+			prep->skipped = minipro_get_skip_blocks(
+				handle, file_data, type, size, 0, prep->skip);
+			if (prep->skipped < 0) {
+				free_write_prep(prep);
+				return EXIT_FAILURE;
+			}
+		}
+		fprintf(stderr, "Skipping %d of %zu %s blocks\n",
+			prep->skipped, blocks_count,
+			prep->erased ? "blank" : "unchanged");
+	}
+
+	int ret = minipro_write_memory(handle, file_data, type, size,
+				       prep->skip);
+	free(prep->skip);
+	prep->skip = NULL;
+	if (ret) {
 		free(file_data);
 		return EXIT_FAILURE;
 	}
@@ -1696,57 +2110,156 @@ int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 			return EXIT_FAILURE;
 		}
 
-		/* There is an off by one bug in T56 firmware.
-		 * Allocate couple extra bytes to prevent buffer overflow.
-		 * We need only one byte but make it 16, we never know.
-		 */
-		uint8_t *chip_data = malloc(size + 16);
-		if (!chip_data) {
-			fprintf(stderr, "Out of memory\n");
-			free(file_data);
+		int failed;
+		int ret = minipro_verify_memory(handle, type, file_data,
+						file_size, size, &failed);
+		free(file_data);
+		if (ret)
 			return EXIT_FAILURE;
-		}
-		if (read_page_ram(handle, chip_data, type, size)) {
-			free(file_data);
-			free(chip_data);
+
+		if (failed) {
 			return EXIT_FAILURE;
+		} else {
+			fprintf(stderr, "Verification OK\n");
 		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Blocks read from the chip are queued in a ring of buffers and encoded to
+ * the output file by a writer thread while the next blocks are read.
+ */
+typedef struct read_ring {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t *slot[READ_RING_SLOTS];
+	size_t len[READ_RING_SLOTS];
+	size_t head, tail;
+	int done, error;
 
+	FILE *file;
+	uint8_t format;
+	ihex_writer_t ihex;
+	srec_writer_t srec;
+	int crc_check;
+	uint32_t crc;
+} read_ring_t;
+
+static void *read_ring_writer(void *arg)
+{
+	read_ring_t *ring = arg;
+	pthread_mutex_lock(&ring->lock);
+	for (;;) {
+		while (ring->tail == ring->head && !ring->done)
+			pthread_cond_wait(&ring->cond, &ring->lock);
+		if (ring->tail == ring->head)
+			break;
+		pthread_mutex_unlock(&ring->lock);
+
+		/* The slot is not touched by the reader until 'tail' moves */
+		size_t i = ring->tail % READ_RING_SLOTS;
+		uint64_t start = stats_start();
 		int ret;
-		uint8_t c1 = 0, c2 = 0;
-		uint16_t cw1 = 0, cw2 = 0;
-		uint32_t address;
-		uint16_t compare_mask =
-			(type == MP_CODE) ? handle->device->compare_mask : 0xff;
-		if (compare_mask > 0xff) {
-			ret = compare_word_memory(0xffff, compare_mask, 1,
-						  file_data, chip_data,
-						  file_size, size, &address,
-						  &cw1, &cw2);
-		} else {
-			ret = compare_memory(compare_mask, file_data, chip_data,
-					     file_size, size, &address, &c1,
-					     &c2);
+		switch (ring->format) {
+		case IHEX:
+			ret = ihex_write_data(&ring->ihex, ring->slot[i],
+					      ring->len[i]);
+			break;
+		case SREC:
+			ret = srec_write_data(&ring->srec, ring->slot[i],
+					      ring->len[i]);
+			break;
+		default:
+			ret = fwrite(ring->slot[i], 1, ring->len[i],
+				     ring->file) != ring->len[i];
 		}
+		if (ring->crc_check)
+			ring->crc = crc_32(ring->slot[i], ring->len[i],
+					   ring->crc);
+		stats_record(STATS_FILE, "file_write", ring->len[i], start);
 
-		free(chip_data);
-		free(file_data);
-
+		pthread_mutex_lock(&ring->lock);
+		ring->tail++;
 		if (ret) {
-			if (compare_mask > 0xff) {
-				fprintf(stderr,
-					"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
-					address, cw1, cw2);
-			} else {
-				fprintf(stderr,
-					"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
-					address, c1, c2);
-			}
-			return EXIT_FAILURE;
-		} else {
-			fprintf(stderr, "Verification OK\n");
+			ring->error = 1;
+			ring->tail = ring->head;
 		}
+		pthread_cond_broadcast(&ring->cond);
+		if (ret)
+			break;
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return NULL;
+}
+
+/* Block callback, waits for a free slot and queues the block */
+static int read_ring_push(void *ctx, uint8_t *block, size_t offset,
+			  size_t len)
+{
+	read_ring_t *ring = ctx;
+	pthread_mutex_lock(&ring->lock);
+	while (ring->head - ring->tail == READ_RING_SLOTS && !ring->error)
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	int error = ring->error;
+	pthread_mutex_unlock(&ring->lock);
+	if (error)
+		return -1;
+
+	size_t i = ring->head % READ_RING_SLOTS;
+	memcpy(ring->slot[i], block, len);
+	ring->len[i] = len;
+
+	pthread_mutex_lock(&ring->lock);
+	ring->head++;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+	return 0;
+}
+
+/* Memory section checked by --crc32 */
+static uint8_t crc32_page_type(cmdopts_t *cmdopts)
+{
+	switch (cmdopts->page) {
+	case DATA:
+		return MP_DATA;
+	case USER:
+		return MP_USER;
+	default:
+		return MP_CODE;
+	}
+}
+
+static int check_crc32(minipro_handle_t *handle, uint32_t crc)
+{
+	if (crc != handle->cmdopts->crc32) {
+		fprintf(stderr,
+			"CRC32 mismatch! Expected 0x%08X, got 0x%08X.\n",
+			handle->cmdopts->crc32, crc);
+		return EXIT_FAILURE;
 	}
+	fprintf(stderr, "CRC32 0x%08X OK\n", crc);
+	return EXIT_SUCCESS;
+}
+
+static int crc32_block_cb(void *ctx, uint8_t *block, size_t offset,
+			  size_t len)
+{
+	uint32_t *crc = ctx;
+	*crc = crc_32(block, len, *crc);
+	return 0;
+}
+
+/* Verify a memory section against the --crc32 value only, no file is
+ * loaded */
+static int verify_page_crc32(minipro_handle_t *handle, uint8_t type,
+			     size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	if (minipro_read_stream(handle, type, size, crc32_block_cb, &crc))
+		return EXIT_FAILURE;
+	if (check_crc32(handle, ~crc))
+		return EXIT_FAILURE;
+	fprintf(stderr, "Verification OK\n");
 	return EXIT_SUCCESS;
 }
 
@@ -1756,46 +2269,85 @@ int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	if (!file)
 		return EXIT_FAILURE;
 
-	/* There is an off by one bug in T56 firmware.
-	 * Allocate couple extra bytes to prevent buffer overflow.
-	 * We need only one byte but make it 16, we never know.
+	read_ring_t ring;
+	memset(&ring, 0, sizeof(ring));
+	ring.file = file;
+	ring.format = handle->cmdopts->format;
+	ring.crc_check = handle->cmdopts->crc32_check &&
+			 type == crc32_page_type(handle->cmdopts);
+	ring.crc = 0xFFFFFFFF;
+	/* Rows are compared byte by byte, so skip word blank values like
+	 * 0x3FFF only if both halves are equal.
 	 */
-	uint8_t *buffer = malloc(size + 16);
-	if (!buffer) {
-		fprintf(stderr, "Out of memory\n");
-		fclose(file);
-		return EXIT_FAILURE;
-	}
-
-	memset(buffer, handle->device->blank_value, size);
-	if (read_page_ram(handle, buffer, type, size)) {
-		fclose(file);
-		free(buffer);
-		return EXIT_FAILURE;
+	uint16_t blank_value = handle->device->blank_value;
+	int blank = -1;
+	if (handle->cmdopts->skip_blank &&
+	    (blank_value <= 0xff || (blank_value >> 8) == (blank_value & 0xff)))
+		blank = blank_value & 0xff;
+	size_t slot_size = minipro_max_read_block(handle);
+	int i, ret = EXIT_FAILURE;
+	for (i = 0; i < READ_RING_SLOTS; i++) {
+		ring.slot[i] = malloc(slot_size);
+		if (!ring.slot[i]) {
+			fprintf(stderr, "Out of memory!\n");
+			goto cleanup;
+		}
 	}
 
-	switch (handle->cmdopts->format) {
+	switch (ring.format) {
 	case IHEX:
-		if (write_hex_file(file, buffer, 0, size, 1)) {
-			fclose(file);
-			free(buffer);
-			return EXIT_FAILURE;
-		}
+		ihex_writer_init(&ring.ihex, file, 0, size, blank);
 		break;
 	case SREC:
-		if (write_srec_file(file, buffer, 0, size, 1)) {
-			fclose(file);
-			free(buffer);
-			return EXIT_FAILURE;
-		}
+		srec_writer_init(&ring.srec, file, 0, blank);
 		break;
-	default:
-		fwrite(buffer, 1, size, file);
 	}
 
+	pthread_t writer;
+	pthread_mutex_init(&ring.lock, NULL);
+	pthread_cond_init(&ring.cond, NULL);
+	if (pthread_create(&writer, NULL, read_ring_writer, &ring)) {
+		fprintf(stderr, "Can't start the file writer thread!\n");
+		goto destroy;
+	}
+
+	ret = minipro_read_stream(handle, type, size, read_ring_push, &ring);
+
+	pthread_mutex_lock(&ring.lock);
+	ring.done = 1;
+	pthread_cond_broadcast(&ring.cond);
+	pthread_mutex_unlock(&ring.lock);
+	pthread_join(writer, NULL);
+
+	if (!ring.error) {
+		switch (ring.format) {
+		case IHEX:
+			ring.error = ihex_writer_end(&ring.ihex, 1);
+			break;
+		case SREC:
+			ring.error = srec_writer_end(&ring.srec, 1);
+			break;
+		}
+	}
+	if (ring.error || fflush(file)) {
+		if (handle->cmdopts->is_pipe)
+			fprintf(stderr, "Error writing to stdout.\n");
+		else
+			fprintf(stderr, "Error writing file %s.\n",
+				handle->cmdopts->filename);
+		ret = EXIT_FAILURE;
+	}
+	if (!ret && ring.crc_check && check_crc32(handle, ~ring.crc))
+		ret = EXIT_FAILURE;
+
+destroy:
+	pthread_cond_destroy(&ring.cond);
+	pthread_mutex_destroy(&ring.lock);
+cleanup:
+	for (i = 0; i < READ_RING_SLOTS; i++)
+		free(ring.slot[i]);
 	fclose(file);
-	free(buffer);
-	return EXIT_SUCCESS;
+	return ret;
 }
 
 int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
@@ -1815,13 +2367,15 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	}
 	size_t file_size = size;
 
-	/* Allocate the buffer and clear it with default value */
-	file_data = malloc(size);
-	if (!file_data) {
-		fprintf(stderr, "Out of memory!\n");
-		return EXIT_FAILURE;
-	}
+	/* Blank check compares against the blank value without a file buffer */
+	file_data = NULL;
 	if (handle->cmdopts->filename) {
+		/* Allocate the buffer and clear it with default value */
+		file_data = malloc(size);
+		if (!file_data) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
 		memset(file_data, handle->device->blank_value, size);
 		if (open_file(handle, file_data, &file_size)) {
 			free(file_data);
@@ -1842,51 +2396,14 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 		}
 
 	}
-	/* Blank check */
-	else
-		memset(file_data, handle->device->blank_value, size);
-
-	/* Downloading data from chip*/
-	uint8_t *chip_data = malloc(size + 128);
-	if (!chip_data) {
-		fprintf(stderr, "Out of memory!\n");
-		free(file_data);
-		return EXIT_FAILURE;
-	}
-	if (read_page_ram(handle, chip_data, type, size)) {
-		free(file_data);
-		free(chip_data);
-		return EXIT_FAILURE;
-	}
-
-	int ret;
-	uint8_t c1 = 0, c2 = 0;
-	uint16_t cw1 = 0, cw2 = 0;
-	uint32_t address;
-	uint16_t compare_mask =
-		(type == MP_CODE) ? handle->device->compare_mask : 0xff;
-	if (compare_mask > 0xff) {
-		ret = compare_word_memory(0xffff, compare_mask, 1, file_data,
-					  chip_data, file_size, size, &address,
-					  &cw1, &cw2);
-	} else {
-		ret = compare_memory(compare_mask, file_data, chip_data,
-				     file_size, size, &address, &c1, &c2);
-	}
 
+	/* Compare the chip data block by block as it is read */
+	int failed;
+	int ret = minipro_verify_memory(handle, type, file_data, file_size,
+					size, &failed);
 	free(file_data);
-	free(chip_data);
 
-	if (ret) {
-		if (compare_mask > 0xff) {
-			fprintf(stderr,
-				"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
-				address, cw1, cw2);
-		} else {
-			fprintf(stderr,
-				"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
-				address, c1, c2);
-		}
+	if (ret || failed) {
 		return EXIT_FAILURE;
 	} else {
 		if (handle->cmdopts->filename) {
@@ -1898,9 +2415,60 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	return EXIT_SUCCESS;
 }
 
+/* The config sections selected on the command line */
+typedef struct config_sections {
+	uint8_t fuses[64];
+	uint8_t uid[64];
+	uint8_t locks[64];
+} config_sections_t;
+
+#define CONFIG_FUSES 0x01
+#define CONFIG_UID   0x02
+#define CONFIG_LOCKS 0x04
+#define CONFIG_ALL   (CONFIG_FUSES | CONFIG_UID | CONFIG_LOCKS)
+
+/* Read the config sections in 'which' selected on the command line into
+ * 'config', with as few USB round trips as the programmer allows.
+ */
+static int read_config_sections(minipro_handle_t *handle, fuse_decl_t *fuses,
+				config_sections_t *config, uint8_t which)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	uint8_t filter = cmdopts->filter_fuses + cmdopts->filter_locks +
+			 cmdopts->filter_uid;
+	size_t word_size = handle->device->flags.word_size;
+	fuse_section_t sections[3];
+	size_t count = 0;
+
+	memset(config, 0, sizeof(config_sections_t));
+	if ((which & CONFIG_FUSES) && fuses->num_fuses &&
+	    (!filter || cmdopts->filter_fuses)) {
+		sections[count].type = MP_FUSE_CFG;
+		sections[count].length = fuses->num_fuses * word_size;
+		sections[count].items_count = fuses->num_fuses;
+		sections[count++].buffer = config->fuses;
+	}
+	if ((which & CONFIG_UID) && fuses->num_uids &&
+	    (!filter || cmdopts->filter_uid)) {
+		uint8_t item_size = handle->device->flags.data_org ? 2 : 1;
+		sections[count].type = MP_FUSE_USER;
+		sections[count].length = fuses->num_uids * item_size;
+		sections[count].items_count = 0;
+		sections[count++].buffer = config->uid;
+	}
+	if ((which & CONFIG_LOCKS) && fuses->num_locks &&
+	    (!filter || cmdopts->filter_locks)) {
+		sections[count].type = MP_FUSE_LOCK;
+		sections[count].length = fuses->num_locks * word_size;
+		sections[count].items_count = word_size;
+		sections[count++].buffer = config->locks;
+	}
+	return minipro_read_fuse_sections(handle, sections, count);
+}
+
 int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 {
-	size_t i;
+	size_t i, word_size = handle->device->flags.word_size;
 	uint8_t buffer[64];
 	uint16_t value;
 	struct timeval begin, end;
@@ -1954,49 +2522,35 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 
 	gettimeofday(&begin, NULL);
 
+	config_sections_t readback;
+	if (read_config_sections(handle, fuses, &readback, CONFIG_ALL)) {
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
 	/* Read fuses section if requested */
 	if (fuses->num_fuses && (!filter || cmdopts->filter_fuses)) {
-		gettimeofday(&begin, NULL);
-		uint8_t items = fuses->num_fuses;
-
-		if (minipro_read_fuses(handle, MP_FUSE_CFG,
-				       fuses->num_fuses *
-					       handle->device->flags.word_size,
-				       items, buffer)) {
-			fclose(file);
-			return EXIT_FAILURE;
-		}
 		for (i = 0; i < fuses->num_fuses; i++) {
-			value = load_int(
-				&(buffer[i * handle->device->flags.word_size]),
-				handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
+			value = load_int(&(readback.fuses[i * word_size]),
+					 word_size, MP_LITTLE_ENDIAN);
 /* FIXME: remove this? (DG) */	/* value |= ~(fuses->fuse[i].mask); */
 			if (handle->device->compare_mask > 0xff)
 				value &= handle->device->compare_mask;
-			if (handle->device->flags.word_size == 1)
+			if (word_size == 1)
 				value &= 0xff;
 			fprintf(file,
-				handle->device->flags.word_size == 1 ?
-					"%s = 0x%02x\n" :
-					"%s = 0x%04x\n",
+				word_size == 1 ? "%s = 0x%02x\n" :
+						 "%s = 0x%04x\n",
 				fuses->fuse[i].name, value);
 		}
 	}
 
 	/* Read user id section if requested */
 	if (fuses->num_uids && (!filter || cmdopts->filter_uid)) {
-		gettimeofday(&begin, NULL);
 		uint8_t item_size = handle->device->flags.data_org ? 2 : 1;
-		if (minipro_read_fuses(handle, MP_FUSE_USER,
-				       fuses->num_uids * item_size, 0,
-				       buffer)) {
-			fclose(file);
-			return EXIT_FAILURE;
-		}
 		for (i = 0; i < fuses->num_uids; i++) {
-			value = load_int(&(buffer[i * item_size]), item_size,
-					 MP_LITTLE_ENDIAN);
+			value = load_int(&(readback.uid[i * item_size]),
+					 item_size, MP_LITTLE_ENDIAN);
 			value &= (handle->device->compare_mask);
 			fprintf(file,
 				item_size == 1 ? "%s = 0x%02x\n" :
@@ -2007,26 +2561,15 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 
 	/* Read lock section if requested */
 	if (fuses->num_locks && (!filter || cmdopts->filter_locks)) {
-		gettimeofday(&begin, NULL);
-		if (minipro_read_fuses(
-			    handle, MP_FUSE_LOCK,
-			    fuses->num_locks * handle->device->flags.word_size,
-			    handle->device->flags.word_size, buffer)) {
-			fclose(file);
-			return EXIT_FAILURE;
-		}
 		for (i = 0; i < fuses->num_locks; i++) {
-			value = load_int(
-				&(buffer[i * handle->device->flags.word_size]),
-				handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
+			value = load_int(&(readback.locks[i * word_size]),
+					 word_size, MP_LITTLE_ENDIAN);
 			value |= ~(fuses->lock[i].mask);
-			if (handle->device->flags.word_size == 1)
+			if (word_size == 1)
 				value &= 0xff;
 			fprintf(file,
-				handle->device->flags.word_size == 1 ?
-					"%s = 0x%02x\n" :
-					"%s = 0x%04x\n",
+				word_size == 1 ? "%s = 0x%02x\n" :
+						 "%s = 0x%04x\n",
 				fuses->lock[i].name, value);
 		}
 	}
@@ -2042,8 +2585,8 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 
 int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 {
-	size_t i;
-	uint8_t wbuffer[64], vbuffer[64];
+	size_t i, word_size = handle->device->flags.word_size;
+	config_sections_t written, readback;
 	uint16_t value;
 	char config[1024];
 	struct timeval begin, end;
@@ -2103,46 +2646,15 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 			value |= ~(fuses->fuse[i].mask);
 			if (handle->device->compare_mask > 0xff)
 				value &= handle->device->compare_mask;
-			if (handle->device->flags.word_size == 1)
+			if (word_size == 1)
 				value &= 0xff;
-			format_int(
-				&(wbuffer[i * handle->device->flags.word_size]),
-				value, handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
+			format_int(&(written.fuses[i * word_size]), value,
+				   word_size, MP_LITTLE_ENDIAN);
 		}
 		if (minipro_write_fuses(handle, MP_FUSE_CFG,
-					fuses->num_fuses *
-						handle->device->flags.word_size,
-					items, wbuffer))
+					fuses->num_fuses * word_size, items,
+					written.fuses))
 			return EXIT_FAILURE;
-		if (minipro_read_fuses(handle, MP_FUSE_CFG,
-				       fuses->num_fuses *
-					       handle->device->flags.word_size,
-				       items, vbuffer))
-			return EXIT_FAILURE;
-
-		/* Mask vbuffer for compare */
-		for (i = 0; i < fuses->num_fuses; i++) {
-			value = load_int(
-				&(vbuffer[i * handle->device->flags.word_size]),
-				handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
-			value |= ~(fuses->fuse[i].mask);
-			if (handle->device->compare_mask > 0xff)
-				value &= handle->device->compare_mask;
-			if (handle->device->flags.word_size == 1)
-				value &= 0xff;
-			format_int(
-				&(vbuffer[i * handle->device->flags.word_size]),
-				value, handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
-		}
-
-		if (memcmp(wbuffer, vbuffer,
-			   fuses->num_fuses *
-				   handle->device->flags.word_size)) {
-			fprintf(stderr, "\nFuses verify error!\n");
-		}
 		gettimeofday(&end, NULL);
 		fprintf(stderr, "%.2fSec  OK\n",
 			(double)(end.tv_usec - begin.tv_usec) / 1000000 +
@@ -2150,11 +2662,11 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 	}
 
 	/* Write user id section if requested */
+	uint8_t item_size = handle->device->flags.data_org ? 2 : 1;
 	if (fuses->num_uids && (!filter || section->filter_uid)) {
 		gettimeofday(&begin, NULL);
 		fprintf(stderr, "Writing user id... ");
 		fflush(stderr);
-		uint8_t item_size = handle->device->flags.data_org ? 2 : 1;
 		for (i = 0; i < fuses->num_uids; i++) {
 			if (get_config_value(config, user_id[i], &value) ==
 			    EXIT_FAILURE) {
@@ -2164,33 +2676,59 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				return EXIT_FAILURE;
 			}
 			value &= (handle->device->compare_mask);
-			format_int(&(wbuffer[i * item_size]), value, item_size,
-				   MP_LITTLE_ENDIAN);
+			format_int(&(written.uid[i * item_size]), value,
+				   item_size, MP_LITTLE_ENDIAN);
 		}
 		if (minipro_write_fuses(handle, MP_FUSE_USER,
 					fuses->num_uids * item_size, item_size,
-					wbuffer))
-			return EXIT_FAILURE;
-		if (minipro_read_fuses(handle, MP_FUSE_USER,
-				       fuses->num_uids * item_size, 0, vbuffer))
+					written.uid))
 			return EXIT_FAILURE;
+		gettimeofday(&end, NULL);
+		fprintf(stderr, "%.2fSec  OK\n",
+			(double)(end.tv_usec - begin.tv_usec) / 1000000 +
+				(double)(end.tv_sec - begin.tv_sec));
+	}
 
-		/* Mask vbuffer for compare */
+	/* Read the fuses and the user id back before the lock bits are
+	 * written, as these can block reading the config */
+	if (read_config_sections(handle, fuses, &readback,
+				 CONFIG_FUSES | CONFIG_UID))
+		return EXIT_FAILURE;
+
+	if (fuses->num_fuses && (!filter || section->filter_fuses)) {
+		/* Mask the read back fuses for compare */
+		for (i = 0; i < fuses->num_fuses; i++) {
+			value = load_int(&(readback.fuses[i * word_size]),
+					 word_size, MP_LITTLE_ENDIAN);
+			value |= ~(fuses->fuse[i].mask);
+			if (handle->device->compare_mask > 0xff)
+				value &= handle->device->compare_mask;
+			if (word_size == 1)
+				value &= 0xff;
+			format_int(&(readback.fuses[i * word_size]), value,
+				   word_size, MP_LITTLE_ENDIAN);
+		}
+
+		if (memcmp(written.fuses, readback.fuses,
+			   fuses->num_fuses * word_size)) {
+			fprintf(stderr, "Fuses verify error!\n");
+		}
+	}
+
+	if (fuses->num_uids && (!filter || section->filter_uid)) {
+		/* Mask the read back user id for compare */
 		for (i = 0; i < fuses->num_uids; i++) {
-			value = load_int(&(vbuffer[i * item_size]), item_size,
-					 MP_LITTLE_ENDIAN);
+			value = load_int(&(readback.uid[i * item_size]),
+					 item_size, MP_LITTLE_ENDIAN);
 			value &= (handle->device->compare_mask);
-			format_int(&(vbuffer[i * item_size]), value, item_size,
-				   MP_LITTLE_ENDIAN);
+			format_int(&(readback.uid[i * item_size]), value,
+				   item_size, MP_LITTLE_ENDIAN);
 		}
 
-		if (memcmp(wbuffer, vbuffer, fuses->num_uids * item_size)) {
-			fprintf(stderr, "\nUser ID verify error!\n");
+		if (memcmp(written.uid, readback.uid,
+			   fuses->num_uids * item_size)) {
+			fprintf(stderr, "User ID verify error!\n");
 		}
-		gettimeofday(&end, NULL);
-		fprintf(stderr, "%.2fSec  OK\n",
-			(double)(end.tv_usec - begin.tv_usec) / 1000000 +
-				(double)(end.tv_sec - begin.tv_sec));
 	}
 
 	/* Write lock section if requested */
@@ -2207,52 +2745,41 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				return EXIT_FAILURE;
 			}
 			value |= ~(fuses->lock[i].mask);
-			format_int(
-				&(wbuffer[i * handle->device->flags.word_size]),
-				value, handle->device->flags.word_size,
-				MP_LITTLE_ENDIAN);
-		}
-		if (minipro_write_fuses(
-			    handle, MP_FUSE_LOCK,
-			    fuses->num_locks * handle->device->flags.word_size,
-			    handle->device->flags.word_size, wbuffer))
-			return EXIT_FAILURE;
-		if (!handle->device->flags.lock_bit_write_only) {
-			if (minipro_read_fuses(
-				    handle, MP_FUSE_LOCK,
-				    fuses->num_locks *
-					    handle->device->flags.word_size,
-				    handle->device->flags.word_size, vbuffer))
-				return EXIT_FAILURE;
-
-			/* Mask vbuffer for compare */
-			for (i = 0; i < fuses->num_locks; i++) {
-				value = load_int(
-					&(vbuffer[i * handle->device->flags
-							      .word_size]),
-					handle->device->flags.word_size,
-					MP_LITTLE_ENDIAN);
-				value |= ~(fuses->lock[i].mask);
-				if (handle->device->flags.word_size == 1)
-					value &= 0xff;
-				format_int(&(vbuffer[i * handle->device->flags
-								 .word_size]),
-					   value,
-					   handle->device->flags.word_size,
-					   MP_LITTLE_ENDIAN);
-			}
-
-			if (memcmp(wbuffer, vbuffer,
-				   fuses->num_locks *
-					   handle->device->flags.word_size)) {
-				fprintf(stderr, "\nLock bits verify error!\n");
-			}
+			format_int(&(written.locks[i * word_size]), value,
+				   word_size, MP_LITTLE_ENDIAN);
 		}
+		if (minipro_write_fuses(handle, MP_FUSE_LOCK,
+					fuses->num_locks * word_size,
+					word_size, written.locks))
+			return EXIT_FAILURE;
 		gettimeofday(&end, NULL);
 		fprintf(stderr, "%.2fSec  OK\n",
 			(double)(end.tv_usec - begin.tv_usec) / 1000000 +
 				(double)(end.tv_sec - begin.tv_sec));
 	}
+
+	if (fuses->num_locks && (!filter || section->filter_locks) &&
+	    !handle->device->flags.lock_bit_write_only) {
+		if (read_config_sections(handle, fuses, &readback,
+					 CONFIG_LOCKS))
+			return EXIT_FAILURE;
+
+		/* Mask the read back lock bits for compare */
+		for (i = 0; i < fuses->num_locks; i++) {
+			value = load_int(&(readback.locks[i * word_size]),
+					 word_size, MP_LITTLE_ENDIAN);
+			value |= ~(fuses->lock[i].mask);
+			if (word_size == 1)
+				value &= 0xff;
+			format_int(&(readback.locks[i * word_size]), value,
+				   word_size, MP_LITTLE_ENDIAN);
+		}
+
+		if (memcmp(written.locks, readback.locks,
+			   fuses->num_locks * word_size)) {
+			fprintf(stderr, "Lock bits verify error!\n");
+		}
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -2293,9 +2820,12 @@ int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 		return EXIT_FAILURE;
 	}
 
+	config_sections_t readback;
+	if (read_config_sections(handle, fuses, &readback, CONFIG_ALL))
+		return EXIT_FAILURE;
+
 	/* Verify/Blank check fuses section if requested */
 	if (fuses->num_fuses && (!filter || section->filter_fuses)) {
-		uint8_t items = fuses->num_fuses;
 		for (i = 0; i < fuses->num_fuses; i++) {
 			value = fuses->fuse[i].def;
 			if (handle->cmdopts->filename &&
@@ -2316,11 +2846,8 @@ int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				value, handle->device->flags.word_size,
 				MP_LITTLE_ENDIAN);
 		}
-		if (minipro_read_fuses(handle, MP_FUSE_CFG,
-				       fuses->num_fuses *
-					       handle->device->flags.word_size,
-				       items, vbuffer))
-			return EXIT_FAILURE;
+		memcpy(vbuffer, readback.fuses,
+		       fuses->num_fuses * handle->device->flags.word_size);
 
 		/* Mask vbuffer for compare */
 		for (i = 0; i < fuses->num_fuses; i++) {
@@ -2371,9 +2898,7 @@ int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 			format_int(&(wbuffer[i * item_size]), value, item_size,
 				   MP_LITTLE_ENDIAN);
 		}
-		if (minipro_read_fuses(handle, MP_FUSE_USER,
-				       fuses->num_uids * item_size, 0, vbuffer))
-			return EXIT_FAILURE;
+		memcpy(vbuffer, readback.uid, fuses->num_uids * item_size);
 
 		/* Mask buffer for compare */
 		for (i = 0; i < fuses->num_uids; i++) {
@@ -2417,11 +2942,8 @@ int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				value, handle->device->flags.word_size,
 				MP_LITTLE_ENDIAN);
 		}
-		if (minipro_read_fuses(
-			    handle, MP_FUSE_LOCK,
-			    fuses->num_locks * handle->device->flags.word_size,
-			    handle->device->flags.word_size, vbuffer))
-			return EXIT_FAILURE;
+		memcpy(vbuffer, readback.locks,
+		       fuses->num_locks * handle->device->flags.word_size);
 
 		/* Mask vbuffer for compare */
 		for (i = 0; i < fuses->num_locks; i++) {
@@ -2471,6 +2993,11 @@ char *get_default_filename(const char *filename)
 int action_read(minipro_handle_t *handle)
 {
 	jedec_t jedec;
+	if (handle->device->chip_type == MP_PLD &&
+	    handle->cmdopts->crc32_check) {
+		fprintf(stderr, "--crc32 can't be used with PLD devices.\n");
+		return EXIT_FAILURE;
+	}
 	if (minipro_begin_transaction(handle))
 		return EXIT_FAILURE;
 	if (handle->device->chip_type == MP_PLD) {
@@ -2479,12 +3006,10 @@ int action_read(minipro_handle_t *handle)
 			fprintf(stderr, "Unknown fuse size!\n");
 			return EXIT_FAILURE;
 		}
-		jedec.fuses = malloc(jedec.QF);
-		if (!jedec.fuses) {
+		if (jedec_alloc_fuses(&jedec, 0)) {
 			fprintf(stderr, "Out of memory\n");
 			return EXIT_FAILURE;
 		}
-		memset(jedec.fuses, 0, jedec.QF);
 		jedec.F = 0;
 		jedec.G = 0;
 		jedec.QP = handle->device->package_details.pin_count;
@@ -2657,56 +3182,48 @@ int action_write(minipro_handle_t *handle)
 		if (open_jed_file(handle, &wjedec))
 			return EXIT_FAILURE;
 
-		if (minipro_begin_transaction(handle)) {
-			free(wjedec.fuses);
-			return EXIT_FAILURE;
-		}
-		if (erase_device(handle)) {
-			free(wjedec.fuses);
-			return EXIT_FAILURE;
-		}
-		if (write_jedec(handle, &wjedec)) {
-			free(wjedec.fuses);
-			return EXIT_FAILURE;
-		}
-		if (minipro_end_transaction(handle)) {
-			free(wjedec.fuses);
-			return EXIT_FAILURE;
-		}
-		if (handle->cmdopts->no_verify == 0) {
+		/* The read back fuse map, filled while writing with
+		 * --verify_rows or by a second pass otherwise. */
+		int verify = !handle->cmdopts->no_verify;
+		int verify_rows = verify && handle->cmdopts->verify_rows;
+		rjedec.fuses = NULL;
+		if (verify) {
 			rjedec.QF = handle->device->code_memory_size;
 			rjedec.F = wjedec.F;
-			rjedec.fuses = malloc(rjedec.QF);
-			if (!rjedec.fuses) {
+			if (jedec_alloc_fuses(&rjedec, 0)) {
 				free(wjedec.fuses);
 				return EXIT_FAILURE;
 			}
+		}
+
+		if (minipro_begin_transaction(handle) ||
+		    erase_device(handle) ||
+		    write_jedec(handle, &wjedec,
+				verify_rows ? &rjedec : NULL) ||
+		    minipro_end_transaction(handle)) {
+			free(wjedec.fuses);
+			free(rjedec.fuses);
+			return EXIT_FAILURE;
+		}
+		if (verify && !verify_rows) {
 			/* compare fuses */
-			if (minipro_begin_transaction(handle)) {
+			if (minipro_begin_transaction(handle) ||
+			    read_jedec(handle, &rjedec) ||
+			    minipro_end_transaction(handle)) {
 				free(wjedec.fuses);
 				free(rjedec.fuses);
 				return EXIT_FAILURE;
 			}
-			if (read_jedec(handle, &rjedec)) {
-				free(wjedec.fuses);
-				free(rjedec.fuses);
-				return EXIT_FAILURE;
-			}
-			if (minipro_end_transaction(handle)) {
-				free(wjedec.fuses);
-				free(rjedec.fuses);
-				return EXIT_FAILURE;
-			}
-			ret = compare_memory(0x01, wjedec.fuses, rjedec.fuses,
-					     wjedec.QF, rjedec.QF, &address,
-					     &c1, &c2);
+		}
+		if (verify) {
+			ret = jedec_compare_fuses(&wjedec, &rjedec, &address,
+						  &c1, &c2);
 
 			/* The error output is delayed until the security
 			 * fuse has been written to avoid a 99% correctly
 			 * programmed chip without the security fuse. */
-
-			free(rjedec.fuses);
 		}
+		free(rjedec.fuses);
 		free(wjedec.fuses);
 
 		if (handle->cmdopts->protect_on) {
@@ -2740,14 +3257,21 @@ int action_write(minipro_handle_t *handle)
 
 		return EXIT_SUCCESS;
 	} else {
-		/* No GAL devices */
-		if (minipro_begin_transaction(handle))
+		/* No GAL devices. The file may be loaded while the
+		 * transaction is set up. */
+		write_prep_t prep;
+		if (start_write_prep(handle, &prep))
 			return EXIT_FAILURE;
+		if (minipro_begin_transaction(handle)) {
+			free_write_prep(&prep);
+			return EXIT_FAILURE;
+		}
 		switch (handle->cmdopts->page) {
 		case UNSPECIFIED:
 		case CODE:
 			if (write_page_file(handle, MP_CODE,
-					    handle->device->code_memory_size))
+					    handle->device->code_memory_size,
+					    &prep))
 				return EXIT_FAILURE;
 			break;
 		case DATA:
@@ -2757,7 +3281,8 @@ int action_write(minipro_handle_t *handle)
 				return EXIT_FAILURE;
 			}
 			if (write_page_file(handle, MP_DATA,
-					    handle->device->data_memory_size))
+					    handle->device->data_memory_size,
+					    &prep))
 				return EXIT_FAILURE;
 			break;
 		case USER:
@@ -2767,7 +3292,8 @@ int action_write(minipro_handle_t *handle)
 				return EXIT_FAILURE;
 			}
 			if (write_page_file(handle, MP_USER,
-					    handle->device->data_memory2_size))
+					    handle->device->data_memory2_size,
+					    &prep))
 				return EXIT_FAILURE;
 			break;
 		case CONFIG:
@@ -2803,6 +3329,11 @@ int action_verify(minipro_handle_t *handle)
 	int ret = EXIT_SUCCESS;
 
 	if (handle->device->chip_type == MP_PLD) {
+		if (handle->cmdopts->crc32_check) {
+			fprintf(stderr,
+				"--crc32 can't be used with PLD devices.\n");
+			return EXIT_FAILURE;
+		}
 		if (handle->cmdopts->filename) {
 			if (open_jed_file(handle, &wjedec))
 				return EXIT_FAILURE;
@@ -2811,8 +3342,8 @@ int action_verify(minipro_handle_t *handle)
 		else {
 			wjedec.QF = handle->device->code_memory_size;
 			wjedec.F = 0x01;
-			wjedec.fuses = malloc(wjedec.QF);
-			memset(wjedec.fuses, 0x01, wjedec.QF);
+			if (jedec_alloc_fuses(&wjedec, 1))
+				return EXIT_FAILURE;
 		}
 
 		if (minipro_begin_transaction(handle)) {
@@ -2822,8 +3353,7 @@ int action_verify(minipro_handle_t *handle)
 
 		rjedec.QF = handle->device->code_memory_size;
 		rjedec.F = wjedec.F;
-		rjedec.fuses = malloc(rjedec.QF);
-		if (!rjedec.fuses) {
+		if (jedec_alloc_fuses(&rjedec, 0)) {
 			free(wjedec.fuses);
 			return EXIT_FAILURE;
 		}
@@ -2846,8 +3376,8 @@ int action_verify(minipro_handle_t *handle)
 		uint8_t c1, c2;
 		uint32_t address;
 
-		if (compare_memory(0x01, wjedec.fuses, rjedec.fuses, wjedec.QF,
-				   rjedec.QF, &address, &c1, &c2)) {
+		if (jedec_compare_fuses(&wjedec, &rjedec, &address, &c1,
+					&c2)) {
 			if (handle->cmdopts->filename) {
 				fprintf(stderr,
 					"Verification failed at address 0x%04X: File=0x%02X, "
@@ -2867,6 +3397,21 @@ int action_verify(minipro_handle_t *handle)
 		}
 		free(rjedec.fuses);
 		free(wjedec.fuses);
+	} else if (handle->cmdopts->crc32_check) {
+		/* Checksum verify of one memory section */
+		uint8_t type = crc32_page_type(handle->cmdopts);
+		size_t size = handle->device->code_memory_size;
+		if (type == MP_DATA)
+			size = handle->device->data_memory_size;
+		else if (type == MP_USER)
+			size = handle->device->data_memory2_size;
+		if (handle->cmdopts->page == CONFIG || !size) {
+			fprintf(stderr, "No such section to check.\n");
+			return EXIT_FAILURE;
+		}
+		if (minipro_begin_transaction(handle))
+			return EXIT_FAILURE;
+		ret = verify_page_crc32(handle, type, size);
 	} else {
 		/* No GAL devices */
 
@@ -2936,80 +3481,101 @@ int action_verify(minipro_handle_t *handle)
 	return ret;
 }
 
-int main(int argc, char **argv)
+/* Check the command line of a programming job.
+ * Returns -1 if the usage has to be printed.
+ */
+static int check_cmdline(cmdopts_t *cmdopts)
 {
-#ifdef _WIN32
-	system(" "); /* If we are in windows start the VT100 support */
-	/* Set the Windows translation mode to binary */
-	setmode(STDOUT_FILENO, O_BINARY);
-	setmode(STDIN_FILENO, O_BINARY);
-#endif
-
-	cmdopts_t cmdopts;
-	parse_cmdline(argc, argv, &cmdopts);
-
 	/* Check if a file name is required */
-	switch (cmdopts.action) {
+	switch (cmdopts->action) {
 	case LOGIC_IC_TEST:
 		break;
+	case VERIFY:
+		/* --crc32 verifies without a file */
+		if (cmdopts->crc32_check) {
+			if (cmdopts->filename) {
+				fprintf(stderr,
+					"Verify either against a file or with --crc32.\n");
+				return -1;
+			}
+			break;
+		}
+		/* fall through */
 	case READ:
 	case WRITE:
-	case VERIFY:
-		if (!cmdopts.filename && !cmdopts.idcheck_only) {
+		if (!cmdopts->filename && !cmdopts->idcheck_only) {
 			fprintf(stderr,
 				"A file name is required for this action.\n");
-			print_help_and_exit(argv[0]);
+			return -1;
 		}
 		break;
 	default:
 		break;
 	}
 
+	if (cmdopts->crc32_check && cmdopts->action != READ &&
+	    cmdopts->action != VERIFY) {
+		fprintf(stderr,
+			"--crc32 can only be used to read or verify.\n");
+		return -1;
+	}
+
 	/* Check if a device name is required */
-	if (!cmdopts.device_name) {
+	if (!cmdopts->device_name && !cmdopts->auto_detect) {
 		fprintf(stderr,
 			"Device required. Use -p <device> to specify a device.\n");
-		print_help_and_exit(argv[0]);
+		return -1;
 	}
 
 	/* don't permit skipping the ID read in write/erase-mode or ID
 	 * only mode */
-	if ((cmdopts.action == WRITE || cmdopts.action == ERASE ||
-	     cmdopts.idcheck_only) &&
-	    cmdopts.idcheck_skip) {
+	if ((cmdopts->action == WRITE || cmdopts->action == ERASE ||
+	     cmdopts->idcheck_only) &&
+	    cmdopts->idcheck_skip) {
 		fprintf(stderr,
 			"Skipping the ID check is not permitted for this action.\n");
-		print_help_and_exit(argv[0]);
+		return -1;
 	}
 
 	/* Exit if no action is supplied */
-	if (cmdopts.action == NO_ACTION && !cmdopts.idcheck_only &&
-	    !cmdopts.pincheck) {
+	if (cmdopts->action == NO_ACTION && !cmdopts->idcheck_only &&
+	    !cmdopts->pincheck) {
 		fprintf(stderr, "No action to perform.\n");
-		print_help_and_exit(argv[0]);
+		return -1;
+	}
+
+	/* A session is either recorded or replayed, and only by one
+	 * programmer */
+	if (cmdopts->record && cmdopts->replay) {
+		fprintf(stderr, "--record and --replay can't be combined.\n");
+		return -1;
+	}
+	if (cmdopts->replay && cmdopts->gang) {
+		fprintf(stderr, "A session can't be replayed in gang mode.\n");
+		return -1;
 	}
 
 	/* Set the pipe flag */
-	if (cmdopts.filename)
-		cmdopts.is_pipe = (!strcmp(cmdopts.filename, "-"));
+	if (cmdopts->filename)
+		cmdopts->is_pipe = (!strcmp(cmdopts->filename, "-"));
+	return EXIT_SUCCESS;
+}
 
-	/* get a handle */
-	minipro_handle_t *handle = minipro_open(VERBOSE);
-	if (!handle)
-		return EXIT_FAILURE;
-	handle->cmdopts = &cmdopts;
+/* Run a programming job on the open programmer, handle->cmdopts holds the
+ * parsed command line. Returns -1 if the usage has to be printed.
+ */
+static int run_job(minipro_handle_t *handle, int argc, char **argv)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
 
 	/* Get the requested device */
-	if (get_device(handle)) {
-		minipro_close(handle);
+	if (get_device(handle))
 		return EXIT_FAILURE;
-	}
 
 	/* Exit if bootloader is active */
 	minipro_print_system_info(handle);
 	if (handle->status == MP_STATUS_BOOTLOADER) {
 		fprintf(stderr, "in bootloader mode!\nExiting...\n");
-		minipro_close(handle);
 		return EXIT_FAILURE;
 	}
 
@@ -3017,43 +3583,46 @@ int main(int argc, char **argv)
 	if (parse_options(handle, argc, argv)) {
 		if (strlen(optarg))
 			fprintf(stderr, "Invalid option '%s'\n", optarg);
-		minipro_close(handle);
-		print_help_and_exit(argv[0]);
+		return -1;
 	}
 
-	if (cmdopts.pincheck) {
-		if (handle->version == MP_TL866IIPLUS && !cmdopts.icsp) {
+	if (cmdopts->pincheck) {
+		if (handle->version == MP_TL866IIPLUS && !cmdopts->icsp) {
 			if (minipro_pin_test(handle)) {
 				minipro_end_transaction(handle);
-				minipro_close(handle);
 				return EXIT_FAILURE;
 			}
 		} else
 			fprintf(stderr, "Pin test is not supported.\n");
-		if (cmdopts.action == NO_ACTION && !cmdopts.idcheck_only)
+		if (cmdopts->action == NO_ACTION && !cmdopts->idcheck_only)
 			return EXIT_SUCCESS;
 	}
 
-	if (cmdopts.action == LOGIC_IC_TEST) {
-		if (minipro_logic_ic_test(handle)) {
-			minipro_close(handle);
+	if (cmdopts->action == LOGIC_IC_TEST) {
+		struct timeval begin, end;
+		gettimeofday(&begin, NULL);
+		if (minipro_logic_ic_test(handle))
 			return EXIT_FAILURE;
-		}
-		minipro_close(handle);
+		gettimeofday(&end, NULL);
+		fprintf(stderr, "Logic test time: %.2fSec\n",
+			(double)(end.tv_usec - begin.tv_usec) / 1000000 +
+				(double)(end.tv_sec - begin.tv_sec));
 		return EXIT_SUCCESS;
 	}
 
 	/* Check for GAL/PLD */
 	if (handle->device->chip_type != MP_PLD &&
 	    !handle->device->read_buffer_size) {
-		minipro_close(handle);
 		fprintf(stderr, "Unsupported device!\n");
 		return EXIT_FAILURE;
 	}
 
-	/* Check for NAND devices */
+	/* Check for NAND devices. The host side is in nand.c (bad block
+	 * table, skip-bad and raw layouts, ECC worker), but the page, spare
+	 * area and status commands of the NAND firmware protocol are not
+	 * known yet, only the geometry from the database is (see -d).
+	 */
 	if (handle->device->chip_type == MP_NAND) {
-		minipro_close(handle);
 		fprintf(stderr, "NAND chips not supported yet.\n");
 		return EXIT_FAILURE;
 	}
@@ -3064,10 +3633,8 @@ int main(int argc, char **argv)
 	case TSOP48_ADAPTER:
 	case SOP44_ADAPTER:
 	case SOP56_ADAPTER:
-		if (minipro_unlock_tsop48(handle, &status)) {
-			minipro_close(handle);
+		if (minipro_unlock_tsop48(handle, &status))
 			return EXIT_FAILURE;
-		}
 		switch (status) {
 		case MP_TSOP48_TYPE_V3:
 			fprintf(stderr, "Found TSOP adapter V3\n");
@@ -3075,7 +3642,6 @@ int main(int argc, char **argv)
 		case MP_TSOP48_TYPE_NONE:
 			/* Needed to turn off the power on the ZIF socket. */
 			minipro_end_transaction(handle);
-			minipro_close(handle);
 			fprintf(stderr, "TSOP adapter not found!\n");
 			return EXIT_FAILURE;
 		case MP_TSOP48_TYPE_V0:
@@ -3097,28 +3663,22 @@ int main(int argc, char **argv)
 		handle->cmdopts->icsp = 0x00;
 	if (handle->cmdopts->icsp)
 		fprintf(stderr, "Activating ICSP...\n");
-	if (cmdopts.icsp && handle->device->flags.prog_support == MP_ZIF_ONLY)
+	if (cmdopts->icsp && handle->device->flags.prog_support == MP_ZIF_ONLY)
 		fprintf(stderr,
 			"Warning: ICSP is not supported by this chip.\n");
 
 	uint8_t id_type;
 	/* Verifying Chip ID (if applicable) */
-	if (cmdopts.idcheck_skip) {
+	if (cmdopts->idcheck_skip) {
 		fprintf(stderr, "WARNING: skipping Chip ID test\n");
 	} else if (handle->device->flags.has_chip_id) {
-		if (minipro_begin_transaction(handle)) {
-			minipro_close(handle);
+		if (minipro_begin_transaction(handle))
 			return EXIT_FAILURE;
-		}
 		uint32_t chip_id;
-		if (minipro_get_chip_id(handle, &id_type, &chip_id)) {
-			minipro_close(handle);
+		if (minipro_get_chip_id(handle, &id_type, &chip_id))
 			return EXIT_FAILURE;
-		}
-		if (minipro_end_transaction(handle)) {
-			minipro_close(handle);
+		if (minipro_end_transaction(handle))
 			return EXIT_FAILURE;
-		}
 		uint32_t chip_id_temp = chip_id;
 		uint8_t shift = 0;
 		fuse_decl_t *config = ((fuse_decl_t *)handle->device->config);
@@ -3167,32 +3727,29 @@ int main(int argc, char **argv)
 			break;
 		}
 
-		if (cmdopts.idcheck_only && ok) {
-			minipro_close(handle);
+		if (cmdopts->idcheck_only && ok)
 			return EXIT_SUCCESS;
-		}
 
 		if (!ok) {
 			db_data_t db_data;
 			memset(&db_data, 0, sizeof(db_data));
-			db_data.logicic_path = cmdopts.logicic_path;
-			db_data.infoic_path = cmdopts.infoic_path;
+			db_data.logicic_path = cmdopts->logicic_path;
+			db_data.infoic_path = cmdopts->infoic_path;
 			db_data.version = handle->version;
 			db_data.chip_id = chip_id_temp;
 			db_data.protocol = handle->device->protocol_id;
 			const char *name = get_device_from_id(&db_data);
-			if (cmdopts.idcheck_only) {
+			if (cmdopts->idcheck_only) {
 				fprintf(stderr,
 					"Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
 					handle->device->chip_id >> shift,
 					chip_id_temp >> shift,
 					name ? name : "unknown");
-				minipro_close(handle);
 				if (name)
 					free((char *)name);
 				return EXIT_FAILURE;
 			}
-			if (cmdopts.idcheck_continue) {
+			if (cmdopts->idcheck_continue) {
 				fprintf(stderr,
 					"WARNING: Chip ID mismatch: expected 0x%04X, got 0x%04X (%s)\n",
 					handle->device->chip_id >> shift,
@@ -3205,7 +3762,6 @@ int main(int argc, char **argv)
 					handle->device->chip_id >> shift,
 					chip_id_temp >> shift,
 					name ? name : "unknown");
-				minipro_close(handle);
 				if (name)
 					free((char *)name);
 				return EXIT_FAILURE;
@@ -3214,22 +3770,20 @@ int main(int argc, char **argv)
 				free((char *)name);
 		}
 
-	} else if (cmdopts.idcheck_only) {
-		minipro_close(handle);
+	} else if (cmdopts->idcheck_only) {
 		fprintf(stderr, "This chip doesn't have a chip ID!\n");
 		return EXIT_FAILURE;
 	}
 
 	/* Performing requested action */
 	int ret;
-	switch (cmdopts.action) {
+	switch (cmdopts->action) {
 	case READ:
 		ret = action_read(handle);
 		break;
 	case WRITE:
 		if (handle->device->flags.prog_support == MP_READ_ONLY) {
 			fprintf(stderr, "Read-only chip.\n");
-			minipro_close(handle);
 			return EXIT_FAILURE;
 		}
 		/* Print a warning about write-protection */
@@ -3253,13 +3807,10 @@ int main(int argc, char **argv)
 	case ERASE:
 		if (!handle->device->flags.can_erase) {
 			fprintf(stderr, "This chip can't be erased!\n");
-			minipro_close(handle);
 			return EXIT_FAILURE;
 		}
-		if (minipro_begin_transaction(handle)) {
-			minipro_close(handle);
+		if (minipro_begin_transaction(handle))
 			return EXIT_FAILURE;
-		}
 		ret = erase_device(handle);
 		break;
 	default:
@@ -3267,10 +3818,655 @@ int main(int argc, char **argv)
 		break;
 	}
 
-	if (minipro_end_transaction(handle)) {
+	if (minipro_end_transaction(handle))
+		return EXIT_FAILURE;
+	return ret;
+}
+
+/*
+ * Gang mode.
+ * The same job is run on several programmers at once. Each programmer gets
+ * a worker process of its own, so it also has its own libusb context,
+ * minipro handle and driver state. The worker output is prefixed with the
+ * programmer serial number and a pass/fail summary is printed at the end.
+ */
+#ifndef _WIN32
+#define GANG_MAX_UNITS 32
+
+typedef struct gang_unit {
+	char name[32];
+	char path[32]; /* USB port path the worker opens, empty if unknown */
+	pid_t pid;
+	int fd;
+	int status;
+	char line[256];
+	size_t len;
+	struct timeval begin, end;
+} gang_unit_t;
+
+/* Print the worker output line by line, only the last state of the
+ * progress indicators is kept */
+static void gang_output(gang_unit_t *unit, char *buf, size_t size, int flush)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (buf[i] == '\r') {
+			unit->len = 0;
+		} else if (buf[i] != '\n' && unit->len < sizeof(unit->line) - 1) {
+			unit->line[unit->len++] = buf[i];
+		} else if (buf[i] == '\n') {
+			fprintf(stderr, "[%s] %.*s\n", unit->name,
+				(int)unit->len, unit->line);
+			unit->len = 0;
+		}
+	}
+	if (flush && unit->len) {
+		fprintf(stderr, "[%s] %.*s\n", unit->name, (int)unit->len,
+			unit->line);
+		unit->len = 0;
+	}
+}
+
+/* Get the programmer list, a comma separated list or "all". Every
+ * programmer is resolved to its USB port path here, before the workers
+ * start, so a worker opens its own programmer and no other one.
+ */
+static size_t gang_units(const char *list, gang_unit_t *units)
+{
+	static gang_unit_t found[GANG_MAX_UNITS];
+	size_t count = 0, found_count = 0, i;
+
+	while (found_count < GANG_MAX_UNITS &&
+	       !minipro_get_unit(found_count, found[found_count].name,
+				 found[found_count].path,
+				 sizeof(found->name)))
+		found_count++;
+
+	if (!strcasecmp(list, "all")) {
+		for (size_t j = 0; j < found_count; j++) {
+			/* Without a serial number or port path it can't be
+			 * selected */
+			if (!found[j].name[0] && !found[j].path[0])
+				continue;
+			units[count] = found[j];
+			/* Use the port path if the serial number is not
+			 * unique */
+			for (i = 0; i < count; i++) {
+				if (!strcmp(units[i].name, units[count].name))
+					break;
+			}
+			if ((i < count || !units[count].name[0]) &&
+			    units[count].path[0])
+				strcpy(units[count].name, units[count].path);
+			count++;
+		}
+		return count;
+	}
+	while (*list && count < GANG_MAX_UNITS) {
+		size_t len = strcspn(list, ",");
+		if (len && len < sizeof(units[count].name)) {
+			memcpy(units[count].name, list, len);
+			units[count].name[len] = '\0';
+			units[count].path[0] = '\0';
+			for (i = 0; i < found_count; i++) {
+				if (!strcmp(found[i].name, units[count].name) ||
+				    !strcmp(found[i].path, units[count].name)) {
+					strcpy(units[count].path,
+					       found[i].path);
+					break;
+				}
+			}
+			count++;
+		}
+		list += len;
+		if (*list)
+			list++;
+	}
+	return count;
+}
+
+/* Start the workers and wait for them. Returns in each worker with
+ * 'worker' set and the programmer selected, the caller then runs the job.
+ */
+static int run_gang(cmdopts_t *cmdopts, int *worker)
+{
+	static gang_unit_t units[GANG_MAX_UNITS];
+	static char filename[PATH_MAX];
+	static char stats[PATH_MAX];
+	static char trace[PATH_MAX];
+	static char record[PATH_MAX];
+	size_t count, i, running = 0, passed = 0;
+
+	*worker = 0;
+	if (cmdopts->is_pipe) {
+		fprintf(stderr, "Pipes can't be used in gang mode.\n");
+		return EXIT_FAILURE;
+	}
+	count = gang_units(cmdopts->gang, units);
+	if (!count) {
+		fprintf(stderr, "No programmer found.\n");
+		return EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < count; i++) {
+		int fds[2];
+		if (pipe(fds)) {
+			perror("pipe");
+			break;
+		}
+		gettimeofday(&units[i].begin, NULL);
+		units[i].pid = fork();
+		if (units[i].pid < 0) {
+			perror("fork");
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		if (!units[i].pid) {
+			/* Worker */
+			for (size_t j = 0; j < i; j++)
+				close(units[j].fd);
+			close(fds[0]);
+			dup2(fds[1], STDERR_FILENO);
+			close(fds[1]);
+			minipro_select_unit(units[i].path[0] ? units[i].path :
+								units[i].name);
+			/* Each programmer reads into a file of its own */
+			if (cmdopts->action == READ && cmdopts->filename) {
+				snprintf(filename, sizeof(filename), "%s.%s",
+					 cmdopts->filename, units[i].name);
+				cmdopts->filename = filename;
+			}
+			/* And reports its own statistics */
+			if (cmdopts->stats) {
+				snprintf(stats, sizeof(stats), "%s.%s",
+					 cmdopts->stats, units[i].name);
+				cmdopts->stats = stats;
+			}
+			if (cmdopts->trace) {
+				snprintf(trace, sizeof(trace), "%s.%s",
+					 cmdopts->trace, units[i].name);
+				cmdopts->trace = trace;
+			}
+			if (cmdopts->record) {
+				snprintf(record, sizeof(record), "%s.%s",
+					 cmdopts->record, units[i].name);
+				cmdopts->record = record;
+			}
+			*worker = 1;
+			return EXIT_SUCCESS;
+		}
+		close(fds[1]);
+		units[i].fd = fds[0];
+		running++;
+	}
+	count = i;
+
+	/* Collect the worker output */
+	struct pollfd fds[GANG_MAX_UNITS];
+	while (running) {
+		for (i = 0; i < count; i++) {
+			fds[i].fd = units[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (poll(fds, count, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			char buf[1024];
+			if (!fds[i].revents || units[i].fd < 0)
+				continue;
+			ssize_t len = read(units[i].fd, buf, sizeof(buf));
+			if (len > 0) {
+				gang_output(&units[i], buf, len, 0);
+				continue;
+			}
+			gang_output(&units[i], buf, 0, 1);
+			close(units[i].fd);
+			units[i].fd = -1;
+			waitpid(units[i].pid, &units[i].status, 0);
+			gettimeofday(&units[i].end, NULL);
+			running--;
+		}
+	}
+
+	/* Print the summary */
+	fprintf(stderr, "\nGang summary:\n");
+	for (i = 0; i < count; i++) {
+		int ok = WIFEXITED(units[i].status) &&
+			 WEXITSTATUS(units[i].status) == EXIT_SUCCESS;
+		double seconds =
+			(double)(units[i].end.tv_usec - units[i].begin.tv_usec) /
+				1000000 +
+			(double)(units[i].end.tv_sec - units[i].begin.tv_sec);
+		fprintf(stderr, "  %-24s %s  %.2fSec\n", units[i].name,
+			ok ? "PASS" : "FAIL", seconds);
+		passed += ok;
+	}
+	fprintf(stderr, "%zu of %zu programmers passed.\n", passed, count);
+	return passed == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
+/*
+ * Server mode.
+ * The server keeps the programmer open and runs the jobs (a minipro
+ * command line) sent by clients over a Unix socket one after another, so
+ * the programmer setup is done only once.
+ *
+ * Request: payload length (4 bytes, little endian), then the client working
+ * directory and the command line arguments as NUL terminated strings.
+ * Reply: the job output as it is printed, a NUL byte and the exit status.
+ */
+#ifndef _WIN32
+#define SERVER_MAX_REQUEST 65536
+#define SERVER_MAX_ARGS	   128
+#define SERVER_PARSED	   100 /* exit code of a parsed job command line */
+#define SERVER_TIMEOUT	   5   /* seconds to send the request */
+
+/* Read exactly 'size' bytes */
+static int read_all(int fd, void *buf, size_t size)
+{
+	uint8_t *p = buf;
+	while (size) {
+		ssize_t len = read(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return EXIT_FAILURE;
+		p += len;
+		size -= len;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Write exactly 'size' bytes */
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	while (size) {
+		ssize_t len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return EXIT_FAILURE;
+		p += len;
+		size -= len;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Jobs run with the rights of the server, so only its own user may send
+ * them */
+static int peer_allowed(int fd)
+{
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return 0;
+	return cred.uid == geteuid();
+#else
+	uid_t uid;
+	gid_t gid;
+	if (getpeereid(fd, &uid, &gid))
+		return 0;
+	return uid == geteuid();
+#endif
+}
+
+static int server_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "Socket path too long.\n");
+		return EXIT_FAILURE;
+	}
+	strcpy(addr->sun_path, path);
+	return EXIT_SUCCESS;
+}
+
+/* Run one job with its output sent to the client 'fd' */
+static int serve_job(minipro_handle_t *handle, int fd, char *payload,
+		     size_t size)
+{
+	char *argv[SERVER_MAX_ARGS + 1];
+	int argc = 0, status;
+	size_t i;
+
+	/* Split the request, the first string is the working directory */
+	for (i = strlen(payload) + 1; i < size && argc < SERVER_MAX_ARGS;
+	     i += strlen(payload + i) + 1)
+		argv[argc++] = payload + i;
+	argv[argc] = NULL;
+	if (!argc || chdir(payload)) {
+		fprintf(stderr, "Invalid job request.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Commands which print information and exit are run by a child */
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (!pid) {
+		cmdopts_t cmdopts;
+		parse_cmdline(argc, argv, &cmdopts);
+		exit(SERVER_PARSED);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return EXIT_FAILURE;
+	if (WEXITSTATUS(status) != SERVER_PARSED)
+		return WEXITSTATUS(status);
+
+	/* Parse it again here, the messages were already printed */
+	cmdopts_t cmdopts;
+	int null = open("/dev/null", O_WRONLY);
+	if (null < 0)
+		return EXIT_FAILURE;
+	dup2(null, STDERR_FILENO);
+	parse_cmdline(argc, argv, &cmdopts);
+	dup2(fd, STDERR_FILENO);
+	close(null);
+	/* The programmer is already open, don't keep a pointer into the
+	 * request */
+	minipro_select_unit(NULL);
+
+	int ret = check_cmdline(&cmdopts);
+	if (!ret && (cmdopts.is_pipe || cmdopts.gang || cmdopts.server ||
+		     cmdopts.record || cmdopts.replay)) {
+		fprintf(stderr, "Pipes, gang and server mode and USB sessions "
+				"can't be used in a job.\n");
+		return EXIT_FAILURE;
+	}
+	if (!ret) {
+		handle->cmdopts = &cmdopts;
+		/* The next job may need another bitstream. The upload is
+		 * skipped if it is the one the programmer already holds. */
+		handle->bitstream_uploaded = 0;
+		ret = stats_open(cmdopts.stats, cmdopts.trace);
+		if (!ret)
+			ret = run_job(handle, argc, argv);
+		if (stats_close() && !ret)
+			ret = EXIT_FAILURE;
+		/* Leave the socket powered off after a failed job */
+		if (ret != EXIT_SUCCESS && handle->device)
+			minipro_end_transaction(handle);
+		minipro_free_device(handle);
+		handle->cmdopts = NULL;
+	}
+	if (ret < 0) {
+		print_help(argv[0]);
+		ret = EXIT_FAILURE;
+	}
+	return ret;
+}
+
+/* Accept and run jobs until killed */
+static int run_server(cmdopts_t *cmdopts)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	size_t jobs = 0;
+
+	if (server_address(cmdopts->server, &addr))
+		return EXIT_FAILURE;
+	minipro_handle_t *handle = minipro_open(VERBOSE);
+	if (!handle)
+		return EXIT_FAILURE;
+	minipro_print_system_info(handle);
+	if (handle->status == MP_STATUS_BOOTLOADER) {
+		fprintf(stderr, "in bootloader mode!\nExiting...\n");
+		minipro_close(handle);
+		return EXIT_FAILURE;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
 		minipro_close(handle);
 		return EXIT_FAILURE;
 	}
+	/* Remove a stale socket of a previous server */
+	if (!stat(cmdopts->server, &st) && S_ISSOCK(st.st_mode))
+		unlink(cmdopts->server);
+	/* Only the owner may connect */
+	mode_t mask = umask(0077);
+	int ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (ret || listen(sock, 8)) {
+		perror(cmdopts->server);
+		close(sock);
+		minipro_close(handle);
+		return EXIT_FAILURE;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Waiting for jobs on %s\n", cmdopts->server);
+
+	int out = dup(STDOUT_FILENO);
+	int err = dup(STDERR_FILENO);
+	int cwd = open(".", O_RDONLY);
+	for (;;) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+
+		if (!peer_allowed(fd)) {
+			static const char denied[] =
+				"Permission denied.\n\0\1";
+			write_all(fd, denied, sizeof(denied) - 1);
+			close(fd);
+			fprintf(stderr, "Job from another user rejected.\n");
+			continue;
+		}
+
+		/* A client which doesn't send its request in time is
+		 * dropped, it would stall the other clients */
+		struct timeval timeout = { SERVER_TIMEOUT, 0 };
+		uint8_t header[4];
+		char *payload = NULL;
+		size_t size = 0;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			       sizeof(timeout))) {
+			perror("setsockopt");
+			close(fd);
+			continue;
+		}
+		errno = 0;
+		if (!read_all(fd, header, sizeof(header)))
+			size = load_int(header, sizeof(header),
+					MP_LITTLE_ENDIAN);
+		if (size && size < SERVER_MAX_REQUEST)
+			payload = malloc(size + 1);
+		if (!payload || read_all(fd, payload, size)) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				fprintf(stderr, "Job request timed out.\n");
+			free(payload);
+			close(fd);
+			continue;
+		}
+		payload[size] = '\0';
+
+		/* The job prints to the client */
+		fflush(stdout);
+		fflush(stderr);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		uint8_t result[2] = { 0, serve_job(handle, fd, payload, size) };
+		fflush(stdout);
+		fflush(stderr);
+		dup2(out, STDOUT_FILENO);
+		dup2(err, STDERR_FILENO);
+		if (cwd >= 0 && fchdir(cwd))
+			perror("fchdir");
+		write_all(fd, result, sizeof(result));
+		close(fd);
+		free(payload);
+		fprintf(stderr, "Job %zu: %s\n", ++jobs,
+			result[1] == EXIT_SUCCESS ? "OK" : "FAILED");
+	}
+	close(out);
+	close(err);
+	if (cwd >= 0)
+		close(cwd);
+	close(sock);
+	unlink(cmdopts->server);
 	minipro_close(handle);
+	return EXIT_FAILURE;
+}
+
+/* Send the command line to the server and print the job output */
+static int run_client(cmdopts_t *cmdopts, int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	char cwd[PATH_MAX], buf[1024];
+	size_t size, i;
+	int status = -1, end = 0;
+
+	if (server_address(cmdopts->connect, &addr))
+		return EXIT_FAILURE;
+	if (!getcwd(cwd, sizeof(cwd))) {
+		perror("getcwd");
+		return EXIT_FAILURE;
+	}
+	size = strlen(cwd) + 1;
+	for (i = 0; i < argc; i++)
+		size += strlen(argv[i]) + 1;
+	if (size >= SERVER_MAX_REQUEST || argc > SERVER_MAX_ARGS) {
+		fprintf(stderr, "Command line too long.\n");
+		return EXIT_FAILURE;
+	}
+	uint8_t *request = malloc(size + 4);
+	if (!request) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	format_int(request, size, 4, MP_LITTLE_ENDIAN);
+	size = 4;
+	memcpy(request + size, cwd, strlen(cwd) + 1);
+	size += strlen(cwd) + 1;
+	for (i = 0; i < argc; i++) {
+		memcpy(request + size, argv[i], strlen(argv[i]) + 1);
+		size += strlen(argv[i]) + 1;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    write_all(sock, request, size)) {
+		perror(cmdopts->connect);
+		free(request);
+		if (sock >= 0)
+			close(sock);
+		return EXIT_FAILURE;
+	}
+	free(request);
+
+	/* The output ends with a NUL byte and the exit status */
+	while (status < 0) {
+		ssize_t len = read(sock, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+		for (i = 0; i < len; i++) {
+			if (end) {
+				status = (uint8_t)buf[i];
+				break;
+			}
+			if (!buf[i]) {
+				end = 1;
+				continue;
+			}
+			fputc(buf[i], stderr);
+		}
+		fflush(stderr);
+	}
+	close(sock);
+	if (status < 0) {
+		fprintf(stderr, "Connection to the server lost.\n");
+		return EXIT_FAILURE;
+	}
+	return status;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef _WIN32
+	system(" "); /* If we are in windows start the VT100 support */
+	/* Set the Windows translation mode to binary */
+	setmode(STDOUT_FILENO, O_BINARY);
+	setmode(STDIN_FILENO, O_BINARY);
+#endif
+
+	cmdopts_t cmdopts;
+	parse_cmdline(argc, argv, &cmdopts);
+
+	/* Run as a server or as a client of one */
+	if (cmdopts.server || cmdopts.connect) {
+#ifdef _WIN32
+		fprintf(stderr, "Server mode is not supported on Windows.\n");
+		return EXIT_FAILURE;
+#else
+		if (cmdopts.server && (cmdopts.record || cmdopts.replay)) {
+			fprintf(stderr, "USB sessions can't be recorded or "
+					"replayed in server mode.\n");
+			return EXIT_FAILURE;
+		}
+		if (cmdopts.server)
+			return run_server(&cmdopts);
+		return run_client(&cmdopts, argc, argv);
+#endif
+	}
+
+	if (check_cmdline(&cmdopts))
+		print_help_and_exit(argv[0]);
+
+	/* Run the job on several programmers */
+	if (cmdopts.gang) {
+#ifdef _WIN32
+		fprintf(stderr, "Gang mode is not supported on Windows.\n");
+		return EXIT_FAILURE;
+#else
+		int worker;
+		int ret = run_gang(&cmdopts, &worker);
+		if (!worker)
+			return ret;
+#endif
+	}
+
+	if (stats_open(cmdopts.stats, cmdopts.trace))
+		return EXIT_FAILURE;
+	if (cmdopts.record && usb_record(cmdopts.record))
+		return EXIT_FAILURE;
+	if (cmdopts.replay &&
+	    usb_replay(cmdopts.replay, cmdopts.replay_latency))
+		return EXIT_FAILURE;
+
+	/* get a handle */
+	minipro_handle_t *handle = minipro_open(VERBOSE);
+	if (!handle)
+		return EXIT_FAILURE;
+	handle->cmdopts = &cmdopts;
+
+	int ret = run_job(handle, argc, argv);
+	minipro_close(handle);
+	if (usb_session_end() && !ret)
+		ret = EXIT_FAILURE;
+	if (stats_close() && !ret)
+		ret = EXIT_FAILURE;
+	if (ret < 0)
+		print_help_and_exit(argv[0]);
 	return ret;
 }
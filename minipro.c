@@ -16,14 +16,19 @@
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
+#include <zlib.h>
 #include "database.h"
 #include "minipro.h"
+#include "stats.h"
 #include "tl866a.h"
 #include "tl866iiplus.h"
 #include "t48.h"
@@ -35,7 +40,9 @@
 #define T48_RESET 0x3F
 #define T56_RESET 0x3F
 
-#define CRC32_POLYNOMIAL  0xEDB88320
+#define OVC_POLL_TIME	  100000
+#define MIN(a, b)	  (((a) < (b)) ? (a) : (b))
+#define MISMATCH_RANGES	  16 /* ranges listed by --mismatch_report */
 
 void format_int(uint8_t *out, uint64_t in, size_t size, uint8_t endianness)
 {
@@ -64,17 +71,18 @@ uint64_t load_int(uint8_t *in, size_t size, uint8_t endianness)
 	return result;
 }
 
-/* Simple crc32 */
+/* Reflected crc32 update without the initial and final inversion. zlib's
+ * crc32() inverts on entry and exit, its table and hardware paths are
+ * used for the bulk of the work. */
 uint32_t crc_32(uint8_t *data, size_t size, uint32_t initial)
 {
-	uint32_t i, j, crc;
-	crc = initial;
-	for (i = 0; i < size; i++) {
-		crc = crc ^ data[i];
-		for (j = 0; j < 8; j++)
-			crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & (-(crc & 1)));
+	uint32_t crc = ~initial;
+	uInt len;
+	for (; size; size -= len, data += len) {
+		len = size > UINT_MAX ? UINT_MAX : size;
+		crc = crc32(crc, data, len);
 	}
-	return crc;
+	return ~crc;
 }
 
 /* Write out results of a logic test. Instead of checking test
@@ -145,6 +153,144 @@ int write_logic_file(minipro_handle_t *handle, uint8_t *first_step,
 	return EXIT_SUCCESS;
 }
 
+/* Run all logic test vectors with the pull-up (pull = 0) or the pull-down
+ * (pull = 1) resistors active, 'opcode' is the test vector command of the
+ * programmer. Up to cmdopts->vector_queue vectors are sent before their
+ * results are read back, so the USB latency is paid once per queue instead
+ * of once per vector. Returns the pin states, one byte per pin.
+ */
+uint8_t *run_logic_vectors(minipro_handle_t *handle, uint8_t opcode, int pull)
+{
+	uint8_t msg[32];
+	uint8_t *result;
+	uint8_t pin_count = handle->device->package_details.pin_count;
+	size_t count = handle->device->vector_count;
+	size_t queue = handle->cmdopts->vector_queue;
+	size_t sent = 0, n;
+	int i;
+
+	if (!queue)
+		queue = 1;
+	result = calloc(pin_count, count);
+	if (!result)
+		return NULL;
+
+	for (n = 0; n < count; n++) {
+		/* Keep the queue full */
+		for (; sent < count && sent < n + queue; sent++) {
+			uint8_t *vector = handle->device->vectors +
+					  sent * pin_count;
+			memset(msg, 0xff, sizeof(msg));
+			msg[0] = opcode;
+			msg[1] = handle->device->voltages.vcc;
+			msg[1] |= pull << 7; /* Set the pull-up/pull-down */
+			format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
+			format_int(&msg[4], sent, 4, MP_LITTLE_ENDIAN);
+
+			/* Pack the vector to 2 pin/byte */
+			for (i = 0; i < pin_count; i++) {
+				if (i & 1)
+					msg[8 + i / 2] |= vector[i] << 4;
+				else
+					msg[8 + i / 2] = vector[i];
+			}
+			if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
+				free(result);
+				return NULL;
+			}
+		}
+
+		/* Read the pin status of the oldest vector */
+		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
+			free(result);
+			return NULL;
+		}
+
+		/* Unpack the result from 2 pin/byte to 1 pin/byte */
+		uint8_t *out = result + n * pin_count;
+		for (i = 0; i < pin_count; i++)
+			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
+	}
+
+	return result;
+}
+
+/* Read 'count' jedec rows starting at 'row' into 'buffer', one row every
+ * 'stride' bytes. Up to cmdopts->row_queue read requests are sent before
+ * their replies are read back. 'opcode' is the read command of the
+ * programmer, 'send_len' and 'recv_len' the request and reply sizes.
+ */
+int run_jedec_row_reads(minipro_handle_t *handle, uint8_t opcode,
+			size_t send_len, size_t recv_len, uint8_t *buffer,
+			size_t stride, uint8_t row, uint8_t flags, size_t size,
+			size_t count)
+{
+	uint8_t msg[64];
+	size_t queue = handle->cmdopts->row_queue;
+	size_t sent = 0, n;
+
+	if (!queue)
+		queue = 1;
+	for (n = 0; n < count; n++) {
+		/* Keep the queue full */
+		for (; sent < count && sent < n + queue; sent++) {
+			memset(msg, 0, sizeof(msg));
+			msg[0] = opcode;
+			msg[1] = handle->device->protocol_id;
+			msg[2] = size;
+			msg[4] = row + sent;
+			msg[5] = flags;
+			if (msg_send(handle->usb_handle, msg, send_len))
+				return EXIT_FAILURE;
+		}
+
+		/* Read the oldest row */
+		if (msg_recv(handle->usb_handle, msg, recv_len))
+			return EXIT_FAILURE;
+		memcpy(buffer + n * stride, msg, (size + 7) / 8);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Read the config 'sections' of a TL866II+/T48/T56 device. All the read
+ * requests are sent before their replies are read back, so the whole
+ * config costs a single USB round trip. 'opcodes' is the read command of
+ * each section type, indexed by MP_FUSE_USER, MP_FUSE_CFG and MP_FUSE_LOCK.
+ */
+int run_fuse_reads(minipro_handle_t *handle, const uint8_t *opcodes,
+		   fuse_section_t *sections, size_t count)
+{
+	uint8_t msg[64];
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (sections[i].type > MP_FUSE_LOCK) {
+			fprintf(stderr, "Unknown type for read_fuses (%d)\n",
+				sections[i].type);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		memset(msg, 0, sizeof(msg));
+		msg[0] = opcodes[sections[i].type];
+		msg[1] = handle->device->protocol_id;
+		msg[2] = sections[i].items_count;
+		format_int(&msg[4], handle->device->code_memory_size, 4,
+			   MP_LITTLE_ENDIAN);
+		if (msg_send(handle->usb_handle, msg, 8))
+			return EXIT_FAILURE;
+	}
+
+	/* The replies come back in the order of the requests */
+	for (i = 0; i < count; i++) {
+		if (msg_recv(handle->usb_handle, msg, sizeof(msg)))
+			return EXIT_FAILURE;
+		memcpy(sections[i].buffer, &(msg[8]), sections[i].length);
+	}
+	return EXIT_SUCCESS;
+}
+
 static int minipro_get_system_info(minipro_handle_t *handle)
 {
 	uint8_t msg[80];
@@ -276,7 +422,96 @@ static int minipro_get_system_info(minipro_handle_t *handle)
 	return EXIT_SUCCESS;
 }
 
+/* Default programmer of minipro_open() selected by serial number or USB port
+ * path, NULL for the first one found */
+static const char *selected_unit = NULL;
+
+void minipro_select_unit(const char *unit)
+{
+	selected_unit = unit;
+}
+
+/* Get the system info of the programmer just opened */
+static int probe_unit(minipro_handle_t *handle)
+{
+	if (!handle->usb_handle)
+		return EXIT_FAILURE;
+	memset(handle->device_code, 0, sizeof(handle->device_code));
+	memset(handle->serial_number, 0, sizeof(handle->serial_number));
+	if (minipro_get_system_info(handle)) {
+		usb_close(handle->usb_handle);
+		handle->usb_handle = NULL;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Open the programmer with the serial number or USB port path 'unit'.
+ * A port path is found without opening any programmer and only that one
+ * is opened. The serial number is only known to the firmware, so the
+ * programmers are opened in turn. The ones which can't be opened, e.g.
+ * because another process has claimed them, are skipped.
+ */
+static int open_selected_unit(minipro_handle_t *handle, const char *unit,
+			      uint8_t verbose)
+{
+	char path[64];
+	int count;
+
+	for (count = 0; !usb_get_index_path(count, path, sizeof(path));
+	     count++) {
+		if (!path[0] || strcmp(path, unit))
+			continue;
+		handle->usb_handle = usb_open_path(verbose, path);
+		if (!probe_unit(handle))
+			return EXIT_SUCCESS;
+		if (verbose)
+			fprintf(stderr, "Programmer %s could not be opened.\n",
+				unit);
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < count; i++) {
+		handle->usb_handle = usb_open_index(NO_VERBOSE, i);
+		if (probe_unit(handle))
+			continue;
+		if (!strcmp(handle->serial_number, unit))
+			return EXIT_SUCCESS;
+		usb_close(handle->usb_handle);
+		handle->usb_handle = NULL;
+	}
+	if (verbose)
+		fprintf(stderr, "Programmer %s not found.\n", unit);
+	return EXIT_FAILURE;
+}
+
+/* Get the serial number and the USB port path (empty if not available)
+ * of the programmer number 'index'. The serial number is empty if the
+ * programmer can't be opened, e.g. because it is in use.
+ * Returns EXIT_FAILURE if there are no more programmers.
+ */
+int minipro_get_unit(int index, char *serial, char *path, size_t size)
+{
+	minipro_handle_t handle;
+	if (usb_get_index_path(index, path, size))
+		return EXIT_FAILURE;
+	memset(&handle, 0, sizeof(handle));
+	serial[0] = '\0';
+	handle.usb_handle = path[0] ? usb_open_path(NO_VERBOSE, path) :
+				      usb_open_index(NO_VERBOSE, index);
+	if (!probe_unit(&handle)) {
+		snprintf(serial, size, "%s", handle.serial_number);
+		usb_close(handle.usb_handle);
+	}
+	return EXIT_SUCCESS;
+}
+
 minipro_handle_t *minipro_open(uint8_t verbose)
+{
+	return minipro_open_unit(selected_unit, verbose);
+}
+
+/* Open the programmer 'unit', or the first one found if NULL */
+minipro_handle_t *minipro_open_unit(const char *unit, uint8_t verbose)
 {
 	minipro_handle_t *handle = calloc(1, sizeof(minipro_handle_t));
 	if (!handle) {
@@ -285,16 +520,23 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		return NULL;
 	}
 
-	/* get a usb handle */
-	handle->usb_handle = usb_open(verbose);
-	if (!handle->usb_handle) {
-		free(handle);
-		return NULL;
-	}
+	if (unit) {
+		if (open_selected_unit(handle, unit, verbose)) {
+			free(handle);
+			return NULL;
+		}
+	} else {
+		/* get a usb handle */
+		handle->usb_handle = usb_open(verbose);
+		if (!handle->usb_handle) {
+			free(handle);
+			return NULL;
+		}
 
-	/* get the system info */
-	if (minipro_get_system_info(handle))
-		return NULL;
+		/* get the system info */
+		if (minipro_get_system_info(handle))
+			return NULL;
+	}
 	switch (handle->version) {
 	case MP_TL866A:
 	case MP_TL866CS:
@@ -340,6 +582,7 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_unlock_tsop48 = tl866a_unlock_tsop48;
 		handle->minipro_hardware_check = tl866a_hardware_check;
 		handle->minipro_read_jedec_row = tl866a_read_jedec_row;
+		handle->minipro_read_jedec_rows = tl866a_read_jedec_rows;
 		handle->minipro_write_jedec_row = tl866a_write_jedec_row;
 		handle->minipro_firmware_update = tl866a_firmware_update;
 		handle->minipro_logic_ic_test = tl866a_logic_ic_test;
@@ -363,11 +606,13 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_erase = tl866iiplus_erase;
 		handle->minipro_read_fuses = tl866iiplus_read_fuses;
 		handle->minipro_write_fuses = tl866iiplus_write_fuses;
+		handle->minipro_read_fuse_sections = tl866iiplus_read_fuse_sections;
 		handle->minipro_read_calibration = tl866iiplus_read_calibration;
 		handle->minipro_get_ovc_status = tl866iiplus_get_ovc_status;
 		handle->minipro_unlock_tsop48 = tl866iiplus_unlock_tsop48;
 		handle->minipro_hardware_check = tl866iiplus_hardware_check;
 		handle->minipro_read_jedec_row = tl866iiplus_read_jedec_row;
+		handle->minipro_read_jedec_rows = tl866iiplus_read_jedec_rows;
 		handle->minipro_write_jedec_row = tl866iiplus_write_jedec_row;
 		handle->minipro_firmware_update = tl866iiplus_firmware_update;
 		handle->minipro_pin_test = tl866iiplus_pin_test;
@@ -392,8 +637,10 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_erase = t48_erase;
 		handle->minipro_read_fuses = t48_read_fuses;
 		handle->minipro_write_fuses = t48_write_fuses;
+		handle->minipro_read_fuse_sections = t48_read_fuse_sections;
 		handle->minipro_get_ovc_status = t48_get_ovc_status;
 		handle->minipro_read_jedec_row = t48_read_jedec_row;
+		handle->minipro_read_jedec_rows = t48_read_jedec_rows;
 		handle->minipro_write_jedec_row = t48_write_jedec_row;
 		handle->minipro_firmware_update = t48_firmware_update;
 		handle->minipro_logic_ic_test = t48_logic_ic_test;
@@ -410,9 +657,11 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_erase = t56_erase;
 		handle->minipro_read_fuses = t56_read_fuses;
 		handle->minipro_write_fuses = t56_write_fuses;
+		handle->minipro_read_fuse_sections = t56_read_fuse_sections;
 		handle->minipro_read_calibration = t56_read_calibration;
 		handle->minipro_get_ovc_status = t56_get_ovc_status;
 		handle->minipro_read_jedec_row = t56_read_jedec_row;
+		handle->minipro_read_jedec_rows = t56_read_jedec_rows;
 		handle->minipro_write_jedec_row = t56_write_jedec_row;
 		handle->minipro_firmware_update = t56_firmware_update;
 		handle->minipro_logic_ic_test = t56_logic_ic_test;
@@ -421,11 +670,10 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 	return handle;
 }
 
-void minipro_close(minipro_handle_t *handle)
+/* Free the device and pin map loaded for the current job */
+void minipro_free_device(minipro_handle_t *handle)
 {
-	if (handle && handle->usb_handle)
-		usb_close(handle->usb_handle);
-	if (handle && handle->device) {
+	if (handle->device) {
 		if (handle->device->config) {
 			if (handle->device->chip_type == MP_PLD &&
 			    ((gal_config_t *)(handle->device->config))->acw_bits)
@@ -435,11 +683,23 @@ void minipro_close(minipro_handle_t *handle)
 		}
 		if (handle->device->vectors)
 			free(handle->device->vectors);
-	}
-	if (handle->device)
 		free(handle->device);
-	if (handle)
-		free(handle);
+		handle->device = NULL;
+	}
+	if (handle->pin_map) {
+		free(handle->pin_map);
+		handle->pin_map = NULL;
+	}
+}
+
+void minipro_close(minipro_handle_t *handle)
+{
+	if (!handle)
+		return;
+	if (handle->usb_handle)
+		usb_close(handle->usb_handle);
+	minipro_free_device(handle);
+	free(handle);
 }
 
 /* Reset TL866 device */
@@ -580,7 +840,10 @@ int minipro_begin_transaction(minipro_handle_t *handle)
 				 (voltages->vdd << 12) | (voltages->vcc << 8) |
 				 voltages->vpp;
 	if (handle->minipro_begin_transaction) {
-		return handle->minipro_begin_transaction(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_begin_transaction(handle);
+		stats_record(STATS_CALL, "begin_transaction", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: begin_transaction not implemented\n",
 			handle->model);
@@ -592,7 +855,10 @@ int minipro_end_transaction(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
 	if (handle->minipro_end_transaction) {
-		return handle->minipro_end_transaction(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_end_transaction(handle);
+		stats_record(STATS_CALL, "end_transaction", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: end_transaction not implemented\n",
 			handle->model);
@@ -605,7 +871,10 @@ int minipro_protect_off(minipro_handle_t *handle)
 	assert(handle != NULL);
 
 	if (handle->minipro_protect_off) {
-		return handle->minipro_protect_off(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_protect_off(handle);
+		stats_record(STATS_CALL, "protect_off", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: protect_off not implemented\n",
 			handle->model);
@@ -618,7 +887,10 @@ int minipro_protect_on(minipro_handle_t *handle)
 	assert(handle != NULL);
 
 	if (handle->minipro_protect_on) {
-		return handle->minipro_protect_on(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_protect_on(handle);
+		stats_record(STATS_CALL, "protect_on", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: protect_on not implemented\n",
 			handle->model);
@@ -635,7 +907,10 @@ int minipro_get_ovc_status(minipro_handle_t *handle, minipro_status_t *status,
 	}
 
 	if (handle->minipro_get_ovc_status) {
-		return handle->minipro_get_ovc_status(handle, status, ovc);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_get_ovc_status(handle, status, ovc);
+		stats_record(STATS_CALL, "get_ovc_status", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: get_ovc_status not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -645,7 +920,10 @@ int minipro_erase(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
 	if (handle->minipro_erase) {
-		return handle->minipro_erase(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_erase(handle);
+		stats_record(STATS_CALL, "erase", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: erase not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -656,8 +934,11 @@ int minipro_read_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 {
 	assert(handle != NULL);
 	if (handle->minipro_read_block) {
-		return handle->minipro_read_block(handle, type, addr, buffer,
-						  len);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_read_block(handle, type, addr, buffer,
+						     len);
+		stats_record(STATS_CALL, "read_block", len, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: read_block not implemented\n",
 			handle->model);
@@ -670,8 +951,11 @@ int minipro_write_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 {
 	assert(handle != NULL);
 	if (handle->minipro_write_block) {
-		return handle->minipro_write_block(handle, type, addr, buffer,
-						   len);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_write_block(handle, type, addr,
+						      buffer, len);
+		stats_record(STATS_CALL, "write_block", len, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: write_block not implemented\n",
 			handle->model);
@@ -685,7 +969,10 @@ int minipro_get_chip_id(minipro_handle_t *handle, uint8_t *type,
 {
 	assert(handle != NULL);
 	if (handle->minipro_get_chip_id) {
-		return handle->minipro_get_chip_id(handle, type, device_id);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_get_chip_id(handle, type, device_id);
+		stats_record(STATS_CALL, "get_chip_id", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: get_chip_id not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -696,7 +983,11 @@ int minipro_spi_autodetect(minipro_handle_t *handle, uint8_t type,
 {
 	assert(handle != NULL);
 	if (handle->minipro_spi_autodetect) {
-		return handle->minipro_spi_autodetect(handle, type, device_id);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_spi_autodetect(handle, type,
+							 device_id);
+		stats_record(STATS_CALL, "spi_autodetect", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: spi_autodetect not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -712,8 +1003,11 @@ int minipro_read_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
 		return EXIT_SUCCESS;
 
 	if (handle->minipro_read_fuses) {
-		return handle->minipro_read_fuses(handle, type, length,
-						  items_count, buffer);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_read_fuses(handle, type, length,
+						     items_count, buffer);
+		stats_record(STATS_CALL, "read_fuses", length, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: read_fuses not implemented\n",
 			handle->model);
@@ -727,8 +1021,11 @@ int minipro_write_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
 	assert(handle != NULL);
 
 	if (handle->minipro_write_fuses) {
-		return handle->minipro_write_fuses(handle, type, length,
-						   items_count, buffer);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_write_fuses(handle, type, length,
+						      items_count, buffer);
+		stats_record(STATS_CALL, "write_fuses", length, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: write_fuses not implemented\n",
 			handle->model);
@@ -736,13 +1033,56 @@ int minipro_write_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
 	return EXIT_FAILURE;
 }
 
+/* Read several config sections, batched in one transaction when the
+ * programmer supports it and --batch_config is given */
+int minipro_read_fuse_sections(minipro_handle_t *handle,
+			       fuse_section_t *sections, size_t count)
+{
+	assert(handle != NULL);
+	fuse_section_t batch[3];
+	size_t i, n = 0;
+
+	if (handle->minipro_read_fuse_sections &&
+	    !handle->device->flags.custom_protocol &&
+	    handle->cmdopts->batch_config && count <= 3) {
+		/* If chip lock bit is write only don't read it. */
+		size_t length = 0;
+		for (i = 0; i < count; i++) {
+			if (sections[i].type == MP_FUSE_LOCK &&
+			    handle->device->flags.lock_bit_write_only)
+				continue;
+			length += sections[i].length;
+			batch[n++] = sections[i];
+		}
+		if (n > 1) {
+			uint64_t start = stats_start();
+			int ret = handle->minipro_read_fuse_sections(handle,
+								     batch, n);
+			stats_record(STATS_CALL, "read_fuse_sections", length,
+				     start);
+			return ret;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (minipro_read_fuses(handle, sections[i].type,
+				       sections[i].length,
+				       sections[i].items_count,
+				       sections[i].buffer))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 int minipro_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			    uint8_t row, uint8_t flags, size_t size)
 {
 	assert(handle != NULL);
 	if (handle->minipro_write_jedec_row) {
-		return handle->minipro_write_jedec_row(handle, buffer, row,
-						       flags, size);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_write_jedec_row(handle, buffer, row,
+							  flags, size);
+		stats_record(STATS_CALL, "write_jedec_row", size, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: write jedec row not implemented\n",
 			handle->model);
@@ -755,8 +1095,11 @@ int minipro_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 {
 	assert(handle != NULL);
 	if (handle->minipro_read_jedec_row) {
-		return handle->minipro_read_jedec_row(handle, buffer, row,
-						      flags, size);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_read_jedec_row(handle, buffer, row,
+							 flags, size);
+		stats_record(STATS_CALL, "read_jedec_row", size, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: read jedec row not implemented\n",
 			handle->model);
@@ -764,12 +1107,41 @@ int minipro_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_FAILURE;
 }
 
+/* Read 'count' consecutive jedec rows, one row every 'stride' bytes */
+int minipro_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			    size_t stride, uint8_t row, uint8_t flags,
+			    size_t size, size_t count)
+{
+	assert(handle != NULL);
+	size_t i;
+	if (handle->minipro_read_jedec_rows &&
+	    !handle->device->flags.custom_protocol &&
+	    handle->cmdopts->row_queue > 1) {
+		uint64_t start = stats_start();
+		int ret = handle->minipro_read_jedec_rows(
+			handle, buffer, stride, row, flags, size, count);
+		stats_record(STATS_CALL, "read_jedec_rows", size * count,
+			     start);
+		return ret;
+	}
+	for (i = 0; i < count; i++) {
+		if (minipro_read_jedec_row(handle, buffer + i * stride,
+					   row + i, flags, size))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 int minipro_read_calibration(minipro_handle_t *handle, uint8_t *buffer,
 			     size_t size)
 {
 	assert(handle != NULL);
 	if (handle->minipro_read_calibration) {
-		return handle->minipro_read_calibration(handle, buffer, size);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_read_calibration(handle, buffer,
+							   size);
+		stats_record(STATS_CALL, "read_calibration", size, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: read calib. bytes not implemented\n",
 			handle->model);
@@ -783,7 +1155,10 @@ int minipro_unlock_tsop48(minipro_handle_t *handle, uint8_t *status)
 	assert(handle != NULL);
 
 	if (handle->minipro_unlock_tsop48) {
-		return handle->minipro_unlock_tsop48(handle, status);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_unlock_tsop48(handle, status);
+		stats_record(STATS_CALL, "unlock_tsop48", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: unlock_tsop48 not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -795,7 +1170,10 @@ int minipro_hardware_check(minipro_handle_t *handle)
 	assert(handle != NULL);
 
 	if (handle->minipro_hardware_check) {
-		return handle->minipro_hardware_check(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_hardware_check(handle);
+		stats_record(STATS_CALL, "hardware_check", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: hardware_check not implemented\n",
 			handle->model);
@@ -807,7 +1185,10 @@ int minipro_firmware_update(minipro_handle_t *handle, const char *firmware)
 {
 	assert(handle != NULL);
 	if (handle->minipro_firmware_update) {
-		return handle->minipro_firmware_update(handle, firmware);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_firmware_update(handle, firmware);
+		stats_record(STATS_CALL, "firmware_update", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: firmware update not implemented\n",
 			handle->model);
@@ -820,7 +1201,10 @@ int minipro_pin_test(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
 	if (handle->minipro_pin_test) {
-		return handle->minipro_pin_test(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_pin_test(handle);
+		stats_record(STATS_CALL, "pin_test", 0, start);
+		return ret;
 	} else {
 		fprintf(stderr, "%s: pin test not implemented\n",
 			handle->model);
@@ -831,8 +1215,17 @@ int minipro_pin_test(minipro_handle_t *handle)
 int minipro_logic_ic_test(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
+	/* A device queried without with_vectors only has the vectors counted */
+	if (!handle->device->vectors && handle->device->vector_count) {
+		fprintf(stderr, "%s: test vectors not loaded\n",
+			handle->device->name);
+		return EXIT_FAILURE;
+	}
 	if (handle->minipro_logic_ic_test) {
-		return handle->minipro_logic_ic_test(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_logic_ic_test(handle);
+		stats_record(STATS_CALL, "logic_ic_test", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: logic IC test not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -842,7 +1235,10 @@ int minipro_set_zif_direction(minipro_handle_t *handle, uint8_t *zif_dir)
 {
 	assert(handle != NULL);
 	if (handle->minipro_set_zif_direction) {
-		return handle->minipro_set_zif_direction(handle, zif_dir);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_set_zif_direction(handle, zif_dir);
+		stats_record(STATS_CALL, "set_zif_direction", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: set zif direction not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -852,7 +1248,10 @@ int minipro_set_zif_state(minipro_handle_t *handle, uint8_t *zif_state)
 {
 	assert(handle != NULL);
 	if (handle->minipro_set_zif_state) {
-		return handle->minipro_set_zif_state(handle, zif_state);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_set_zif_state(handle, zif_state);
+		stats_record(STATS_CALL, "set_zif_state", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: set zif state not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -862,7 +1261,10 @@ int minipro_get_zif_state(minipro_handle_t *handle, uint8_t *zif_state)
 {
 	assert(handle != NULL);
 	if (handle->minipro_get_zif_state) {
-		return handle->minipro_get_zif_state(handle, zif_state);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_get_zif_state(handle, zif_state);
+		stats_record(STATS_CALL, "get_zif_state", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: get zif state not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -872,7 +1274,10 @@ int minipro_set_pin_drivers(minipro_handle_t *handle, pin_driver_t *pins)
 {
 	assert(handle != NULL);
 	if (handle->minipro_set_pin_drivers) {
-		return handle->minipro_set_pin_drivers(handle, pins);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_set_pin_drivers(handle, pins);
+		stats_record(STATS_CALL, "set_pin_drivers", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: set pin drivers not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -882,7 +1287,10 @@ int minipro_set_voltages(minipro_handle_t *handle, uint8_t vcc, uint8_t vpp)
 {
 	assert(handle != NULL);
 	if (handle->minipro_set_voltages) {
-		return handle->minipro_set_voltages(handle, vcc, vpp);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_set_voltages(handle, vcc, vpp);
+		stats_record(STATS_CALL, "set_voltages", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: set voltages not implemented\n", handle->model);
 	return EXIT_FAILURE;
@@ -892,9 +1300,921 @@ int minipro_reset_state(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
 	if (handle->minipro_reset_state) {
-		return handle->minipro_reset_state(handle);
+		uint64_t start = stats_start();
+		int ret = handle->minipro_reset_state(handle);
+		stats_record(STATS_CALL, "reset_state", 0, start);
+		return ret;
 	}
 	fprintf(stderr, "%s: reset state not implemented\n", handle->model);
 	return EXIT_FAILURE;
 }
 
+/* Report the progress of a long operation */
+void minipro_progress(minipro_handle_t *handle, const char *status,
+		      int percent)
+{
+	if (handle->progress) {
+		handle->progress(handle, status, percent);
+		return;
+	}
+	if (percent < 0)
+		fprintf(stderr, "\r\e[K%s\n", status);
+	else
+		fprintf(stderr, "\r\e[K%s%2d%%", status, percent);
+	fflush(stderr);
+}
+
+/* Report an error or a verify result */
+void minipro_message(minipro_handle_t *handle, const char *fmt, ...)
+{
+	char message[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	if (handle->message)
+		handle->message(handle, message);
+	else
+		fputs(message, stderr);
+}
+
+/* Return the length of the leading part of s1 and s2 which is equal
+ * under the 8 byte 'pattern' mask. The buffers are compared a machine word
+ * at a time, so the result is a multiple of 8 and the caller has to locate
+ * the exact mismatch.
+ */
+static size_t skip_equal(const uint8_t *s1, const uint8_t *s2, size_t size,
+			 const uint8_t *pattern)
+{
+	uint64_t mask, a, b, diff;
+	size_t i = 0, j;
+	memcpy(&mask, pattern, sizeof(mask));
+
+	/* Four words per round, this is easily vectorized by the compiler */
+	for (; i + 4 * sizeof(uint64_t) <= size; i += 4 * sizeof(uint64_t)) {
+		diff = 0;
+		for (j = 0; j < 4 * sizeof(uint64_t); j += sizeof(uint64_t)) {
+			memcpy(&a, s1 + i + j, sizeof(a));
+			memcpy(&b, s2 + i + j, sizeof(b));
+			diff |= a ^ b;
+		}
+		if (diff & mask)
+			break;
+	}
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		memcpy(&a, s1 + i, sizeof(a));
+		memcpy(&b, s2 + i, sizeof(b));
+		if ((a ^ b) & mask)
+			break;
+	}
+	return i;
+}
+
+int compare_memory(uint8_t compare_mask, uint8_t *s1, uint8_t *s2, size_t size1,
+		   size_t size2, uint32_t *address, uint8_t *c1, uint8_t *c2)
+{
+	size_t i;
+	uint8_t v1, v2, pattern[8];
+	size_t size = (size1 > size2) ? size2 : size1;
+
+	/* Skip the equal part, then find the exact mismatch */
+	memset(pattern, compare_mask, sizeof(pattern));
+	for (i = skip_equal(s1, s2, size, pattern); i < size; i++) {
+		v1 = s1[i] & compare_mask;
+		v2 = s2[i] & compare_mask;
+		if (v1 != v2) {
+			if (address)
+				*address = i;
+			if (c1)
+				*c1 = v1;
+			if (c2)
+				*c2 = v2;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* returned value will be a byte offset
+ * sizes are in bytes
+ * replacement_value needs to be in native byte order
+ * sizes can be odd */
+int compare_word_memory(uint16_t replacement_value, uint16_t compare_mask,
+			uint8_t little_endian, uint8_t *s1, uint8_t *s2,
+			size_t size1, size_t size2, uint32_t *address,
+			uint16_t *c1, uint16_t *c2)
+{
+	size_t i;
+	uint16_t v1, v2;
+	uint8_t pattern[8];
+	size_t size = (size1 > size2) ? size2 : size1;
+	if (compare_mask == 0)
+		compare_mask = 0xffff;
+	uint8_t rvl = (replacement_value & compare_mask) & 0xff;
+	uint8_t rvh = ((replacement_value & compare_mask) >> 8) & 0xff;
+
+	/* Skip the equal part, then find the exact mismatch */
+	for (i = 0; i < sizeof(pattern); i += 2) {
+		pattern[i] = little_endian ? compare_mask : compare_mask >> 8;
+		pattern[i + 1] = little_endian ? compare_mask >> 8 :
+						 compare_mask;
+	}
+	for (i = skip_equal(s1, s2, size, pattern); i < size; i += 2) {
+		if (little_endian) {
+			v1 = (i < size1) ? s1[i] : rvl;
+			v1 |= (((i + 1) < size1) ? s1[i + 1] : rvh) << 8;
+			v2 = (i < size2) ? s2[i] : rvl;
+			v2 |= (((i + 1) < size2) ? s2[i + 1] : rvh) << 8;
+		} else {
+			v1 = ((i < size1) ? s1[i] : rvh) << 8;
+			v1 |= ((i + 1) < size1) ? (s1[i + 1]) : rvl;
+			v2 = ((i < size2) ? s2[i] : rvh) << 8;
+			v2 |= ((i + 1) < size2) ? (s2[i + 1]) : rvl;
+		}
+		if ((v1 & compare_mask) != (v2 & compare_mask)) {
+			if (address)
+				*address = i;
+			if (c1)
+				*c1 = v1;
+			if (c2)
+				*c2 = v2;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Mismatch statistics of a verify, collected block by block */
+typedef struct mismatch_report {
+	size_t count;
+	size_t ranges;
+	size_t start, end; /* current range */
+	uint16_t bits;
+} mismatch_report_t;
+
+/* Print the current mismatching range */
+static void print_mismatch_range(minipro_handle_t *handle,
+				 mismatch_report_t *report, uint8_t word)
+{
+	if (!report->ranges || report->ranges > MISMATCH_RANGES)
+		return;
+	minipro_message(handle, "  0x%04zX - 0x%04zX (%zu %s)\n",
+			report->start, report->end - 1,
+			(report->end - report->start + word) / (word ? 2 : 1),
+			word ? "words" : "bytes");
+}
+
+/* Add the mismatches between s1 and s2 to the report. 'offset' is the
+ * address of the first byte, so that ranges continue across blocks.
+ * With 'word' set the buffers are compared as little endian 16 bit words.
+ */
+static void add_mismatches(minipro_handle_t *handle, mismatch_report_t *report,
+			   uint16_t compare_mask, uint8_t word, uint8_t *s1,
+			   uint8_t *s2, size_t offset, size_t size)
+{
+	size_t i = 0, start, step = word ? 2 : 1;
+	uint16_t v1, v2;
+	uint32_t address;
+
+	while (i < size) {
+		/* Skip to the next mismatch */
+		if (word ? compare_word_memory(0xffff, compare_mask, 1, s1 + i,
+					       s2 + i, size - i, size - i,
+					       &address, NULL, NULL) :
+			   compare_memory(compare_mask, s1 + i, s2 + i, size - i,
+					  size - i, &address, NULL, NULL))
+			start = i + address;
+		else
+			break;
+
+		/* Find where it ends */
+		for (i = start; i < size; i += step) {
+			v1 = s1[i];
+			v2 = s2[i];
+			if (word) {
+				v1 |= ((i + 1 < size) ? s1[i + 1] : 0xff) << 8;
+				v2 |= ((i + 1 < size) ? s2[i + 1] : 0xff) << 8;
+			}
+			if (!((v1 ^ v2) & compare_mask))
+				break;
+			report->bits |= (v1 ^ v2) & compare_mask;
+			report->count++;
+		}
+
+		/* Extend the current range or start a new one */
+		if (!report->ranges || report->end != offset + start) {
+			print_mismatch_range(handle, report, word);
+			report->ranges++;
+			report->start = offset + start;
+		}
+		report->end = offset + MIN(i, size);
+	}
+}
+
+/* Print the last range and the mismatch summary */
+static void print_mismatches(minipro_handle_t *handle,
+			     mismatch_report_t *report, uint8_t word)
+{
+	print_mismatch_range(handle, report, word);
+	if (report->ranges > MISMATCH_RANGES)
+		minipro_message(handle, "  ... and %zu more ranges\n",
+			report->ranges - MISMATCH_RANGES);
+	minipro_message(handle,
+		"%zu mismatching %s in %zu ranges, differing bits 0x%0*X\n",
+		report->count, word ? "words" : "bytes", report->ranges,
+		word ? 4 : 2, report->bits);
+}
+
+/*
+ * Adaptive read block size.
+ * The database read_buffer_size is often conservative for newer firmware.
+ * With --adaptive the first code or data read of a chip probes multiples
+ * of it: the same region is read with every candidate size, each read is
+ * timed and its data compared to the one read with the database size. The
+ * fastest size which returned the same data, and is at least
+ * ADAPTIVE_MIN_GAIN percent faster, is kept in the ADAPTIVE_PROFILE cache
+ * file per programmer model, firmware and chip, so later jobs start with
+ * it. Writes always use the database size, the pages are programmed as
+ * the chip algorithm expects them.
+ */
+#define ADAPTIVE_PROFILE    "blocksize.profile"
+#define ADAPTIVE_MAX_BLOCK  0x8000 /* The length field is 16 bits */
+#define ADAPTIVE_MAX_FACTOR 16
+#define ADAPTIVE_MIN_GAIN   110
+
+static int adaptive_eligible(minipro_handle_t *handle, uint8_t type)
+{
+	/* A recorded session must replay the same transfers, never probe */
+	return handle->cmdopts->adaptive && handle->version != MP_TL866A &&
+	       handle->version != MP_TL866CS &&
+	       !handle->device->flags.custom_protocol &&
+	       (type == MP_CODE || type == MP_DATA) && !usb_session_active();
+}
+
+/* The profile key of a chip memory, one line per key in the profile */
+static void get_profile_key(minipro_handle_t *handle, uint8_t type,
+			    size_t size, char *key, size_t len)
+{
+	snprintf(key, len, "%s %s %s %u %zu", handle->model,
+		 handle->firmware_str, handle->device->name, type, size);
+}
+
+/* Return the tuned block size of a chip memory, 0 if not profiled yet */
+static size_t get_profile_size(minipro_handle_t *handle, uint8_t type,
+			       size_t size)
+{
+	char path[PATH_MAX], key[256], line[320];
+	size_t len, block_size = 0;
+
+	if (get_cache_file(ADAPTIVE_PROFILE, path, sizeof(path)))
+		return 0;
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return 0;
+	get_profile_key(handle, type, size, key, sizeof(key));
+	len = strlen(key);
+	while (fgets(line, sizeof(line), file)) {
+		if (!strncmp(line, key, len) && line[len] == ' ') {
+			block_size = strtoul(line + len + 1, NULL, 0);
+			break;
+		}
+	}
+	fclose(file);
+	return block_size;
+}
+
+/* Store the tuned block size of a chip memory, replacing the old entry */
+static void set_profile_size(minipro_handle_t *handle, uint8_t type,
+			     size_t size, size_t block_size)
+{
+	char path[PATH_MAX], temp[PATH_MAX + 16], key[256], line[320];
+	size_t len;
+
+	if (get_cache_file(ADAPTIVE_PROFILE, path, sizeof(path)))
+		return;
+	snprintf(temp, sizeof(temp), "%s.%u", path, (unsigned int)getpid());
+	FILE *out = fopen(temp, "w");
+	if (!out)
+		return;
+	get_profile_key(handle, type, size, key, sizeof(key));
+	len = strlen(key);
+	FILE *in = fopen(path, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if (strncmp(line, key, len) || line[len] != ' ')
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	fprintf(out, "%s %zu\n", key, block_size);
+	if (ferror(out) | fclose(out)) {
+		remove(temp);
+		return;
+	}
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(temp, path))
+		remove(temp);
+}
+
+/* Read 'len' bytes from the start of a chip memory in 'block_size'
+ * blocks, return the elapsed time in nanoseconds or 0 on error */
+static uint64_t probe_read(minipro_handle_t *handle, uint8_t type,
+			   uint8_t *buf, size_t len, size_t block_size)
+{
+	uint32_t offset = (handle->device->flags.has_data_offset) ?
+				  handle->device->page_size :
+				  0;
+	uint32_t address;
+	uint64_t start = stats_now();
+	size_t i;
+
+	for (i = 0; i < len; i += block_size) {
+		address = i + offset;
+		if (handle->device->flags.has_word && type == MP_CODE)
+			address = address >> 1;
+		if (minipro_read_block(handle, type, address, buf + i,
+				       block_size))
+			return 0;
+	}
+	uint64_t elapsed = stats_now() - start;
+	return elapsed ? elapsed : 1;
+}
+
+/* Find the best block size to read a chip memory with. Return 0 if the
+ * programmer could not be recovered after a failed probe. */
+static size_t probe_block_size(minipro_handle_t *handle, uint8_t type,
+			       size_t size)
+{
+	size_t base = handle->device->read_buffer_size;
+	size_t len = base, block_size, best = base;
+	uint64_t elapsed, best_time;
+
+	while (len * 2 <= ADAPTIVE_MAX_BLOCK && len * 2 <= size &&
+	       !(size % (len * 2)) && len * 2 <= base * ADAPTIVE_MAX_FACTOR)
+		len *= 2;
+	if (len == base)
+		return base;
+
+	/* Some extra bytes, the T56 may return one more byte than asked */
+	uint8_t *reference = malloc(len + 16);
+	uint8_t *probe = malloc(len + 16);
+	if (!reference || !probe) {
+		free(reference);
+		free(probe);
+		return base;
+	}
+
+	int failed = 0;
+	best_time = probe_read(handle, type, reference, len, base);
+	for (block_size = base * 2; best_time && block_size <= len;
+	     block_size *= 2) {
+		elapsed = probe_read(handle, type, probe, len, block_size);
+		if (!elapsed) {
+			failed = 1;
+			break;
+		}
+		if (memcmp(reference, probe, len))
+			break;
+		if (elapsed * ADAPTIVE_MIN_GAIN / 100 < best_time) {
+			best = block_size;
+			best_time = elapsed;
+		}
+	}
+	free(reference);
+	free(probe);
+	if (!best_time)
+		return base;
+
+	/* Start over with a clean programmer state after a failed read */
+	if (failed && (minipro_end_transaction(handle) ||
+		       minipro_begin_transaction(handle)))
+		return 0;
+	set_profile_size(handle, type, size, best);
+	if (best != base)
+		minipro_message(handle,
+				"Tuned the read block size to %zu bytes.\n",
+				best);
+	return best;
+}
+
+/* Return the largest block size a chip memory may be read with */
+size_t minipro_max_read_block(minipro_handle_t *handle)
+{
+	size_t len = handle->device->read_buffer_size;
+	if (handle->cmdopts->adaptive && len < ADAPTIVE_MAX_BLOCK)
+		len = ADAPTIVE_MAX_BLOCK;
+	return len;
+}
+
+/* Return the block size to read a chip memory with */
+static size_t get_read_block_size(minipro_handle_t *handle, uint8_t type,
+				  size_t size)
+{
+	size_t base = handle->device->read_buffer_size;
+	if (!adaptive_eligible(handle, type) || size <= base)
+		return base;
+
+	size_t block_size = get_profile_size(handle, type, size);
+	if (!block_size)
+		block_size = probe_block_size(handle, type, size);
+	else if (block_size % base || size % block_size ||
+		 block_size > ADAPTIVE_MAX_BLOCK)
+		block_size = base;
+	return block_size;
+}
+
+/*
+ * Streaming verify.
+ * The chip is read block by block and each block is compared with the
+ * file data as soon as it arrives, so only one block of chip data is held
+ * in memory. Without file data (blank check) the blocks are compared with
+ * the device blank value.
+ */
+typedef struct verify_state {
+	minipro_handle_t *handle;
+	uint8_t *file_data;
+	size_t file_size;
+	uint8_t *blank;
+	uint16_t compare_mask;
+	uint8_t word;
+	uint8_t report;
+	uint8_t abort;
+	int failed;
+	uint32_t address; /* first mismatch */
+	uint16_t c1, c2;
+	mismatch_report_t mismatches;
+} verify_state_t;
+
+static int verify_init(minipro_handle_t *handle, verify_state_t *verify,
+		       uint8_t type, uint8_t *file_data, size_t file_size)
+{
+	memset(verify, 0, sizeof(*verify));
+	verify->handle = handle;
+	verify->file_data = file_data;
+	verify->file_size = file_size;
+	verify->compare_mask =
+		(type == MP_CODE) ? handle->device->compare_mask : 0xff;
+	verify->word = verify->compare_mask > 0xff;
+	verify->report = handle->cmdopts->mismatch_report;
+	verify->abort = handle->cmdopts->abort_on_mismatch;
+	if (file_data)
+		return EXIT_SUCCESS;
+
+	size_t len = minipro_max_read_block(handle);
+	verify->blank = malloc(len);
+	if (!verify->blank) {
+		minipro_message(handle, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	memset(verify->blank, handle->device->blank_value, len);
+	return EXIT_SUCCESS;
+}
+
+/* Compare one block read from the chip at 'offset' */
+static void verify_block(verify_state_t *verify, uint8_t *chip_data,
+			 size_t offset, size_t size)
+{
+	if (offset >= verify->file_size)
+		return;
+	size = MIN(size, verify->file_size - offset);
+	uint8_t *file_data = verify->file_data ? verify->file_data + offset :
+						 verify->blank;
+
+	if (!verify->failed) {
+		uint32_t address;
+		uint8_t c1 = 0, c2 = 0;
+		uint16_t cw1 = 0, cw2 = 0;
+		if (verify->word)
+			verify->failed = compare_word_memory(
+				0xffff, verify->compare_mask, 1, file_data,
+				chip_data, size, size, &address, &cw1, &cw2);
+		else
+			verify->failed = compare_memory(verify->compare_mask,
+							file_data, chip_data,
+							size, size, &address,
+							&c1, &c2);
+		if (!verify->failed)
+			return;
+		verify->address = offset + address;
+		verify->c1 = verify->word ? cw1 : c1;
+		verify->c2 = verify->word ? cw2 : c2;
+	}
+	if (verify->report)
+		add_mismatches(verify->handle, &verify->mismatches,
+			       verify->compare_mask, verify->word, file_data,
+			       chip_data, offset, size);
+}
+
+/* Report the first mismatch, or all of them if requested.
+ * Returns EXIT_FAILURE on mismatch.
+ */
+static int verify_result(verify_state_t *verify)
+{
+	minipro_handle_t *handle = verify->handle;
+	free(verify->blank);
+	verify->blank = NULL;
+	if (!verify->failed)
+		return EXIT_SUCCESS;
+
+	if (verify->word) {
+		minipro_message(handle,
+			"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
+			verify->address, verify->c1, verify->c2);
+	} else {
+		minipro_message(handle,
+			"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
+			verify->address, verify->c1, verify->c2);
+	}
+	if (verify->report) {
+		if (verify->abort)
+			minipro_message(handle,
+					"Verify aborted, mismatches so far:\n");
+		print_mismatches(handle, &verify->mismatches, verify->word);
+	}
+	return EXIT_FAILURE;
+}
+
+/*
+ * Overcurrent status polling.
+ * By default the status is requested after every transferred block. With
+ * --ovc_interval it is requested every 'ovc_interval' blocks, whenever
+ * OVC_POLL_TIME microseconds have passed since the last poll and always
+ * after the last block.
+ * A recorded or replayed USB session must poll at the same blocks, so it
+ * polls every 'ovc_interval' blocks only.
+ */
+typedef struct ovc_poll {
+	size_t interval;
+	size_t blocks;
+	int timed;
+	struct timeval last;
+} ovc_poll_t;
+
+static void ovc_poll_init(minipro_handle_t *handle, ovc_poll_t *poll)
+{
+	poll->interval = handle->cmdopts->ovc_interval;
+	poll->blocks = 0;
+	poll->timed = poll->interval && !usb_session_active();
+	if (!poll->interval)
+		poll->interval = 1;
+	gettimeofday(&poll->last, NULL);
+}
+
+static int ovc_poll_due(ovc_poll_t *poll, int last_block)
+{
+	struct timeval now;
+	poll->blocks++;
+	gettimeofday(&now, NULL);
+	long elapsed = (now.tv_sec - poll->last.tv_sec) * 1000000 +
+		       (now.tv_usec - poll->last.tv_usec);
+	if (!last_block && poll->blocks < poll->interval &&
+	    (!poll->timed || elapsed < OVC_POLL_TIME))
+		return 0;
+	poll->blocks = 0;
+	poll->last = now;
+	return 1;
+}
+
+/* Return the transfer rate in KB/s */
+static double get_throughput(size_t size, double seconds)
+{
+	return seconds > 0 ? (double)size / 1024 / seconds : 0;
+}
+
+/* RAM-centric IO operations */
+
+/* Read 'size' bytes of the chip memory 'type' in 'block_size' blocks.
+ * With 'block_cb' set every block is handed to it as soon as it is read
+ * and 'buf' only has to hold one block, otherwise the whole memory is read
+ * into 'buf'.
+ */
+static int read_page_blocks(minipro_handle_t *handle, uint8_t *buf,
+			    uint8_t type, size_t size, size_t block_size,
+			    minipro_block_cb block_cb, void *ctx)
+{
+	char status_msg[64], *name;
+	switch (type) {
+	case MP_DATA:
+		name = "Data";
+		break;
+	case MP_USER:
+		name = "User";
+		break;
+	default:
+		name = "Code";
+	}
+	snprintf(status_msg, sizeof(status_msg), "Reading %s...  ", name);
+
+	size_t buffer_size = size < block_size ? size : block_size;
+	size_t blocks_count = size / buffer_size;
+	if (size % buffer_size)
+		blocks_count++;
+
+	struct timeval begin, end;
+	gettimeofday(&begin, NULL);
+	uint64_t start = stats_start();
+	/* Some controllers have data memory (eeprom) mapped to a
+	 * different address than 0 in programming mode. For ex. AT89S8252 */
+	uint32_t offset = (handle->device->flags.has_data_offset) ?
+				  handle->device->page_size :
+				  0;
+	uint32_t address;
+	size_t i;
+	ovc_poll_t poll;
+	ovc_poll_init(handle, &poll);
+	for (i = 0; i < blocks_count; i++) {
+		minipro_progress(handle, status_msg, i * 100 / blocks_count);
+		/* Translating address to protocol-specific */
+		address = i * buffer_size + offset;
+		if (handle->device->flags.has_word && type == MP_CODE)
+			address = address >> 1;
+
+		uint8_t *block = block_cb ? buf : buf + i * buffer_size;
+		if (minipro_read_block(handle, type, address, block,
+				       buffer_size))
+			return EXIT_FAILURE;
+
+		if (block_cb) {
+			int ret = block_cb(ctx, block, i * buffer_size,
+					   MIN(buffer_size,
+					       size - i * buffer_size));
+			if (ret) {
+				minipro_progress(handle, status_msg, -1);
+				return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+			}
+		}
+
+		if (!ovc_poll_due(&poll, i + 1 == blocks_count))
+			continue;
+		uint8_t ovc;
+		if (minipro_get_ovc_status(handle, NULL, &ovc))
+			return EXIT_FAILURE;
+		if (ovc) {
+			minipro_message(handle,
+					"\nOvercurrent protection!\007\n");
+			return EXIT_FAILURE;
+		}
+	}
+	gettimeofday(&end, NULL);
+	stats_record(STATS_PHASE, "read_memory", size, start);
+	double seconds = (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+			 (double)(end.tv_sec - begin.tv_sec);
+	snprintf(status_msg, sizeof(status_msg),
+		 "Reading %s...  %.2fSec  %.2fKB/s  OK", name, seconds,
+		 get_throughput(size, seconds));
+	minipro_progress(handle, status_msg, -1);
+	return EXIT_SUCCESS;
+}
+
+int minipro_read_memory(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
+			size_t size)
+{
+	size_t block_size = get_read_block_size(handle, type, size);
+	if (!block_size)
+		return EXIT_FAILURE;
+	return read_page_blocks(handle, buf, type, size, block_size, NULL,
+				NULL);
+}
+
+/* Read 'size' bytes of the chip memory 'type' one block at a time and hand
+ * every block to 'block_cb', so the memory is never held as a whole.
+ */
+int minipro_read_stream(minipro_handle_t *handle, uint8_t type, size_t size,
+			minipro_block_cb block_cb, void *user_data)
+{
+	size_t block_size = get_read_block_size(handle, type, size);
+	if (!block_size)
+		return EXIT_FAILURE;
+	/* Some extra bytes, the T56 may return one more byte than asked */
+	uint8_t *block = malloc(block_size + 16);
+	if (!block) {
+		minipro_message(handle, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	int ret = read_page_blocks(handle, block, type, size, block_size,
+				   block_cb, user_data);
+	free(block);
+	return ret;
+}
+
+/* Compare one block, stop the read on the first mismatch if requested */
+static int verify_block_cb(void *ctx, uint8_t *block, size_t offset,
+			   size_t len)
+{
+	verify_state_t *verify = ctx;
+	verify_block(verify, block, offset, len);
+	return verify->failed && verify->abort;
+}
+
+/* Verify 'size' bytes of the chip memory 'type' against 'file_data', or
+ * against the blank value if 'file_data' is NULL, one block at a time.
+ */
+int minipro_verify_memory(minipro_handle_t *handle, uint8_t type,
+			  uint8_t *file_data, size_t file_size, size_t size,
+			  int *failed)
+{
+	verify_state_t verify;
+	if (verify_init(handle, &verify, type, file_data,
+			MIN(file_size, size)))
+		return EXIT_FAILURE;
+
+	if (minipro_read_stream(handle, type, size, verify_block_cb,
+				&verify)) {
+		verify.failed = 0;
+		verify_result(&verify);
+		return EXIT_FAILURE;
+	}
+	*failed = verify_result(&verify);
+	return EXIT_SUCCESS;
+}
+
+/* Write 'size' bytes of 'buffer' to the chip memory 'type'. Blocks of
+ * write_buffer_size bytes with 'skip' set are not written, NULL writes all.
+ */
+int minipro_write_memory(minipro_handle_t *handle, uint8_t *buffer,
+			 uint8_t type, size_t size, uint8_t *skip)
+{
+	char status_msg[64], *name;
+	switch (type) {
+	case MP_DATA:
+		name = "Data";
+		break;
+	case MP_USER:
+		name = "User";
+		break;
+	default:
+		name = "Code";
+	}
+	snprintf(status_msg, sizeof(status_msg), "Writing  %s...  ", name);
+
+	size_t buffer_size = handle->device->write_buffer_size;
+	size_t blocks_count = size / buffer_size;
+	if (size % buffer_size)
+		blocks_count++;
+
+	struct timeval begin, end;
+	gettimeofday(&begin, NULL);
+	uint64_t start = stats_start();
+	minipro_status_t status;
+	size_t i;
+	/* Some controllers have data memory (eeprom) mapped to a
+	 * different address than 0 in programming mode. For ex. AT89S8252 */
+	uint32_t offset = (handle->device->flags.has_data_offset) ?
+				  handle->device->page_size :
+				  0;
+	uint32_t address;
+	size_t len, written = 0;
+	ovc_poll_t poll;
+	ovc_poll_init(handle, &poll);
+	for (i = 0; i < blocks_count; i++) {
+		minipro_progress(handle, status_msg, i * 100 / blocks_count);
+		if (skip && skip[i] && i + 1 < blocks_count)
+			continue;
+		/* Translating address to protocol-specific */
+		address = i * buffer_size + offset;
+		if (handle->device->flags.has_word && type == MP_CODE)
+			address = address >> 1;
+
+		/* Last block */
+		len = buffer_size;
+		if ((i + 1) * buffer_size > size)
+			len = size % buffer_size;
+		/* A skipped last block still gets the final status poll */
+		if (!(skip && skip[i])) {
+			if (minipro_write_block(handle, type, address,
+						buffer + i * buffer_size, len))
+				return EXIT_FAILURE;
+			written += len;
+		}
+
+		/* With --ovc_interval the verify-while-writing status is only
+		 * checked at the polled blocks */
+		if (!ovc_poll_due(&poll, i + 1 == blocks_count))
+			continue;
+		uint8_t ovc = 0;
+		if (minipro_get_ovc_status(handle, &status, &ovc))
+			return EXIT_FAILURE;
+		if (ovc) {
+			minipro_message(handle,
+					"\nOvercurrent protection!\007\n");
+			return EXIT_FAILURE;
+		}
+		if (status.error && !handle->cmdopts->no_verify) {
+			if (minipro_end_transaction(handle))
+				return EXIT_FAILURE;
+			minipro_message(handle,
+				"\nVerification failed at address 0x%04X: File=0x%02X, "
+				"Device=0x%02X\n",
+				status.address,
+				status.c2 &
+					(handle->device->flags.word_size == 1 ?
+						 0xFF :
+						 0xFFFF),
+				status.c1 &
+					(handle->device->flags.word_size == 1 ?
+						 0xFF :
+						 0xFFFF));
+			return EXIT_FAILURE;
+		}
+	}
+	gettimeofday(&end, NULL);
+	stats_record(STATS_PHASE, "write_memory", written, start);
+	double seconds = (double)(end.tv_usec - begin.tv_usec) / 1000000 +
+			 (double)(end.tv_sec - begin.tv_sec);
+	snprintf(status_msg, sizeof(status_msg),
+		 "Writing %s...  %.2fSec  %.2fKB/s  OK", name, seconds,
+		 get_throughput(written, seconds));
+	minipro_progress(handle, status_msg, -1);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Incremental programming.
+ * Mark the write blocks which can be skipped. If the chip was erased these
+ * are the blocks holding only the blank value, otherwise the chip is read
+ * block by block and the write blocks already holding the file data are
+ * skipped.
+ */
+typedef struct skip_state {
+	uint8_t *file_data;
+	uint8_t *skip;
+	size_t buffer_size;
+	uint16_t compare_mask;
+} skip_state_t;
+
+/* Check if 'len' bytes of the chip hold the file data */
+static int skip_compare(uint16_t compare_mask, uint8_t *file_data,
+			uint8_t *chip_data, size_t len)
+{
+	uint32_t address;
+	if (compare_mask > 0xff)
+		return !compare_word_memory(0xffff, compare_mask, 1, file_data,
+					    chip_data, len, len, &address,
+					    NULL, NULL);
+	return !compare_memory(compare_mask, file_data, chip_data, len, len,
+			       &address, NULL, NULL);
+}
+
+/* Clear the skip flag of every write block a read block differs in. The
+ * read and write block sizes may differ. */
+static int skip_block_cb(void *ctx, uint8_t *block, size_t offset,
+			 size_t len)
+{
+	skip_state_t *state = ctx;
+	while (len) {
+		size_t i = offset / state->buffer_size;
+		size_t n = MIN(len, (i + 1) * state->buffer_size - offset);
+		if (state->skip[i] &&
+		    !skip_compare(state->compare_mask,
+				  state->file_data + offset, block, n))
+			state->skip[i] = 0;
+		block += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Returns the number of skipped blocks or -1 on error */
+int minipro_get_skip_blocks(minipro_handle_t *handle, uint8_t *file_data,
+			    uint8_t type, size_t size, int erased,
+			    uint8_t *skip)
+{
+	size_t buffer_size = handle->device->write_buffer_size;
+	size_t blocks_count = (size + buffer_size - 1) / buffer_size;
+	size_t i, len, skipped = 0;
+	uint16_t compare_mask =
+		(type == MP_CODE) ? handle->device->compare_mask : 0xff;
+
+	if (!erased) {
+		skip_state_t state;
+		state.file_data = file_data;
+		state.skip = skip;
+		state.buffer_size = buffer_size;
+		state.compare_mask = compare_mask;
+		memset(skip, 1, blocks_count);
+		if (minipro_read_stream(handle, type, size, skip_block_cb,
+					&state))
+			return -1;
+		for (i = 0; i < blocks_count; i++)
+			skipped += skip[i];
+		return skipped;
+	}
+
+	uint8_t *blank = malloc(buffer_size);
+	if (!blank) {
+		minipro_message(handle, "Out of memory!\n");
+		return -1;
+	}
+	memset(blank, handle->device->blank_value, buffer_size);
+	for (i = 0; i < blocks_count; i++) {
+		len = MIN(buffer_size, size - i * buffer_size);
+		skip[i] = skip_compare(compare_mask,
+				       file_data + i * buffer_size, blank, len);
+		skipped += skip[i];
+	}
+	free(blank);
+	return skipped;
+}
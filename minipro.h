@@ -260,11 +260,60 @@ typedef struct cmdopts_s {
 	uint8_t is_pipe;
 	uint8_t version;
 	uint8_t force_erase;
+	uint32_t ovc_interval;
+	uint8_t mismatch_report;
+	uint8_t abort_on_mismatch;
+	uint8_t incremental;
+	uint8_t reuse_bitstream;
+	uint8_t vector_queue;
+	uint8_t skip_blank;
+	uint8_t row_queue;
+	uint8_t verify_rows;
+	uint8_t batch_config;
+	uint8_t async_load;
+	uint8_t adaptive;
+	uint8_t auto_detect; /* -a package type of a job, 0 if not given */
+	uint8_t list_prefix;
+	uint32_t list_pins;
+	uint32_t list_protocol;
+	uint8_t crc32_check;
+	uint32_t crc32;
+	char *gang;
+	char *server;
+	char *connect;
+	char *stats;
+	char *trace;
+	char *record;
+	char *replay;
+	long replay_latency;
 	int filter_fuses;
 	int filter_locks;
 	int filter_uid;
 } cmdopts_t;
 
+struct minipro_handle;
+
+/* One config section of a batched fuse read, see minipro_read_fuse_sections */
+typedef struct fuse_section {
+	uint8_t type; /* MP_FUSE_CFG, MP_FUSE_USER or MP_FUSE_LOCK */
+	size_t length;
+	uint8_t items_count;
+	uint8_t *buffer;
+} fuse_section_t;
+
+/* Progress callback, 'percent' is -1 for the final status line */
+typedef void (*minipro_progress_cb)(struct minipro_handle *,
+				    const char *status, int percent);
+/* Message callback for errors and reports, 'message' ends with a newline */
+typedef void (*minipro_message_cb)(struct minipro_handle *,
+				   const char *message);
+/* Block callback of minipro_read_stream(), 'offset' is the position of the
+ * 'len' bytes in 'block' within the memory. Return 0 to go on reading, a
+ * positive value to stop or a negative value to fail the read.
+ */
+typedef int (*minipro_block_cb)(void *user_data, uint8_t *block,
+				size_t offset, size_t len);
+
 typedef struct minipro_handle {
 	char *model;
 	char firmware_str[16];
@@ -278,9 +327,25 @@ typedef struct minipro_handle {
 	uint8_t speed;
 	float voltage;
 	device_t *device;
+	struct pin_map *pin_map;
 	void *usb_handle;
 	cmdopts_t *cmdopts;
 
+	/* Output callbacks, NULL prints to stderr */
+	minipro_progress_cb progress;
+	minipro_message_cb message;
+	void *user_data;
+
+	/* Per session programmer state */
+	uint8_t bitstream_uploaded;
+	/* Names and CRCs of the FPGA algorithms last uploaded, empty if
+	 * unknown. Kept across the jobs of a server. */
+	char bitstream_loaded[2 * NAME_LEN + 24];
+	uint8_t zif_dir[40];
+	uint8_t zif_state[40];
+	uint8_t mask_prom_detected; /* CE/CS polarity of mask PROMs */
+	uint8_t mask_prom_ce, mask_prom_cs;
+
 	int (*minipro_begin_transaction)(struct minipro_handle *);
 	int (*minipro_end_transaction)(struct minipro_handle *);
 	int (*minipro_protect_off)(struct minipro_handle *);
@@ -299,6 +364,8 @@ typedef struct minipro_handle {
 				  uint8_t, uint8_t *);
 	int (*minipro_write_fuses)(struct minipro_handle *, uint8_t, size_t,
 				   uint8_t, uint8_t *);
+	int (*minipro_read_fuse_sections)(struct minipro_handle *,
+					  fuse_section_t *, size_t);
 	int (*minipro_read_calibration)(struct minipro_handle *, uint8_t *,
 					size_t);
 	int (*minipro_erase)(struct minipro_handle *);
@@ -308,6 +375,9 @@ typedef struct minipro_handle {
 				       uint8_t, uint8_t, size_t);
 	int (*minipro_read_jedec_row)(struct minipro_handle *, uint8_t *,
 				      uint8_t, uint8_t, size_t);
+	int (*minipro_read_jedec_rows)(struct minipro_handle *, uint8_t *,
+				       size_t, uint8_t, uint8_t, size_t,
+				       size_t);
 	int (*minipro_firmware_update)(struct minipro_handle *, const char *);
 	int (*minipro_pin_test)(struct minipro_handle *);
 	int (*minipro_logic_ic_test)(struct minipro_handle *);
@@ -328,9 +398,46 @@ uint64_t load_int(uint8_t *buffer, size_t size, uint8_t endianness);
 void minipro_print_system_info(minipro_handle_t *handle);
 int write_logic_file(minipro_handle_t *handle, uint8_t *first_step,
 		     uint8_t *second_step);
+uint8_t *run_logic_vectors(minipro_handle_t *handle, uint8_t opcode,
+			   int pull);
+int run_jedec_row_reads(minipro_handle_t *handle, uint8_t opcode,
+			size_t send_len, size_t recv_len, uint8_t *buffer,
+			size_t stride, uint8_t row, uint8_t flags, size_t size,
+			size_t count);
+int run_fuse_reads(minipro_handle_t *handle, const uint8_t *opcodes,
+		   fuse_section_t *sections, size_t count);
 uint32_t crc_32(uint8_t *data, size_t size, uint32_t initial);
 int minipro_reset(minipro_handle_t *handle);
 int minipro_get_devices_count(uint8_t version);
+int compare_memory(uint8_t compare_mask, uint8_t *s1, uint8_t *s2,
+		   size_t size1, size_t size2, uint32_t *address, uint8_t *c1,
+		   uint8_t *c2);
+int compare_word_memory(uint16_t replacement_value, uint16_t compare_mask,
+			uint8_t little_endian, uint8_t *s1, uint8_t *s2,
+			size_t size1, size_t size2, uint32_t *address,
+			uint16_t *c1, uint16_t *c2);
+void minipro_progress(minipro_handle_t *handle, const char *status,
+		      int percent);
+void minipro_message(minipro_handle_t *handle, const char *fmt, ...);
+
+/*
+ * RAM-centric IO operations on the chip memory 'type' (MP_CODE, MP_DATA,
+ * MP_USER). Progress and errors are reported through the handle callbacks.
+ */
+int minipro_read_memory(minipro_handle_t *handle, uint8_t *buffer,
+			uint8_t type, size_t size);
+int minipro_read_stream(minipro_handle_t *handle, uint8_t type, size_t size,
+			minipro_block_cb block_cb, void *user_data);
+/* The largest block minipro_read_stream() may hand to its callback */
+size_t minipro_max_read_block(minipro_handle_t *handle);
+int minipro_write_memory(minipro_handle_t *handle, uint8_t *buffer,
+			 uint8_t type, size_t size, uint8_t *skip);
+int minipro_verify_memory(minipro_handle_t *handle, uint8_t type,
+			  uint8_t *file_data, size_t file_size, size_t size,
+			  int *failed);
+int minipro_get_skip_blocks(minipro_handle_t *handle, uint8_t *file_data,
+			    uint8_t type, size_t size, int erased,
+			    uint8_t *skip);
 
 /*
  * Standard interface functions compatible with both TL866A/TL866II+
@@ -341,7 +448,11 @@ int minipro_get_devices_count(uint8_t version);
  * state.
  */
 minipro_handle_t *minipro_open(uint8_t verbose);
+minipro_handle_t *minipro_open_unit(const char *unit, uint8_t verbose);
+void minipro_select_unit(const char *unit);
+int minipro_get_unit(int index, char *serial, char *path, size_t size);
 void minipro_close(minipro_handle_t *handle);
+void minipro_free_device(minipro_handle_t *handle);
 int minipro_begin_transaction(minipro_handle_t *handle);
 int minipro_end_transaction(minipro_handle_t *handle);
 int minipro_protect_off(minipro_handle_t *handle);
@@ -360,12 +471,17 @@ int minipro_read_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
 		       uint8_t items_count, uint8_t *buffer);
 int minipro_write_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
 			uint8_t items_count, uint8_t *buffer);
+int minipro_read_fuse_sections(minipro_handle_t *handle,
+			       fuse_section_t *sections, size_t count);
 int minipro_read_calibration(minipro_handle_t *handle, uint8_t *buffer,
 			     size_t size);
 int minipro_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			    uint8_t row, uint8_t flags, size_t size);
 int minipro_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			   uint8_t row, uint8_t flags, size_t size);
+int minipro_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			    size_t stride, uint8_t row, uint8_t flags,
+			    size_t size, size_t count);
 int minipro_erase(minipro_handle_t *handle);
 int minipro_unlock_tsop48(minipro_handle_t *handle, uint8_t *status);
 int minipro_hardware_check(minipro_handle_t *handle);
@@ -0,0 +1,377 @@
+/*
+ * nand.c - Host side NAND flash support: bad block table, file layouts
+ *		and software ECC.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nand.h"
+
+/* Factory bad block marker: the first spare byte of a large page, the
+ * sixth of a 512 byte page */
+#define SMALL_PAGE_SIZE	  512
+#define SMALL_PAGE_MARKER 5
+
+int nand_bbt_init(nand_bbt_t *bbt, const nand_geometry_t *geometry)
+{
+	memset(bbt, 0, sizeof(*bbt));
+	if (!geometry->page_size || !geometry->pages_per_block ||
+	    !geometry->block_count) {
+		fprintf(stderr, "Invalid NAND geometry.\n");
+		return EXIT_FAILURE;
+	}
+	bbt->bad = calloc(1, ((size_t)geometry->block_count + 7) / 8);
+	if (!bbt->bad) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	bbt->geometry = *geometry;
+	return EXIT_SUCCESS;
+}
+
+void nand_bbt_free(nand_bbt_t *bbt)
+{
+	free(bbt->bad);
+	bbt->bad = NULL;
+	bbt->bad_count = 0;
+}
+
+void nand_bbt_mark_bad(nand_bbt_t *bbt, uint32_t block)
+{
+	if (nand_bbt_is_bad(bbt, block))
+		return;
+	bbt->bad[block / 8] |= 0x01 << (block & 0x07);
+	bbt->bad_count++;
+}
+
+/* Check the factory markers of one raw block. Depending on the vendor
+ * the marker is in the first, the second or the last page, so all three
+ * are looked at. */
+int nand_block_marked_bad(const nand_geometry_t *geometry,
+			  const uint8_t *block)
+{
+	size_t page_bytes = nand_raw_page_size(geometry);
+	size_t marker = geometry->page_size > SMALL_PAGE_SIZE ?
+				0 :
+				SMALL_PAGE_MARKER;
+	uint32_t pages[] = { 0, 1, geometry->pages_per_block - 1 };
+
+	if (marker >= geometry->spare_size)
+		return 0;
+	for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+		if (pages[i] >= geometry->pages_per_block)
+			continue;
+		if (block[pages[i] * page_bytes + geometry->page_size +
+			  marker] != 0xFF)
+			return 1;
+	}
+	return 0;
+}
+
+/* Build the table from the factory markers of a raw image. This has to
+ * be done on a chip that was never erased by anything that doesn't know
+ * about the markers, an erase wipes them. */
+int nand_bbt_scan(nand_bbt_t *bbt, const uint8_t *raw, size_t size)
+{
+	const nand_geometry_t *geometry = &bbt->geometry;
+	size_t block_bytes = nand_raw_block_size(geometry);
+
+	if (size < nand_raw_size(geometry)) {
+		fprintf(stderr, "The NAND image is too small.\n");
+		return EXIT_FAILURE;
+	}
+	memset(bbt->bad, 0, ((size_t)geometry->block_count + 7) / 8);
+	bbt->bad_count = 0;
+	for (uint32_t block = 0; block < geometry->block_count; block++) {
+		if (nand_block_marked_bad(geometry, raw + block * block_bytes))
+			nand_bbt_mark_bad(bbt, block);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Data bytes of the good blocks, the size of a skip-bad image */
+size_t nand_good_size(const nand_bbt_t *bbt)
+{
+	const nand_geometry_t *geometry = &bbt->geometry;
+	return (size_t)(geometry->block_count - bbt->bad_count) *
+	       geometry->pages_per_block * geometry->page_size;
+}
+
+/* Extract the page data of the good blocks from a raw image, 'data' must
+ * hold nand_good_size() bytes */
+void nand_raw_to_skip_bad(const nand_bbt_t *bbt, const uint8_t *raw,
+			  uint8_t *data)
+{
+	const nand_geometry_t *geometry = &bbt->geometry;
+	size_t page_bytes = nand_raw_page_size(geometry);
+
+	for (uint32_t block = 0; block < geometry->block_count; block++) {
+		if (nand_bbt_is_bad(bbt, block)) {
+			raw += nand_raw_block_size(geometry);
+			continue;
+		}
+		for (uint32_t i = 0; i < geometry->pages_per_block; i++) {
+			memcpy(data, raw, geometry->page_size);
+			data += geometry->page_size;
+			raw += page_bytes;
+		}
+	}
+}
+
+/* Spread a skip-bad image over the good blocks of a raw image of
+ * nand_raw_size() bytes. Everything not covered, the spare areas and the
+ * bad blocks are left erased (0xFF). */
+int nand_skip_bad_to_raw(const nand_bbt_t *bbt, const uint8_t *data,
+			 size_t size, uint8_t *raw)
+{
+	const nand_geometry_t *geometry = &bbt->geometry;
+	size_t page_bytes = nand_raw_page_size(geometry);
+
+	if (size > nand_good_size(bbt)) {
+		fprintf(stderr,
+			"The file is larger than the %zu bytes of the good "
+			"blocks.\n",
+			nand_good_size(bbt));
+		return EXIT_FAILURE;
+	}
+	memset(raw, 0xFF, nand_raw_size(geometry));
+	for (uint32_t block = 0; size && block < geometry->block_count;
+	     block++) {
+		if (nand_bbt_is_bad(bbt, block)) {
+			raw += nand_raw_block_size(geometry);
+			continue;
+		}
+		for (uint32_t i = 0; size && i < geometry->pages_per_block;
+		     i++) {
+			size_t len = size < geometry->page_size ?
+					     size :
+					     geometry->page_size;
+			memcpy(raw, data, len);
+			data += len;
+			size -= len;
+			raw += page_bytes;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static inline uint8_t parity8(uint8_t value)
+{
+	value ^= value >> 4;
+	value ^= value >> 2;
+	value ^= value >> 1;
+	return value & 0x01;
+}
+
+static inline int bit_count(uint8_t value)
+{
+	int count = 0;
+	for (; value; value &= value - 1)
+		count++;
+	return count;
+}
+
+/* Move the four low bits of 'value' to the even bit positions */
+static inline uint8_t spread4(uint8_t value)
+{
+	return (value & 0x01) | (value & 0x02) << 1 | (value & 0x04) << 2 |
+	       (value & 0x08) << 3;
+}
+
+/* Collect the odd bit positions of 'value' into four bits */
+static inline uint8_t odd_bits(uint8_t value)
+{
+	return (value >> 1 & 0x01) | (value >> 2 & 0x02) |
+	       (value >> 3 & 0x04) | (value >> 4 & 0x08);
+}
+
+/* Hamming ECC of NAND_ECC_STEP bytes.
+ * The line parities of a byte address bit are the parities of the bytes
+ * with that address bit set (odd) or clear (even). As the parity of a
+ * set of bytes is the xor of their parities, the xor of the addresses of
+ * the odd parity bytes gives all the 'odd' line parities at once. The
+ * column parities are taken from the xor of all bytes. Everything is
+ * stored inverted, so an erased page has an erased ECC.
+ */
+void nand_ecc_calculate(const uint8_t *data, uint8_t *ecc)
+{
+	uint8_t column = 0, odd = 0, even;
+
+	for (unsigned int i = 0; i < NAND_ECC_STEP; i++) {
+		column ^= data[i];
+		if (parity8(data[i]))
+			odd ^= i;
+	}
+	even = parity8(column) ? ~odd : odd;
+
+	ecc[0] = ~(spread4(even & 0x0F) | spread4(odd & 0x0F) << 1);
+	ecc[1] = ~(spread4(even >> 4) | spread4(odd >> 4) << 1);
+	ecc[2] = ~(parity8(column & 0xF0) << 7 | parity8(column & 0x0F) << 6 |
+		   parity8(column & 0xCC) << 5 | parity8(column & 0x33) << 4 |
+		   parity8(column & 0xAA) << 3 | parity8(column & 0x55) << 2);
+}
+
+/* Correct NAND_ECC_STEP bytes with the ECC read from the chip and the one
+ * calculated from the data read. Returns 0 if they match, 1 if a single
+ * bit error was fixed (in the data or in the ECC itself) and -1 if the
+ * data can't be corrected.
+ */
+int nand_ecc_correct(uint8_t *data, const uint8_t *read_ecc,
+		     const uint8_t *calc_ecc)
+{
+	uint8_t b0 = read_ecc[0] ^ calc_ecc[0];
+	uint8_t b1 = read_ecc[1] ^ calc_ecc[1];
+	uint8_t b2 = read_ecc[2] ^ calc_ecc[2];
+
+	if (!(b0 | b1 | b2))
+		return 0;
+
+	/* A data bit error flips exactly one parity of each pair */
+	if (((b0 ^ (b0 >> 1)) & 0x55) == 0x55 &&
+	    ((b1 ^ (b1 >> 1)) & 0x55) == 0x55 &&
+	    ((b2 ^ (b2 >> 1)) & 0x54) == 0x54) {
+		data[odd_bits(b1) << 4 | odd_bits(b0)] ^= 0x01
+							  << odd_bits(b2 >> 2);
+		return 1;
+	}
+
+	/* A single flipped ECC bit */
+	if (bit_count(b0) + bit_count(b1) + bit_count(b2) == 1)
+		return 1;
+	return -1;
+}
+
+/* The ECC needs whole steps and room at the end of the spare area */
+int nand_ecc_fits(const nand_geometry_t *geometry)
+{
+	return geometry->page_size && !(geometry->page_size % NAND_ECC_STEP) &&
+	       geometry->page_size / NAND_ECC_STEP * NAND_ECC_BYTES <=
+		       geometry->spare_size;
+}
+
+/* Write the ECC of a raw page into its spare area */
+void nand_ecc_encode_page(const nand_geometry_t *geometry, uint8_t *page)
+{
+	size_t steps = geometry->page_size / NAND_ECC_STEP;
+	uint8_t *ecc = page + nand_raw_page_size(geometry) -
+		       steps * NAND_ECC_BYTES;
+
+	for (size_t i = 0; i < steps; i++)
+		nand_ecc_calculate(page + i * NAND_ECC_STEP,
+				   ecc + i * NAND_ECC_BYTES);
+}
+
+/* Check and correct the data of a raw page read back. Returns the number
+ * of uncorrectable steps and adds the bit errors fixed to 'corrected'.
+ */
+int nand_ecc_correct_page(const nand_geometry_t *geometry, uint8_t *page,
+			  uint32_t *corrected)
+{
+	size_t steps = geometry->page_size / NAND_ECC_STEP;
+	const uint8_t *ecc = page + nand_raw_page_size(geometry) -
+			     steps * NAND_ECC_BYTES;
+	uint8_t calc[NAND_ECC_BYTES];
+	int failed = 0;
+
+	for (size_t i = 0; i < steps; i++) {
+		nand_ecc_calculate(page + i * NAND_ECC_STEP, calc);
+		int ret = nand_ecc_correct(page + i * NAND_ECC_STEP,
+					   ecc + i * NAND_ECC_BYTES, calc);
+		if (ret < 0)
+			failed++;
+		else
+			*corrected += ret;
+	}
+	return failed;
+}
+
+static void *ecc_worker(void *arg)
+{
+	nand_ecc_job_t *job = arg;
+	const nand_geometry_t *geometry = &job->bbt->geometry;
+	size_t page_bytes = nand_raw_page_size(geometry);
+	uint8_t *page = job->raw;
+
+	for (uint32_t block = 0; block < geometry->block_count; block++) {
+		int bad = nand_bbt_is_bad(job->bbt, block);
+		uint32_t corrected = 0, failed = 0;
+
+		for (uint32_t i = 0; i < geometry->pages_per_block;
+		     i++, page += page_bytes) {
+			if (bad)
+				continue;
+			if (job->mode == NAND_ECC_ENCODE)
+				nand_ecc_encode_page(geometry, page);
+			else
+				failed += nand_ecc_correct_page(geometry, page,
+								&corrected);
+		}
+
+		pthread_mutex_lock(&job->lock);
+		job->corrected += corrected;
+		job->failed += failed;
+		job->blocks_done++;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+/* Start the ECC worker on a raw image, the image belongs to the worker
+ * until the blocks are waited for */
+int nand_ecc_start(nand_ecc_job_t *job, const nand_bbt_t *bbt, uint8_t *raw,
+		   uint8_t mode)
+{
+	memset(job, 0, sizeof(*job));
+	if (!nand_ecc_fits(&bbt->geometry)) {
+		fprintf(stderr, "The ECC doesn't fit the NAND spare area.\n");
+		return EXIT_FAILURE;
+	}
+	job->bbt = bbt;
+	job->raw = raw;
+	job->mode = mode;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+	if (pthread_create(&job->thread, NULL, ecc_worker, job)) {
+		fprintf(stderr, "Could not start the ECC thread.\n");
+		pthread_cond_destroy(&job->cond);
+		pthread_mutex_destroy(&job->lock);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Wait until the ECC of 'block' and all blocks before it is done */
+void nand_ecc_wait_block(nand_ecc_job_t *job, uint32_t block)
+{
+	if (block >= job->bbt->geometry.block_count)
+		block = job->bbt->geometry.block_count - 1;
+	pthread_mutex_lock(&job->lock);
+	while (job->blocks_done <= block)
+		pthread_cond_wait(&job->cond, &job->lock);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/* Wait for the whole image, the corrected and failed counts are final
+ * after this */
+void nand_ecc_wait(nand_ecc_job_t *job)
+{
+	pthread_join(job->thread, NULL);
+	pthread_cond_destroy(&job->cond);
+	pthread_mutex_destroy(&job->lock);
+}
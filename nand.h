@@ -0,0 +1,113 @@
+/*
+ * nand.h - Host side NAND flash declarations: bad block table, file
+ *		layouts and software ECC.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef NAND_H_
+#define NAND_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hamming ECC, 3 bytes for each 256 data bytes, in the byte order of the
+ * Linux MTD software ECC. The ECC of a page is kept at the end of its
+ * spare area. */
+#define NAND_ECC_STEP	256
+#define NAND_ECC_BYTES	3
+
+/* Layouts of a NAND image file */
+#define NAND_LAYOUT_RAW	     0 /* Every page followed by its spare area */
+#define NAND_LAYOUT_SKIP_BAD 1 /* Page data of the good blocks only */
+
+/* What the ECC worker does with each page */
+#define NAND_ECC_ENCODE	 0 /* Write the ECC of the data into the spare */
+#define NAND_ECC_CORRECT 1 /* Check the data against its ECC and fix it */
+
+typedef struct nand_geometry {
+	uint32_t page_size;	  /* Data bytes of a page */
+	uint32_t spare_size;	  /* Spare (OOB) bytes of a page */
+	uint32_t pages_per_block; /* Pages of an erase block */
+	uint32_t block_count;
+} nand_geometry_t;
+
+/* Bad block table, bit (n & 7) of bad[n / 8] is set for a bad block n */
+typedef struct nand_bbt {
+	nand_geometry_t geometry;
+	uint32_t bad_count;
+	uint8_t *bad;
+} nand_bbt_t;
+
+/* ECC of a raw image computed on a worker thread, one block after the
+ * other, so the blocks done can be transferred while the rest is still
+ * being computed. Bad blocks are left alone. */
+typedef struct nand_ecc_job {
+	const nand_bbt_t *bbt;
+	uint8_t *raw;
+	uint8_t mode;
+	uint32_t blocks_done; /* Guarded by lock */
+	uint32_t corrected;   /* Bit errors fixed, NAND_ECC_CORRECT */
+	uint32_t failed;      /* Uncorrectable ECC steps, NAND_ECC_CORRECT */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} nand_ecc_job_t;
+
+/* Bytes of a page with its spare area */
+static inline size_t nand_raw_page_size(const nand_geometry_t *geometry)
+{
+	return (size_t)geometry->page_size + geometry->spare_size;
+}
+
+static inline size_t nand_raw_block_size(const nand_geometry_t *geometry)
+{
+	return nand_raw_page_size(geometry) * geometry->pages_per_block;
+}
+
+static inline size_t nand_raw_size(const nand_geometry_t *geometry)
+{
+	return nand_raw_block_size(geometry) * geometry->block_count;
+}
+
+static inline int nand_bbt_is_bad(const nand_bbt_t *bbt, uint32_t block)
+{
+	return (bbt->bad[block / 8] >> (block & 0x07)) & 0x01;
+}
+
+int nand_bbt_init(nand_bbt_t *bbt, const nand_geometry_t *geometry);
+void nand_bbt_free(nand_bbt_t *bbt);
+void nand_bbt_mark_bad(nand_bbt_t *bbt, uint32_t block);
+int nand_block_marked_bad(const nand_geometry_t *geometry,
+			  const uint8_t *block);
+int nand_bbt_scan(nand_bbt_t *bbt, const uint8_t *raw, size_t size);
+size_t nand_good_size(const nand_bbt_t *bbt);
+void nand_raw_to_skip_bad(const nand_bbt_t *bbt, const uint8_t *raw,
+			  uint8_t *data);
+int nand_skip_bad_to_raw(const nand_bbt_t *bbt, const uint8_t *data,
+			 size_t size, uint8_t *raw);
+void nand_ecc_calculate(const uint8_t *data, uint8_t *ecc);
+int nand_ecc_correct(uint8_t *data, const uint8_t *read_ecc,
+		     const uint8_t *calc_ecc);
+int nand_ecc_fits(const nand_geometry_t *geometry);
+void nand_ecc_encode_page(const nand_geometry_t *geometry, uint8_t *page);
+int nand_ecc_correct_page(const nand_geometry_t *geometry, uint8_t *page,
+			  uint32_t *corrected);
+int nand_ecc_start(nand_ecc_job_t *job, const nand_bbt_t *bbt, uint8_t *raw,
+		   uint8_t mode);
+void nand_ecc_wait_block(nand_ecc_job_t *job, uint32_t block);
+void nand_ecc_wait(nand_ecc_job_t *job);
+
+#endif /* NAND_H_ */
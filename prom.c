@@ -27,6 +27,7 @@
 #include "bitbang.h"
 
 #define HITACHI_MASK_PROM_MASK 0x80
+#define MASK_PROM_SAMPLE 16 /* bytes read to detect the CE/CS polarity */
 
 typedef struct prom {
 	uint8_t *gnd_pins;	/* GND pins list */
@@ -176,14 +177,12 @@ static mask_prom_t mask_prom_table[] = {
 	  .compare_mask = 0xff }
 };
 
-/* Persistent state */
-static uint8_t zif_dir[40];
-static uint8_t zif_state[40];
-static pin_driver_t pin_drivers[40];
-
 /* Set the initial state */
 static int mask_prom_init(minipro_handle_t *handle)
 {
+	uint8_t *zif_dir = handle->zif_dir;
+	uint8_t *zif_state = handle->zif_state;
+	pin_driver_t pin_drivers[40];
 	uint8_t type = (uint8_t)handle->device->variant & ~HITACHI_MASK_PROM_MASK;
 	size_t prom_entries = sizeof(mask_prom_table) / sizeof(mask_prom_table[0]);
 
@@ -196,9 +195,10 @@ static int mask_prom_init(minipro_handle_t *handle)
 
 	/* Modify the compare mask according to the chip type */
 	handle->device->compare_mask = mask_prom_table[type].compare_mask;
+	handle->mask_prom_detected = 0;
 
-	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(zif_dir));
-	memset(zif_state, 0x00, sizeof(zif_state));
+	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(handle->zif_dir));
+	memset(zif_state, 0x00, sizeof(handle->zif_state));
 	memset(pin_drivers, 0x00, sizeof(pin_drivers));
 
 	/* Set address bus direction to output */
@@ -239,6 +239,9 @@ static int mask_prom_init(minipro_handle_t *handle)
 /* Set the initial state */
 int prom_init(minipro_handle_t *handle)
 {
+	uint8_t *zif_dir = handle->zif_dir;
+	uint8_t *zif_state = handle->zif_state;
+	pin_driver_t pin_drivers[40];
 	uint8_t type = (uint8_t)handle->device->variant;
 	if (type & HITACHI_MASK_PROM_MASK)
 	  return mask_prom_init(handle);
@@ -255,8 +258,8 @@ int prom_init(minipro_handle_t *handle)
 	/* Modify the compare mask according to the chip type */
 	handle->device->compare_mask = prom_table[type].compare_mask;
 
-	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(zif_dir));
-	memset(zif_state, 0x00, sizeof(zif_state));
+	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(handle->zif_dir));
+	memset(zif_state, 0x00, sizeof(handle->zif_state));
 	memset(pin_drivers, 0x00, sizeof(pin_drivers));
 
 	/* Set address bus direction to output */
@@ -308,14 +311,53 @@ static int is_empty(uint8_t *buffer, size_t length)
 	return 1;
 }
 
+/* Read 'length' bytes from a Hitachi mask PROM with the chip enable and
+ * chip select pins set to the 'ce' and 'cs' patterns. The chip stays
+ * enabled during the sweep, so each byte takes just one zif state write
+ * and one zif state read.
+ */
+static int mask_prom_sweep(minipro_handle_t *handle, uint32_t address,
+			   uint8_t *buffer, size_t length, uint8_t ce,
+			   uint8_t cs)
+{
+	uint8_t *zif_state = handle->zif_state;
+	uint8_t zif[40];
+	uint8_t type = (uint8_t)handle->device->variant & ~HITACHI_MASK_PROM_MASK;
+	uint8_t pin_count = handle->device->package_details.pin_count;
+
+	set_bits(zif_state, mask_prom_table[type].cs_pins, cs, pin_count);
+	set_bits(zif_state, mask_prom_table[type].ce_pins, ce, pin_count);
+	for (size_t i = 0; i < length; i++) {
+		/* Set address value to zif pins */
+		set_bits(zif_state, mask_prom_table[type].addr_bus_pins,
+			 address + i, pin_count);
+		if (minipro_set_zif_state(handle, zif_state))
+			return EXIT_FAILURE;
+
+		/* Now read the zif pins */
+		if (minipro_get_zif_state(handle, zif))
+			return EXIT_FAILURE;
+
+		/* Convert zif data bus value and write it to buffer */
+		buffer[i] = get_bits(zif, mask_prom_table[type].data_bus_pins,
+				     pin_count);
+	}
+
+	/* Disable the chip again */
+	set_bits(zif_state, mask_prom_table[type].ce_pins, ~ce, pin_count);
+	return minipro_set_zif_state(handle, zif_state);
+}
+
 /* Read bytes from Hitachi mask PROMs */
 static int prom_read_mask_prom(minipro_handle_t *handle, uint32_t address,
 	                uint8_t *buffer, size_t length) {
-	static uint8_t zif[40];
+	uint8_t *zif_dir = handle->zif_dir;
+	uint8_t *zif_state = handle->zif_state;
 	uint8_t type = (uint8_t)handle->device->variant & ~HITACHI_MASK_PROM_MASK;
 	uint8_t pin_count = handle->device->package_details.pin_count;
 	uint8_t ce_pin_count = strlen((const char *) mask_prom_table[type].ce_pins);
 	uint8_t cs_pin_count = strlen((const char *) mask_prom_table[type].cs_pins);
+	size_t sample = length < MASK_PROM_SAMPLE ? length : MASK_PROM_SAMPLE;
 
 	/* Set data bus direction to input with pull-up resistors */
 	set_io_pins(zif_dir, mask_prom_table[type].data_bus_pins,
@@ -326,43 +368,48 @@ static int prom_read_mask_prom(minipro_handle_t *handle, uint32_t address,
 	if (minipro_set_zif_state(handle, zif_state))
 		return EXIT_FAILURE;
 
+	/* The CE and CS polarity is already known */
+	if (handle->mask_prom_detected)
+		return mask_prom_sweep(handle, address, buffer, length,
+				       handle->mask_prom_ce,
+				       handle->mask_prom_cs);
+
+	/* CS and CE are mask programmed, and may be active high or active
+	 * low. Try each pattern on a few bytes first, the chip outputs
+	 * nothing but the pull-ups (0xFF) while it isn't selected. */
 	for (uint8_t ce_bit_pattern = 0; ce_bit_pattern < (1 << ce_pin_count);
 		 ce_bit_pattern++) {
 	  for (uint8_t cs_bit_pattern = 0; cs_bit_pattern < (1 << cs_pin_count);
 		   cs_bit_pattern++) {
-		/* Read length bytes */
-		for (int i = 0; i < length; i++) {
-			/* Set address value to zif pins */
-			set_bits(zif_state, mask_prom_table[type].addr_bus_pins,
-				 address + i, pin_count);
-			set_bits(zif_state, mask_prom_table[type].cs_pins,
-					 cs_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-				return EXIT_FAILURE;
-
-			set_bits(zif_state, mask_prom_table[type].ce_pins,
-					 ce_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-			  return EXIT_FAILURE;
-
-			/* Now read the zif pins */
-			if (minipro_get_zif_state(handle, zif))
-				return EXIT_FAILURE;
-
-			/* Convert zif data bus value and write it to buffer */
-			buffer[i] = get_bits(zif, mask_prom_table[type].data_bus_pins,
-					     pin_count);
-
-			set_bits(zif_state, mask_prom_table[type].ce_pins,
-					 ~ce_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-			  return EXIT_FAILURE;
-		}
+		if (mask_prom_sweep(handle, address, buffer, sample,
+				    ce_bit_pattern, cs_bit_pattern))
+			return EXIT_FAILURE;
+		if (is_empty(buffer, sample))
+			continue;
+		handle->mask_prom_detected = 1;
+		handle->mask_prom_ce = ce_bit_pattern;
+		handle->mask_prom_cs = cs_bit_pattern;
+		return mask_prom_sweep(handle, address + sample,
+				       buffer + sample, length - sample,
+				       ce_bit_pattern, cs_bit_pattern);
+	  }
+	}
 
-		/* Check if contents are read properly. Necessaray as CS
-		 * and CE are mask programmed, and may be active high or
-		 * active low */
-		if (is_empty(buffer, length) == 0) {
+	/* The sample is blank with every pattern, check the whole block */
+	if (sample == length)
+		return EXIT_SUCCESS;
+	for (uint8_t ce_bit_pattern = 0; ce_bit_pattern < (1 << ce_pin_count);
+		 ce_bit_pattern++) {
+	  for (uint8_t cs_bit_pattern = 0; cs_bit_pattern < (1 << cs_pin_count);
+		   cs_bit_pattern++) {
+		if (mask_prom_sweep(handle, address + sample,
+				    buffer + sample, length - sample,
+				    ce_bit_pattern, cs_bit_pattern))
+			return EXIT_FAILURE;
+		if (is_empty(buffer + sample, length - sample) == 0) {
+		  handle->mask_prom_detected = 1;
+		  handle->mask_prom_ce = ce_bit_pattern;
+		  handle->mask_prom_cs = cs_bit_pattern;
 		  return EXIT_SUCCESS;
 		}
 	  }
@@ -378,7 +425,9 @@ int prom_read(minipro_handle_t *handle, uint32_t address, uint8_t *buffer,
 	if ((uint8_t)handle->device->variant & HITACHI_MASK_PROM_MASK)
 		return prom_read_mask_prom(handle, address, buffer, lenght);
 
-	static uint8_t zif[40];
+	uint8_t *zif_dir = handle->zif_dir;
+	uint8_t *zif_state = handle->zif_state;
+	uint8_t zif[40];
 	uint8_t type = (uint8_t)handle->device->variant;
 	uint8_t pin_count = handle->device->package_details.pin_count;
 
@@ -20,10 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "hexenc.h"
 #include "srec.h"
 
 #define MIN_RECORD_SIZE 4
-#define ROW_SIZE	16
+#define MAX_LINE_SIZE	526
+#define ROW_SIZE	SREC_ROW_SIZE
 
 typedef enum {
 	S0 = 0,
@@ -80,7 +82,8 @@ static record_t parse_record(uint8_t *record)
 	}
 
 	/* Check for valid characters */
-	for (i = 1; record[i] != '\r' && record[i] != '\n'; i++) {
+	for (i = 1; record[i] && record[i] != '\r' && record[i] != '\n';
+	     i++) {
 		if (hex(record[i]) > 0x0F) {
 			rec.result = BAD_FORMAT;
 			return rec;
@@ -164,155 +167,275 @@ static record_t parse_record(uint8_t *record)
 	return rec;
 }
 
-/* Write a record */
-static int write_record(FILE *file, record_t *record)
+void srec_reader_init(srec_reader_t *reader, uint8_t *data, size_t size)
 {
-	uint8_t *pData = record->data;
-	uint8_t fmt;
-	switch (record->type) {
+	memset(reader, 0, sizeof(*reader));
+	reader->data = data;
+	reader->chip_size = size;
+	reader->log = stderr;
+	reader->size = size;
+}
+
+/* Parse one line of an S-Record file, the line ends with a new line or
+ * NUL character. Returns NOT_SREC if the first record isn't valid.
+ */
+int srec_read_line(srec_reader_t *reader, const uint8_t *line)
+{
+	record_t rec;
+
+	reader->line++;
+	if (!reader->records) {
+		/* The first record must start the line */
+		if (!*line || *line == '\r' || *line == '\n')
+			return EXIT_SUCCESS;
+		if (*line != 'S')
+			return NOT_SREC;
+	} else {
+		/* Skip anything before the start code */
+		while (*line && *line != '\n' && *line != 'S')
+			line++;
+		if (*line != 'S')
+			return EXIT_SUCCESS;
+	}
+
+	rec = parse_record((uint8_t *)line);
+	switch (rec.result) {
+	case BAD_FORMAT:
+		if (!reader->records)
+			return NOT_SREC;
+		fprintf(reader->log, "Error on line %u: bad record.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_RECORD:
+		fprintf(reader->log, "Error on line %u: bad record type.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_COUNT:
+		fprintf(reader->log, "Error on line %u: bad count.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	case BAD_CKECKSUM:
+		fprintf(reader->log, "Error on line %u: bad checksum.\n",
+			reader->line);
+		return EXIT_FAILURE;
+	default:
+		break;
+	}
+
+	reader->records++;
+	switch (rec.type) {
+	case S0:
+		fprintf(reader->log, "%s\n", rec.data);
+		break;
+	case S1:
 	case S2:
+	case S3:
+		reader->data_records++;
+		/* If file data size is bigger than chip size
+		 * update the new size */
+		if (reader->chip_size >= rec.address + rec.count)
+			/* copy record data */
+			memcpy(&(reader->data[rec.address]), rec.data,
+			       rec.count);
+		else
+			reader->size = (rec.address + rec.count);
+		break;
+	case S5:
 	case S6:
-	case S8:
-		fmt = 6;
+		if (rec.address != reader->data_records) {
+			fprintf(reader->log, "Error: wrong record count.\n");
+			return EXIT_FAILURE;
+		}
 		break;
-	case S3:
 	case S7:
-		fmt = 8;
+	case S8:
+	case S9:
 		break;
 	default:
-		fmt = 4;
-	}
-
-	uint8_t checksum = record->count + 1 + fmt / 2 +
-			   (record->address >> 24) + (record->address >> 16) +
-			   (record->address >> 8) + (record->address & 0xff);
-
-	fprintf(file, "S%01X%02X%0*X", record->type,
-		record->count + 1 + fmt / 2, fmt, record->address);
-	while (record->count--) {
-		fprintf(file, "%02X", *pData);
-		checksum += *pData;
-		pData++;
+		fprintf(reader->log,
+			"Error on line %u: unknown record type.\n",
+			reader->line);
+		return EXIT_FAILURE;
 	}
-	checksum = ~checksum;
-	fprintf(file, "%02X\r\n", checksum);
 	return EXIT_SUCCESS;
 }
 
-/* Read a Motorola S-Record file */
-int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size)
+/* Check the end of the file */
+int srec_reader_end(srec_reader_t *reader, size_t *size)
 {
-	uint32_t line = 0;
-	record_t rec;
-	size_t s0 = 0;
-	size_t chip_size = *size;
+	if (!reader->records)
+		return NOT_SREC;
+	*size = reader->size;
+	return SREC_FORMAT;
+}
 
-	while (buffer) {
-		/* Skip empty lines */
-		line++;
-		if (*buffer == '\r' || *buffer == '\n') {
+/* Read a Motorola S-Record file from a NUL terminated buffer */
+int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size)
+{
+	srec_reader_t reader;
+	srec_reader_init(&reader, data, *size);
+	while (buffer && *buffer) {
+		int ret = srec_read_line(&reader, buffer);
+		if (ret)
+			return ret;
+		buffer = (uint8_t *)strchr((char *)buffer, '\n');
+		if (buffer)
 			buffer++;
-			continue;
-		}
+	}
+	return srec_reader_end(&reader, size);
+}
 
-		rec = parse_record(buffer);
-		switch (rec.result) {
-		case BAD_FORMAT:
-			return NOT_SREC;
-		case BAD_RECORD:
-			fprintf(stderr, "Error on line %u: bad record type.\n",
-				line);
-			return EXIT_FAILURE;
-		case BAD_COUNT:
-			fprintf(stderr, "Error on line %u: bad count.\n", line);
-			return EXIT_FAILURE;
-		case BAD_CKECKSUM:
-			fprintf(stderr, "Error on line %u: bad checksum.\n",
-				line);
-			return EXIT_FAILURE;
-		default:
-			switch (rec.type) {
-			case S0:
-				s0++;
-				fprintf(stderr, "%s\n", rec.data);
-				break;
-			case S1:
-			case S2:
-			case S3:
-				/* If file data size is bigger than chip size
-				 * update the new size */
-				if (chip_size >= rec.address + rec.count)
-					/* copy record data */
-					memcpy(&(data[rec.address]), rec.data,
-					       rec.count);
-				else
-					*size = (rec.address + rec.count);
-				break;
-			case S5:
-			case S6:
-				if (rec.address != line - 1 - s0) {
-					fprintf(stderr,
-						"Error: wrong record count.\n");
-					return EXIT_FAILURE;
-				}
-				break;
-			case S7:
-			case S8:
-			case S9:
-				break;
-			default:
-				fprintf(stderr,
-					"Error on line %u: unknown record type.\n",
-					line);
-				return EXIT_FAILURE;
-			}
-		}
-		buffer = (uint8_t *)strchr((char *)++buffer, 'S');
+static void flush_output(srec_writer_t *writer)
+{
+	if (writer->out_len &&
+	    fwrite(writer->out, 1, writer->out_len, writer->file) !=
+		    writer->out_len)
+		writer->error = 1;
+	writer->out_len = 0;
+}
+
+/* Encode a record into the output buffer */
+static void write_record(srec_writer_t *writer, record_t *record)
+{
+	uint8_t bytes;
+	switch (record->type) {
+	case S2:
+	case S6:
+	case S8:
+		bytes = 3;
+		break;
+	case S3:
+	case S7:
+		bytes = 4;
+		break;
+	default:
+		bytes = 2;
 	}
-	return SREC_FORMAT;
+
+	if (writer->out_len + MAX_LINE_SIZE > SREC_OUT_SIZE)
+		flush_output(writer);
+
+	char *out = writer->out + writer->out_len;
+	uint8_t checksum = 0;
+	size_t i;
+	*out++ = 'S';
+	*out++ = '0' + record->type;
+	out = put_byte(out, record->count + 1 + bytes, &checksum);
+	while (bytes--)
+		out = put_byte(out, record->address >> (bytes * 8), &checksum);
+	for (i = 0; i < record->count; i++)
+		out = put_byte(out, record->data[i], &checksum);
+	out = put_byte(out, ~checksum, &checksum);
+	*out++ = '\r';
+	*out++ = '\n';
+	writer->out_len = out - writer->out;
 }
 
-/* Write an S-Record file */
-int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
-		    int write_rec_count)
+/* Start an S-Record file with the S0 header record. With 'blank' set to a
+ * byte value rows holding only that value are left out, -1 writes every row.
+ */
+void srec_writer_init(srec_writer_t *writer, FILE *file, uint32_t address,
+		      int blank)
 {
 	record_t rec;
-	size_t len;
-	uint8_t type;
-	static size_t line = 0;
+	memset(writer, 0, sizeof(*writer));
+	writer->file = file;
+	writer->address = address;
+	writer->blank = blank;
 
 	char *header = "Written by Minipro open source software";
 	memcpy(rec.data, header, strlen(header));
 	rec.type = S0;
 	rec.count = strlen(header);
 	rec.address = 0x00;
-	write_record(file, &rec);
+	write_record(writer, &rec);
+}
+
+/* Write one data record from the row buffer */
+static void write_row(srec_writer_t *writer)
+{
+	record_t rec;
+	if (writer->address < 65536)
+		rec.type = S1;
+	else if (writer->address < 16777216)
+		rec.type = S2;
+	else
+		rec.type = S3;
+	rec.count = writer->len;
+	rec.address = writer->address;
+	memcpy(rec.data, writer->row, writer->len);
+	write_record(writer, &rec);
+	writer->records++;
+}
+
+/* Check if the row buffer only holds the skipped blank value */
+static int row_is_blank(srec_writer_t *writer)
+{
+	size_t i;
+	if (writer->blank < 0)
+		return 0;
+	for (i = 0; i < writer->len; i++)
+		if (writer->row[i] != writer->blank)
+			return 0;
+	return 1;
+}
 
+/* Append 'size' bytes, full rows are written as soon as they are complete */
+int srec_write_data(srec_writer_t *writer, const uint8_t *data, size_t size)
+{
 	while (size) {
-		if (address < 65536)
-			type = S1;
-		else if (address < 16777216)
-			type = S2;
-		else
-			type = S3;
-		len = (size > ROW_SIZE ? ROW_SIZE : size);
-		rec.type = type;
-		rec.count = len;
-		rec.address = address;
-		memcpy(rec.data, data, len);
-		write_record(file, &rec);
-		data += ROW_SIZE;
+		size_t len = ROW_SIZE - writer->len;
+		if (len > size)
+			len = size;
+		memcpy(writer->row + writer->len, data, len);
+		writer->len += len;
+		data += len;
 		size -= len;
-		address += ROW_SIZE;
-		line++;
+		if (writer->len < ROW_SIZE)
+			continue;
+		writer->skipped = row_is_blank(writer);
+		if (!writer->skipped)
+			write_row(writer);
+		writer->address += ROW_SIZE;
+		writer->len = 0;
 	}
-	/* Write record count */
+	return writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Flush the last row and write the record count if requested. The last row
+ * is always written, even if blank, so the file keeps the image size.
+ */
+int srec_writer_end(srec_writer_t *writer, int write_rec_count)
+{
+	if (!writer->len && writer->skipped) {
+		writer->address -= ROW_SIZE;
+		writer->len = ROW_SIZE;
+		memset(writer->row, writer->blank, ROW_SIZE);
+	}
+	if (writer->len)
+		write_row(writer);
 	if (write_rec_count) {
-		rec.type = (line < 65536 ? S5 : S6);
+		record_t rec;
+		rec.type = (writer->records < 65536 ? S5 : S6);
 		rec.count = 0x00;
-		rec.address = line;
-		line = 0;
-		write_record(file, &rec);
+		rec.address = writer->records;
+		write_record(writer, &rec);
 	}
-	return EXIT_SUCCESS;
+	flush_output(writer);
+	return writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Write an S-Record file */
+int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
+		    int write_rec_count)
+{
+	srec_writer_t *writer = malloc(sizeof(*writer));
+	if (!writer)
+		return EXIT_FAILURE;
+	srec_writer_init(writer, file, address, -1);
+	int ret = srec_write_data(writer, data, size);
+	if (srec_writer_end(writer, write_rec_count))
+		ret = EXIT_FAILURE;
+	free(writer);
+	return ret;
 }
@@ -20,11 +20,46 @@
 #define SREC_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define SREC_FORMAT 0
 #define NOT_SREC    -1
+#define SREC_ROW_SIZE 16
+#define SREC_OUT_SIZE 16384
 
+/* Line by line S-Record reader */
+typedef struct srec_reader {
+	uint8_t *data;
+	size_t chip_size;
+	size_t size;
+	FILE *log; /* Errors and notes, stderr by default */
+	uint32_t line;
+	uint32_t records;
+	uint32_t data_records;
+} srec_reader_t;
+
+/* S-Record writer fed with consecutive blocks of data */
+typedef struct srec_writer {
+	FILE *file;
+	uint32_t address;
+	uint32_t records;
+	int blank;
+	uint8_t skipped;
+	uint8_t error;
+	uint8_t row[SREC_ROW_SIZE];
+	size_t len;
+	size_t out_len;
+	char out[SREC_OUT_SIZE];
+} srec_writer_t;
+
+void srec_reader_init(srec_reader_t *reader, uint8_t *data, size_t size);
+int srec_read_line(srec_reader_t *reader, const uint8_t *line);
+int srec_reader_end(srec_reader_t *reader, size_t *size);
 int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size);
+void srec_writer_init(srec_writer_t *writer, FILE *file, uint32_t address,
+		      int blank);
+int srec_write_data(srec_writer_t *writer, const uint8_t *data, size_t size);
+int srec_writer_end(srec_writer_t *writer, int write_rec_count);
 int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
 		    int write_rec_count);
 
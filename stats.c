@@ -0,0 +1,287 @@
+/*
+ * stats.c - USB and protocol instrumentation.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "stats.h"
+
+#define STATS_MAX_ENTRIES 64
+#define STATS_BUCKETS	  32
+
+/* Accumulated measurements of one operation */
+typedef struct stats_entry {
+	const char *name;
+	uint8_t category;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t total; /* Nanoseconds */
+	uint64_t min;
+	uint64_t max;
+	/* Bucket i counts latencies below 2^i microseconds */
+	uint64_t histogram[STATS_BUCKETS];
+} stats_entry_t;
+
+static const char *category_names[] = { "usb", "calls", "phases", "file" };
+
+int stats_enabled = 0;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_entry_t entries[STATS_MAX_ENTRIES];
+static size_t entry_count;
+static uint64_t base_time;
+static char *summary_file;
+static char *trace_file;
+static FILE *trace;
+static size_t trace_events;
+
+/* Monotonic time in nanoseconds */
+uint64_t stats_now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+	       (uint64_t)(counter.QuadPart % frequency.QuadPart) *
+		       1000000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static stats_entry_t *get_entry(uint8_t category, const char *name)
+{
+	size_t i;
+
+	/* Names are string constants, compare the pointers first */
+	for (i = 0; i < entry_count; i++) {
+		if (entries[i].category == category &&
+		    (entries[i].name == name || !strcmp(entries[i].name, name)))
+			return &entries[i];
+	}
+	if (entry_count == STATS_MAX_ENTRIES)
+		return NULL;
+	memset(&entries[entry_count], 0, sizeof(stats_entry_t));
+	entries[entry_count].name = name;
+	entries[entry_count].category = category;
+	entries[entry_count].min = UINT64_MAX;
+	return &entries[entry_count++];
+}
+
+void stats_record(uint8_t category, const char *name, size_t bytes,
+		  uint64_t start)
+{
+	if (!stats_enabled)
+		return;
+	uint64_t end = stats_now();
+	uint64_t duration = end - start;
+	uint64_t us = duration / 1000;
+	size_t bucket = 0;
+
+	while (us && bucket < STATS_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats_entry_t *entry = get_entry(category, name);
+	if (entry) {
+		entry->count++;
+		entry->bytes += bytes;
+		entry->total += duration;
+		if (duration < entry->min)
+			entry->min = duration;
+		if (duration > entry->max)
+			entry->max = duration;
+		entry->histogram[bucket]++;
+	}
+
+	/* One complete event per operation, each layer on a track of its
+	 * own */
+	if (trace) {
+		fprintf(trace,
+			"%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+			"\"args\":{\"bytes\":%zu}}",
+			trace_events ? ",\n" : "", name,
+			category_names[category],
+			(double)(start - base_time) / 1000.0,
+			(double)duration / 1000.0, (int)getpid(),
+			category + 1, bytes);
+		trace_events++;
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_atexit(void)
+{
+	stats_close();
+}
+
+int stats_open(const char *summary, const char *trace_name)
+{
+	static int registered = 0;
+
+	if (stats_enabled)
+		stats_close();
+	if (!summary && !trace_name)
+		return EXIT_SUCCESS;
+
+	entry_count = 0;
+	trace_events = 0;
+	summary_file = summary ? strdup(summary) : NULL;
+	trace_file = trace_name ? strdup(trace_name) : NULL;
+	if ((summary && !summary_file) || (trace_name && !trace_file)) {
+		fprintf(stderr, "Out of memory!\n");
+		free(summary_file);
+		free(trace_file);
+		return EXIT_FAILURE;
+	}
+
+	if (trace_file) {
+		trace = fopen(trace_file, "w");
+		if (!trace) {
+			fprintf(stderr, "Could not open file %s for writing.\n",
+				trace_file);
+			perror("");
+			free(summary_file);
+			free(trace_file);
+			return EXIT_FAILURE;
+		}
+		fputs("[\n", trace);
+	}
+
+	/* Jobs which bail out through exit() still get their report */
+	if (!registered) {
+		atexit(stats_atexit);
+		registered = 1;
+	}
+	base_time = stats_now();
+	stats_enabled = 1;
+	return EXIT_SUCCESS;
+}
+
+static void write_entry(FILE *file, stats_entry_t *entry, int first)
+{
+	size_t i, last = 0;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (entry->histogram[i])
+			last = i;
+	}
+	fprintf(file,
+		"%s\n\t\t\"%s\": {\"count\": %llu, \"bytes\": %llu, "
+		"\"total_us\": %.3f, \"min_us\": %.3f, \"max_us\": %.3f, "
+		"\"mean_us\": %.3f,\n\t\t\t\"histogram\": [",
+		first ? "" : ",", entry->name,
+		(unsigned long long)entry->count,
+		(unsigned long long)entry->bytes, entry->total / 1000.0,
+		entry->min / 1000.0, entry->max / 1000.0,
+		entry->total / 1000.0 / entry->count);
+	for (i = 0; i <= last; i++)
+		fprintf(file, "%s%llu", i ? ", " : "",
+			(unsigned long long)entry->histogram[i]);
+	fputs("]}", file);
+}
+
+/* Write the JSON summary; the histogram bucket i counts the operations
+ * which took less than 2^i microseconds (and at least 2^(i-1)) */
+static int write_summary(uint64_t wall)
+{
+	FILE *file = fopen(summary_file, "w");
+	uint8_t category;
+	size_t i;
+	int first;
+
+	if (!file) {
+		fprintf(stderr, "Could not open file %s for writing.\n",
+			summary_file);
+		perror("");
+		return EXIT_FAILURE;
+	}
+	fprintf(file, "{\n\t\"wall_us\": %.3f", wall / 1000.0);
+	for (category = STATS_USB; category <= STATS_FILE; category++) {
+		fprintf(file, ",\n\t\"%s\": {", category_names[category]);
+		first = 1;
+		for (i = 0; i < entry_count; i++) {
+			if (entries[i].category != category)
+				continue;
+			write_entry(file, &entries[i], first);
+			first = 0;
+		}
+		fputs(first ? "}" : "\n\t}", file);
+	}
+	fputs("\n}\n", file);
+	if (ferror(file) | fclose(file)) {
+		fprintf(stderr, "Error writing file %s.\n", summary_file);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Stop the instrumentation and write the summary and trace files */
+int stats_close(void)
+{
+	int ret = EXIT_SUCCESS;
+	uint8_t category;
+
+	if (!stats_enabled)
+		return EXIT_SUCCESS;
+
+	pthread_mutex_lock(&stats_lock);
+	stats_enabled = 0;
+	uint64_t wall = stats_now() - base_time;
+	if (summary_file && write_summary(wall))
+		ret = EXIT_FAILURE;
+
+	if (trace) {
+		/* Name the tracks after the layers */
+		for (category = STATS_USB; category <= STATS_FILE;
+		     category++, trace_events++)
+			fprintf(trace,
+				"%s{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":%d,\"tid\":%u,"
+				"\"args\":{\"name\":\"%s\"}}",
+				trace_events ? ",\n" : "", (int)getpid(),
+				category + 1, category_names[category]);
+		fputs("\n]\n", trace);
+		if (ferror(trace) | fclose(trace)) {
+			fprintf(stderr, "Error writing file %s.\n", trace_file);
+			ret = EXIT_FAILURE;
+		}
+		trace = NULL;
+	}
+	free(summary_file);
+	free(trace_file);
+	summary_file = NULL;
+	trace_file = NULL;
+	pthread_mutex_unlock(&stats_lock);
+	return ret;
+}
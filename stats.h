@@ -0,0 +1,50 @@
+/*
+ * stats.h - USB and protocol instrumentation declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Layers the measurements are accounted to */
+#define STATS_USB   0 /* USB transfers */
+#define STATS_CALL  1 /* minipro_* protocol calls */
+#define STATS_PHASE 2 /* Job phases */
+#define STATS_FILE  3 /* File encoding and writing */
+
+extern int stats_enabled;
+
+uint64_t stats_now(void);
+
+/* Start time of a measurement, 0 if the instrumentation is off */
+static inline uint64_t stats_start(void)
+{
+	return stats_enabled ? stats_now() : 0;
+}
+
+/* Account one operation which began at 'start' to 'name'. 'name' must
+ * be a string constant. */
+void stats_record(uint8_t category, const char *name, size_t bytes,
+		  uint64_t start);
+
+/* Start the instrumentation, writing the summary and/or the trace to the
+ * given files when stopped. Either file name may be NULL. */
+int stats_open(const char *summary, const char *trace);
+int stats_close(void);
+
+#endif
@@ -281,6 +281,14 @@ int t48_read_fuses(minipro_handle_t *handle, uint8_t type,
 	return EXIT_SUCCESS;
 }
 
+int t48_read_fuse_sections(minipro_handle_t *handle,
+			   fuse_section_t *sections, size_t count)
+{
+	static const uint8_t opcodes[] = { T48_READ_USER, T48_READ_CFG,
+					   T48_READ_LOCK };
+	return run_fuse_reads(handle, opcodes, sections, count);
+}
+
 int t48_write_fuses(minipro_handle_t *handle, uint8_t type,
 			    size_t length, uint8_t items_count, uint8_t *buffer)
 {
@@ -456,56 +464,18 @@ int t48_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_SUCCESS;
 }
 
+int t48_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			size_t stride, uint8_t row, uint8_t flags,
+			size_t size, size_t count)
+{
+	return run_jedec_row_reads(handle, T48_READ_JEDEC, 8, 32, buffer,
+				   stride, row, flags, size, count);
+}
+
 /* Pull: 0=Pull-up, 1=Pull-down */
 static uint8_t *do_ic_test(minipro_handle_t *handle, int pull)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t msg[32];
-	uint8_t *result;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
-	result = calloc(pin_count, handle->device->vector_count);
-	if (!result)
-		return NULL;
-
-	uint8_t *out = result;
-	int n;
-	for (n = 0; n < handle->device->vector_count; n++) {
-		memset(msg, 0xff, sizeof(msg));
-
-		msg[0] = T48_LOGIC_IC_TEST_VECTOR;
-		msg[1] = handle->device->voltages.vcc;
-		msg[1] |= pull << 7; /* Set the pull-up/pull-down */
-		format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
-		format_int(&msg[4], n, 4, MP_LITTLE_ENDIAN);
-
-		int i;
-		/* Pack the vector to 2 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count;
-		     i++) {
-			if (i & 1)
-				msg[8 + i / 2] |= *vector << 4;
-			else
-				msg[8 + i / 2] = *vector;
-			vector++;
-		}
-
-		/* Send the test vector and read the pin status */
-		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-
-		/* Unpack the result from 2 pin/byte to 1 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count; i++)
-			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
-	}
-
-	return result;
+	return run_logic_vectors(handle, T48_LOGIC_IC_TEST_VECTOR, pull);
 }
 
 /* Performing a logic test. This is accomplished in two steps.
@@ -618,7 +588,7 @@ It has a fixed 16 byte header, followed by a number of 276-byte blocks
 /* Performing a firmware update */
 int t48_firmware_update(minipro_handle_t *handle, const char *firmware)
 {
-	static uint8_t msg[288];
+	uint8_t msg[288];
 
 	struct stat st;
 	if (stat(firmware, &st)) {
@@ -38,6 +38,8 @@ int t48_read_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
 			   uint8_t items_count, uint8_t *buffer);
 int t48_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
 			    uint8_t items_count, uint8_t *buffer);
+int t48_read_fuse_sections(minipro_handle_t *handle,
+			   fuse_section_t *sections, size_t count);
 int t48_protect_off(minipro_handle_t *handle);
 int t48_protect_on(minipro_handle_t *handle);
 int t48_erase(minipro_handle_t *handle);
@@ -45,6 +47,9 @@ int t48_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer, uint8_t row,
 			uint8_t flags, size_t size);
 int t48_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			       uint8_t row, uint8_t flags, size_t size);
+int t48_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			size_t stride, uint8_t row, uint8_t flags,
+			size_t size, size_t count);
 int t48_logic_ic_test(minipro_handle_t *handle);
 int t48_firmware_update(minipro_handle_t *handle, const char *firmware);
 #endif
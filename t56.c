@@ -16,6 +16,8 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,8 +27,13 @@
 #include <unistd.h>
 #include <time.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #include "database.h"
 #include "minipro.h"
+#include "stats.h"
 #include "t56.h"
 #include "bitbang.h"
 #include "usb.h"
@@ -81,15 +88,147 @@
 #define SPI_PROTOCOL 0x03
 
 
-/* Send the required bitstream algorithm to T56 */
-static int t56_send_bitstream(minipro_handle_t *handle)
+/*
+ * Bitstream upload record.
+ * The firmware has no command to query which FPGA bitstream is loaded, so
+ * with --reuse_bitstream the last uploaded algorithms are recorded per
+ * programmer serial number together with the USB bus number and device
+ * address. A reset or power cycle makes the programmer enumerate with a new
+ * device address, which invalidates the record. The OS hands out the same
+ * address again after a reboot or enough re-plugs, so the record also
+ * holds the host boot time. A record of an earlier boot is never trusted.
+ * The record is removed before each upload, so an interrupted upload is
+ * never trusted either.
+ */
+#define BITSTREAM_MAGIC "MPFPGA2"
+
+/* The boot time is derived from two clocks read one after the other */
+#define BITSTREAM_BOOT_SLACK 2
+
+typedef struct bitstream_record {
+	char magic[8];
+	uint32_t location;
+	uint32_t count;
+	int64_t boot_time;
+	uint32_t crc[2];
+	char name[2][NAME_LEN];
+} bitstream_record_t;
+
+/* Get the wall clock time of the host boot in seconds. Clocks which stop
+ * in suspend make a record of the same boot look older, which is safe. */
+static int get_boot_time(int64_t *boot_time)
 {
-	static uint8_t bitstream_uploaded = 0;
-	uint8_t msg[64];
+#ifdef _WIN32
+	*boot_time = (int64_t)time(NULL) - (int64_t)(GetTickCount64() / 1000);
+#else
+	struct timespec ts;
+#ifdef CLOCK_BOOTTIME
+	if (clock_gettime(CLOCK_BOOTTIME, &ts))
+		return EXIT_FAILURE;
+#else
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return EXIT_FAILURE;
+#endif
+	*boot_time = (int64_t)time(NULL) - ts.tv_sec;
+#endif
+	return EXIT_SUCCESS;
+}
 
-	/* Don't upload the bitstream again if we are in the same session */
-	if (bitstream_uploaded)
-		return EXIT_SUCCESS;
+/* Get the record file of this programmer */
+static int get_record_path(minipro_handle_t *handle, char *path, size_t size)
+{
+	char name[64];
+	if (!handle->serial_number[0])
+		return EXIT_FAILURE;
+	for (char *p = handle->serial_number; *p; p++) {
+		if (!isalnum((unsigned char)*p))
+			return EXIT_FAILURE;
+	}
+	snprintf(name, sizeof(name), "bitstream.%s", handle->serial_number);
+	return get_cache_file(name, path, size);
+}
+
+/* Fill a record with the algorithms to be uploaded */
+static int init_record(minipro_handle_t *handle, bitstream_record_t *record,
+		       algorithm_t *algorithm, size_t count, size_t offset)
+{
+	memset(record, 0, sizeof(*record));
+	if (!handle->cmdopts->reuse_bitstream ||
+	    usb_get_location(handle->usb_handle, &record->location) ||
+	    get_boot_time(&record->boot_time))
+		return EXIT_FAILURE;
+	memcpy(record->magic, BITSTREAM_MAGIC, sizeof(record->magic));
+	record->count = count;
+	for (size_t i = 0; i < count; i++) {
+		snprintf(record->name[i], NAME_LEN, "%s", algorithm[i].name);
+		record->crc[i] = load_int(algorithm[i].bitstream + offset +
+						  ALGO_CRC_OFFSET,
+					  4, MP_LITTLE_ENDIAN);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Check if the programmer still holds the recorded algorithms */
+static int bitstream_loaded(minipro_handle_t *handle,
+			    bitstream_record_t *record)
+{
+	char path[PATH_MAX];
+	bitstream_record_t last;
+
+	if (get_record_path(handle, path, sizeof(path)))
+		return 0;
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return 0;
+	size_t ret = fread(&last, sizeof(last), 1, file);
+	fclose(file);
+	if (ret != 1 ||
+	    last.boot_time > record->boot_time + BITSTREAM_BOOT_SLACK ||
+	    last.boot_time < record->boot_time - BITSTREAM_BOOT_SLACK)
+		return 0;
+	last.boot_time = record->boot_time;
+	return !memcmp(&last, record, sizeof(last));
+}
+
+/* Forget the last upload, or record a new one if 'record' is set */
+static void set_bitstream_record(minipro_handle_t *handle,
+				 bitstream_record_t *record)
+{
+	char path[PATH_MAX];
+	if (get_record_path(handle, path, sizeof(path)))
+		return;
+	remove(path);
+	if (!record)
+		return;
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return;
+	size_t ret = fwrite(record, sizeof(*record), 1, file);
+	if (fclose(file) || ret != 1)
+		remove(path);
+}
+
+/* Identify the algorithms of an upload by their names and CRCs */
+static void get_algorithm_key(algorithm_t *algorithm, size_t count,
+			      size_t offset, char *key, size_t size)
+{
+	int len = 0;
+	key[0] = '\0';
+	for (size_t i = 0; i < count && len >= 0 && len < size; i++)
+		len += snprintf(key + len, size - len, "%s%s:%08X",
+				i ? "+" : "", algorithm[i].name,
+				(uint32_t)load_int(algorithm[i].bitstream +
+							   offset +
+							   ALGO_CRC_OFFSET,
+						   4, MP_LITTLE_ENDIAN));
+}
+
+/* Load and send the required bitstream algorithm to T56 */
+static int send_bitstream(minipro_handle_t *handle)
+{
+	bitstream_record_t record;
+	char key[sizeof(handle->bitstream_loaded)];
+	uint8_t msg[64];
 
 	/* Get the required FPGA bitstream algorithm
 	* For logic chips it is required to send two consecutive
@@ -97,6 +236,7 @@ static int t56_send_bitstream(minipro_handle_t *handle)
 	*/
 	device_t *device = handle->device;
 	if (device->chip_type == MP_LOGIC) {
+		algorithm_t ttl[2];
 		fprintf(stderr, "Using LOGIC algorithm..\n");
 		device->protocol_id = IC2_ALG_NONE;
 		for (int i = 0; i < 2; i++) {
@@ -105,25 +245,42 @@ static int t56_send_bitstream(minipro_handle_t *handle)
 						      UTIL_ALG_TTL1 << 8;
 			if (get_algorithm(device, handle->cmdopts->algo_path,
 					  handle->cmdopts->icsp,
-					  handle->cmdopts->vopt, 8))
+					  handle->cmdopts->vopt, 8)) {
+				if (i)
+					free(ttl[0].bitstream);
 				return EXIT_FAILURE;
+			}
+			ttl[i] = device->algorithm;
+		}
 
-			/* Use multipart bitstream sending protocol */
-			device->algorithm.bitstream[0] = T56_WRITE_BITSTREAM2;
-			device->algorithm.bitstream[1] = i ? 0 : 1;
-			format_int(&device->algorithm.bitstream[4],
-				   handle->device->algorithm.length, 4,
-				   MP_LITTLE_ENDIAN);
-
-			if (msg_send(handle->usb_handle,
-				     device->algorithm.bitstream,
-				     device->algorithm.length + 8)) {
-				free(device->algorithm.bitstream);
-				return EXIT_FAILURE;
+		int ret = EXIT_SUCCESS;
+		int reuse = !init_record(handle, &record, ttl, 2, 8);
+		get_algorithm_key(ttl, 2, 8, key, sizeof(key));
+		if (!strcmp(handle->bitstream_loaded, key) ||
+		    (reuse && bitstream_loaded(handle, &record))) {
+			fprintf(stderr, "LOGIC algorithm already loaded.\n");
+		} else {
+			handle->bitstream_loaded[0] = '\0';
+			set_bitstream_record(handle, NULL);
+			for (int i = 0; i < 2 && !ret; i++) {
+				/* Use multipart bitstream sending protocol */
+				ttl[i].bitstream[0] = T56_WRITE_BITSTREAM2;
+				ttl[i].bitstream[1] = i ? 0 : 1;
+				format_int(&ttl[i].bitstream[4],
+					   ttl[i].length, 4,
+					   MP_LITTLE_ENDIAN);
+				ret = msg_send(handle->usb_handle,
+					       ttl[i].bitstream,
+					       ttl[i].length + 8);
 			}
-			free(handle->device->algorithm.bitstream);
+			if (!ret && reuse)
+				set_bitstream_record(handle, &record);
 		}
-		return EXIT_SUCCESS;
+		if (!ret)
+			strcpy(handle->bitstream_loaded, key);
+		free(ttl[0].bitstream);
+		free(ttl[1].bitstream);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
 
 	/* Normal devices algorithm handling */
@@ -134,8 +291,22 @@ static int t56_send_bitstream(minipro_handle_t *handle)
 	fprintf(stderr, "Using %s algorithm..\n",
 		device->algorithm.name);
 
-	/* Send the bitstream algorithm to the T56 */
 	algorithm_t *algorithm = &device->algorithm;
+	int reuse = !init_record(handle, &record, algorithm, 1, 0);
+	get_algorithm_key(algorithm, 1, 0, key, sizeof(key));
+	if (!strcmp(handle->bitstream_loaded, key) ||
+	    (reuse && bitstream_loaded(handle, &record))) {
+		fprintf(stderr, "%s algorithm already loaded.\n",
+			algorithm->name);
+		strcpy(handle->bitstream_loaded, key);
+		handle->bitstream_uploaded = 1;
+		free(algorithm->bitstream);
+		return EXIT_SUCCESS;
+	}
+	handle->bitstream_loaded[0] = '\0';
+	set_bitstream_record(handle, NULL);
+
+	/* Send the bitstream algorithm to the T56 */
 	memset(msg, 0x00, sizeof(msg));
 	msg[0] = T56_WRITE_BITSTREAM;
 	format_int(&msg[4], algorithm->length, 4, MP_LITTLE_ENDIAN);
@@ -150,11 +321,26 @@ static int t56_send_bitstream(minipro_handle_t *handle)
 		return EXIT_FAILURE;
 	}
 
-	bitstream_uploaded = 1;
+	if (reuse)
+		set_bitstream_record(handle, &record);
+	strcpy(handle->bitstream_loaded, key);
+	handle->bitstream_uploaded = 1;
 	free(algorithm->bitstream);
 	return EXIT_SUCCESS;
 }
 
+static int t56_send_bitstream(minipro_handle_t *handle)
+{
+	/* Don't upload the bitstream again if we are in the same session */
+	if (handle->bitstream_uploaded)
+		return EXIT_SUCCESS;
+
+	uint64_t start = stats_start();
+	int ret = send_bitstream(handle);
+	stats_record(STATS_PHASE, "algorithm", 0, start);
+	return ret;
+}
+
 int t56_begin_transaction(minipro_handle_t *handle)
 {
 	uint8_t msg[64];
@@ -336,6 +522,14 @@ int t56_read_fuses(minipro_handle_t *handle, uint8_t type,
 	return EXIT_SUCCESS;
 }
 
+int t56_read_fuse_sections(minipro_handle_t *handle,
+			   fuse_section_t *sections, size_t count)
+{
+	static const uint8_t opcodes[] = { T56_READ_USER, T56_READ_CFG,
+					   T56_READ_LOCK };
+	return run_fuse_reads(handle, opcodes, sections, count);
+}
+
 int t56_write_fuses(minipro_handle_t *handle, uint8_t type,
 			    size_t length, uint8_t items_count, uint8_t *buffer)
 {
@@ -554,56 +748,18 @@ int t56_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_SUCCESS;
 }
 
+int t56_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			size_t stride, uint8_t row, uint8_t flags,
+			size_t size, size_t count)
+{
+	return run_jedec_row_reads(handle, T56_READ_JEDEC, 8, 32, buffer,
+				   stride, row, flags, size, count);
+}
+
 /* Pull: 0=Pull-up, 1=Pull-down */
 static uint8_t *do_ic_test(minipro_handle_t *handle, int pull)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t msg[32];
-	uint8_t *result;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
-	result = calloc(pin_count, handle->device->vector_count);
-	if (!result)
-		return NULL;
-
-	uint8_t *out = result;
-	int n;
-	for (n = 0; n < handle->device->vector_count; n++) {
-		memset(msg, 0xff, 32);
-
-		msg[0] = T56_LOGIC_IC_TEST_VECTOR;
-		msg[1] = handle->device->voltages.vcc;
-		msg[1] |= pull << 7; /* Set the pull-up/pull-down */
-		format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
-		format_int(&msg[4], n, 4, MP_LITTLE_ENDIAN);
-
-		int i;
-		/* Pack the vector to 2 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count;
-		     i++) {
-			if (i & 1)
-				msg[8 + i / 2] |= *vector << 4;
-			else
-				msg[8 + i / 2] = *vector;
-			vector++;
-		}
-
-		/* Send the test vector and read the pin status */
-		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-
-		/* Unpack the result from 2 pin/byte to 1 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count; i++)
-			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
-	}
-
-	return result;
+	return run_logic_vectors(handle, T56_LOGIC_IC_TEST_VECTOR, pull);
 }
 
 /* Performing a logic test. This is accomplished in two steps.
@@ -720,7 +876,7 @@ It has a fixed 16 byte header, followed by a number of 2068-byte blocks
 /* Performing a firmware update */
 int t56_firmware_update(minipro_handle_t *handle, const char *firmware)
 {
-	static uint8_t msg[2080];
+	uint8_t msg[2080];
 
 	struct stat st;
 	if (stat(firmware, &st)) {
@@ -0,0 +1,321 @@
+/*
+ * bench.c - Timing, test data and session helpers of the test programs.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "minipro.h"
+#include "stats.h"
+#include "usb.h"
+#include "bench.h"
+
+void bench_init(bench_t *bench, const char *name)
+{
+	memset(bench, 0, sizeof(*bench));
+	bench->name = name;
+}
+
+void bench_start(bench_t *bench)
+{
+	bench->start = stats_now();
+}
+
+void bench_stop(bench_t *bench, size_t bytes)
+{
+	bench->elapsed += stats_now() - bench->start;
+	bench->bytes += bytes;
+	bench->runs++;
+}
+
+/* Print the average time of a run and the throughput */
+void bench_report(const bench_t *bench)
+{
+	double ms = bench->runs ?
+			    (double)bench->elapsed / bench->runs / 1000000 :
+			    0;
+	printf("  %-24s %10.3f ms", bench->name, ms);
+	if (bench->bytes && bench->elapsed)
+		printf(" %10.2f MB/s",
+		       (double)bench->bytes / 1048576 /
+			       ((double)bench->elapsed / 1000000000));
+	printf("\n");
+}
+
+void bench_fill(uint8_t *data, size_t size, uint32_t seed)
+{
+	uint32_t x = seed * 2654435761u + 1;
+	for (size_t i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = x >> 24;
+	}
+}
+
+char *bench_read_back(FILE *file, size_t *size)
+{
+	long len;
+
+	if (fflush(file) || fseek(file, 0, SEEK_END) ||
+	    (len = ftell(file)) < 0) {
+		fprintf(stderr, "Could not read the temporary file back.\n");
+		return NULL;
+	}
+	rewind(file);
+	char *buffer = malloc(len + 1);
+	if (!buffer) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	if (fread(buffer, 1, len, file) != (size_t)len) {
+		free(buffer);
+		fprintf(stderr, "Could not read the temporary file back.\n");
+		return NULL;
+	}
+	buffer[len] = 0;
+	*size = len;
+	return buffer;
+}
+
+int bench_fail(const char *fmt, ...)
+{
+	va_list args;
+	fprintf(stderr, "FAILED: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	return EXIT_FAILURE;
+}
+
+device_t *bench_get_device(uint8_t version, const char *name)
+{
+	db_data_t db_data;
+	db_query_t query;
+
+	memset(&db_data, 0, sizeof(db_data));
+	db_data.infoic_path = BENCH_INFOIC;
+	db_data.logicic_path = BENCH_LOGICIC;
+	db_data.version = version;
+	memset(&query, 0, sizeof(query));
+	query.type = DB_QUERY_DEVICE;
+	query.name = name;
+	if (query_database(&db_data, &query, 1))
+		return NULL;
+	return query.device;
+}
+
+void bench_free_device(device_t *device)
+{
+	minipro_handle_t handle;
+	memset(&handle, 0, sizeof(handle));
+	handle.device = device;
+	minipro_free_device(&handle);
+}
+
+/*
+ * Programming flow.
+ * A session is recorded once against the simulated programmer and then
+ * replayed with usb_replay(), which checks that every replayed transfer
+ * matches the recording. The replays don't touch the simulator, so they
+ * measure the host side of a job: the protocol code, the block loops,
+ * the compare and the session layer.
+ */
+typedef struct flow {
+	bench_t open, erase, write, read, verify;
+} flow_t;
+
+static void flow_init(flow_t *flow)
+{
+	bench_init(&flow->open, "open");
+	bench_init(&flow->erase, "erase");
+	bench_init(&flow->write, "write");
+	bench_init(&flow->read, "read");
+	bench_init(&flow->verify, "verify");
+}
+
+static void bench_progress(minipro_handle_t *handle, const char *status,
+			   int percent)
+{
+}
+
+/* Gather the streamed chip blocks in the buffer of 'user_data' */
+static int read_block_cb(void *user_data, uint8_t *block, size_t offset,
+			 size_t len)
+{
+	memcpy((uint8_t *)user_data + offset, block, len);
+	return 0;
+}
+
+/* Erase, write, read back and verify the chip within the transaction */
+static int flow_steps(minipro_handle_t *handle, flow_t *flow, uint8_t *data,
+		      uint8_t *chip, size_t size)
+{
+	int failed;
+
+	/* The transaction is reset after the erase */
+	if (handle->device->flags.can_erase) {
+		bench_start(&flow->erase);
+		if (minipro_erase(handle) ||
+		    minipro_end_transaction(handle) ||
+		    minipro_begin_transaction(handle))
+			return bench_fail("Could not erase the chip.\n");
+		bench_stop(&flow->erase, 0);
+	}
+
+	bench_start(&flow->write);
+	if (minipro_write_memory(handle, data, MP_CODE, size, NULL))
+		return bench_fail("Could not write the chip.\n");
+	bench_stop(&flow->write, size);
+
+	/* Streamed, the T56 may hand back more than a block */
+	bench_start(&flow->read);
+	if (minipro_read_stream(handle, MP_CODE, size, read_block_cb, chip))
+		return bench_fail("Could not read the chip.\n");
+	bench_stop(&flow->read, size);
+	if (memcmp(data, chip, size))
+		return bench_fail("The chip doesn't hold the written data.\n");
+
+	bench_start(&flow->verify);
+	if (minipro_verify_memory(handle, MP_CODE, data, size, size, &failed))
+		return bench_fail("Could not verify the chip.\n");
+	bench_stop(&flow->verify, size);
+	if (failed)
+		return bench_fail("The verify of the written data failed.\n");
+
+	if (minipro_end_transaction(handle))
+		return bench_fail("Could not end the transaction.\n");
+	return EXIT_SUCCESS;
+}
+
+static int run_flow(device_t *device, cmdopts_t *cmdopts, flow_t *flow,
+		    uint8_t *data, uint8_t *chip)
+{
+	int ret;
+
+	memset(chip, 0, device->code_memory_size);
+	bench_start(&flow->open);
+	minipro_handle_t *handle = minipro_open(VERBOSE);
+	if (!handle)
+		return bench_fail("Could not open the programmer.\n");
+	handle->cmdopts = cmdopts;
+	handle->progress = bench_progress;
+	handle->device = device;
+	/* The T56 FPGA bitstream comes from algorithm.xml, which can't be
+	 * shipped. The simulated programmer doesn't need one. */
+	handle->bitstream_uploaded = 1;
+
+	if (minipro_begin_transaction(handle)) {
+		ret = bench_fail("Could not begin the transaction.\n");
+	} else {
+		bench_stop(&flow->open, 0);
+		ret = flow_steps(handle, flow, data, chip,
+				 device->code_memory_size);
+	}
+	handle->device = NULL;
+	minipro_close(handle);
+	return ret;
+}
+
+static const char *model_name(uint8_t version)
+{
+	switch (version) {
+	case MP_TL866IIPLUS:
+		return "TL866II+";
+	case MP_T48:
+		return "T48";
+	case MP_T56:
+		return "T56";
+	default:
+		return "Unknown";
+	}
+}
+
+int bench_flow(uint8_t version, const char *name)
+{
+	char dir[] = "/tmp/minipro_test.XXXXXX";
+	char session[sizeof(dir) + 16];
+	cmdopts_t cmdopts;
+	flow_t flow;
+	int ret;
+
+	device_t *device = bench_get_device(version, name);
+	if (!device)
+		return bench_fail("%s was not found.\n", name);
+	size_t size = device->code_memory_size;
+	uint8_t *data = malloc(size);
+	uint8_t *chip = malloc(size);
+	if (!data || !chip) {
+		free(data);
+		free(chip);
+		bench_free_device(device);
+		return bench_fail("Out of memory!\n");
+	}
+	bench_fill(data, size, version);
+	memset(&cmdopts, 0, sizeof(cmdopts));
+
+	/* The recording is kept out of the source tree */
+	if (!mkdtemp(dir)) {
+		free(data);
+		free(chip);
+		bench_free_device(device);
+		return bench_fail("Can't create a directory in /tmp.\n");
+	}
+	snprintf(session, sizeof(session), "%s/session.rec", dir);
+
+	/* Record the session */
+	flow_init(&flow);
+	sim_init(version);
+	ret = usb_record(session);
+	if (!ret) {
+		ret = run_flow(device, &cmdopts, &flow, data, chip);
+		if (usb_session_end())
+			ret = EXIT_FAILURE;
+	}
+	sim_free();
+
+	/* And replay it */
+	flow_init(&flow);
+	for (int i = 0; i < BENCH_RUNS && !ret; i++) {
+		ret = usb_replay(session, 0);
+		if (ret)
+			break;
+		ret = run_flow(device, &cmdopts, &flow, data, chip);
+		if (usb_session_end())
+			ret = EXIT_FAILURE;
+	}
+	remove(session);
+	rmdir(dir);
+
+	if (!ret) {
+		printf("%s %s, %zu bytes, %d replays:\n", model_name(version),
+		       name, size, BENCH_RUNS);
+		bench_report(&flow.open);
+		if (flow.erase.runs)
+			bench_report(&flow.erase);
+		bench_report(&flow.write);
+		bench_report(&flow.read);
+		bench_report(&flow.verify);
+	}
+	free(data);
+	free(chip);
+	bench_free_device(device);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ * bench.h - Timing, test data and session helpers of the test programs.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "minipro.h"
+
+/* The tests are run from the top directory */
+#define BENCH_INFOIC  "infoic.xml"
+#define BENCH_LOGICIC "logicic.xml"
+
+/* Replays of a recorded session */
+#define BENCH_RUNS    5
+
+/* Accumulated time of one measured operation */
+typedef struct bench {
+	const char *name;
+	uint64_t start;
+	uint64_t elapsed; /* ns */
+	size_t runs;
+	size_t bytes;
+} bench_t;
+
+void bench_init(bench_t *bench, const char *name);
+void bench_start(bench_t *bench);
+void bench_stop(bench_t *bench, size_t bytes);
+void bench_report(const bench_t *bench);
+
+/* Fill 'data' with a repeatable pattern which is neither blank nor
+ * constant */
+void bench_fill(uint8_t *data, size_t size, uint32_t seed);
+
+/* Read a written temporary file back as a NUL terminated string */
+char *bench_read_back(FILE *file, size_t *size);
+
+/* Print a failed check and return EXIT_FAILURE */
+int bench_fail(const char *fmt, ...);
+
+/* Look up a device in the database of the 'version' programmer */
+device_t *bench_get_device(uint8_t version, const char *name);
+void bench_free_device(device_t *device);
+
+/* Record an erase, write, read and verify of 'name' with the simulated
+ * 'version' programmer, then replay the session BENCH_RUNS times and
+ * report the time of every step.
+ */
+int bench_flow(uint8_t version, const char *name);
+
+/* Simulated programmer of usb_sim.c, which answers the recording */
+void sim_init(uint8_t version);
+void sim_free(void);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * test_compare.c - Compare and verify timing.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minipro.h"
+#include "bench.h"
+
+#define COMPARE_SIZE	 0x1000000 /* A 128 Mbit flash */
+#define COMPARE_MISMATCH (COMPARE_SIZE - 3)
+
+/* A full equal compare, then one failing a few bytes before the end */
+static int test_bytes(uint8_t *s1, uint8_t *s2)
+{
+	bench_t equal, differ;
+	uint32_t address;
+	uint8_t c1, c2;
+
+	bench_init(&equal, "byte compare");
+	bench_init(&differ, "byte compare, mismatch");
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		bench_start(&equal);
+		int ret = compare_memory(0xff, s1, s2, COMPARE_SIZE,
+					 COMPARE_SIZE, &address, &c1, &c2);
+		bench_stop(&equal, COMPARE_SIZE);
+		if (ret)
+			return bench_fail("Equal data compare as different at "
+					  "0x%X.\n",
+					  address);
+
+		s2[COMPARE_MISMATCH] ^= 0x10;
+		bench_start(&differ);
+		ret = compare_memory(0xff, s1, s2, COMPARE_SIZE, COMPARE_SIZE,
+				     &address, &c1, &c2);
+		bench_stop(&differ, COMPARE_SIZE);
+		s2[COMPARE_MISMATCH] ^= 0x10;
+		if (!ret || address != COMPARE_MISMATCH ||
+		    c1 != s1[COMPARE_MISMATCH] ||
+		    c2 != (s1[COMPARE_MISMATCH] ^ 0x10))
+			return bench_fail("The mismatch at 0x%X wasn't "
+					  "found.\n",
+					  COMPARE_MISMATCH);
+
+		/* Masked bits never differ */
+		s2[COMPARE_MISMATCH] ^= 0x80;
+		ret = compare_memory(0x7f, s1, s2, COMPARE_SIZE, COMPARE_SIZE,
+				     &address, &c1, &c2);
+		s2[COMPARE_MISMATCH] ^= 0x80;
+		if (ret)
+			return bench_fail("A masked bit compares as "
+					  "different.\n");
+	}
+	bench_report(&equal);
+	bench_report(&differ);
+	return EXIT_SUCCESS;
+}
+
+/* 16 bit words as on the PIC and 27C1024 kind of devices */
+static int test_words(uint8_t *s1, uint8_t *s2)
+{
+	bench_t equal, differ;
+	uint32_t address;
+	uint16_t c1, c2;
+
+	bench_init(&equal, "word compare");
+	bench_init(&differ, "word compare, mismatch");
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		bench_start(&equal);
+		int ret = compare_word_memory(0xffff, 0x3fff, 1, s1, s2,
+					      COMPARE_SIZE, COMPARE_SIZE,
+					      &address, &c1, &c2);
+		bench_stop(&equal, COMPARE_SIZE);
+		if (ret)
+			return bench_fail("Equal words compare as different "
+					  "at 0x%X.\n",
+					  address);
+
+		s2[COMPARE_MISMATCH] ^= 0x01;
+		bench_start(&differ);
+		ret = compare_word_memory(0xffff, 0x3fff, 1, s1, s2,
+					  COMPARE_SIZE, COMPARE_SIZE, &address,
+					  &c1, &c2);
+		bench_stop(&differ, COMPARE_SIZE);
+		s2[COMPARE_MISMATCH] ^= 0x01;
+		if (!ret || address != (COMPARE_MISMATCH & ~1))
+			return bench_fail("The word mismatch at 0x%X wasn't "
+					  "found.\n",
+					  COMPARE_MISMATCH & ~1);
+	}
+	bench_report(&equal);
+	bench_report(&differ);
+	return EXIT_SUCCESS;
+}
+
+int main(void)
+{
+	uint8_t *s1 = malloc(COMPARE_SIZE);
+	uint8_t *s2 = malloc(COMPARE_SIZE);
+	if (!s1 || !s2) {
+		free(s1);
+		free(s2);
+		return bench_fail("Out of memory!\n");
+	}
+	bench_fill(s1, COMPARE_SIZE, 3);
+	memcpy(s2, s1, COMPARE_SIZE);
+
+	printf("Compare, %u bytes, %d runs:\n", COMPARE_SIZE, BENCH_RUNS);
+	int ret = test_bytes(s1, s2) || test_words(s1, s2);
+	free(s1);
+	free(s2);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
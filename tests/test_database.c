@@ -0,0 +1,174 @@
+/*
+ * test_database.c - Device and chip ID lookup timing.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "minipro.h"
+#include "bench.h"
+
+#define NAMES_COUNT (sizeof(names) / sizeof(names[0]))
+
+static const char *names[] = { "AT24C256",	   "W25Q80BV",
+			       "W25Q32BV@SOIC8",   "SST39SF040",
+			       "AT29C010A@PLCC32", "27C512@DIP28",
+			       "GAL16V8" };
+
+/* The first lookup builds or loads the database index */
+static int test_device_lookup(void)
+{
+	bench_t first, single;
+
+	bench_init(&first, "first device lookup");
+	bench_init(&single, "device lookup");
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		for (size_t i = 0; i < NAMES_COUNT; i++) {
+			bench_t *bench = run || i ? &single : &first;
+			bench_start(bench);
+			device_t *device =
+				bench_get_device(MP_TL866IIPLUS, names[i]);
+			bench_stop(bench, 0);
+			if (!device)
+				return bench_fail("%s was not found.\n",
+						  names[i]);
+			if (strcmp(device->name, names[i])) {
+				bench_free_device(device);
+				return bench_fail("%s found for %s.\n",
+						  device->name, names[i]);
+			}
+			bench_free_device(device);
+		}
+	}
+	bench_report(&first);
+	bench_report(&single);
+	return EXIT_SUCCESS;
+}
+
+/* All devices of a job in one pass */
+static int test_batched_lookup(void)
+{
+	db_data_t db_data;
+	db_query_t query[NAMES_COUNT];
+	bench_t batch;
+	int ret = EXIT_SUCCESS;
+
+	bench_init(&batch, "batched device lookup");
+	memset(&db_data, 0, sizeof(db_data));
+	db_data.infoic_path = BENCH_INFOIC;
+	db_data.logicic_path = BENCH_LOGICIC;
+	db_data.version = MP_T48;
+	for (int run = 0; run < BENCH_RUNS && !ret; run++) {
+		memset(query, 0, sizeof(query));
+		for (size_t i = 0; i < NAMES_COUNT; i++) {
+			query[i].type = DB_QUERY_DEVICE;
+			query[i].name = names[i];
+		}
+		bench_start(&batch);
+		if (query_database(&db_data, query, NAMES_COUNT))
+			return bench_fail("The batched lookup failed.\n");
+		bench_stop(&batch, 0);
+		for (size_t i = 0; i < NAMES_COUNT; i++) {
+			if (!query[i].device)
+				ret = bench_fail("%s was not found in a "
+						 "batch.\n",
+						 names[i]);
+			else
+				bench_free_device(query[i].device);
+		}
+	}
+	if (!ret)
+		bench_report(&batch);
+	return ret;
+}
+
+/* The first device of a chip ID, and an unknown chip ID */
+static int test_chip_id_lookup(void)
+{
+	db_data_t db_data;
+	db_query_t query;
+	bench_t hit, miss;
+
+	device_t *device = bench_get_device(MP_T56, "W25Q80BV");
+	if (!device)
+		return bench_fail("W25Q80BV was not found.\n");
+	uint32_t chip_id = device->chip_id;
+	uint32_t protocol = device->protocol_id;
+	bench_free_device(device);
+
+	bench_init(&hit, "chip ID lookup");
+	bench_init(&miss, "unknown chip ID lookup");
+	memset(&db_data, 0, sizeof(db_data));
+	db_data.infoic_path = BENCH_INFOIC;
+	db_data.logicic_path = BENCH_LOGICIC;
+	db_data.version = MP_T56;
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		memset(&query, 0, sizeof(query));
+		query.type = DB_QUERY_CHIP_ID;
+		query.chip_id = chip_id;
+		query.protocol = protocol;
+		db_data.chip_id = chip_id;
+		db_data.protocol = protocol;
+		bench_start(&hit);
+		if (query_database(&db_data, &query, 1))
+			return bench_fail("The chip ID lookup failed.\n");
+		bench_stop(&hit, 0);
+		if (!query.chip_name)
+			return bench_fail("Chip ID 0x%06X was not found.\n",
+					  query.chip_id);
+		/* Another device of the same ID may come first */
+		device = run ? NULL : bench_get_device(MP_T56, query.chip_name);
+		if (!run && (!device || device->chip_id != chip_id)) {
+			bench_fail("%s found for chip ID 0x%06X.\n",
+				   query.chip_name, query.chip_id);
+			bench_free_device(device);
+			free(query.chip_name);
+			return EXIT_FAILURE;
+		}
+		bench_free_device(device);
+		free(query.chip_name);
+
+		memset(&query, 0, sizeof(query));
+		query.type = DB_QUERY_CHIP_ID;
+		query.chip_id = 0x5A5A5A;
+		query.protocol = protocol;
+		db_data.chip_id = query.chip_id;
+		db_data.protocol = protocol;
+		bench_start(&miss);
+		if (query_database(&db_data, &query, 1))
+			return bench_fail("The chip ID lookup failed.\n");
+		bench_stop(&miss, 0);
+		if (query.chip_name) {
+			free(query.chip_name);
+			return bench_fail("Chip ID 0x%06X was found.\n",
+					  query.chip_id);
+		}
+	}
+	bench_report(&hit);
+	bench_report(&miss);
+	return EXIT_SUCCESS;
+}
+
+int main(void)
+{
+	printf("Database lookup, %d runs:\n", BENCH_RUNS);
+	if (test_device_lookup() || test_batched_lookup() ||
+	    test_chip_id_lookup())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
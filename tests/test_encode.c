@@ -0,0 +1,108 @@
+/*
+ * test_encode.c - IHEX, SREC and JEDEC encoding timing.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ihex.h"
+#include "jedec.h"
+#include "srec.h"
+#include "bench.h"
+
+#define ENCODE_SIZE	   0x100000
+#define ENCODE_JEDEC_FUSES 5892 /* ATF16V8 */
+#define ENCODE_JEDEC_PINS  20
+
+enum { ENCODE_IHEX, ENCODE_SREC, ENCODE_JEDEC };
+
+static int encode(int format, FILE *file, uint8_t *data, jedec_t *jedec)
+{
+	switch (format) {
+	case ENCODE_IHEX:
+		return write_hex_file(file, data, 0, ENCODE_SIZE, 1);
+	case ENCODE_SREC:
+		return write_srec_file(file, data, 0, ENCODE_SIZE, 1);
+	default:
+		return write_jedec_file(file, jedec);
+	}
+}
+
+/* Time the writing of 'format' to a temporary file */
+static int test_encode(const char *name, int format, uint8_t *data,
+		       jedec_t *jedec)
+{
+	bench_t bench;
+	size_t len;
+
+	bench_init(&bench, name);
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		FILE *file = tmpfile();
+		if (!file)
+			return bench_fail("Could not create a temporary "
+					  "file.\n");
+		bench_start(&bench);
+		if (encode(format, file, data, jedec) || fflush(file)) {
+			fclose(file);
+			return bench_fail("Could not encode the %s file.\n",
+					  name);
+		}
+		long pos = ftell(file);
+		bench_stop(&bench, pos > 0 ? pos : 0);
+		if (i)
+			fclose(file);
+		else {
+			/* Check the first output is sane */
+			char *buffer = bench_read_back(file, &len);
+			fclose(file);
+			if (!buffer)
+				return EXIT_FAILURE;
+			int empty = !len || !strchr(buffer, '\n');
+			free(buffer);
+			if (empty)
+				return bench_fail("The %s file is empty.\n",
+						  name);
+		}
+	}
+	bench_report(&bench);
+	return EXIT_SUCCESS;
+}
+
+int main(void)
+{
+	jedec_t jedec;
+
+	memset(&jedec, 0, sizeof(jedec));
+	jedec.device_name = "ATF16V8B";
+	jedec.QF = ENCODE_JEDEC_FUSES;
+	jedec.QP = ENCODE_JEDEC_PINS;
+	uint8_t *data = malloc(ENCODE_SIZE);
+	if (!data || jedec_alloc_fuses(&jedec, 0)) {
+		free(data);
+		return bench_fail("Out of memory!\n");
+	}
+	bench_fill(data, ENCODE_SIZE, 2);
+	bench_fill(jedec.fuses, ENCODE_JEDEC_FUSES / 8, ENCODE_JEDEC_FUSES);
+
+	printf("File encoding, %d runs:\n", BENCH_RUNS);
+	int ret = test_encode("Intel hex", ENCODE_IHEX, data, &jedec) ||
+		  test_encode("Motorola SREC", ENCODE_SREC, data, &jedec) ||
+		  test_encode("JEDEC", ENCODE_JEDEC, data, &jedec);
+	free(data);
+	free(jedec.fuses);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
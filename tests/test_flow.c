@@ -0,0 +1,43 @@
+/*
+ * test_flow.c - Replayed programming sessions of each programmer model.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "minipro.h"
+#include "bench.h"
+
+/* A serial and a parallel device of each model */
+static const struct {
+	uint8_t version;
+	const char *name;
+} flows[] = {
+	{ MP_TL866IIPLUS, "AT24C256" },
+	{ MP_TL866IIPLUS, "AT29C010A@PLCC32" },
+	{ MP_T48, "W25Q80BV" },
+	{ MP_T48, "SST39SF040" },
+	{ MP_T56, "SST39SF040" },
+	{ MP_T56, "W25Q80BV" },
+};
+
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(flows) / sizeof(flows[0]); i++) {
+		if (bench_flow(flows[i].version, flows[i].name))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,346 @@
+/*
+ * test_nand.c - NAND bad block table, image layouts and ECC.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nand.h"
+#include "bench.h"
+
+/* A 512+16 byte page part and a 2048+64 byte page part */
+static const nand_geometry_t small_page = { 512, 16, 32, 64 };
+static const nand_geometry_t large_page = { 2048, 64, 64, 128 };
+
+/* Bad blocks, marked in the first, the second and the last page */
+static const uint32_t bad_blocks[] = { 3, 10, 63 };
+#define BAD_COUNT (sizeof(bad_blocks) / sizeof(bad_blocks[0]))
+
+/* ECC by its definition, bit by bit: the inverted parities of the bytes
+ * with each address bit clear and set, and of the bit columns */
+static void reference_ecc(const uint8_t *data, uint8_t *ecc)
+{
+	static const uint8_t columns[] = { 0x55, 0xAA, 0x33, 0xCC, 0x0F, 0xF0 };
+	uint8_t line[16] = { 0 }, column = 0;
+
+	for (int i = 0; i < NAND_ECC_STEP; i++) {
+		int parity = 0;
+		for (int bit = 0; bit < 8; bit++)
+			parity ^= (data[i] >> bit) & 1;
+		for (int bit = 0; bit < 8; bit++)
+			line[bit * 2 + ((i >> bit) & 1)] ^= parity;
+		column ^= data[i];
+	}
+	memset(ecc, 0, NAND_ECC_BYTES);
+	for (int i = 0; i < 16; i++)
+		ecc[i / 8] |= !line[i] << (i & 7);
+	ecc[2] = 0x03;
+	for (int i = 0; i < 6; i++) {
+		int parity = 0;
+		for (int bit = 0; bit < 8; bit++)
+			parity ^= ((column & columns[i]) >> bit) & 1;
+		ecc[2] |= !parity << (i + 2);
+	}
+}
+
+static int test_ecc(void)
+{
+	uint8_t data[NAND_ECC_STEP], copy[NAND_ECC_STEP];
+	uint8_t ecc[NAND_ECC_BYTES], ref[NAND_ECC_BYTES], bad[NAND_ECC_BYTES];
+
+	for (int run = 0; run < 64; run++) {
+		bench_fill(data, sizeof(data), run);
+		nand_ecc_calculate(data, ecc);
+		reference_ecc(data, ref);
+		if (memcmp(ecc, ref, NAND_ECC_BYTES))
+			return bench_fail("ECC %02X%02X%02X, expected "
+					  "%02X%02X%02X.\n",
+					  ecc[0], ecc[1], ecc[2], ref[0],
+					  ref[1], ref[2]);
+	}
+
+	/* An erased step has an erased ECC */
+	memset(data, 0xFF, sizeof(data));
+	nand_ecc_calculate(data, ecc);
+	if (ecc[0] != 0xFF || ecc[1] != 0xFF || ecc[2] != 0xFF)
+		return bench_fail("The ECC of erased data isn't erased.\n");
+
+	/* Every single bit error in the data is fixed */
+	bench_fill(data, sizeof(data), 1);
+	nand_ecc_calculate(data, ecc);
+	for (int bit = 0; bit < NAND_ECC_STEP * 8; bit++) {
+		memcpy(copy, data, sizeof(data));
+		copy[bit / 8] ^= 1 << (bit & 7);
+		nand_ecc_calculate(copy, ref);
+		if (nand_ecc_correct(copy, ecc, ref) != 1 ||
+		    memcmp(copy, data, sizeof(data)))
+			return bench_fail("Bit %d wasn't corrected.\n", bit);
+	}
+
+	/* and so is a bit error in the ECC itself */
+	for (int bit = 0; bit < NAND_ECC_BYTES * 8; bit++) {
+		memcpy(bad, ecc, sizeof(ecc));
+		bad[bit / 8] ^= 1 << (bit & 7);
+		memcpy(copy, data, sizeof(data));
+		if (nand_ecc_correct(copy, bad, ecc) != 1 ||
+		    memcmp(copy, data, sizeof(data)))
+			return bench_fail("ECC bit %d wasn't accepted.\n", bit);
+	}
+
+	/* Two bit errors are detected */
+	for (int bit = 0; bit < NAND_ECC_STEP * 8; bit += 7) {
+		int other = (bit * 13 + 5) % (NAND_ECC_STEP * 8);
+		if (other == bit)
+			continue;
+		memcpy(copy, data, sizeof(data));
+		copy[bit / 8] ^= 1 << (bit & 7);
+		copy[other / 8] ^= 1 << (other & 7);
+		nand_ecc_calculate(copy, ref);
+		if (nand_ecc_correct(copy, ecc, ref) != -1)
+			return bench_fail("Bits %d and %d weren't detected.\n",
+					  bit, other);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* A raw image of random page data, with the bad_blocks[] marked */
+static uint8_t *make_raw(const nand_geometry_t *geometry)
+{
+	size_t page_bytes = nand_raw_page_size(geometry);
+	size_t marker = geometry->page_size > 512 ? 0 : 5;
+	uint32_t pages[] = { 0, 1, geometry->pages_per_block - 1 };
+	uint8_t *raw = malloc(nand_raw_size(geometry));
+
+	if (!raw)
+		return NULL;
+	bench_fill(raw, nand_raw_size(geometry), geometry->page_size);
+	for (size_t i = 0; i < nand_raw_size(geometry) / page_bytes; i++)
+		memset(raw + i * page_bytes + geometry->page_size, 0xFF,
+		       geometry->spare_size);
+	for (size_t i = 0; i < BAD_COUNT; i++)
+		raw[bad_blocks[i] * nand_raw_block_size(geometry) +
+		    pages[i] * page_bytes + geometry->page_size + marker] =
+			0x00;
+	return raw;
+}
+
+static int test_bbt(const nand_geometry_t *geometry)
+{
+	nand_bbt_t bbt;
+	uint8_t *raw = make_raw(geometry);
+
+	if (!raw)
+		return bench_fail("Out of memory!\n");
+	if (nand_bbt_init(&bbt, geometry)) {
+		free(raw);
+		return EXIT_FAILURE;
+	}
+	int ret = nand_bbt_scan(&bbt, raw, nand_raw_size(geometry));
+	if (!ret && bbt.bad_count != BAD_COUNT)
+		ret = bench_fail("%u bad blocks found, expected %zu.\n",
+				 bbt.bad_count, BAD_COUNT);
+	for (size_t i = 0; !ret && i < BAD_COUNT; i++) {
+		if (!nand_bbt_is_bad(&bbt, bad_blocks[i]))
+			ret = bench_fail("Block %u wasn't found bad.\n",
+					 bad_blocks[i]);
+	}
+	if (!ret && nand_bbt_scan(&bbt, raw, nand_raw_size(geometry) - 1) !=
+			    EXIT_FAILURE)
+		ret = bench_fail("A short image was scanned.\n");
+	nand_bbt_free(&bbt);
+	free(raw);
+	return ret;
+}
+
+/* A skip-bad image comes back from its raw layout unchanged, the bad
+ * blocks and the spare areas stay erased */
+static int test_layout(const nand_geometry_t *geometry)
+{
+	nand_bbt_t bbt;
+	size_t page_bytes = nand_raw_page_size(geometry);
+	uint8_t *raw = make_raw(geometry);
+	size_t good_size, partial;
+	uint8_t *data = NULL, *back = NULL;
+	int ret = EXIT_FAILURE;
+
+	if (!raw || nand_bbt_init(&bbt, geometry)) {
+		free(raw);
+		return bench_fail("No NAND image.\n");
+	}
+	if (nand_bbt_scan(&bbt, raw, nand_raw_size(geometry)))
+		goto out;
+	good_size = nand_good_size(&bbt);
+	if (good_size != (geometry->block_count - BAD_COUNT) *
+				 geometry->pages_per_block *
+				 geometry->page_size) {
+		bench_fail("The good size is %zu bytes.\n", good_size);
+		goto out;
+	}
+	data = malloc(good_size);
+	back = malloc(good_size);
+	if (!data || !back) {
+		bench_fail("Out of memory!\n");
+		goto out;
+	}
+	bench_fill(data, good_size, 7);
+	if (nand_skip_bad_to_raw(&bbt, data, good_size, raw))
+		goto out;
+	for (uint32_t block = 0; block < geometry->block_count; block++) {
+		uint8_t *p = raw + block * nand_raw_block_size(geometry);
+		for (uint32_t i = 0; i < geometry->pages_per_block; i++) {
+			size_t start = nand_bbt_is_bad(&bbt, block) ?
+					       0 :
+					       geometry->page_size;
+			for (size_t j = start; j < page_bytes; j++) {
+				if (p[i * page_bytes + j] != 0xFF) {
+					bench_fail("Block %u page %u isn't "
+						   "erased.\n",
+						   block, i);
+					goto out;
+				}
+			}
+		}
+	}
+	nand_raw_to_skip_bad(&bbt, raw, back);
+	if (memcmp(data, back, good_size)) {
+		bench_fail("The skip-bad image changed.\n");
+		goto out;
+	}
+
+	/* A short file, the rest of the last page and after it is erased */
+	partial = geometry->page_size * 5 / 2;
+	if (nand_skip_bad_to_raw(&bbt, data, partial, raw))
+		goto out;
+	nand_raw_to_skip_bad(&bbt, raw, back);
+	if (memcmp(data, back, partial) || back[partial] != 0xFF ||
+	    back[good_size - 1] != 0xFF) {
+		bench_fail("A short skip-bad image wasn't padded.\n");
+		goto out;
+	}
+	if (nand_skip_bad_to_raw(&bbt, data, good_size + 1, raw) !=
+	    EXIT_FAILURE) {
+		bench_fail("An image larger than the good blocks fit.\n");
+		goto out;
+	}
+	ret = EXIT_SUCCESS;
+out:
+	free(data);
+	free(back);
+	free(raw);
+	nand_bbt_free(&bbt);
+	return ret;
+}
+
+/* The ECC worker against page by page encoding, then a read back with a
+ * single bit error in every good page and a double bit error in one */
+static int test_worker(const nand_geometry_t *geometry)
+{
+	size_t page_bytes = nand_raw_page_size(geometry);
+	size_t pages = (size_t)geometry->block_count *
+		       geometry->pages_per_block;
+	size_t size = nand_raw_size(geometry);
+	bench_t encode, correct;
+	nand_ecc_job_t job;
+	nand_bbt_t bbt;
+	int ret = EXIT_FAILURE;
+	uint8_t *raw = make_raw(geometry);
+	uint8_t *copy = malloc(size);
+
+	if (!raw || !copy || nand_bbt_init(&bbt, geometry)) {
+		free(raw);
+		free(copy);
+		return bench_fail("No NAND image.\n");
+	}
+	if (nand_bbt_scan(&bbt, raw, size))
+		goto out;
+	memcpy(copy, raw, size);
+	for (uint32_t block = 0; block < geometry->block_count; block++) {
+		if (nand_bbt_is_bad(&bbt, block))
+			continue;
+		for (uint32_t i = 0; i < geometry->pages_per_block; i++)
+			nand_ecc_encode_page(
+				geometry,
+				copy + (block * geometry->pages_per_block + i) *
+					       page_bytes);
+	}
+
+	bench_init(&encode, "ECC encode worker");
+	bench_init(&correct, "ECC correct worker");
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		/* The blocks are taken as they are done, like a writer */
+		bench_start(&encode);
+		if (nand_ecc_start(&job, &bbt, raw, NAND_ECC_ENCODE))
+			goto out;
+		for (uint32_t block = 0; block < geometry->block_count;
+		     block++)
+			nand_ecc_wait_block(&job, block);
+		nand_ecc_wait(&job);
+		bench_stop(&encode, size);
+		if (memcmp(raw, copy, size)) {
+			bench_fail("The ECC worker encoded another ECC.\n");
+			goto out;
+		}
+
+		size_t flips = 0;
+		for (size_t page = 0; page < pages; page++) {
+			if (nand_bbt_is_bad(&bbt,
+					    page / geometry->pages_per_block))
+				continue;
+			raw[page * page_bytes + (page * 37) %
+						      geometry->page_size] ^=
+				1 << (page & 7);
+			flips++;
+		}
+		raw[geometry->page_size - 1] ^= 0x03;
+
+		bench_start(&correct);
+		if (nand_ecc_start(&job, &bbt, raw, NAND_ECC_CORRECT))
+			goto out;
+		nand_ecc_wait(&job);
+		bench_stop(&correct, size);
+		raw[geometry->page_size - 1] ^= 0x03;
+		if (job.corrected != flips || job.failed != 1) {
+			bench_fail("%u bits corrected and %u steps failed, "
+				   "expected %zu and 1.\n",
+				   job.corrected, job.failed, flips);
+			goto out;
+		}
+		if (memcmp(raw, copy, size)) {
+			bench_fail("The ECC worker didn't fix the data.\n");
+			goto out;
+		}
+	}
+	printf("NAND ECC, %u+%u byte pages, %zu bytes, %d runs:\n",
+	       geometry->page_size, geometry->spare_size, size, BENCH_RUNS);
+	bench_report(&encode);
+	bench_report(&correct);
+	ret = EXIT_SUCCESS;
+out:
+	free(raw);
+	free(copy);
+	nand_bbt_free(&bbt);
+	return ret;
+}
+
+int main(void)
+{
+	if (test_ecc() || test_bbt(&small_page) || test_bbt(&large_page) ||
+	    test_layout(&small_page) || test_layout(&large_page) ||
+	    test_worker(&large_page))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
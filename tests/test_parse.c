@@ -0,0 +1,153 @@
+/*
+ * test_parse.c - IHEX, SREC and JEDEC decoding timing.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ihex.h"
+#include "jedec.h"
+#include "srec.h"
+#include "bench.h"
+
+#define PARSE_SIZE	  0x100000
+#define PARSE_JEDEC_FUSES 5892 /* ATF16V8 */
+#define PARSE_JEDEC_PINS  20
+
+/* Encode ROM image 'data' with 'srec' or IHEX and time the decoding */
+static int test_hex(const char *name, int srec, uint8_t *data)
+{
+	bench_t bench;
+	size_t len, size;
+	int ret = EXIT_SUCCESS;
+
+	FILE *file = tmpfile();
+	if (!file)
+		return bench_fail("Could not create a temporary file.\n");
+	if (srec ? write_srec_file(file, data, 0, PARSE_SIZE, 1) :
+		   write_hex_file(file, data, 0, PARSE_SIZE, 1)) {
+		fclose(file);
+		return bench_fail("Could not encode the %s file.\n", name);
+	}
+	char *buffer = bench_read_back(file, &len);
+	fclose(file);
+	uint8_t *chip = malloc(PARSE_SIZE);
+	if (!buffer || !chip) {
+		free(buffer);
+		free(chip);
+		return bench_fail("Out of memory!\n");
+	}
+
+	bench_init(&bench, name);
+	for (int i = 0; i < BENCH_RUNS && !ret; i++) {
+		/* Unused space is left blank */
+		memset(chip, 0xff, PARSE_SIZE);
+		size = PARSE_SIZE;
+		bench_start(&bench);
+		if (srec ? read_srec_file((uint8_t *)buffer, chip, &size) :
+			   read_hex_file((uint8_t *)buffer, chip, &size))
+			ret = bench_fail("Could not decode the %s file.\n",
+					 name);
+		bench_stop(&bench, len);
+		if (!ret && memcmp(data, chip, PARSE_SIZE))
+			ret = bench_fail("The %s file doesn't decode to the "
+					 "encoded data.\n",
+					 name);
+	}
+	if (!ret)
+		bench_report(&bench);
+	free(buffer);
+	free(chip);
+	return ret;
+}
+
+/* The parser frees its buffer on errors, so each run gets a copy */
+static int test_jedec(void)
+{
+	jedec_t jedec, parsed;
+	bench_t bench;
+	size_t len;
+	int ret = EXIT_SUCCESS;
+
+	memset(&jedec, 0, sizeof(jedec));
+	jedec.device_name = "ATF16V8B";
+	jedec.QF = PARSE_JEDEC_FUSES;
+	jedec.QP = PARSE_JEDEC_PINS;
+	if (jedec_alloc_fuses(&jedec, 0))
+		return bench_fail("Out of memory!\n");
+	bench_fill(jedec.fuses, PARSE_JEDEC_FUSES / 8, PARSE_JEDEC_FUSES);
+
+	FILE *file = tmpfile();
+	if (!file) {
+		free(jedec.fuses);
+		return bench_fail("Could not create a temporary file.\n");
+	}
+	if (write_jedec_file(file, &jedec)) {
+		fclose(file);
+		free(jedec.fuses);
+		return bench_fail("Could not encode the JEDEC file.\n");
+	}
+	char *buffer = bench_read_back(file, &len);
+	fclose(file);
+	if (!buffer) {
+		free(jedec.fuses);
+		return bench_fail("Out of memory!\n");
+	}
+
+	bench_init(&bench, "JEDEC");
+	for (int i = 0; i < BENCH_RUNS && !ret; i++) {
+		char *copy = malloc(len + 1);
+		if (!copy) {
+			ret = bench_fail("Out of memory!\n");
+			break;
+		}
+		memcpy(copy, buffer, len + 1);
+		memset(&parsed, 0, sizeof(parsed));
+		bench_start(&bench);
+		if (read_jedec_file(copy, len, &parsed)) {
+			ret = bench_fail("Could not decode the JEDEC file.\n");
+			break;
+		}
+		bench_stop(&bench, len);
+		free(copy);
+		if (parsed.QF != jedec.QF || parsed.QP != jedec.QP ||
+		    !parsed.fuses ||
+		    jedec_compare_fuses(&jedec, &parsed, NULL, NULL, NULL))
+			ret = bench_fail("The JEDEC file doesn't decode to the "
+					 "encoded fuses.\n");
+		free(parsed.fuses);
+	}
+	if (!ret)
+		bench_report(&bench);
+	free(buffer);
+	free(jedec.fuses);
+	return ret;
+}
+
+int main(void)
+{
+	uint8_t *data = malloc(PARSE_SIZE);
+	if (!data)
+		return bench_fail("Out of memory!\n");
+	bench_fill(data, PARSE_SIZE, 1);
+
+	printf("File decoding, %d runs:\n", BENCH_RUNS);
+	int ret = test_hex("Intel hex", 0, data) ||
+		  test_hex("Motorola SREC", 1, data) || test_jedec();
+	free(data);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/*
+ * usb_sim.c - Simulated programmer transport for the test programs.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minipro.h"
+#include "usb.h"
+#include "bench.h"
+
+/*
+ * This takes the place of usb_nix.c/usb_win.c in the test programs. It
+ * answers the memory commands the TL866II+, T48 and T56 have in common
+ * from a chip image held in memory, so a session can be recorded without
+ * a programmer and then replayed. Only byte addressed memories without a
+ * data offset are simulated. Block commands outside of a transaction, or
+ * beyond the memory sizes of the begin transaction command, fail.
+ */
+#define SIM_SYSTEM_INFO	    0x00
+#define SIM_BEGIN_TRANS	    0x03
+#define SIM_END_TRANS	    0x04
+#define SIM_WRITE_USER_DATA 0x0A
+#define SIM_READ_USER_DATA  0x0B
+#define SIM_WRITE_CODE	    0x0C
+#define SIM_READ_CODE	    0x0D
+#define SIM_ERASE	    0x0E
+#define SIM_READ_DATA	    0x10
+#define SIM_WRITE_DATA	    0x11
+
+#define SIM_RESPONSE_SIZE   80
+#define SIM_BLANK	    0xff
+#define SIM_PATH	    "1-2"
+
+typedef struct sim_memory {
+	uint8_t *data;
+	size_t size;
+} sim_memory_t;
+
+static struct {
+	uint8_t version;
+	uint8_t opened;
+	uint8_t transaction;
+	sim_memory_t memory[3]; /* MP_CODE, MP_DATA and MP_USER */
+	uint8_t response[SIM_RESPONSE_SIZE];
+
+	/* The block of the last read or write command */
+	sim_memory_t *block;
+	uint32_t address;
+	size_t length;
+	uint8_t reading;
+	uint8_t writing;
+} sim;
+
+void sim_init(uint8_t version)
+{
+	sim_free();
+	sim.version = version;
+}
+
+void sim_free(void)
+{
+	for (size_t i = 0; i < 3; i++)
+		free(sim.memory[i].data);
+	memset(&sim, 0, sizeof(sim));
+}
+
+/* Grow a memory to the size of the chip, new space is blank */
+static int sim_resize(sim_memory_t *memory, size_t size)
+{
+	if (size <= memory->size)
+		return EXIT_SUCCESS;
+	uint8_t *data = realloc(memory->data, size);
+	if (!data) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	memset(data + memory->size, SIM_BLANK, size - memory->size);
+	memory->data = data;
+	memory->size = size;
+	return EXIT_SUCCESS;
+}
+
+static void sim_system_info(void)
+{
+	uint8_t *msg = sim.response;
+	const char *serial = "SIM0000000000000001";
+
+	memset(msg, 0, sizeof(sim.response));
+	msg[1] = 1;
+	msg[4] = 1; /* Firmware 1.1, not the bootloader */
+	msg[5] = 1;
+	msg[6] = sim.version;
+	if (sim.version == MP_TL866IIPLUS) {
+		memcpy(msg + 8, "SIMULATE", 8);
+		memcpy(msg + 16, serial, strlen(serial));
+		msg[40] = 1;
+	} else {
+		memcpy(msg + 8, "2024-01-01", 10);
+		memcpy(msg + 24, "SIMULATE", 8);
+		memcpy(msg + 32, serial, strlen(serial));
+		format_int(msg + 56, 0x27000 * 5, 4, MP_LITTLE_ENDIAN);
+		msg[60] = 1;
+	}
+}
+
+static int sim_begin_transaction(uint8_t *msg, size_t size)
+{
+	if (size < 20) {
+		fprintf(stderr, "Simulator: short begin transaction.\n");
+		return EXIT_FAILURE;
+	}
+	if (sim_resize(&sim.memory[MP_CODE], load_int(msg + 16, 4,
+						      MP_LITTLE_ENDIAN)) ||
+	    sim_resize(&sim.memory[MP_DATA], load_int(msg + 8, 2,
+						      MP_LITTLE_ENDIAN)) ||
+	    sim_resize(&sim.memory[MP_USER], load_int(msg + 14, 2,
+						      MP_LITTLE_ENDIAN)))
+		return EXIT_FAILURE;
+	sim.transaction = 1;
+	return EXIT_SUCCESS;
+}
+
+/* Start a block read or write of 'type' memory */
+static int sim_block(uint8_t *msg, uint8_t type, int write)
+{
+	sim_memory_t *memory = &sim.memory[type];
+	uint32_t address = load_int(msg + 4, 4, MP_LITTLE_ENDIAN);
+	size_t length = load_int(msg + 2, 2, MP_LITTLE_ENDIAN);
+
+	if (!sim.transaction) {
+		fprintf(stderr, "Simulator: block command 0x%02x outside of "
+				"a transaction.\n",
+			msg[0]);
+		return EXIT_FAILURE;
+	}
+	if (address > memory->size || length > memory->size - address) {
+		fprintf(stderr,
+			"Simulator: block of %zu bytes at 0x%04X is beyond "
+			"the memory.\n",
+			length, address);
+		return EXIT_FAILURE;
+	}
+	sim.block = memory;
+	sim.address = address;
+	sim.length = length;
+	sim.reading = !write;
+	sim.writing = write;
+	return EXIT_SUCCESS;
+}
+
+/* Store the data of a pending block write */
+static int sim_write_data(uint8_t *buffer, size_t size)
+{
+	if (!sim.writing) {
+		fprintf(stderr, "Simulator: data without a write command.\n");
+		return EXIT_FAILURE;
+	}
+	memcpy(sim.block->data + sim.address, buffer,
+	       size < sim.length ? size : sim.length);
+	sim.writing = 0;
+	return EXIT_SUCCESS;
+}
+
+/* Hand out the data of a pending block read */
+static int sim_read_data(uint8_t *buffer, size_t size)
+{
+	size_t length = size < sim.length ? size : sim.length;
+	memcpy(buffer, sim.block->data + sim.address, length);
+	memset(buffer + length, 0, size - length);
+	sim.reading = 0;
+	return EXIT_SUCCESS;
+}
+
+void *usb_dev_open(uint8_t verbose)
+{
+	if (!sim.version) {
+		if (verbose)
+			fprintf(stderr, "No programmer found.\n");
+		return NULL;
+	}
+	sim.opened = 1;
+	return &sim;
+}
+
+void *usb_dev_open_index(uint8_t verbose, int index)
+{
+	return index ? NULL : usb_dev_open(verbose);
+}
+
+void *usb_dev_open_path(uint8_t verbose, const char *path)
+{
+	return strcmp(path, SIM_PATH) ? NULL : usb_dev_open(verbose);
+}
+
+int usb_dev_get_index_path(int index, char *path, size_t size)
+{
+	if (index || !sim.version)
+		return EXIT_FAILURE;
+	return usb_dev_get_path(&sim, path, size);
+}
+
+int usb_dev_close(void *usb_handle)
+{
+	sim.opened = 0;
+	sim.transaction = 0;
+	return EXIT_SUCCESS;
+}
+
+int usb_dev_get_devices_count(uint8_t version)
+{
+	return sim.version ? 1 : 0;
+}
+
+int usb_dev_get_location(void *usb_handle, uint32_t *location)
+{
+	*location = 0x0102; /* Bus 1, device address 2 */
+	return EXIT_SUCCESS;
+}
+
+int usb_dev_get_path(void *usb_handle, char *path, size_t size)
+{
+	int len = snprintf(path, size, "%s", SIM_PATH);
+	return len < 0 || len >= size ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int usb_dev_msg_send(void *handle, uint8_t *buffer, size_t size)
+{
+	if (!sim.opened || !size)
+		return EXIT_FAILURE;
+
+	/* The T56 sends the data of a block write over endpoint 1 */
+	if (sim.writing)
+		return sim_write_data(buffer, size);
+
+	memset(sim.response, 0, sizeof(sim.response));
+	switch (buffer[0]) {
+	case SIM_SYSTEM_INFO:
+		sim_system_info();
+		return EXIT_SUCCESS;
+	case SIM_BEGIN_TRANS:
+		return sim_begin_transaction(buffer, size);
+	case SIM_END_TRANS:
+		sim.transaction = 0;
+		return EXIT_SUCCESS;
+	case SIM_READ_CODE:
+		return sim_block(buffer, MP_CODE, 0);
+	case SIM_READ_DATA:
+		return sim_block(buffer, MP_DATA, 0);
+	case SIM_READ_USER_DATA:
+		return sim_block(buffer, MP_USER, 0);
+	case SIM_WRITE_CODE:
+	case SIM_WRITE_DATA:
+	case SIM_WRITE_USER_DATA:
+		if (sim_block(buffer,
+			      buffer[0] == SIM_WRITE_CODE ? MP_CODE :
+			      buffer[0] == SIM_WRITE_DATA ? MP_DATA :
+							    MP_USER,
+			      1))
+			return EXIT_FAILURE;
+		/* Small blocks come with the command */
+		if (size > 8)
+			return sim_write_data(buffer + 8, size - 8);
+		return EXIT_SUCCESS;
+	case SIM_ERASE:
+		for (size_t i = 0; i < 3; i++)
+			if (sim.memory[i].data)
+				memset(sim.memory[i].data, SIM_BLANK,
+				       sim.memory[i].size);
+		return EXIT_SUCCESS;
+	default:
+		/* Status requests and everything else get an all zero
+		 * response: no error and no overcurrent */
+		return EXIT_SUCCESS;
+	}
+}
+
+int usb_dev_msg_recv(void *handle, uint8_t *buffer, size_t size)
+{
+	if (!sim.opened)
+		return EXIT_FAILURE;
+	if (sim.reading)
+		return sim_read_data(buffer, size);
+	memset(buffer, 0, size);
+	memcpy(buffer, sim.response,
+	       size < sizeof(sim.response) ? size : sizeof(sim.response));
+	return EXIT_SUCCESS;
+}
+
+int usb_dev_write_payload(void *handle, uint8_t *buffer, size_t length,
+			  size_t limit)
+{
+	if (!sim.opened)
+		return EXIT_FAILURE;
+	return sim_write_data(buffer, length);
+}
+
+int usb_dev_read_payload(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit)
+{
+	if (!sim.opened || !sim.reading) {
+		fprintf(stderr, "Simulator: payload without a read command.\n");
+		return EXIT_FAILURE;
+	}
+	return sim_read_data(buffer, length);
+}
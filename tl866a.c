@@ -587,6 +587,14 @@ int tl866a_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_SUCCESS;
 }
 
+int tl866a_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			   size_t stride, uint8_t row, uint8_t flags,
+			   size_t size, size_t count)
+{
+	return run_jedec_row_reads(handle, TL866A_READ_CODE, 18, 64, buffer,
+				   stride, row, flags, size, count);
+}
+
 /* Minipro hardware check */
 int tl866a_hardware_check(minipro_handle_t *handle)
 {
@@ -1180,27 +1188,27 @@ static zif_pins_t *get_pwr_pin(int pin, zif_pins_t *table, int count)
 static int pwr_init(minipro_handle_t *handle, uint8_t *vector, size_t pin_count)
 {
 	assert(vector != NULL);
-	static uint8_t pwr[] = { TL866A_POWER_ON,
-				 0x00,
-				 0x00,
-				 0x00,
-				 0x00,
-				 0x00,
-				 0x00,
-				 0x06,
-				 TL866A_OE_VCC_GND,
-				 0x02,
-				 0xff,
-				 0x03,
-				 0xff,
-				 0x04,
-				 0xff,
-				 0x05,
-				 0x00,
-				 0x06,
-				 0x00,
-				 0x07,
-				 0x00 };
+	uint8_t pwr[] = { TL866A_POWER_ON,
+			  0x00,
+			  0x00,
+			  0x00,
+			  0x00,
+			  0x00,
+			  0x00,
+			  0x06,
+			  TL866A_OE_VCC_GND,
+			  0x02,
+			  0xff,
+			  0x03,
+			  0xff,
+			  0x04,
+			  0xff,
+			  0x05,
+			  0x00,
+			  0x06,
+			  0x00,
+			  0x07,
+			  0x00 };
 
 	/* This is a trick to switch on all pull-up resistors
 	 * First switch on VCC
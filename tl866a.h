@@ -90,6 +90,9 @@ int tl866a_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			   uint8_t row, uint8_t flags, size_t size);
 int tl866a_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			  uint8_t row, uint8_t flags, size_t size);
+int tl866a_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+			   size_t stride, uint8_t row, uint8_t flags,
+			   size_t size, size_t count);
 int tl866a_firmware_update(minipro_handle_t *handle, const char *firmware);
 int tl866a_logic_ic_test(minipro_handle_t *handle);
 int tl866a_reset_state(minipro_handle_t *);
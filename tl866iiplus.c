@@ -390,6 +390,15 @@ int tl866iiplus_read_fuses(minipro_handle_t *handle, uint8_t type,
 	return EXIT_SUCCESS;
 }
 
+int tl866iiplus_read_fuse_sections(minipro_handle_t *handle,
+				   fuse_section_t *sections, size_t count)
+{
+	static const uint8_t opcodes[] = { TL866IIPLUS_READ_USER,
+					   TL866IIPLUS_READ_CFG,
+					   TL866IIPLUS_READ_LOCK };
+	return run_fuse_reads(handle, opcodes, sections, count);
+}
+
 int tl866iiplus_write_fuses(minipro_handle_t *handle, uint8_t type,
 			    size_t length, uint8_t items_count, uint8_t *buffer)
 {
@@ -614,6 +623,14 @@ int tl866iiplus_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_SUCCESS;
 }
 
+int tl866iiplus_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+				size_t stride, uint8_t row, uint8_t flags,
+				size_t size, size_t count)
+{
+	return run_jedec_row_reads(handle, TL866IIPLUS_READ_JEDEC, 8, 32,
+				   buffer, stride, row, flags, size, count);
+}
+
 /*****************************************************************************
  * Firmware updater section
  *****************************************************************************
@@ -643,7 +660,7 @@ The structure of each data block is as following:
 /* Performing a firmware update */
 int tl866iiplus_firmware_update(minipro_handle_t *handle, const char *firmware)
 {
-	static uint8_t msg[264];
+	uint8_t msg[264];
 	struct stat st;
 	if (stat(firmware, &st)) {
 		fprintf(stderr, "%s open error!: ", firmware);
@@ -982,11 +999,16 @@ int tl866iiplus_pin_test(minipro_handle_t *handle)
 	db_data_t db_data;
 	memset(&db_data, 0, sizeof(db_data));
 
-	/* Get the chip pin mask for testing */
-	db_data.infoic_path = handle->cmdopts->infoic_path;
-	db_data.logicic_path = handle->cmdopts->logicic_path;
-	db_data.index = handle->device->pin_map;
-	pin_map_t *map = get_pin_map(&db_data);
+	/* Get the chip pin mask for testing, unless it was already
+	 * loaded together with the device */
+	pin_map_t *map = handle->pin_map;
+	handle->pin_map = NULL;
+	if (!map) {
+		db_data.infoic_path = handle->cmdopts->infoic_path;
+		db_data.logicic_path = handle->cmdopts->logicic_path;
+		db_data.index = handle->device->pin_map;
+		map = get_pin_map(&db_data);
+	}
 	if (!map)
 		return EXIT_FAILURE;
 
@@ -1108,53 +1130,7 @@ cleanup:
 /* Pull: 0=Pull-up, 1=Pull-down */
 static uint8_t *do_ic_test(minipro_handle_t *handle, int pull)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t msg[32];
-	uint8_t *result;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
-	result = calloc(pin_count, handle->device->vector_count);
-	if (!result)
-		return NULL;
-
-	uint8_t *out = result;
-	int n;
-	for (n = 0; n < handle->device->vector_count; n++) {
-		memset(msg, 0xff, sizeof(msg));
-
-		msg[0] = TL866IIPLUS_LOGIC_IC_TEST_VECTOR;
-		msg[1] = handle->device->voltages.vcc;
-		msg[1] |= pull << 7; /* Set the pull-up/pull-down */
-		format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
-		format_int(&msg[4], n, 4, MP_LITTLE_ENDIAN);
-
-		int i;
-		/* Pack the vector to 2 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count;
-		     i++) {
-			if (i & 1)
-				msg[8 + i / 2] |= *vector << 4;
-			else
-				msg[8 + i / 2] = *vector;
-			vector++;
-		}
-
-		/* Send the test vector and read the pin status */
-		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-
-		/* Unpack the result from 2 pin/byte to 1 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count; i++)
-			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
-	}
-
-	return result;
+	return run_logic_vectors(handle, TL866IIPLUS_LOGIC_IC_TEST_VECTOR, pull);
 }
 
 /* Performing a logic test. This is accomplished in two steps.
@@ -103,6 +103,8 @@ int tl866iiplus_read_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
 			   uint8_t items_count, uint8_t *buffer);
 int tl866iiplus_write_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
 			    uint8_t items_count, uint8_t *buffer);
+int tl866iiplus_read_fuse_sections(minipro_handle_t *handle,
+				   fuse_section_t *sections, size_t count);
 int tl866iiplus_read_calibration(minipro_handle_t *handle, uint8_t *buffer,
 				 size_t len);
 int tl866iiplus_erase(minipro_handle_t *handle);
@@ -111,6 +113,9 @@ int tl866iiplus_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 				uint8_t row, uint8_t flags, size_t size);
 int tl866iiplus_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			       uint8_t row, uint8_t flags, size_t size);
+int tl866iiplus_read_jedec_rows(minipro_handle_t *handle, uint8_t *buffer,
+				size_t stride, uint8_t row, uint8_t flags,
+				size_t size, size_t count);
 int tl866iiplus_hardware_check(minipro_handle_t *handle);
 int tl866iiplus_firmware_update(minipro_handle_t *handle, const char *firmware);
 int tl866iiplus_pin_test(minipro_handle_t *handle);
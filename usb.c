@@ -0,0 +1,541 @@
+/*
+ * usb.c - USB transport, session recording and replay.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "usb.h"
+
+/*
+ * A session file starts with SESSION_MAGIC and a 4 bytes version, then
+ * holds one record per call of the functions below in the order they were
+ * made. Each record is a RECORD_HEADER_SIZE bytes header followed by
+ * 'length' data bytes, all numbers are little endian:
+ *   type (1), reserved (3), status (4), length (4), duration in us (4),
+ *   time since the session start in us (8)
+ * The data is what was sent for sends, what was received for receives,
+ * the programmer index, USB location or path for the open and query calls.
+ */
+#define SESSION_MAGIC	   "MPUSBREC"
+#define SESSION_VERSION	   1
+#define RECORD_HEADER_SIZE 24
+
+enum session_mode { SESSION_NONE, SESSION_RECORD, SESSION_REPLAY };
+
+enum record_type {
+	REC_OPEN = 1,
+	REC_OPEN_INDEX,
+	REC_CLOSE,
+	REC_DEVICES_COUNT,
+	REC_LOCATION,
+	REC_PATH,
+	REC_MSG_SEND,
+	REC_MSG_RECV,
+	REC_WRITE_PAYLOAD,
+	REC_READ_PAYLOAD,
+	REC_OPEN_PATH,
+	REC_INDEX_PATH,
+	REC_COUNT
+};
+
+static const char *record_names[REC_COUNT] = {
+	"unknown",  "open", "open_index", "close",	  "devices_count",
+	"location", "path", "msg_send",	  "msg_recv",	  "write_payload",
+	"read_payload", "open_path", "index_path"
+};
+
+typedef struct record {
+	uint8_t type;
+	int32_t status;
+	uint32_t length;
+	uint32_t duration;
+	uint64_t time;
+	uint8_t *data;
+} record_t;
+
+static struct {
+	uint8_t mode;
+	FILE *file;
+	char *name;
+	long latency;
+	uint64_t base;
+	size_t index;  /* Number of the current record */
+	int failed;    /* Replay went out of step or recording failed */
+	uint8_t *data; /* Data of the replayed record */
+	size_t size;
+} session;
+
+static void put_le(uint8_t *p, uint64_t value, size_t n)
+{
+	for (size_t i = 0; i < n; i++, value >>= 8)
+		p[i] = value & 0xff;
+}
+
+static uint64_t get_le(const uint8_t *p, size_t n)
+{
+	uint64_t value = 0;
+	while (n--)
+		value = (value << 8) | p[n];
+	return value;
+}
+
+static void record_call(uint8_t type, int status, const void *data,
+			size_t length, uint64_t start)
+{
+	uint8_t header[RECORD_HEADER_SIZE];
+	uint64_t now = stats_now();
+
+	memset(header, 0, sizeof(header));
+	header[0] = type;
+	put_le(header + 4, (uint32_t)status, 4);
+	put_le(header + 8, length, 4);
+	put_le(header + 12, (now - start) / 1000, 4);
+	put_le(header + 16, (start - session.base) / 1000, 8);
+	if (fwrite(header, 1, sizeof(header), session.file) != sizeof(header) ||
+	    (length && fwrite(data, 1, length, session.file) != length))
+		session.failed = 1;
+	session.index++;
+}
+
+/* Get the next replayed record, which must be a 'type' one */
+static int replay_call(uint8_t type, record_t *record)
+{
+	uint8_t header[RECORD_HEADER_SIZE];
+
+	if (session.failed)
+		return EXIT_FAILURE;
+	if (fread(header, 1, sizeof(header), session.file) != sizeof(header)) {
+		fprintf(stderr,
+			"Replay: the session ended before %s at record %zu.\n",
+			record_names[type], session.index);
+		session.failed = 1;
+		return EXIT_FAILURE;
+	}
+	record->type = header[0];
+	record->status = (int32_t)get_le(header + 4, 4);
+	record->length = get_le(header + 8, 4);
+	record->duration = get_le(header + 12, 4);
+	record->time = get_le(header + 16, 8);
+	if (record->type != type) {
+		fprintf(stderr,
+			"Replay: expected %s but the session has %s at record "
+			"%zu.\n",
+			record_names[type],
+			record_names[record->type < REC_COUNT ? record->type :
+								0],
+			session.index);
+		session.failed = 1;
+		return EXIT_FAILURE;
+	}
+
+	if (record->length > session.size) {
+		uint8_t *data = realloc(session.data, record->length);
+		if (!data) {
+			fprintf(stderr, "Out of memory!\n");
+			session.failed = 1;
+			return EXIT_FAILURE;
+		}
+		session.data = data;
+		session.size = record->length;
+	}
+	if (fread(session.data, 1, record->length, session.file) !=
+	    record->length) {
+		fprintf(stderr, "Replay: session file %s is truncated.\n",
+			session.name);
+		session.failed = 1;
+		return EXIT_FAILURE;
+	}
+	record->data = session.data;
+	session.index++;
+
+	/* Simulated transfer time */
+	if (session.latency == USB_LATENCY_RECORDED)
+		usleep(record->duration);
+	else if (session.latency > 0)
+		usleep(session.latency);
+	return EXIT_SUCCESS;
+}
+
+/* Replayed data must have the size asked for */
+static int replay_data(uint8_t type, record_t *record, size_t size)
+{
+	if (replay_call(type, record))
+		return EXIT_FAILURE;
+	if (record->length != size) {
+		fprintf(stderr,
+			"Replay: %s of %zu bytes but the session has %u bytes "
+			"at record %zu.\n",
+			record_names[type], size, record->length,
+			session.index - 1);
+		session.failed = 1;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static void *replay_open(uint8_t type, int index, const char *path,
+			 uint8_t verbose)
+{
+	record_t record;
+	if (replay_call(type, &record))
+		return NULL;
+	if ((type == REC_OPEN_INDEX &&
+	     (record.length != 4 || (int)get_le(record.data, 4) != index)) ||
+	    (type == REC_OPEN_PATH &&
+	     (record.length != strlen(path) ||
+	      memcmp(record.data, path, record.length)))) {
+		fprintf(stderr,
+			"Replay: another programmer opened than the one of "
+			"the session at record %zu.\n",
+			session.index - 1);
+		session.failed = 1;
+		return NULL;
+	}
+	if (record.status) {
+		if (verbose && type == REC_OPEN)
+			fprintf(stderr, "No programmer found.\n");
+		return NULL;
+	}
+	/* Any non NULL handle will do */
+	return &session;
+}
+
+static int open_session(const char *file, const char *mode)
+{
+	if (session.mode != SESSION_NONE)
+		usb_session_end();
+	memset(&session, 0, sizeof(session));
+	session.name = strdup(file);
+	if (!session.name) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	session.file = fopen(file, mode);
+	if (!session.file) {
+		fprintf(stderr, "Could not open file %s for %s.\n", file,
+			*mode == 'w' ? "writing" : "reading");
+		perror("");
+		free(session.name);
+		return EXIT_FAILURE;
+	}
+	session.base = stats_now();
+	return EXIT_SUCCESS;
+}
+
+int usb_record(const char *file)
+{
+	uint8_t header[12];
+
+	if (open_session(file, "wb"))
+		return EXIT_FAILURE;
+	memcpy(header, SESSION_MAGIC, 8);
+	put_le(header + 8, SESSION_VERSION, 4);
+	if (fwrite(header, 1, sizeof(header), session.file) != sizeof(header))
+		session.failed = 1;
+	session.mode = SESSION_RECORD;
+	return EXIT_SUCCESS;
+}
+
+int usb_replay(const char *file, long latency)
+{
+	uint8_t header[12];
+
+	if (open_session(file, "rb"))
+		return EXIT_FAILURE;
+	if (fread(header, 1, sizeof(header), session.file) != sizeof(header) ||
+	    memcmp(header, SESSION_MAGIC, 8) ||
+	    get_le(header + 8, 4) != SESSION_VERSION) {
+		fprintf(stderr, "%s is not a minipro session file.\n", file);
+		fclose(session.file);
+		free(session.name);
+		return EXIT_FAILURE;
+	}
+	session.latency = latency;
+	session.mode = SESSION_REPLAY;
+	return EXIT_SUCCESS;
+}
+
+/* Close the session file. Returns EXIT_FAILURE if the recording could not
+ * be written or the replay went out of step. */
+int usb_session_end(void)
+{
+	int ret = session.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	switch (session.mode) {
+	case SESSION_RECORD:
+		if (ferror(session.file) | fclose(session.file) ||
+		    session.failed) {
+			fprintf(stderr, "Error writing file %s.\n",
+				session.name);
+			ret = EXIT_FAILURE;
+		}
+		break;
+	case SESSION_REPLAY:
+		if (!session.failed && fgetc(session.file) != EOF)
+			fprintf(stderr,
+				"Warning: the session continues after record "
+				"%zu.\n",
+				session.index);
+		fclose(session.file);
+		break;
+	default:
+		return EXIT_SUCCESS;
+	}
+	free(session.name);
+	free(session.data);
+	memset(&session, 0, sizeof(session));
+	return ret;
+}
+
+/* Timing dependent code must behave the same way in a recorded and in a
+ * replayed session */
+int usb_session_active(void)
+{
+	return session.mode != SESSION_NONE;
+}
+
+void *usb_open(uint8_t verbose)
+{
+	uint64_t start = stats_now();
+	if (session.mode == SESSION_REPLAY)
+		return replay_open(REC_OPEN, -1, NULL, verbose);
+	void *handle = usb_dev_open(verbose);
+	if (session.mode == SESSION_RECORD)
+		record_call(REC_OPEN, !handle, NULL, 0, start);
+	return handle;
+}
+
+void *usb_open_index(uint8_t verbose, int index)
+{
+	uint64_t start = stats_now();
+	uint8_t data[4];
+	if (session.mode == SESSION_REPLAY)
+		return replay_open(REC_OPEN_INDEX, index, NULL, verbose);
+	void *handle = usb_dev_open_index(verbose, index);
+	if (session.mode == SESSION_RECORD) {
+		put_le(data, (uint32_t)index, 4);
+		record_call(REC_OPEN_INDEX, !handle, data, 4, start);
+	}
+	return handle;
+}
+
+void *usb_open_path(uint8_t verbose, const char *path)
+{
+	uint64_t start = stats_now();
+	if (session.mode == SESSION_REPLAY)
+		return replay_open(REC_OPEN_PATH, -1, path, verbose);
+	void *handle = usb_dev_open_path(verbose, path);
+	if (session.mode == SESSION_RECORD)
+		record_call(REC_OPEN_PATH, !handle, path, strlen(path), start);
+	return handle;
+}
+
+/* The record holds the index followed by the path */
+int usb_get_index_path(int index, char *path, size_t size)
+{
+	uint64_t start = stats_now();
+	uint8_t data[4 + 64];
+	record_t record;
+	if (session.mode == SESSION_REPLAY) {
+		if (replay_call(REC_INDEX_PATH, &record))
+			return EXIT_FAILURE;
+		if (record.length < 4 || (int)get_le(record.data, 4) != index) {
+			fprintf(stderr,
+				"Replay: programmer %d listed but the session "
+				"has another one at record %zu.\n",
+				index, session.index - 1);
+			session.failed = 1;
+			return EXIT_FAILURE;
+		}
+		if (record.status)
+			return record.status;
+		int len = snprintf(path, size, "%.*s", (int)record.length - 4,
+				   (char *)record.data + 4);
+		return len < 0 || len >= size ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	int ret = usb_dev_get_index_path(index, path, size);
+	if (session.mode == SESSION_RECORD) {
+		size_t len = ret ? 0 : strlen(path);
+		if (len > sizeof(data) - 4)
+			len = sizeof(data) - 4;
+		put_le(data, (uint32_t)index, 4);
+		memcpy(data + 4, path, len);
+		record_call(REC_INDEX_PATH, ret, data, 4 + len, start);
+	}
+	return ret;
+}
+
+int usb_close(void *usb_handle)
+{
+	uint64_t start = stats_now();
+	record_t record;
+	if (session.mode == SESSION_REPLAY)
+		return replay_call(REC_CLOSE, &record) ? EXIT_FAILURE :
+							 record.status;
+	int ret = usb_dev_close(usb_handle);
+	if (session.mode == SESSION_RECORD)
+		record_call(REC_CLOSE, ret, NULL, 0, start);
+	return ret;
+}
+
+int minipro_get_devices_count(uint8_t version)
+{
+	uint64_t start = stats_now();
+	record_t record;
+	if (session.mode == SESSION_REPLAY)
+		return replay_call(REC_DEVICES_COUNT, &record) ? 0 :
+								  record.status;
+	int count = usb_dev_get_devices_count(version);
+	if (session.mode == SESSION_RECORD)
+		record_call(REC_DEVICES_COUNT, count, &version, 1, start);
+	return count;
+}
+
+int usb_get_location(void *usb_handle, uint32_t *location)
+{
+	uint64_t start = stats_now();
+	uint8_t data[4];
+	record_t record;
+	if (session.mode == SESSION_REPLAY) {
+		if (replay_data(REC_LOCATION, &record, 4))
+			return EXIT_FAILURE;
+		*location = get_le(record.data, 4);
+		return record.status;
+	}
+	int ret = usb_dev_get_location(usb_handle, location);
+	if (session.mode == SESSION_RECORD) {
+		put_le(data, ret ? 0 : *location, 4);
+		record_call(REC_LOCATION, ret, data, 4, start);
+	}
+	return ret;
+}
+
+int usb_get_path(void *usb_handle, char *path, size_t size)
+{
+	uint64_t start = stats_now();
+	record_t record;
+	if (session.mode == SESSION_REPLAY) {
+		if (replay_call(REC_PATH, &record))
+			return EXIT_FAILURE;
+		if (record.status)
+			return record.status;
+		int len = snprintf(path, size, "%.*s", (int)record.length,
+				   (char *)record.data);
+		return len < 0 || len >= size ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	int ret = usb_dev_get_path(usb_handle, path, size);
+	if (session.mode == SESSION_RECORD)
+		record_call(REC_PATH, ret, path, ret ? 0 : strlen(path), start);
+	return ret;
+}
+
+/* Transfers, timed for the --stats/--trace report. A replayed send must
+ * have the recorded length and command byte. */
+int msg_send(void *handle, uint8_t *buffer, size_t size)
+{
+	uint64_t start = stats_start();
+	record_t record;
+	int ret;
+	if (session.mode == SESSION_REPLAY) {
+		ret = replay_data(REC_MSG_SEND, &record, size) ? EXIT_FAILURE :
+								 record.status;
+		if (!ret && size && record.data[0] != buffer[0]) {
+			fprintf(stderr,
+				"Replay: command 0x%02x sent but the session "
+				"has 0x%02x at record %zu.\n",
+				buffer[0], record.data[0], session.index - 1);
+			session.failed = 1;
+			ret = EXIT_FAILURE;
+		}
+	} else {
+		if (session.mode == SESSION_RECORD)
+			start = stats_now();
+		ret = usb_dev_msg_send(handle, buffer, size);
+		if (session.mode == SESSION_RECORD)
+			record_call(REC_MSG_SEND, ret, buffer, size, start);
+	}
+	stats_record(STATS_USB, "msg_send", size, start);
+	return ret;
+}
+
+int msg_recv(void *handle, uint8_t *buffer, size_t size)
+{
+	uint64_t start = stats_start();
+	record_t record;
+	int ret;
+	if (session.mode == SESSION_REPLAY) {
+		ret = replay_data(REC_MSG_RECV, &record, size) ? EXIT_FAILURE :
+								 record.status;
+		if (!ret)
+			memcpy(buffer, record.data, size);
+	} else {
+		if (session.mode == SESSION_RECORD)
+			start = stats_now();
+		ret = usb_dev_msg_recv(handle, buffer, size);
+		if (session.mode == SESSION_RECORD)
+			record_call(REC_MSG_RECV, ret, buffer, size, start);
+	}
+	stats_record(STATS_USB, "msg_recv", size, start);
+	return ret;
+}
+
+int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+{
+	uint64_t start = stats_start();
+	record_t record;
+	int ret;
+	if (session.mode == SESSION_REPLAY) {
+		ret = replay_data(REC_WRITE_PAYLOAD, &record, length) ?
+			      EXIT_FAILURE :
+			      record.status;
+	} else {
+		if (session.mode == SESSION_RECORD)
+			start = stats_now();
+		ret = usb_dev_write_payload(handle, buffer, length, limit);
+		if (session.mode == SESSION_RECORD)
+			record_call(REC_WRITE_PAYLOAD, ret, buffer, length,
+				    start);
+	}
+	stats_record(STATS_USB, "write_payload", length, start);
+	return ret;
+}
+
+int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+{
+	uint64_t start = stats_start();
+	record_t record;
+	int ret;
+	if (session.mode == SESSION_REPLAY) {
+		ret = replay_data(REC_READ_PAYLOAD, &record, length) ?
+			      EXIT_FAILURE :
+			      record.status;
+		if (!ret)
+			memcpy(buffer, record.data, length);
+	} else {
+		if (session.mode == SESSION_RECORD)
+			start = stats_now();
+		ret = usb_dev_read_payload(handle, buffer, length, limit);
+		if (session.mode == SESSION_RECORD)
+			record_call(REC_READ_PAYLOAD, ret, buffer, length,
+				    start);
+	}
+	stats_record(STATS_USB, "read_payload", length, start);
+	return ret;
+}
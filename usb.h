@@ -18,11 +18,17 @@
 #ifndef USB_H_
 #define USB_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 void *usb_open(uint8_t verbose);
+void *usb_open_index(uint8_t verbose, int index);
+void *usb_open_path(uint8_t verbose, const char *path);
+int usb_get_index_path(int index, char *path, size_t size);
 int usb_close(void *usb_handle);
 int minipro_get_devices_count(uint8_t version);
+int usb_get_location(void *usb_handle, uint32_t *location);
+int usb_get_path(void *usb_handle, char *path, size_t size);
 
 int msg_send(void *handle, uint8_t *buffer, size_t size);
 int msg_recv(void *handle, uint8_t *buffer, size_t size);
@@ -36,4 +42,31 @@ static inline int read_payload(void *handle, uint8_t *buffer, size_t length)
 {
 	return read_payload2(handle, buffer, length, 64);
 }
+
+/* Record the USB traffic of the session to 'file', or replay a recorded
+ * session instead of talking to a programmer. 'latency' is added to every
+ * replayed transfer in microseconds, USB_LATENCY_RECORDED waits as long as
+ * the recorded transfer took.
+ */
+#define USB_LATENCY_RECORDED -1
+int usb_record(const char *file);
+int usb_replay(const char *file, long latency);
+int usb_session_end(void);
+int usb_session_active(void);
+
+/* Platform transport, implemented by usb_nix.c and usb_win.c */
+void *usb_dev_open(uint8_t verbose);
+void *usb_dev_open_index(uint8_t verbose, int index);
+void *usb_dev_open_path(uint8_t verbose, const char *path);
+int usb_dev_get_index_path(int index, char *path, size_t size);
+int usb_dev_close(void *usb_handle);
+int usb_dev_get_devices_count(uint8_t version);
+int usb_dev_get_location(void *usb_handle, uint32_t *location);
+int usb_dev_get_path(void *usb_handle, char *path, size_t size);
+int usb_dev_msg_send(void *handle, uint8_t *buffer, size_t size);
+int usb_dev_msg_recv(void *handle, uint8_t *buffer, size_t size);
+int usb_dev_write_payload(void *handle, uint8_t *buffer, size_t length,
+			  size_t limit);
+int usb_dev_read_payload(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit);
 #endif
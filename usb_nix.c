@@ -32,63 +32,278 @@
 #define MP_USBTIMEOUT	    5000
 #define MP_USB_READ_TIMEOUT 360000
 
+/* Endpoint 2/3 transfer pool */
+#define MP_URB_COUNT	    8	 /* Transfers queued per endpoint */
+#define MP_URB_SIZE	    4096 /* Size of each transfer */
+#define MP_PACKET_SIZE	    64
+
+#define MIN(a, b)	    (((a) < (b)) ? (a) : (b))
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HAVE_DEV_MEM
+#endif
+
+struct usb_handle;
+
+/* One persistent transfer of the endpoint 2/3 pool */
+typedef struct urb_slot {
+	struct usb_handle *handle;
+	struct libusb_transfer *urb;
+	uint8_t *buffer; /* Bounce buffer used for reads */
+	size_t offset;	 /* Offset of this chunk in the endpoint stream */
+	int busy;
+	int completed;
+} urb_slot_t;
+
+/* Endpoint stream of a payload transfer */
+typedef struct ep_stream {
+	uint8_t *buffer; /* Source buffer for writes, unused for reads */
+	size_t length;
+	size_t submitted;
+	int done;
+} ep_stream_t;
+
+/* Opaque structure used externally as handle */
+typedef struct usb_handle {
+	libusb_context *ctx;
+	libusb_device_handle *dev;
+	uint8_t dev_mem; /* Bounce buffers are libusb_dev_mem_alloc'ed */
+	int event;
+	urb_slot_t urbs[2][MP_URB_COUNT]; /* Endpoint 2 and 3 */
+} usb_handle_t;
+
+/* Internaly used functions prototypes */
+static int alloc_urbs(usb_handle_t *handle);
+static void free_urbs(usb_handle_t *handle);
+
+/* Claim the interface and set up the transfer pool of an opened device */
+static void *usb_setup(usb_handle_t *handle, uint8_t verbose)
+{
+	int ret = libusb_claim_interface(handle->dev, 0);
+	if (ret != 0) {
+		if (verbose)
+			fprintf(stderr, "\nIO error: claim_interface: %s\n",
+				libusb_error_name(ret));
+		libusb_close(handle->dev);
+		libusb_exit(handle->ctx);
+		free(handle);
+		return NULL;
+	}
+
+	if (alloc_urbs(handle)) {
+		if (verbose)
+			fprintf(stderr, "Out of memory!\n");
+		usb_dev_close(handle);
+		return NULL;
+	}
+	return handle;
+}
+
 /* Open usb device */
-void *usb_open(uint8_t verbose)
+void *usb_dev_open(uint8_t verbose)
 {
-	int ret = libusb_init(NULL);
+	/* Alocate memory for the usb handle structure */
+	usb_handle_t *handle = calloc(1, sizeof(usb_handle_t));
+	if (!handle) {
+		if (verbose)
+			fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+
+	int ret = libusb_init(&handle->ctx);
 	if (ret < 0) {
 		if (verbose)
 			fprintf(stderr, "Error initializing libusb: %s\n",
 				libusb_error_name(ret));
+		free(handle);
 		return NULL;
 	}
 
-	void *usb_handle = libusb_open_device_with_vid_pid(NULL, MP_TL866_VID,
-							   MP_TL866_PID);
-	if (usb_handle == NULL) {
+	handle->dev = libusb_open_device_with_vid_pid(handle->ctx, MP_TL866_VID,
+						      MP_TL866_PID);
+	if (handle->dev == NULL) {
 		/* We didn't match the vid / pid of the "original" TL866.
 		 * So try the new TL866II+ */
-		usb_handle = libusb_open_device_with_vid_pid(
-			NULL, MP_TL866II_VID, MP_TL866II_PID);
+		handle->dev = libusb_open_device_with_vid_pid(
+			handle->ctx, MP_TL866II_VID, MP_TL866II_PID);
 
 		/* If we don't get that either report error in connecting */
-		if (usb_handle == NULL) {
-			libusb_exit(NULL);
+		if (handle->dev == NULL) {
+			libusb_exit(handle->ctx);
+			free(handle);
 			if (verbose)
 				fprintf(stderr, "No programmer found.\n");
 			return NULL;
 		}
 	}
+	return usb_setup(handle, verbose);
+}
 
-	ret = libusb_claim_interface(usb_handle, 0);
-	if (ret != 0) {
+static int is_programmer(libusb_device *device)
+{
+	struct libusb_device_descriptor desc;
+	if (libusb_get_device_descriptor(device, &desc) < 0)
+		return 0;
+	return (desc.idVendor == MP_TL866_VID &&
+		desc.idProduct == MP_TL866_PID) ||
+	       (desc.idVendor == MP_TL866II_VID &&
+		desc.idProduct == MP_TL866II_PID);
+}
+
+/* Format the USB port path of 'device' as "bus-port.port..." */
+static int get_port_path(libusb_device *device, char *path, size_t size)
+{
+	uint8_t ports[8];
+	int count = libusb_get_port_numbers(device, ports, sizeof(ports));
+	if (count < 0)
+		return EXIT_FAILURE;
+	int len = snprintf(path, size, "%u", libusb_get_bus_number(device));
+	for (int i = 0; i < count && len > 0 && len < size; i++)
+		len += snprintf(path + len, size - len, "%c%u", i ? '.' : '-',
+				ports[i]);
+	return (len < 0 || len >= size) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Open the programmer number 'index' in the bus enumeration order, or the
+ * one at the USB port 'path' if set. Each opened device gets its own
+ * libusb context.
+ */
+static void *open_programmer(uint8_t verbose, int index, const char *path)
+{
+	libusb_device **devs;
+	char port[64];
+	usb_handle_t *handle = calloc(1, sizeof(usb_handle_t));
+	if (!handle) {
 		if (verbose)
-			fprintf(stderr, "\nIO error: claim_interface: %s\n",
+			fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+
+	int ret = libusb_init(&handle->ctx);
+	if (ret < 0) {
+		if (verbose)
+			fprintf(stderr, "Error initializing libusb: %s\n",
 				libusb_error_name(ret));
-		libusb_close(usb_handle);
-		libusb_exit(NULL);
+		free(handle);
+		return NULL;
+	}
+
+	ssize_t count = libusb_get_device_list(handle->ctx, &devs);
+	for (ssize_t i = 0; i < count; i++) {
+		if (!is_programmer(devs[i]))
+			continue;
+		if (path ? get_port_path(devs[i], port, sizeof(port)) ||
+				   strcmp(port, path) :
+			   index--)
+			continue;
+		ret = libusb_open(devs[i], &handle->dev);
+		if (ret && verbose)
+			fprintf(stderr, "\nIO error: open: %s\n",
+				libusb_error_name(ret));
+		break;
+	}
+	if (count >= 0)
+		libusb_free_device_list(devs, 1);
+	if (!handle->dev) {
+		libusb_exit(handle->ctx);
+		free(handle);
 		return NULL;
 	}
-	return usb_handle;
+	return usb_setup(handle, verbose);
+}
+
+/* Open the programmer number 'index'. Returns NULL if there are no more
+ * programmers or it can't be opened, e.g. because another process has
+ * claimed it.
+ */
+void *usb_dev_open_index(uint8_t verbose, int index)
+{
+	return open_programmer(verbose, index, NULL);
+}
+
+/* Open the programmer at the USB port 'path' */
+void *usb_dev_open_path(uint8_t verbose, const char *path)
+{
+	return open_programmer(verbose, 0, path);
+}
+
+/* Get the USB port path of the programmer number 'index' without opening
+ * it, so a programmer in use by another process is left alone. The path
+ * is empty if it is not available. Returns EXIT_FAILURE if there are no
+ * more programmers.
+ */
+int usb_dev_get_index_path(int index, char *path, size_t size)
+{
+	libusb_context *ctx;
+	libusb_device **devs;
+	int ret = EXIT_FAILURE;
+
+	if (libusb_init(&ctx) < 0)
+		return EXIT_FAILURE;
+	ssize_t count = libusb_get_device_list(ctx, &devs);
+	for (ssize_t i = 0; i < count; i++) {
+		if (!is_programmer(devs[i]) || index--)
+			continue;
+		if (get_port_path(devs[i], path, size))
+			path[0] = '\0';
+		ret = EXIT_SUCCESS;
+		break;
+	}
+	if (count >= 0)
+		libusb_free_device_list(devs, 1);
+	libusb_exit(ctx);
+	return ret;
 }
 
 /* Close usb device */
-int usb_close(void *usb_handle)
+int usb_dev_close(void *usb_handle)
 {
+	usb_handle_t *handle = usb_handle;
 	int ret = EXIT_SUCCESS;
-	ret = libusb_release_interface(usb_handle, 0);
+
+	free_urbs(handle);
+	ret = libusb_release_interface(handle->dev, 0);
 	if (ret != 0 && ret != LIBUSB_ERROR_NO_DEVICE) {
 		fprintf(stderr, "\nIO error: release_interface: %s\n",
 			libusb_error_name(ret));
 		ret = EXIT_FAILURE;
 	}
-	libusb_close(usb_handle);
-	libusb_exit(NULL);
+	libusb_close(handle->dev);
+	libusb_exit(handle->ctx);
+	free(handle);
 	return ret;
 }
 
+/* Get the bus number and device address of the opened device. The address
+ * changes whenever the device is enumerated again after a reset or a power
+ * cycle.
+ */
+int usb_dev_get_location(void *usb_handle, uint32_t *location)
+{
+	usb_handle_t *handle = usb_handle;
+	libusb_device *device = libusb_get_device(handle->dev);
+	if (!device)
+		return EXIT_FAILURE;
+	*location = ((uint32_t)libusb_get_bus_number(device) << 8) |
+		    libusb_get_device_address(device);
+	return EXIT_SUCCESS;
+}
+
+/* Get the USB port path of the opened device as "bus-port.port...". Unlike
+ * the device address it stays the same when the device is reconnected to
+ * the same port.
+ */
+int usb_dev_get_path(void *usb_handle, char *path, size_t size)
+{
+	usb_handle_t *handle = usb_handle;
+	libusb_device *device = libusb_get_device(handle->dev);
+	if (!device)
+		return EXIT_FAILURE;
+	return get_port_path(device, path, size);
+}
+
 /* Get no. of devices connected */
-int minipro_get_devices_count(uint8_t version)
+int usb_dev_get_devices_count(uint8_t version)
 {
 	libusb_device **devs;
 	int i, devices = 0;
@@ -135,20 +350,113 @@ int minipro_get_devices_count(uint8_t version)
 	return devices;
 }
 
-static void payload_transfer_cb(struct libusb_transfer *transfer)
+/*
+ * Allocate the endpoint 2/3 transfer pool. It lives for the whole usb
+ * session so payload transfers don't allocate anything.
+ * Read bounce buffers are allocated as DMA capable memory if the platform
+ * supports it, otherwise plain heap memory is used.
+ */
+static int alloc_urbs(usb_handle_t *handle)
 {
-	int *completed = transfer->user_data;
-	if (completed != NULL) {
-		*completed = 1;
+	int i, j;
+
+#ifdef HAVE_DEV_MEM
+	handle->dev_mem = 1;
+	for (i = 0; i < 2 && handle->dev_mem; i++) {
+		for (j = 0; j < MP_URB_COUNT; j++) {
+			handle->urbs[i][j].buffer =
+				libusb_dev_mem_alloc(handle->dev, MP_URB_SIZE);
+			if (!handle->urbs[i][j].buffer) {
+				/* Not supported; release what we got */
+				free_urbs(handle);
+				handle->dev_mem = 0;
+				break;
+			}
+		}
+	}
+#endif
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < MP_URB_COUNT; j++) {
+			urb_slot_t *slot = &handle->urbs[i][j];
+			slot->handle = handle;
+			if (!slot->buffer)
+				slot->buffer = malloc(MP_URB_SIZE);
+			if (!slot->urb)
+				slot->urb = libusb_alloc_transfer(0);
+			if (!slot->buffer || !slot->urb)
+				return EXIT_FAILURE;
+		}
 	}
+	return EXIT_SUCCESS;
+}
+
+/* Release the endpoint 2/3 transfer pool */
+static void free_urbs(usb_handle_t *handle)
+{
+	int i, j;
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < MP_URB_COUNT; j++) {
+			urb_slot_t *slot = &handle->urbs[i][j];
+			if (slot->urb)
+				libusb_free_transfer(slot->urb);
+#ifdef HAVE_DEV_MEM
+			if (slot->buffer && handle->dev_mem)
+				libusb_dev_mem_free(handle->dev, slot->buffer,
+						    MP_URB_SIZE);
+			else
+#endif
+				free(slot->buffer);
+			slot->urb = NULL;
+			slot->buffer = NULL;
+		}
+	}
+}
+
+/* Cancel all queued transfers of an endpoint (0 = EP2, 1 = EP3) */
+static void cancel_urbs(usb_handle_t *handle, int ep)
+{
+	for (int i = 0; i < MP_URB_COUNT; i++) {
+		if (handle->urbs[ep][i].busy && !handle->urbs[ep][i].completed)
+			libusb_cancel_transfer(handle->urbs[ep][i].urb);
+	}
+}
+
+/*
+ * Copy a chunk of an endpoint stream to its place in the payload.
+ * Even 64 byte blocks are read over the endpoint 2 and odd blocks
+ * over the endpoint 3.
+ */
+static void deinterlace(uint8_t *buffer, size_t length, uint8_t *chunk,
+			size_t offset, size_t size, int ep)
+{
+	while (size) {
+		size_t pos = offset % MP_PACKET_SIZE;
+		size_t count = MIN(size, MP_PACKET_SIZE - pos);
+		size_t dst = (2 * (offset / MP_PACKET_SIZE) + ep) *
+				     MP_PACKET_SIZE + pos;
+		if (dst < length)
+			memcpy(buffer + dst, chunk, MIN(count, length - dst));
+		chunk += count;
+		offset += count;
+		size -= count;
+	}
+}
+
+static void payload_transfer_cb(struct libusb_transfer *transfer)
+{
+	urb_slot_t *slot = transfer->user_data;
+	slot->completed = 1;
+	slot->handle->event = 1;
 }
 
 static int msg_transfer(void *handle, uint8_t *buffer, size_t size,
 			uint8_t direction, uint8_t endpoint,
 			int *bytes_transferred, uint32_t timeout)
 {
-	int ret = libusb_bulk_transfer(handle, (endpoint | direction), buffer,
-				       size, bytes_transferred, timeout);
+	int ret = libusb_bulk_transfer(((usb_handle_t *)handle)->dev,
+				       (endpoint | direction), buffer, size,
+				       bytes_transferred, timeout);
 
 	if (ret != LIBUSB_SUCCESS)
 		fprintf(stderr, "\nIO error: bulk_transfer: %s\n",
@@ -156,79 +464,117 @@ static int msg_transfer(void *handle, uint8_t *buffer, size_t size,
 	return ret;
 }
 
-static int payload_transfer(void *handle, uint8_t direction,
-			    uint8_t *ep2_buffer, size_t ep2_length,
-			    uint8_t *ep3_buffer, size_t ep3_length)
+/*
+ * Transfer payload asynchronously over the endpoints 2 and 3.
+ * Each endpoint stream is split in MP_URB_SIZE chunks and up to
+ * MP_URB_COUNT chunks per endpoint are kept queued.
+ * Writes are sent straight from the stream buffers. Reads land in the
+ * bounce buffers and are deinterlaced into 'buffer' as they complete.
+ */
+static int payload_transfer(usb_handle_t *handle, uint8_t direction,
+			    ep_stream_t *streams, uint8_t *buffer,
+			    size_t length)
 {
-	struct libusb_transfer *ep2_urb;
-	struct libusb_transfer *ep3_urb;
-	int ret;
-	int ep2_completed = 0;
-	int ep3_completed = 0;
-
-	ep2_urb = libusb_alloc_transfer(0);
-	ep3_urb = libusb_alloc_transfer(0);
-	if (!ep2_urb || !ep3_urb) {
-		fprintf(stderr, "Out of memory!\n");
-		return EXIT_FAILURE;
-	}
-
-	libusb_fill_bulk_transfer(ep2_urb, handle, (0x02 | direction),
-				  ep2_buffer, ep2_length, payload_transfer_cb,
-				  &ep2_completed, MP_USBTIMEOUT);
-	libusb_fill_bulk_transfer(ep3_urb, handle, (0x03 | direction),
-				  ep3_buffer, ep3_length, payload_transfer_cb,
-				  &ep3_completed, MP_USBTIMEOUT);
+	int ep, i, ret;
+	int active = 0;
+	int error = 0;
+
+	for (;;) {
+		/* Keep the endpoint queues filled */
+		for (ep = 0; ep < 2 && !error; ep++) {
+			ep_stream_t *stream = &streams[ep];
+			for (i = 0; i < MP_URB_COUNT && !error; i++) {
+				urb_slot_t *slot = &handle->urbs[ep][i];
+				if (stream->done ||
+				    stream->submitted >= stream->length)
+					break;
+				if (slot->busy)
+					continue;
+
+				size_t size = MIN(stream->length -
+							  stream->submitted,
+						  MP_URB_SIZE);
+				uint8_t *data = (direction == LIBUSB_ENDPOINT_IN) ?
+							slot->buffer :
+							stream->buffer +
+								stream->submitted;
+				libusb_fill_bulk_transfer(
+					slot->urb, handle->dev,
+					((0x02 + ep) | direction), data, size,
+					payload_transfer_cb, slot,
+					MP_USBTIMEOUT);
+				slot->offset = stream->submitted;
+				slot->completed = 0;
+				ret = libusb_submit_transfer(slot->urb);
+				if (ret < 0) {
+					fprintf(stderr,
+						"\nIO error: submit_transfer: %s\n",
+						libusb_error_name(ret));
+					cancel_urbs(handle, 0);
+					cancel_urbs(handle, 1);
+					error = 1;
+					break;
+				}
+				slot->busy = 1;
+				stream->submitted += size;
+				active++;
+			}
+		}
 
-	ret = libusb_submit_transfer(ep2_urb);
-	if (ret < 0) {
-		fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-			libusb_error_name(ret));
-		return EXIT_FAILURE;
-	}
-	ret = libusb_submit_transfer(ep3_urb);
-	if (ret < 0) {
-		fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-			libusb_error_name(ret));
-		return EXIT_FAILURE;
-	}
+		if (!active)
+			break;
 
-	while (!ep2_completed) {
-		ret = libusb_handle_events_completed(NULL, &ep2_completed);
-		if (ret < 0) {
-			if (ret == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(ep2_urb);
-			libusb_cancel_transfer(ep3_urb);
-			continue;
+		handle->event = 0;
+		ret = libusb_handle_events_completed(handle->ctx,
+						     &handle->event);
+		if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED && !error) {
+			cancel_urbs(handle, 0);
+			cancel_urbs(handle, 1);
+			error = 1;
 		}
-	}
-	while (!ep3_completed) {
-		ret = libusb_handle_events_completed(NULL, &ep3_completed);
-		if (ret < 0) {
-			if (ret == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(ep2_urb);
-			libusb_cancel_transfer(ep3_urb);
-			continue;
-		}
-	}
 
-	if (ep2_urb->status != 0 || ep3_urb->status != 0) {
-		fprintf(stderr, "\nIO Error: Async transfer failed: %s\n",
-			libusb_error_name(ep2_urb->status ? ep2_urb->status :
-							    ep3_urb->status));
-		libusb_free_transfer(ep2_urb);
-		libusb_free_transfer(ep3_urb);
-		return EXIT_FAILURE;
+		/* Collect completed transfers */
+		for (ep = 0; ep < 2; ep++) {
+			for (i = 0; i < MP_URB_COUNT; i++) {
+				urb_slot_t *slot = &handle->urbs[ep][i];
+				if (!slot->busy || !slot->completed)
+					continue;
+				slot->busy = 0;
+				active--;
+
+				struct libusb_transfer *urb = slot->urb;
+				if (urb->status == LIBUSB_TRANSFER_CANCELLED &&
+				    (error || streams[ep].done))
+					continue;
+				if (urb->status != LIBUSB_TRANSFER_COMPLETED) {
+					if (!error)
+						fprintf(stderr,
+							"\nIO Error: Async transfer failed: %s\n",
+							libusb_error_name(
+								urb->status));
+					cancel_urbs(handle, 0);
+					cancel_urbs(handle, 1);
+					error = 1;
+					continue;
+				}
+				if (direction == LIBUSB_ENDPOINT_IN)
+					deinterlace(buffer, length, slot->buffer,
+						    slot->offset,
+						    urb->actual_length, ep);
+
+				/* A short packet ends the endpoint stream */
+				if (urb->actual_length < urb->length) {
+					streams[ep].done = 1;
+					cancel_urbs(handle, ep);
+				}
+			}
+		}
 	}
-
-	libusb_free_transfer(ep2_urb);
-	libusb_free_transfer(ep3_urb);
-	return EXIT_SUCCESS;
+	return error ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+int usb_dev_write_payload(void *handle, uint8_t *buffer, size_t length,
+			  size_t limit)
 {
 	uint32_t ep2_length;
 	uint32_t ep3_length;
@@ -263,18 +609,20 @@ int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
 		ep2_length = ep3_length;
 	}
 
-	return payload_transfer(handle, LIBUSB_ENDPOINT_OUT, buffer, ep2_length,
-				buffer + ep2_length, ep3_length);
+	ep_stream_t streams[2] = { { buffer, ep2_length, 0, 0 },
+				   { buffer + ep2_length, ep3_length, 0, 0 } };
+	return payload_transfer(handle, LIBUSB_ENDPOINT_OUT, streams, NULL, 0);
 }
 
-int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+int usb_dev_read_payload(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit)
 {
 	/* If the payload length is less than 64 bytes increase the
 	 * buffer to 64 bytes and read it over the endpoint2 only.
 	 * Submitting a buffer less than 64 bytes will cause an libusb
 	 * overflow.
 	 */
-	int i, bytes_transferred;
+	int bytes_transferred;
 	if (length < 64) {
 		uint8_t data[64];
 		if (msg_transfer(handle, data, sizeof(data), LIBUSB_ENDPOINT_IN,
@@ -289,36 +637,15 @@ int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
 		return msg_transfer(handle, buffer, length, LIBUSB_ENDPOINT_IN,
 				    0x02, &bytes_transferred, MP_USBTIMEOUT);
 
-	/* More than limit bytes */
-	uint8_t *data = malloc(length);
-	if (!data) {
-		fprintf(stderr, "\nOut of memory\n");
-		return EXIT_FAILURE;
-	}
-
-	/* Async read of endpoints 2 and 3 */
-	if (payload_transfer(handle, LIBUSB_ENDPOINT_IN, data, length / 2,
-			     data + length / 2, length / 2)) {
-		free(data);
-		return EXIT_FAILURE;
-	}
-
-	/* Deinterlacing the buffers */
-	size_t blocks = length / 64;
-	for (i = 0; i < blocks; ++i) {
-		uint8_t *ep_buf;
-		if (i % 2 == 0) {
-			ep_buf = data;
-		} else {
-			ep_buf = data + length / 2;
-		}
-		memcpy(buffer + (i * 64), ep_buf + ((i / 2) * 64), 64);
-	}
-	free(data);
-	return EXIT_SUCCESS;
+	/* More than limit bytes; async read of endpoints 2 and 3
+	 * deinterlaced straight into the caller's buffer */
+	ep_stream_t streams[2] = { { NULL, length / 2, 0, 0 },
+				   { NULL, length / 2, 0, 0 } };
+	return payload_transfer(handle, LIBUSB_ENDPOINT_IN, streams, buffer,
+				length);
 }
 
-int msg_send(void *handle, uint8_t *buffer, size_t size)
+int usb_dev_msg_send(void *handle, uint8_t *buffer, size_t size)
 {
 	int bytes_transferred, ret;
 	ret = msg_transfer(handle, buffer, size, LIBUSB_ENDPOINT_OUT, 0x01,
@@ -332,7 +659,7 @@ int msg_send(void *handle, uint8_t *buffer, size_t size)
 	return ret;
 }
 
-int msg_recv(void *handle, uint8_t *buffer, size_t size)
+int usb_dev_msg_recv(void *handle, uint8_t *buffer, size_t size)
 {
 	int bytes_transferred;
 	return msg_transfer(handle, buffer, size, LIBUSB_ENDPOINT_IN, 0x01,
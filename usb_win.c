@@ -62,7 +62,7 @@ typedef struct usb_handle {
 } usb_handle_t;
 
 /* Open usb device */
-void *usb_open(uint8_t verbose)
+void *usb_dev_open(uint8_t verbose)
 {
 	char *device_path;
 
@@ -129,7 +129,7 @@ void *usb_open(uint8_t verbose)
 }
 
 /* Close usb device */
-int usb_close(void *handle)
+int usb_dev_close(void *handle)
 {
 	if (((usb_handle_t *)handle)->InterfaceHandle)
 		WinUsb_Free(((usb_handle_t *)handle)->InterfaceHandle);
@@ -138,26 +138,63 @@ int usb_close(void *handle)
 	return EXIT_SUCCESS;
 }
 
+/* Only the first programmer can be opened */
+void *usb_dev_open_index(uint8_t verbose, int index)
+{
+	return index ? NULL : usb_dev_open(verbose);
+}
+
+/* Port paths are not available */
+void *usb_dev_open_path(uint8_t verbose, const char *path)
+{
+	return NULL;
+}
+
+/* The first programmer, with an empty port path */
+int usb_dev_get_index_path(int index, char *path, size_t size)
+{
+	if (index || (!search_devices(MP_TL866A, NULL) &&
+		      !search_devices(MP_TL866IIPLUS, NULL)))
+		return EXIT_FAILURE;
+	if (size)
+		path[0] = '\0';
+	return EXIT_SUCCESS;
+}
+
+/* The port path is not available */
+int usb_dev_get_path(void *handle, char *path, size_t size)
+{
+	return EXIT_FAILURE;
+}
+
+/* The device location is not available, callers must assume the device
+ * was reset */
+int usb_dev_get_location(void *handle, uint32_t *location)
+{
+	return EXIT_FAILURE;
+}
+
 /* Get number of devices connected */
-int minipro_get_devices_count(uint8_t version)
+int usb_dev_get_devices_count(uint8_t version)
 {
 	return search_devices(version, NULL);
 }
 
 /* synchronously message send */
-int msg_send(void *handle, uint8_t *buffer, size_t size)
+int usb_dev_msg_send(void *handle, uint8_t *buffer, size_t size)
 {
 	return usb_write(handle, buffer, size, USB_ENDPOINT_OUT | 0x01);
 }
 
 /* synchronously message receive */
-int msg_recv(void *handle, uint8_t *buffer, size_t size)
+int usb_dev_msg_recv(void *handle, uint8_t *buffer, size_t size)
 {
 	return usb_read(handle, buffer, size, USB_ENDPOINT_IN | 0x01);
 }
 
 /* Write payload asynchronously */
-int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+int usb_dev_write_payload(void *handle, uint8_t *buffer, size_t length,
+			  size_t limit)
 {
 	uint32_t ep2_length;
 	uint32_t ep3_length;
@@ -188,7 +225,8 @@ int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
 }
 
 /* Read payload asynchronously */
-int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+int usb_dev_read_payload(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit)
 {
   /*
    * If the payload length is less than 64 bytes increase the buffer to 64
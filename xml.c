@@ -24,6 +24,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <string.h>
 #include "xml.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define BUFFER_SIZE 102400U
 
 static size_t readblock(FILE *f, uint8_t *s, size_t w)
@@ -62,6 +70,7 @@ static int nextpair(const uint8_t **value, size_t *valuelen,
 
 	while (!(s = memchr(mm->b + mm->i, '<', mm->g))) {
 		if (start) {
+			mm->o += mm->i;
 			memmove(mm->b, mm->b + mm->i, mm->g);
 			mm->i = mm->g;
 			start = 0;
@@ -129,13 +138,97 @@ static int nextpair(const uint8_t **value, size_t *valuelen,
 	return XML_OK;
 }
 
+/* Same as nextpair but for a memory mapped input. Tags and values are
+ * returned as slices of the mapping, mm.i holds the current position.
+ */
+static int nextpair_map(const uint8_t **value, size_t *valuelen,
+			const uint8_t **tag, size_t *taglen, Parser *p)
+{
+	const uint8_t *b = p->map.data, *end = b + p->map.size, *s, *t;
+
+	*value = b + p->mm.i;
+	if (!(s = memchr(*value, '<', end - *value))) {
+		*valuelen = end - *value;
+		*taglen = 0;
+		*tag = (uint8_t *)"";
+		p->mm.i = p->map.size;
+		return ERREND;
+	}
+	*valuelen = (size_t)(s - *value);
+	t = s + 1;
+	if (t == end)
+		s = 0;
+	else if (*t == '!')
+		s = memchrignore(t, end - t);
+	else
+		s = memchr(t, '>', end - t);
+	*tag = t;
+	if (!s) {
+		*taglen = end - t;
+		p->mm.i = p->map.size;
+		return ERREND;
+	}
+	*taglen = (size_t)(s - t);
+	p->mm.i = (size_t)(s - b) + 1;
+	return XML_OK;
+}
+
+/* Map the file behind 'f' so that the parser runs over the mapping,
+ * starting at the current file position. This fails for pipes and
+ * such, parse() will then read from 'f' as usual.
+ * Returns XML_OK if the input is mapped.
+ */
+int map_input(Parser *p, FILE *f)
+{
+	long pos = ftell(f);
+	if (pos < 0)
+		return ERRMEM;
+#ifdef _WIN32
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno(f));
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE ||
+	    GetFileType(file) != FILE_TYPE_DISK ||
+	    !GetFileSizeEx(file, &size) || !size.QuadPart ||
+	    pos > size.QuadPart)
+		return ERRMEM;
+	HANDLE mapping =
+		CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		return ERRMEM;
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		return ERRMEM;
+	}
+	p->map.handle = mapping;
+	p->map.size = (size_t)size.QuadPart;
+#else
+	struct stat st;
+	int fd = fileno(f);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+	    pos > st.st_size)
+		return ERRMEM;
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		return ERRMEM;
+	posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+	p->map.size = st.st_size;
+#endif
+	p->map.data = data;
+	p->mm.i = (size_t)pos;
+	return XML_OK;
+}
+
 int parse(Parser *p)
 {
 	const uint8_t *content, *tag = NULL;
 	size_t contentlen = 0, taglen = 0;
 	int r, new = 1;
-	while ((r = nextpair(&content, &contentlen, &tag, &taglen, &p->mm,
-			     p->inputcbdata)) == XML_OK) {
+	while ((r = p->map.data ? nextpair_map(&content, &contentlen, &tag,
+					       &taglen, p) :
+				  nextpair(&content, &contentlen, &tag,
+					   &taglen, &p->mm, p->inputcbdata)) ==
+	       XML_OK) {
 		p->content = content;
 		p->contentlen = contentlen;
 		if (*tag == '/') {
@@ -183,10 +276,26 @@ int parse(Parser *p)
 
 void done(Parser *p)
 {
+	if (p->map.data) {
+#ifdef _WIN32
+		UnmapViewOfFile(p->map.data);
+		CloseHandle(p->map.handle);
+#else
+		munmap((void *)p->map.data, p->map.size);
+#endif
+	}
 	free(p->mm.b);
 	memset(p, 0, sizeof *p);
 }
 
+/* Return the input offset of a tag pointer passed to the worker */
+uint64_t get_offset(Parser *p, const char *tag)
+{
+	if (p->map.data)
+		return (uint64_t)((const uint8_t *)tag - p->map.data);
+	return p->mm.o + (uint64_t)((const uint8_t *)tag - p->mm.b);
+}
+
 Memblock get_attribute(const char *tag, size_t taglen, const char *attribute)
 {
 	int i = 0;
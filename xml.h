@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct {
 	size_t z;
@@ -33,13 +34,21 @@ typedef struct {
 typedef struct {
 	uint8_t *b;
 	size_t i, g, e;
+	uint64_t o; /* input offset of b[0] */
 } MemMan;
 
+typedef struct {
+	const uint8_t *data;	/* Memory mapped input or NULL */
+	size_t size;
+	void *handle;		/* Windows file mapping handle */
+} MemMap;
+
 typedef struct {
 	void *inputcbdata;
 	int (*worker)();
 	void *userdata;
 	MemMan mm;
+	MemMap map;
 	size_t level;
 	const uint8_t *content;
 	size_t contentlen;
@@ -61,7 +70,9 @@ enum {
 	UNKNOWN_
 };
 
+int map_input(Parser *, FILE *);
 int parse(Parser *);
 void done(Parser *);
 Memblock get_attribute(const char *, size_t, const char *);
+uint64_t get_offset(Parser *, const char *);
 #endif